@@ -0,0 +1,67 @@
+// bench_backgroundio.cpp
+//
+// Measures what %save costs the UI thread against what it costs the I/O thread, for histories
+// of growing size: the command only snapshots the history, and the file is written elsewhere.
+
+#include "chathistory.hpp"
+#include "command.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+double _millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+int main()
+{
+    const std::filesystem::path path =
+        std::filesystem::temp_directory_path() / ("bench_backgroundio_" + std::to_string(getpid()));
+    std::vector<BackgroundJob> jobs;
+    std::vector<std::function<void()>> posted;
+    setCommandRunner({[](BackgroundJob job) {
+                          std::atomic<bool> notCancelled{false};
+                          job(notCancelled);
+                      },
+                      [&](std::function<void()> task) { posted.push_back(std::move(task)); },
+                      [&](BackgroundJob job) { jobs.push_back(std::move(job)); }, {}});
+
+    std::printf("%-10s %10s %16s %16s\n", "messages", "MB", "UI thread ms", "I/O thread ms");
+    const std::string message(1024, 'x');
+    for (size_t messages : {1000, 10000, 100000, 400000})
+    {
+        ChatHistory history;
+        for (size_t i = 0; i < messages; ++i)
+        {
+            history.addDialog(i % 2 == 0 ? "user" : "assistant", message);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        saveCommand(path.string(), history);
+        double uiMs = _millisecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        std::atomic<bool> notCancelled{false};
+        for (BackgroundJob &job : jobs)
+        {
+            job(notCancelled);
+        }
+        double ioMs = _millisecondsSince(start);
+        jobs.clear();
+        posted.clear();
+
+        std::printf("%-10zu %10.1f %16.3f %16.1f\n", messages, std::filesystem::file_size(path) / (1024.0 * 1024.0),
+                    uiMs, ioMs);
+    }
+    std::filesystem::remove(path);
+    return 0;
+}
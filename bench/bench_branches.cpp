@@ -0,0 +1,130 @@
+// bench_branches.cpp
+//
+// Measures forking a 50 MB conversation into 20 branches with ConversationBranches: the time
+// per fork and switch, and the live heap bytes of all the branches against one session and
+// against independent copies of it.
+
+#include "branches.hpp"
+#include "chathistory.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#define malloc_usable_size malloc_size
+#else
+#include <malloc.h>
+#endif
+#include <new>
+#include <string>
+#include <vector>
+
+namespace
+{
+size_t g_liveBytes = 0; // Heap bytes currently allocated through operator new
+
+double _megabytes(size_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+// An independent copy, as copying a history cost before storage was shared
+ChatHistory _deepCopy(const ChatHistory &history)
+{
+    ChatHistory copy;
+    for (const Dialog &dialog : history)
+    {
+        copy.addDialog(dialog.participant, dialog.message);
+    }
+    return copy;
+}
+} // namespace
+
+void *operator new(size_t size)
+{
+    if (void *p = std::malloc(size))
+    {
+        g_liveBytes += malloc_usable_size(p);
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    if (p != nullptr)
+    {
+        g_liveBytes -= malloc_usable_size(p);
+        std::free(p);
+    }
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+int main()
+{
+    const int kMessages = 5000;
+    const int kBranches = 20;
+    const std::string message(10 * 1024, 'm');
+    const std::string reply(10 * 1024, 'r');
+
+    size_t before = g_liveBytes;
+    ChatHistory session;
+    for (int i = 0; i < kMessages; ++i)
+    {
+        session.addDialog(i % 2 == 0 ? "user" : "assistant", message);
+    }
+    session.buildRequestPayload("gpt-4o", false); // Fills the payload cache, as the first request does
+    size_t sessionBytes = g_liveBytes - before;
+
+    // Fork at points spread over the conversation and add a turn to each branch
+    ConversationBranches branches;
+    before = g_liveBytes;
+    for (int b = 0; b < kBranches; ++b)
+    {
+        size_t at = kMessages - 1 - static_cast<size_t>(b) * (kMessages / kBranches / 2);
+        branches.fork("branch" + std::to_string(b), session, at);
+        session.addDialog("user", message);
+        session.addDialog("assistant", reply);
+        session.buildRequestPayload("gpt-4o", false);
+    }
+    size_t branchBytes = g_liveBytes - before;
+
+    // Timed apart from the requests above, whose 50 MB bodies leave the caches cold
+    const int kTimed = 1000;
+    std::vector<std::string> names;
+    for (int i = 0; i < kTimed; ++i)
+    {
+        names.push_back("timed" + std::to_string(i));
+    }
+    branches.switchTo("branch0", session);
+    size_t longest = session.size();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kTimed; ++i)
+    {
+        branches.fork(names[i], session, longest - static_cast<size_t>(i) * 4); // Each fork is shorter
+    }
+    double forkNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kTimed; ++i)
+    {
+        branches.switchTo(i % 2 == 0 ? "branch0" : "branch1", session);
+    }
+    double switchNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    before = g_liveBytes;
+    ChatHistory copy = _deepCopy(session);
+    copy.buildRequestPayload("gpt-4o", false);
+    size_t copyBytes = g_liveBytes - before;
+
+    std::printf("%d messages, %.1f MB of text\n", kMessages, _megabytes(size_t(kMessages) * message.size()));
+    std::printf("%-40s %10.1f MB\n", "one session (with payload cache)", _megabytes(sessionBytes));
+    std::printf("%-40s %10.1f MB\n", "20 more branches, one turn each", _megabytes(branchBytes));
+    std::printf("%-40s %10.1f MB\n", "20 independent copies would add", _megabytes(copyBytes * kBranches));
+    std::printf("%-40s %10.0f ns\n", "fork", forkNs / kTimed);
+    std::printf("%-40s %10.0f ns\n", "switch", switchNs / kTimed);
+    return copy.size() == 0 ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+// bench_command.cpp
+//
+// Measures the overhead of dispatching a % command before its handler runs: the original
+// istringstream tokenizer and chain of string comparisons against CommandContext's in-place
+// tokenizer and findCommand's perfect hash, in nanoseconds per command.
+
+#include "command.hpp"
+#include "commandcontext.hpp"
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+// The original CommandContext::_parseCommand
+void _legacyParse(const std::string &rawCommandInput, std::string &command, std::vector<std::string> &arguments)
+{
+    std::string token;
+    std::vector<std::string> commandTokens;
+    std::istringstream iss(rawCommandInput);
+    while (iss >> token)
+    {
+        commandTokens.push_back(token);
+    }
+    command.clear();
+    arguments.clear();
+    if (commandTokens.empty())
+    {
+        return;
+    }
+    command = commandTokens[0];
+    arguments.assign(commandTokens.begin() + 1, commandTokens.end());
+}
+
+// The original handleCommand's if/else chain, returning the position of the matching branch
+int _legacyLookup(const std::string &command)
+{
+    const char *names[] = {"%save",  "%readfile", "%load",    "%clear", "%deletelast", "%printhistory", "%tokens",
+                           "%connections", "%cache", "%compare", "%stats", "%help",       "%quit"};
+    for (int i = 0; i < 13; ++i)
+    {
+        if (command == names[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+template <typename Fn> double _nanosecondsPerCall(Fn &&fn, size_t iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        fn();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+} // namespace
+
+int main()
+{
+    const std::string inputs[] = {
+        "%help",
+        "%quit",
+        "%save \"my chat.txt\"",
+        "%readfile src/*.cpp include/*.hpp README.md",
+        "%compare gpt-4o gpt-4o-mini -- which is faster?",
+        "%nosuchcommand",
+    };
+    const size_t iterations = 1000000;
+
+    std::printf("%-50s %12s %12s %9s %12s\n", "command", "original ns", "table ns", "speedup", "lookup ns");
+    for (const std::string &input : inputs)
+    {
+        size_t sink = 0;
+        std::string command;
+        std::vector<std::string> arguments;
+        double legacyNs = _nanosecondsPerCall(
+            [&] {
+                _legacyParse(input, command, arguments);
+                sink += static_cast<size_t>(_legacyLookup(command) + 1) + arguments.size();
+            },
+            iterations);
+
+        // Tokenize, look up and check the arity: everything handleCommand does before the handler
+        CommandContext context;
+        double tableNs = _nanosecondsPerCall(
+            [&] {
+                context.setCommandAndArgs(input);
+                const CommandSpec *spec = findCommand(context.getCommand());
+                size_t count = context.getArgumentsSize();
+                sink += spec != nullptr && count >= spec->minArguments && count <= spec->maxArguments ? 1 : 2;
+            },
+            iterations);
+
+        std::string_view name = context.getCommand();
+        double lookupNs = _nanosecondsPerCall([&] { sink += findCommand(name) != nullptr; }, iterations * 10);
+
+        std::printf("%-50s %12.1f %12.1f %8.1fx %12.1f\n", input.c_str(), legacyNs, tableNs, legacyNs / tableNs,
+                    lookupNs);
+        if (sink == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+// bench_corpusindex.cpp
+//
+// Measures %index and %ask retrieval: building the BM25 index of 50,000 source-like files in a
+// temporary directory, opening it, answering queries, and the size of what %ask sends compared
+// with sending the files themselves.
+
+#include "corpusindex.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+double _millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// A vocabulary of identifiers, drawn with a Zipf-like skew as words in real code are
+std::vector<std::string> _vocabulary(size_t size)
+{
+    const char *parts[] = {"parse", "token", "buffer", "request", "history", "index", "stream", "cache", "file",
+                           "reply", "chunk", "query", "socket", "payload", "limit", "budget", "branch", "search",
+                           "layout", "render", "model", "usage", "journal", "entry", "pool", "retry"};
+    const size_t partCount = sizeof(parts) / sizeof(parts[0]);
+    std::vector<std::string> words;
+    for (size_t i = 0; words.size() < size; ++i)
+    {
+        std::string word = parts[i % partCount];
+        std::string second = parts[(i / partCount) % partCount];
+        second[0] = static_cast<char>(second[0] - 'a' + 'A');
+        words.push_back(i < partCount ? word : word + second + std::to_string(i / (partCount * partCount)));
+    }
+    return words;
+}
+} // namespace
+
+int main()
+{
+    const std::filesystem::path root =
+        std::filesystem::temp_directory_path() / ("bench_corpusindex_" + std::to_string(getpid()));
+    const std::filesystem::path indexPath = root.string() + ".bm25";
+    std::filesystem::remove_all(root);
+
+    const size_t fileCount = 50000;
+    const size_t filesPerDirectory = 500;
+    const std::vector<std::string> words = _vocabulary(20000);
+    std::mt19937 random(42);
+    std::vector<double> weights(words.size());
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        weights[i] = 1.0 / std::pow(static_cast<double>(i + 1), 1.1);
+    }
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    std::uniform_int_distribution<size_t> lines(20, 80);
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t corpusBytes = 0;
+    for (size_t file = 0; file < fileCount; ++file)
+    {
+        std::filesystem::path directory = root / ("module" + std::to_string(file / filesPerDirectory));
+        if (file % filesPerDirectory == 0)
+        {
+            std::filesystem::create_directories(directory);
+        }
+        std::string text;
+        for (size_t line = 0, count = lines(random); line < count; ++line)
+        {
+            text += "    auto " + words[pick(random)] + " = " + words[pick(random)] + "(" + words[pick(random)] + ");\n";
+        }
+        std::ofstream(directory / ("file" + std::to_string(file) + ".cpp"), std::ios::binary) << text;
+        corpusBytes += text.size();
+    }
+    std::printf("%-36s %10zu files, %.1f MB (written in %.1f s)\n", "corpus", fileCount,
+                corpusBytes / (1024.0 * 1024.0), _millisecondsSince(start) / 1000.0);
+
+    start = std::chrono::steady_clock::now();
+    CorpusBuildReport report = buildCorpusIndex(root, indexPath);
+    double buildMs = _millisecondsSince(start);
+    std::printf("%-36s %10.2f s on %u threads (%.0f MB/s)\n", "buildCorpusIndex", buildMs / 1000.0,
+                std::max(1u, std::thread::hardware_concurrency()), corpusBytes / (1024.0 * 1024.0) / (buildMs / 1000.0));
+    std::printf("%-36s %10zu excerpts, %zu terms, %zu postings, index %.1f MB\n", "index", report.chunks, report.terms,
+                report.postings, std::filesystem::file_size(indexPath) / (1024.0 * 1024.0));
+
+    start = std::chrono::steady_clock::now();
+    CorpusIndex index(indexPath);
+    std::printf("%-36s %10.3f ms\n", "open (mmap)", _millisecondsSince(start));
+
+    const char *queries[] = {"how is the parse buffer flushed", "where does the request retry budget run out",
+                             "socketPayload stream layout", "which branch renders the usage journal",
+                             "cacheEntry pool limit"};
+    const size_t excerpts = 6;
+    std::vector<double> times;
+    size_t promptBytes = 0;
+    for (int round = 0; round < 20; ++round)
+    {
+        for (const char *query : queries)
+        {
+            start = std::chrono::steady_clock::now();
+            std::vector<CorpusHit> hits = index.search(query, excerpts);
+            times.push_back(_millisecondsSince(start));
+            if (round == 0)
+            {
+                for (const CorpusHit &hit : hits)
+                {
+                    promptBytes += hit.text.size();
+                }
+            }
+        }
+    }
+    std::sort(times.begin(), times.end());
+    std::printf("%-36s %10.3f ms p50, %.3f ms max\n", "search (6 excerpts)", times[times.size() / 2], times.back());
+    double averagePrompt = static_cast<double>(promptBytes) / (sizeof(queries) / sizeof(queries[0]));
+    std::printf("%-36s %10.1f KB, 1/%.0f of the corpus\n", "excerpts sent per %ask", averagePrompt / 1024.0,
+                corpusBytes / std::max(averagePrompt, 1.0));
+
+    std::filesystem::remove_all(root);
+    std::filesystem::remove(indexPath);
+    return report.files == fileCount ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+// bench_daemon.cpp
+//
+// Measures daemon mode against a MockOpenAIServer: the latency of a streamed conversation turn
+// made in-process and through a ChatDaemon on a Unix socket, and the throughput of many clients
+// sharing one daemon.
+
+#include "chathistory.hpp"
+#include "daemon.hpp"
+#include "mockserver.hpp"
+#include "request.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+double _millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// A conversation of the given number of turns, as a client would send with each request
+ChatHistory _conversation(size_t turns)
+{
+    ChatHistory history;
+    for (size_t i = 0; i < turns; ++i)
+    {
+        history.addDialog("user", "question " + std::to_string(i) + std::string(200, 'q'));
+        history.addDialog("assistant", "answer " + std::to_string(i) + std::string(400, 'a'));
+    }
+    return history;
+}
+
+/**
+ * @brief Times conversations of 20 turns made with request as the UI makes them, each turn sent
+ * with a copy of the conversation so far, and prints the percentiles of a turn.
+ * @return The median in milliseconds.
+ */
+template <typename Request> double _timeTurns(const char *label, size_t conversations, Request request)
+{
+    std::vector<double> times;
+    for (size_t c = 0; c < conversations; ++c)
+    {
+        ChatHistory history = _conversation(2);
+        for (size_t turn = 0; turn < 20; ++turn)
+        {
+            std::string prompt = "turn " + std::to_string(turn) + " " + std::string(200, 'p');
+            ChatHistory requestHistory = history;
+            history.addDialog("user", prompt);
+            std::string reply;
+            auto start = std::chrono::steady_clock::now();
+            request(prompt, requestHistory, [&](const std::string &delta) { reply += delta; });
+            times.push_back(_millisecondsSince(start));
+            if (reply.empty())
+            {
+                std::fprintf(stderr, "%s: empty reply\n", label);
+                std::exit(1);
+            }
+            history.addDialog("assistant", reply);
+        }
+    }
+    std::sort(times.begin(), times.end());
+    std::printf("%-36s %10.3f ms p50, %.3f ms p90, %.3f ms p99\n", label, times[times.size() / 2],
+                times[times.size() * 9 / 10], times[times.size() * 99 / 100]);
+    return times[times.size() / 2];
+}
+} // namespace
+
+int main()
+{
+    setenv("NO_PROXY", "127.0.0.1", 1);
+    setenv("OPENAI_KEY", "bench-key", 1);
+    setenv("CHATGPT_CLI_USAGE_LEDGER", "", 1); // Keep mock usage out of the real ledger
+    MockServerOptions serverOptions;
+    serverOptions.replyWords = 64;
+    MockOpenAIServer server(serverOptions);
+    setenv("OPENAI_BASE_URL", server.baseUrl().c_str(), 1);
+
+    DaemonOptions options;
+    options.socketPath =
+        std::filesystem::temp_directory_path() / ("bench_daemon_" + std::to_string(getpid()) + ".sock");
+    options.url = server.baseUrl() + "/chat/completions";
+    ChatDaemon daemon(options);
+    std::thread loop([&] { daemon.run(); });
+
+    const size_t conversations = 20;
+    // Warm both paths' connections first
+    _timeTurns("warm-up", 1, [](auto &&...args) { return makeStreamingRequest(args...); });
+    _timeTurns("warm-up", 1, [&](auto &&...args) { return daemonStreamingRequest(options.socketPath, args...); });
+    double inProcess = _timeTurns("in-process turn", conversations,
+                                  [](auto &&...args) { return makeStreamingRequest(args...); });
+    double throughDaemon = _timeTurns("daemon turn", conversations, [&](auto &&...args) {
+        return daemonStreamingRequest(options.socketPath, args...);
+    });
+    std::printf("%-36s %+10.3f ms p50\n", "daemon overhead", throughDaemon - inProcess);
+
+    // Many clients at once, each with its own connection to the daemon
+    for (size_t clients : {8, 64})
+    {
+        const size_t perClient = 2000 / clients;
+        std::atomic<size_t> failed{0};
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t c = 0; c < clients; ++c)
+        {
+            threads.emplace_back([&] {
+                const ChatHistory conversation = _conversation(2);
+                for (size_t i = 0; i < perClient; ++i)
+                {
+                    ChatHistory history = conversation;
+                    std::string reply;
+                    try
+                    {
+                        daemonStreamingRequest(options.socketPath, "concurrent", history,
+                                               [&](const std::string &delta) { reply += delta; });
+                    }
+                    catch (const std::exception &)
+                    {
+                    }
+                    if (reply.empty())
+                    {
+                        ++failed;
+                    }
+                }
+            });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        double seconds = _millisecondsSince(start) / 1000.0;
+        char label[64];
+        std::snprintf(label, sizeof(label), "%zu clients", clients);
+        std::printf("%-36s %10.0f turns/s, %zu failed\n", label, clients * perClient / seconds, failed.load());
+    }
+
+    daemon.stop();
+    loop.join();
+    DaemonStats stats = daemon.stats();
+    std::printf("%-36s %10llu requests on %llu connections, %llu upstream connections\n", "daemon",
+                static_cast<unsigned long long>(stats.requests), static_cast<unsigned long long>(stats.clients),
+                static_cast<unsigned long long>(server.stats().connections));
+    return stats.failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+// bench_history.cpp
+//
+// Measures memory per message and iteration cost of ChatHistory against the original
+// std::vector<std::pair<std::string, std::string>> store with its copying iterator.
+
+#include "chathistory.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#define malloc_usable_size malloc_size
+#else
+#include <malloc.h>
+#endif
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+size_t g_liveBytes = 0; // Heap bytes currently allocated through operator new
+
+// The original store: role and message as separate heap strings, copied on every dereference
+class LegacyHistory
+{
+  public:
+    void addDialog(const std::string &participantName, const std::string &message)
+    {
+        m_chatHistory.push_back({participantName, message});
+    }
+
+    class iterator
+    {
+      private:
+        using PairIterator = std::vector<std::pair<std::string, std::string>>::iterator;
+        PairIterator it;
+
+      public:
+        iterator(PairIterator iterator) : it(iterator)
+        {
+        }
+        bool operator!=(const iterator &other) const
+        {
+            return it != other.it;
+        }
+        void operator++()
+        {
+            ++it;
+        }
+        auto operator*() const
+        {
+            return *it;
+        }
+    };
+
+    iterator begin()
+    {
+        return iterator(m_chatHistory.begin());
+    }
+    iterator end()
+    {
+        return iterator(m_chatHistory.end());
+    }
+
+  private:
+    std::vector<std::pair<std::string, std::string>> m_chatHistory;
+};
+
+template <typename History> double nanosecondsPerEntry(History &history, int count)
+{
+    const int passes = 50;
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (const auto &dialog : history)
+        {
+            sink += dialog.second.size();
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    if (sink == 0)
+    {
+        std::printf("unexpected empty history\n");
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / passes / count;
+}
+
+template <> double nanosecondsPerEntry(ChatHistory &history, int count)
+{
+    const int passes = 50;
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (const auto &dialog : history)
+        {
+            sink += dialog.message.size();
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    if (sink == 0)
+    {
+        std::printf("unexpected empty history\n");
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / passes / count;
+}
+} // namespace
+
+void *operator new(size_t size)
+{
+    if (void *p = std::malloc(size))
+    {
+        g_liveBytes += malloc_usable_size(p);
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    if (p != nullptr)
+    {
+        g_liveBytes -= malloc_usable_size(p);
+        std::free(p);
+    }
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+int main()
+{
+    const int count = 100000;
+    const std::string message = "A typical short chat message of about sixty bytes in length.";
+
+    size_t before = g_liveBytes;
+    LegacyHistory legacy;
+    for (int i = 0; i < count; ++i)
+    {
+        legacy.addDialog(i % 2 == 0 ? "user" : "assistant", message);
+    }
+    size_t legacyBytes = g_liveBytes - before;
+
+    before = g_liveBytes;
+    ChatHistory history;
+    for (int i = 0; i < count; ++i)
+    {
+        history.addDialog(i % 2 == 0 ? "user" : "assistant", message);
+    }
+    size_t historyBytes = g_liveBytes - before;
+    size_t payloadBytes = history.buildRequestPayload("gpt-4o", false).size();
+
+    // Live heap bytes after the fill, including vector slack. ChatHistory also holds the
+    // serialized request payload (PayloadBuilder), reported separately below.
+    std::printf("%d messages of %zu bytes\n", count, message.size());
+    std::printf("%-12s %16s %18s\n", "store", "bytes/message", "iterate (ns/entry)");
+    std::printf("%-12s %16.1f %18.2f\n", "legacy", double(legacyBytes) / count, nanosecondsPerEntry(legacy, count));
+    std::printf("%-12s %16.1f %18.2f\n", "ChatHistory", double(historyBytes) / count,
+                nanosecondsPerEntry(history, count));
+    std::printf("  of which payload cache: %.1f bytes/message\n", double(payloadBytes) / count);
+    return 0;
+}
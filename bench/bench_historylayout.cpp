@@ -0,0 +1,75 @@
+// bench_historylayout.cpp
+//
+// Measures the per-frame cost of preparing the history pane: concatenating every entry's text,
+// as the original Renderer did, against syncing the cached HistoryLayout and producing only the
+// visible lines.
+
+#include "chathistory.hpp"
+#include "historylayout.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+namespace
+{
+constexpr size_t kWidth = 100;
+constexpr size_t kVisibleLines = 40;
+
+template <typename Fn> double microsecondsPerFrame(int iterations, Fn &&fn)
+{
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        sink += fn();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    if (sink == 0)
+    {
+        std::printf("unexpected empty frame\n");
+    }
+    return std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+}
+} // namespace
+
+int main()
+{
+    const std::string message = "A typical chat message that is long enough to wrap onto a second line of the "
+                                "history pane at a hundred columns, with a short second paragraph.\nLike this.";
+
+    std::printf("%10s %16s %16s\n", "messages", "full (us/frame)", "window (us/frame)");
+    for (int count : {100, 1000, 10000})
+    {
+        ChatHistory history;
+        for (int i = 0; i < count; ++i)
+        {
+            history.addDialog(i % 2 == 0 ? "user" : "assistant", message);
+        }
+
+        int iterations = count >= 10000 ? 50 : 500;
+        double full = microsecondsPerFrame(iterations, [&] {
+            size_t bytes = 0;
+            for (const auto &dialog : history)
+            {
+                std::string line = std::string(dialog.participant) + ": " + std::string(dialog.message);
+                bytes += line.size();
+            }
+            return bytes;
+        });
+
+        HistoryLayout layout;
+        layout.sync(history, kWidth); // The first frame lays everything out once
+        double window = microsecondsPerFrame(iterations * 20, [&] {
+            layout.sync(history, kWidth);
+            size_t first = layout.lineCount() - kVisibleLines;
+            size_t bytes = 0;
+            for (const HistoryLine &line : layout.window(first, kVisibleLines))
+            {
+                bytes += HistoryLayout::lineText(history, line).size();
+            }
+            return bytes;
+        });
+        std::printf("%10d %16.2f %16.2f\n", count, full, window);
+    }
+    return 0;
+}
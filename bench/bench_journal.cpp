@@ -0,0 +1,76 @@
+// bench_journal.cpp
+//
+// Measures recording a ~100 MB session into a SessionJournal, resuming it, and building the
+// first request payload after the resume.
+
+#include "chathistory.hpp"
+#include "sessionjournal.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+namespace
+{
+double _millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+int main()
+{
+    const size_t messageSize = 2000;
+    const size_t count = 50000;
+    std::string message;
+    for (size_t i = 0; message.size() < messageSize; ++i)
+    {
+        message += "word" + std::to_string(i % 97) + " ";
+    }
+    message.resize(messageSize);
+
+    std::filesystem::path journalPath = std::filesystem::temp_directory_path() / ("bench_journal_" + std::to_string(getpid()));
+
+    ChatHistory history;
+    JournalStats stats;
+    auto start = std::chrono::steady_clock::now();
+    {
+        SessionJournal journal(journalPath, true);
+        history.setJournal(&journal);
+        for (size_t i = 0; i < count; ++i)
+        {
+            history.addDialog(i % 2 == 0 ? "user" : "assistant", message);
+        }
+        history.setJournal(nullptr);
+        stats = journal.stats();
+    }
+    double recordMs = _millisecondsSince(start);
+    std::printf("%zu messages of %zu bytes: %.1f MB journal\n", count, messageSize, stats.bytes / 1e6);
+    std::printf("record:            %8.1f ms (%.2f us per message, %llu syncs)\n", recordMs, recordMs * 1000 / count,
+                static_cast<unsigned long long>(stats.syncs));
+
+    // The journal was just written, so it is in the page cache as it would be after a restart
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        ChatHistory resumed;
+        start = std::chrono::steady_clock::now();
+        JournalReplay replay = replaySessionJournal(journalPath, resumed);
+        double replayMs = _millisecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        resumed.buildRequestPayload("gpt-4o", true);
+        double payloadMs = _millisecondsSince(start);
+
+        std::printf("resume:            %8.1f ms for %llu records; first request payload %.1f ms\n", replayMs,
+                    static_cast<unsigned long long>(replay.records), payloadMs);
+        if (resumed.size() != count)
+        {
+            std::printf("unexpected history size\n");
+            return 1;
+        }
+    }
+
+    std::filesystem::remove(journalPath);
+    return 0;
+}
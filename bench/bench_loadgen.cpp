@@ -0,0 +1,228 @@
+// bench_loadgen.cpp
+//
+// Load generator for the network path: drives makeRequest / makeStreamingRequest from several
+// threads against a MockOpenAIServer (started in-process unless --url is given) and reports
+// latency percentiles, client CPU time per request and heap allocations per request.
+
+#include "batch.hpp"
+#include "chathistory.hpp"
+#include "mockserver.hpp"
+#include "request.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+std::atomic<size_t> g_allocations{0}; // Calls to operator new made by client threads
+thread_local bool t_counting = false;  // Set on the load generator's request threads only
+
+struct LoadOptions
+{
+    size_t requests = 2000;
+    size_t concurrency = 8;
+    size_t promptBytes = 512;
+    bool stream = false;
+    std::string url; // External API root; empty starts a MockOpenAIServer
+    MockServerOptions server;
+};
+
+double _processCpuSeconds()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/**
+ * @brief Sends one prompt through the real request path.
+ * @return True if a non-empty reply came back.
+ */
+bool _sendOne(const std::string &prompt, bool stream)
+{
+    ChatHistory history;
+    if (stream)
+    {
+        std::string reply;
+        std::string rest = makeStreamingRequest(prompt, history, [&](const std::string &delta) { reply += delta; });
+        return !reply.empty() && rest.empty();
+    }
+    return !getChatGPTResponseContent(makeRequest(prompt, history)).empty();
+}
+
+/**
+ * @brief Runs count requests on options.concurrency threads.
+ * @return Latencies and failures of the run.
+ */
+BatchReport _run(const LoadOptions &options, size_t count)
+{
+    const std::string prompt(options.promptBytes, 'x');
+    std::atomic<size_t> next{0};
+    std::vector<std::vector<double>> latencies(options.concurrency);
+    std::atomic<size_t> failed{0};
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < options.concurrency; ++t)
+    {
+        threads.emplace_back([&, t] {
+            t_counting = true;
+            while (next++ < count)
+            {
+                auto sent = std::chrono::steady_clock::now();
+                bool ok = _sendOne(prompt, options.stream);
+                latencies[t].push_back(
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count());
+                failed += ok ? 0 : 1;
+            }
+            t_counting = false;
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    BatchReport report;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (const std::vector<double> &samples : latencies)
+    {
+        report.latenciesMs.insert(report.latenciesMs.end(), samples.begin(), samples.end());
+    }
+    std::sort(report.latenciesMs.begin(), report.latenciesMs.end());
+    report.requests = report.latenciesMs.size();
+    report.failed = failed;
+    return report;
+}
+
+void _printUsage()
+{
+    std::fprintf(stderr, "Usage: bench_loadgen [--requests <n>] [--concurrency <n>] [--prompt-bytes <n>] [--stream]\n"
+                         "                     [--url <api root>] [--latency-ms <n>] [--jitter-ms <n>]\n"
+                         "                     [--tokens-per-second <x>] [--reply-words <n>] [--error-rate <0..1>]\n"
+                         "                     [--rpm <n>] [--tpm <n>] [--limit-window <seconds>]\n");
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    LoadOptions options;
+    options.server.replyWords = 64;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--stream")
+        {
+            options.stream = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            _printUsage();
+            return EXIT_FAILURE;
+        }
+        std::string value = argv[++i];
+        if (arg == "--requests")
+            options.requests = std::stoul(value);
+        else if (arg == "--concurrency")
+            options.concurrency = std::max<size_t>(1, std::stoul(value));
+        else if (arg == "--prompt-bytes")
+            options.promptBytes = std::max<size_t>(1, std::stoul(value));
+        else if (arg == "--url")
+            options.url = value;
+        else if (arg == "--latency-ms")
+            options.server.latencyMs = static_cast<unsigned>(std::stoul(value));
+        else if (arg == "--jitter-ms")
+            options.server.latencyJitterMs = static_cast<unsigned>(std::stoul(value));
+        else if (arg == "--tokens-per-second")
+            options.server.tokensPerSecond = std::stod(value);
+        else if (arg == "--reply-words")
+            options.server.replyWords = std::stoul(value);
+        else if (arg == "--error-rate")
+            options.server.errorRate = std::stod(value);
+        else if (arg == "--rpm")
+            options.server.requestsPerMinute = std::stod(value);
+        else if (arg == "--tpm")
+            options.server.tokensPerMinute = std::stod(value);
+        else if (arg == "--limit-window")
+            options.server.limitWindowSeconds = std::stod(value);
+        else
+        {
+            _printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::unique_ptr<MockOpenAIServer> server;
+    if (options.url.empty())
+    {
+        server = std::make_unique<MockOpenAIServer>(options.server);
+        options.url = server->baseUrl();
+    }
+    setenv("OPENAI_BASE_URL", options.url.c_str(), 1);
+    setenv("NO_PROXY", "127.0.0.1,localhost", 1);
+    setenv("OPENAI_KEY", std::getenv("OPENAI_KEY") != nullptr ? std::getenv("OPENAI_KEY") : "mock", 1);
+    setenv("CHATGPT_CLI_USAGE_LEDGER", "", 1); // Load runs are not real usage
+
+    // Warm up the connection pool so the measured run reuses connections like a long session
+    _run(options, options.concurrency);
+
+    double serverCpuBefore = server ? server->stats().cpuSeconds : 0;
+    double cpuBefore = _processCpuSeconds();
+    size_t allocationsBefore = g_allocations;
+    BatchReport report = _run(options, options.requests);
+    double cpu = _processCpuSeconds() - cpuBefore;
+    size_t allocations = g_allocations - allocationsBefore;
+    double serverCpu = server ? server->stats().cpuSeconds - serverCpuBefore : 0;
+    double perRequest = report.requests == 0 ? 0 : 1.0 / report.requests;
+
+    std::printf("%s %s, %zu requests, %zu threads, %zu-byte prompts\n", options.stream ? "streaming" : "plain",
+                options.url.c_str(), report.requests, options.concurrency, options.promptBytes);
+    std::printf("%-24s %10.1f (%zu failed)\n", "requests/s", report.requestsPerSecond(), report.failed);
+    if (server)
+    {
+        std::printf("%-24s %10llu\n", "429s from the server",
+                    static_cast<unsigned long long>(server->stats().rateLimited));
+    }
+    std::printf("%-24s %10.3f %10.3f %10.3f %10.3f\n", "latency ms p50/95/99/max", report.percentile(50),
+                report.percentile(95), report.percentile(99),
+                report.latenciesMs.empty() ? 0 : report.latenciesMs.back());
+    std::printf("%-24s %10.1f\n", "client CPU us/request", (cpu - serverCpu) * 1e6 * perRequest);
+    if (server)
+    {
+        std::printf("%-24s %10.1f\n", "server CPU us/request", serverCpu * 1e6 * perRequest);
+    }
+    std::printf("%-24s %10.1f\n", "allocations/request", allocations * perRequest);
+    return report.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void *operator new(size_t size)
+{
+    if (t_counting)
+    {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void *p = std::malloc(size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,63 @@
+// bench_payload.cpp
+//
+// Compares building a request body with the cached PayloadBuilder against rebuilding a full
+// nlohmann::json DOM of the history, as makeRequest originally did, on every turn.
+
+#include "chathistory.hpp"
+#include <chrono>
+#include <cstdio>
+#include <nlohmann/json.hpp>
+#include <string>
+
+namespace
+{
+std::string domPayload(ChatHistory &history)
+{
+    nlohmann::json payload;
+    payload["model"] = "gpt-4o";
+    for (const auto &dialog : history)
+    {
+        payload["messages"].push_back(
+            {{"role", std::string(dialog.participant)}, {"content", std::string(dialog.message)}});
+    }
+    return payload.dump();
+}
+
+template <typename Fn> double microsecondsPerCall(int iterations, Fn &&fn)
+{
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        sink += fn().size();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    if (sink == 0)
+    {
+        std::printf("unexpected empty payload\n");
+    }
+    return std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+}
+} // namespace
+
+int main()
+{
+    const std::string message =
+        "A typical chat message with \"quotes\", a newline\nand some more text to escape and copy around.";
+
+    std::printf("%10s %14s %14s %9s\n", "messages", "dom (us)", "cached (us)", "speedup");
+    for (int count : {10, 1000, 10000})
+    {
+        ChatHistory history;
+        for (int i = 0; i < count; ++i)
+        {
+            history.addDialog(i % 2 == 0 ? "user" : "assistant", message);
+        }
+
+        int iterations = count >= 10000 ? 20 : (count >= 1000 ? 200 : 20000);
+        double dom = microsecondsPerCall(iterations, [&] { return domPayload(history); });
+        double cached = microsecondsPerCall(iterations, [&] { return history.buildRequestPayload("gpt-4o", false); });
+        std::printf("%10d %14.2f %14.2f %8.1fx\n", count, dom, cached, dom / cached);
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+// bench_readfile.cpp
+//
+// Measures attaching a source tree to a ChatHistory: the original serial ifstream/ostringstream
+// read of each file against readFiles, with wall time and peak heap use of each.
+
+#include "chathistory.hpp"
+#include "filereadwrite.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#define malloc_usable_size malloc_size
+#else
+#include <malloc.h>
+#endif
+#include <new>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+std::atomic<size_t> g_liveBytes{0}; // Heap bytes currently allocated through operator new
+std::atomic<size_t> g_peakBytes{0};
+
+// The original readFileToString: the file goes through a string stream and is copied out of it
+std::string _legacyRead(const std::filesystem::path &path)
+{
+    std::ostringstream ss;
+    std::ifstream ifs(path);
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+// Empties the page cache so the next pass reads from disk; needs root, and is skipped otherwise
+bool _dropPageCache()
+{
+    sync();
+    std::ofstream control("/proc/sys/vm/drop_caches");
+    control << "3\n";
+    control.flush();
+    return control.good();
+}
+
+double _millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+void *operator new(size_t size)
+{
+    if (void *p = std::malloc(size))
+    {
+        size_t live = g_liveBytes += malloc_usable_size(p);
+        size_t peak = g_peakBytes.load();
+        while (live > peak && !g_peakBytes.compare_exchange_weak(peak, live))
+        {
+        }
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    if (p != nullptr)
+    {
+        g_liveBytes -= malloc_usable_size(p);
+        std::free(p);
+    }
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+int main()
+{
+    // A few thousand small sources plus some large generated files
+    std::filesystem::path root = std::filesystem::temp_directory_path() / ("bench_readfile_" + std::to_string(getpid()));
+    std::string line = "    int value = compute(input, 42); // a typical line of source code\n";
+    size_t totalBytes = 0;
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::filesystem::path path = root / ("dir" + std::to_string(i % 40)) / ("file" + std::to_string(i) + ".cpp");
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream out(path);
+        for (int j = 0; j < 20 + i % 100; ++j)
+        {
+            out << line;
+            totalBytes += line.size();
+        }
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        std::ofstream out(root / ("generated" + std::to_string(i) + ".cpp"));
+        for (int j = 0; j < 40000; ++j)
+        {
+            out << line;
+            totalBytes += line.size();
+        }
+    }
+
+    std::vector<std::string> unmatched;
+    std::vector<std::filesystem::path> files = expandFilePatterns({root.string()}, unmatched);
+    std::printf("%zu files, %.1f MB\n", files.size(), totalBytes / 1e6);
+
+    // Pass 0 starts from a cold page cache when it can be dropped; the rest are warm
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        const char *cache = pass == 0 && _dropPageCache() ? "cold" : "warm";
+        {
+            ChatHistory history;
+            size_t baseline = g_liveBytes;
+            g_peakBytes = baseline;
+            auto start = std::chrono::steady_clock::now();
+            for (const std::filesystem::path &path : files)
+            {
+                history.addDialog("user", _legacyRead(path));
+            }
+            double legacyMs = _millisecondsSince(start);
+            std::printf("%s serial ifstream: %7.1f ms, peak heap %6.1f MB\n", cache, legacyMs,
+                        (g_peakBytes - baseline) / 1e6);
+        }
+        if (pass == 0 && _dropPageCache())
+        {
+            cache = "cold";
+        }
+        {
+            ChatHistory history;
+            size_t baseline = g_liveBytes;
+            g_peakBytes = baseline;
+            auto start = std::chrono::steady_clock::now();
+            ReadFilesOptions options;
+            options.maxTotalBytes = SIZE_MAX;
+            std::string message;
+            ReadFilesReport report = readFiles(files, options, [&](const FileContent &file) {
+                for (std::string_view chunk : splitIntoChunks(file.text, 128 * 1024))
+                {
+                    message.assign("File: ").append(file.path.string()).append("\n\n").append(chunk);
+                    history.addDialog("user", message);
+                }
+            });
+            double readMs = _millisecondsSince(start);
+            std::printf("%s readFiles:       %7.1f ms, peak heap %6.1f MB (%zu files, %zu messages)\n", cache, readMs,
+                        (g_peakBytes - baseline) / 1e6, report.files, history.size());
+        }
+    }
+
+    std::filesystem::remove_all(root);
+    return 0;
+}
@@ -0,0 +1,112 @@
+// bench_response.cpp
+//
+// Measures extracting the reply from chat completion responses of 1 KB to 5 MB: the original
+// nlohmann DOM parse against parseChatResponse, with time per response and throughput.
+
+#include "responseparser.hpp"
+#include <chrono>
+#include <cstdio>
+#include <nlohmann/json.hpp>
+#include <string>
+
+namespace
+{
+// The original getChatGPTResponseContent, less its error reporting
+std::string _domContent(const std::string &jsonStr)
+{
+    nlohmann::json jsonResponse = nlohmann::json::parse(jsonStr);
+    if (jsonResponse.contains("error"))
+    {
+        return "";
+    }
+    if (!jsonResponse.contains("choices") || !jsonResponse["choices"].is_array() || jsonResponse["choices"].empty())
+    {
+        return "";
+    }
+    if (!jsonResponse["choices"][0].contains("message") || !jsonResponse["choices"][0]["message"].contains("content"))
+    {
+        return "";
+    }
+    std::string response = jsonResponse["choices"][0]["message"]["content"];
+    return response;
+}
+
+// A realistic reply: prose and code with newlines, quotes, tabs and some non-ASCII text
+std::string _response(size_t contentBytes)
+{
+    const std::string paragraphs[] = {
+        "Here is how the \"cache\" works in practice:\n\n",
+        "```cpp\nfor (size_t i = 0; i < n; ++i)\n{\n\tsum += values[i];\n}\n```\n",
+        "The result is stored per key, so repeated requests are cheap. ",
+        "Prix: 12 € — naïve café déjà vu. ",
+    };
+    std::string content;
+    for (size_t i = 0; content.size() < contentBytes; ++i)
+    {
+        content += paragraphs[i % 4];
+    }
+    content.resize(contentBytes);
+    while (!content.empty() && (static_cast<unsigned char>(content.back()) & 0xc0) == 0x80)
+    {
+        content.pop_back(); // Do not cut a character in half
+    }
+    if (!content.empty() && static_cast<unsigned char>(content.back()) >= 0xc0)
+    {
+        content.pop_back();
+    }
+    nlohmann::json reply = {
+        {"id", "chatcmpl-bench"},
+        {"object", "chat.completion"},
+        {"created", 1700000000},
+        {"model", "gpt-4o-2024-08-06"},
+        {"choices",
+         {{{"index", 0},
+           {"message", {{"role", "assistant"}, {"content", content}, {"refusal", nullptr}}},
+           {"logprobs", nullptr},
+           {"finish_reason", "stop"}}}},
+        {"usage",
+         {{"prompt_tokens", 1200},
+          {"completion_tokens", contentBytes / 4},
+          {"total_tokens", 1200 + contentBytes / 4},
+          {"prompt_tokens_details", {{"cached_tokens", 1024}}}}},
+        {"system_fingerprint", "fp_bench"},
+    };
+    return reply.dump();
+}
+
+template <typename Fn> double _microsecondsPerCall(Fn &&fn, size_t iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        fn();
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+} // namespace
+
+int main()
+{
+    std::printf("%10s %14s %14s %10s %12s\n", "response", "DOM us", "one-pass us", "speedup", "one-pass MB/s");
+    for (size_t contentBytes : {1000u, 16000u, 256000u, 1000000u, 5000000u})
+    {
+        std::string body = _response(contentBytes);
+        if (parseChatResponse(body).content != _domContent(body))
+        {
+            std::printf("extractors disagree at %zu bytes\n", body.size());
+            return 1;
+        }
+        // About a quarter of a second of work per measurement
+        size_t iterations = std::max<size_t>(3, 25000000 / body.size());
+        size_t sink = 0;
+        double domUs = _microsecondsPerCall([&] { sink += _domContent(body).size(); }, iterations);
+        double onePassUs = _microsecondsPerCall([&] { sink += parseChatResponse(body).content.size(); }, iterations);
+        std::printf("%8.1fKB %14.1f %14.1f %9.1fx %12.0f\n", body.size() / 1e3, domUs, onePassUs, domUs / onePassUs,
+                    body.size() / onePassUs);
+        if (sink == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+// bench_responsecache.cpp
+//
+// Measures the latency of ResponseCache hits and stores: hashing the payload, taking the file
+// lock, probing the mapped index and reading the record.
+
+#include "responsecache.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+int main()
+{
+    std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("chatgpt_cli_bench_cache_" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+
+    const std::string response(2048, 'r');
+    std::printf("%14s %14s %14s\n", "payload bytes", "store (us)", "hit (us)");
+    for (size_t payloadSize : {1024, 16 * 1024, 256 * 1024})
+    {
+        ResponseCache cache(directory, 256 * 1024 * 1024);
+        const int entries = 1000;
+        std::string payload(payloadSize, 'p');
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < entries; ++i)
+        {
+            payload.replace(0, 8, std::to_string(10000000 + i));
+            cache.store(payload, response);
+        }
+        double store = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        std::string result;
+        size_t hits = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < entries; ++i)
+        {
+            payload.replace(0, 8, std::to_string(10000000 + i));
+            hits += cache.lookup(payload, result) ? 1 : 0;
+        }
+        double hit = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        if (hits != static_cast<size_t>(entries))
+        {
+            std::printf("unexpected misses: %zu\n", entries - hits);
+        }
+        std::printf("%14zu %14.2f %14.2f\n", payloadSize, store / entries, hit / entries);
+        std::filesystem::remove_all(directory);
+    }
+    return 0;
+}
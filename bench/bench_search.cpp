@@ -0,0 +1,107 @@
+// bench_search.cpp
+//
+// Measures %search over about 100 MB of history: building the index once, keeping it up to date
+// as a message is added, and answering word, phrase and substring queries.
+
+#include "chathistory.hpp"
+#include "historyindex.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+double _millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Prose-like text: words drawn from a vocabulary with a Zipf distribution, so a few words are very common
+std::vector<std::string> _vocabulary(size_t size)
+{
+    std::vector<std::string> words = {"the", "of", "and", "to", "in", "token", "budget", "parser"};
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::uniform_int_distribution<int> length(3, 10);
+    while (words.size() < size)
+    {
+        std::string word;
+        for (int i = length(random); i > 0; --i)
+        {
+            word += static_cast<char>(letter(random));
+        }
+        words.push_back(word);
+    }
+    return words;
+}
+} // namespace
+
+int main()
+{
+    const std::vector<std::string> vocabulary = _vocabulary(50000);
+    std::vector<double> weights;
+    for (size_t i = 0; i < vocabulary.size(); ++i)
+    {
+        weights.push_back(1.0 / static_cast<double>(i + 1));
+    }
+    std::mt19937 random(11);
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+    ChatHistory history;
+    size_t bytes = 0;
+    std::string message;
+    while (bytes < 100u * 1024 * 1024)
+    {
+        message.clear();
+        while (message.size() < 2000)
+        {
+            message += vocabulary[pick(random)];
+            message += message.size() % 13 == 0 ? ".\n" : " ";
+        }
+        history.addDialog(history.size() % 2 == 0 ? "user" : "assistant", message);
+        bytes += message.size();
+    }
+    history.addDialog("assistant", "Use std::vector<int> for the token budget table.");
+
+    HistoryIndex index;
+    auto start = std::chrono::steady_clock::now();
+    index.sync(history);
+    std::printf("%-36s %10.1f ms (%zu messages, %.0f MB, %zu words, %zu postings)\n", "index the whole history",
+                _millisecondsSince(start), history.size(), bytes / (1024.0 * 1024.0), index.terms(), index.postings());
+
+    history.addDialog("user", "one more question about the token budget");
+    start = std::chrono::steady_clock::now();
+    index.sync(history);
+    std::printf("%-36s %10.3f ms\n", "sync after one new message", _millisecondsSince(start));
+
+    struct Query
+    {
+        const char *label;
+        std::vector<std::string> terms;
+    };
+    const Query queries[] = {
+        {"rare word", {vocabulary[40000]}},
+        {"common word", {"the"}},
+        {"two words", {"token", "parser"}},
+        {"phrase of common words", {"of the"}},
+        {"phrase", {"token budget"}},
+        {"substring with a whole word", {"std::vector<int>"}},
+        {"substring, full scan", {"vector<*"}},
+    };
+    for (const Query &query : queries)
+    {
+        SearchQuery parsed = parseSearchQuery(query.terms);
+        const int rounds = 5;
+        std::vector<size_t> hits;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; ++i)
+        {
+            hits = index.search(history, parsed);
+        }
+        std::printf("%-36s %10.3f ms (%zu messages)\n", query.label, _millisecondsSince(start) / rounds, hits.size());
+    }
+    return 0;
+}
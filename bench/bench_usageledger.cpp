@@ -0,0 +1,90 @@
+// bench_usageledger.cpp
+//
+// Measures the usage ledger: appending one record per request, adding up the last 30 days of a
+// year-long ledger, and a new session reading the day's total, in a temporary file.
+
+#include "usageledger.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+namespace
+{
+double _millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+int main()
+{
+    const std::filesystem::path path =
+        std::filesystem::temp_directory_path() / ("bench_usageledger_" + std::to_string(getpid()));
+    std::filesystem::remove(path);
+
+    // A year of heavy use from several processes: 5000 requests a day
+    const size_t days = 365;
+    const size_t perDay = 5000;
+    const auto now = std::chrono::system_clock::now();
+    ChatUsage usage;
+    usage.promptTokens = 1200;
+    usage.completionTokens = 300;
+    usage.cachedTokens = 1024;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        UsageLedger ledger(path);
+        for (size_t day = days; day-- > 0;)
+        {
+            for (size_t i = 0; i < perDay; ++i)
+            {
+                auto when = now - std::chrono::hours(24 * day) + std::chrono::seconds(i * 86400 / perDay) -
+                            std::chrono::hours(24);
+                ledger.record(usage, when);
+            }
+        }
+    }
+    double writeMs = _millisecondsSince(start);
+    size_t records = days * perDay;
+    std::printf("%-36s %10zu records, %.1f MB\n", "ledger", records,
+                std::filesystem::file_size(path) / (1024.0 * 1024.0));
+    std::printf("%-36s %10.2f us\n", "record() per request", writeMs * 1000.0 / records);
+
+    UsageLedger ledger(path);
+    start = std::chrono::steady_clock::now();
+    UsageTotals today = ledger.today();
+    std::printf("%-36s %10.3f ms (%llu requests)\n", "first today() of a session", _millisecondsSince(start),
+                static_cast<unsigned long long>(today.requests));
+
+    const int rounds = 20;
+    UsageTotals month;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i)
+    {
+        month = ledger.totals(now - std::chrono::hours(24 * 30), now);
+    }
+    std::printf("%-36s %10.3f ms (%llu requests, %llu tokens)\n", "totals() over the last 30 days",
+                _millisecondsSince(start) / rounds, static_cast<unsigned long long>(month.requests),
+                static_cast<unsigned long long>(month.tokens()));
+
+    UsageTotals year;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i)
+    {
+        year = ledger.totals(now - std::chrono::hours(24 * 400), now);
+    }
+    std::printf("%-36s %10.3f ms (%llu requests)\n", "totals() over the whole year", _millisecondsSince(start) / rounds,
+                static_cast<unsigned long long>(year.requests));
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; ++i)
+    {
+        today = ledger.today();
+    }
+    std::printf("%-36s %10.3f us\n", "today() with nothing new", _millisecondsSince(start));
+
+    std::filesystem::remove(path);
+    return month.requests == 30 * perDay ? 0 : 1;
+}
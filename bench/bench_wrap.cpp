@@ -0,0 +1,139 @@
+// bench_wrap.cpp
+//
+// Compares the LineWrapper-based wrap() against the original istringstream/vector<string>
+// implementation on multi-megabyte inputs, counting heap allocations made while wrapping.
+
+#include "formatting.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace
+{
+size_t g_allocations = 0; // Calls to operator new
+
+// The original wrap(), kept here for comparison
+void legacyWrap(std::string const &input, size_t width, std::ostream &os, size_t defaultIndent = 0)
+{
+    std::istringstream ss(input);
+    std::string line;
+    while (std::getline(ss, line))
+    {
+        if (line.find_first_not_of(' ') == std::string::npos)
+        {
+            os << line << '\n';
+            continue;
+        }
+        size_t originalIndent = line.find_first_not_of(' ');
+        size_t totalIndent = originalIndent + defaultIndent;
+        line = line.substr(originalIndent);
+
+        std::vector<std::string> words;
+        std::istringstream lineStream(line);
+        std::string word;
+        while (lineStream >> word)
+        {
+            words.push_back(word);
+        }
+
+        std::string newLine = std::string(totalIndent, ' ');
+        for (const auto &w : words)
+        {
+            if (newLine.length() + w.length() > width + totalIndent)
+            {
+                os << newLine << '\n';
+                newLine = std::string(totalIndent, ' ');
+            }
+            if (newLine.length() > totalIndent)
+                newLine += ' ';
+            newLine += w;
+        }
+        os << newLine << '\n';
+    }
+}
+
+// Discards output but counts it, so the stream itself costs nothing
+class CountingBuffer : public std::streambuf
+{
+  public:
+    size_t bytes = 0;
+
+  protected:
+    int_type overflow(int_type c) override
+    {
+        ++bytes;
+        return c;
+    }
+    std::streamsize xsputn(const char *, std::streamsize n) override
+    {
+        bytes += static_cast<size_t>(n);
+        return n;
+    }
+};
+
+template <typename Fn> void report(const char *name, const std::string &input, Fn &&wrapFn)
+{
+    CountingBuffer buffer;
+    std::ostream os(&buffer);
+    const int passes = 5;
+    size_t allocationsBefore = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        wrapFn(input, os);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double seconds = std::chrono::duration<double>(elapsed).count() / passes;
+    std::printf("%-10s %10.1f MB/s %14zu allocs/pass\n", name, input.size() / seconds / 1e6,
+                (g_allocations - allocationsBefore) / passes);
+}
+} // namespace
+
+void *operator new(size_t size)
+{
+    ++g_allocations;
+    if (void *p = std::malloc(size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+int main()
+{
+    const std::string ascii = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+                              "incididunt ut labore et dolore magna aliqua.\n  Ut enim ad minim veniam, quis "
+                              "nostrud exercitation ullamco laboris.\n\n";
+    const std::string mixed = "Caf\xc3\xa9 na\xc3\xafve r\xc3\xa9sum\xc3\xa9 \xe4\xbd\xa0\xe5\xa5\xbd\xe4\xb8\x96"
+                              "\xe7\x95\x8c \xe3\x81\x93\xe3\x82\x93\xe3\x81\xab\xe3\x81\xa1\xe3\x81\xaf mixed "
+                              "with plain words \xf0\x9f\x98\x80 and more text.\n";
+
+    for (const auto &sample : {std::make_pair("ascii", &ascii), std::make_pair("utf-8", &mixed)})
+    {
+        std::string input;
+        while (input.size() < 8 * 1024 * 1024)
+        {
+            input += *sample.second;
+        }
+        std::printf("%s input, %.1f MB, width 80\n", sample.first, input.size() / 1e6);
+        report("legacy", input, [](const std::string &text, std::ostream &os) { legacyWrap(text, 80, os); });
+        report("wrap", input, [](const std::string &text, std::ostream &os) { wrap(text, 80, os); });
+    }
+    return 0;
+}
@@ -2,46 +2,254 @@
 //
 // Implementation of API key validity check for OpenAI API.
 #include "apikeycheck.hpp"
+#include "connectionpool.hpp"
+#include "ratelimiter.hpp"
+#include "request.hpp"
+#include "sha256.hpp"
+#include <cstdio>
 #include <cstdlib>
 #include <curl/curl.h>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
 
-void checkOpenAIKeyOrExit() {
-    const char *api_key = std::getenv("OPENAI_KEY");
-    if (api_key == nullptr || std::string(api_key).empty()) {
-        std::cerr << "[CRITICAL ERROR] Your OpenAI API key (OPENAI_KEY) is not set.\n"
-                  << "Please update your API key by setting the OPENAI_KEY environment variable to a valid key.\n"
-                  << "Visit https://platform.openai.com/account/api-keys to create or view your API keys.\nExiting program." << std::endl;
-        std::exit(EXIT_FAILURE);
+namespace {
+
+// Cache entry name: the key is only ever stored hashed, together with the API it was valid for
+std::string _entryDigest(std::string_view baseUrl, std::string_view key) {
+    Sha256 hasher;
+    hasher.update(baseUrl);
+    hasher.update("\n");
+    hasher.update(key);
+    return Sha256::toHex(hasher.finish());
+}
+
+int64_t _toSeconds(KeyValidationCache::Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
+
+/**
+ * @brief cURL progress callback that aborts the check once the cancel flag is raised.
+ */
+int _cancelProgressCallback(void *clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+    return static_cast<const std::atomic<bool> *>(clientp)->load() ? 1 : 0;
+}
+
+std::string _whichKey(size_t index, size_t count) {
+    return count > 1 ? " (key " + std::to_string(index + 1) + " of " + std::to_string(count) + ")" : "";
+}
+
+} // namespace
+
+KeyValidationCache::KeyValidationCache(std::filesystem::path file, std::chrono::seconds ttl)
+    : m_file(std::move(file)), m_ttl(ttl) {}
+
+bool KeyValidationCache::isFresh(std::string_view baseUrl, std::string_view key, Clock::time_point now) const {
+    std::map<std::string, int64_t> entries = _load();
+    auto it = entries.find(_entryDigest(baseUrl, key));
+    if (it == entries.end()) {
+        return false;
+    }
+    int64_t age = _toSeconds(now) - it->second;
+    // A validation from the future means the clock moved; do not trust it
+    return age >= 0 && age < m_ttl.count();
+}
+
+void KeyValidationCache::remember(std::string_view baseUrl, std::string_view key, Clock::time_point now) {
+    std::map<std::string, int64_t> entries = _load();
+    int64_t nowSeconds = _toSeconds(now);
+    for (auto it = entries.begin(); it != entries.end();) {
+        it = nowSeconds - it->second >= m_ttl.count() ? entries.erase(it) : std::next(it);
+    }
+    entries[_entryDigest(baseUrl, key)] = nowSeconds;
+    _save(entries);
+}
+
+void KeyValidationCache::forget(std::string_view baseUrl, std::string_view key) {
+    std::map<std::string, int64_t> entries = _load();
+    if (entries.erase(_entryDigest(baseUrl, key)) > 0) {
+        _save(entries);
+    }
+}
+
+std::map<std::string, int64_t> KeyValidationCache::_load() const {
+    std::map<std::string, int64_t> entries;
+    std::ifstream in(m_file);
+    std::string digest;
+    int64_t seconds = 0;
+    // A damaged line ends the read; the entries after it are simply checked again
+    while (in >> digest >> seconds) {
+        if (digest.size() == 64) {
+            entries[digest] = seconds;
+        }
+    }
+    return entries;
+}
+
+void KeyValidationCache::_save(const std::map<std::string, int64_t> &entries) const {
+    // Written to a private temporary file and renamed over the cache, so a concurrent launch
+    // sees either the old or the new entries; losing one of two racing updates only costs a check
+    std::error_code error;
+    std::filesystem::create_directories(m_file.parent_path(), error);
+    std::filesystem::path tempPath = m_file;
+    tempPath += ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tempPath, std::ios::trunc);
+        for (const auto &[digest, seconds] : entries) {
+            out << digest << ' ' << seconds << '\n';
+        }
+        if (!out.flush()) {
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+    }
+    std::filesystem::permissions(tempPath, std::filesystem::perms::owner_read | std::filesystem::perms::owner_write,
+                                 error);
+    if (std::rename(tempPath.c_str(), m_file.c_str()) != 0) {
+        std::filesystem::remove(tempPath, error);
+    }
+}
+
+KeyValidationCache *sharedKeyValidationCache() {
+    static KeyValidationCache *cache = []() -> KeyValidationCache * {
+        std::filesystem::path file;
+        if (const char *configured = std::getenv("CHATGPT_CLI_KEY_CACHE")) {
+            if (*configured == '\0') {
+                return nullptr;
+            }
+            file = configured;
+        } else if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg != '\0') {
+            file = std::filesystem::path(xdg) / "chatgpt-cli" / "validated-keys";
+        } else if (const char *home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+            file = std::filesystem::path(home) / ".cache" / "chatgpt-cli" / "validated-keys";
+        } else {
+            return nullptr;
+        }
+        long hours = 24;
+        const char *ttl = std::getenv("CHATGPT_CLI_KEY_CACHE_TTL_HOURS");
+        if (ttl != nullptr && *ttl != '\0') {
+            hours = std::strtol(ttl, nullptr, 10);
+        }
+        if (hours <= 0) {
+            return nullptr;
+        }
+        return new KeyValidationCache(file, std::chrono::hours(hours));
+    }();
+    return cache;
+}
+
+KeyCheckResult checkApiKeys(const std::vector<std::string> &keys, KeyValidationCache *cache,
+                            const std::atomic<bool> *cancelFlag) {
+    KeyCheckResult result;
+    if (keys.empty()) {
+        result.status = KeyCheckResult::Status::Missing;
+        result.message = "OPENAI_KEY is not set";
+        return result;
     }
 
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        std::cerr << "[CRITICAL ERROR] Failed to initialize CURL for API key check. Exiting program." << std::endl;
-        std::exit(EXIT_FAILURE);
+    const std::string baseUrl = apiBaseUrl();
+    std::vector<size_t> unchecked;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (cache == nullptr || !cache->isFresh(baseUrl, keys[i])) {
+            unchecked.push_back(i);
+        }
     }
-    struct curl_slist *headers = nullptr;
-    std::string auth_header = "Authorization: Bearer " + std::string(api_key);
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    headers = curl_slist_append(headers, auth_header.c_str());
-    curl_easy_setopt(curl, CURLOPT_URL, "https://api.openai.com/v1/models");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L); // HEAD request is enough
+    if (unchecked.empty()) {
+        result.fromCache = true;
+        result.message = keys.size() > 1 ? "API keys validated recently" : "API key validated recently";
+        return result;
+    }
+
+    ConnectionPool &pool = ConnectionPool::instance();
+    const std::string url = baseUrl + "/models";
+    for (size_t i : unchecked) {
+        if (cancelFlag != nullptr && cancelFlag->load()) {
+            result.status = KeyCheckResult::Status::Cancelled;
+            result.message = "API key check cancelled";
+            return result;
+        }
+        ConnectionPool::Handle handle = pool.acquire(url);
+        CURL *curl = handle.get();
+        if (!curl) {
+            result.status = KeyCheckResult::Status::Unreachable;
+            result.message = "Failed to initialize CURL for the API key check";
+            return result;
+        }
+        struct curl_slist *headers = nullptr;
+        std::string auth_header = "Authorization: Bearer " + keys[i];
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+        headers = curl_slist_append(headers, auth_header.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L); // HEAD request is enough
+        if (cancelFlag != nullptr) {
+            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, _cancelProgressCallback);
+            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, const_cast<std::atomic<bool> *>(cancelFlag));
+        }
+
+        CURLcode res = curl_easy_perform(curl);
+        pool.recordTransfer(curl, res);
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        // The warmed-up connection stays in the pool for the first chat request
+        curl_slist_free_all(headers);
 
-    CURLcode res = curl_easy_perform(curl);
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        std::string which = _whichKey(i, keys.size());
+        if (res == CURLE_ABORTED_BY_CALLBACK) {
+            result.status = KeyCheckResult::Status::Cancelled;
+            result.message = "API key check cancelled";
+            return result;
+        }
+        if (res != CURLE_OK) {
+            // Offline or a proxy problem says nothing about the key, so nothing is cached either way
+            result.status = KeyCheckResult::Status::Unreachable;
+            result.message = "Could not verify the API key" + which + ": " + curl_easy_strerror(res);
+            return result;
+        }
+        if (http_code == 401 || http_code == 403) {
+            if (cache != nullptr) {
+                cache->forget(baseUrl, keys[i]);
+            }
+            result.status = KeyCheckResult::Status::Invalid;
+            result.message = "Your OpenAI API key (OPENAI_KEY)" + which + " is invalid or inactive";
+            return result;
+        }
+        if (http_code != 200) {
+            result.status = KeyCheckResult::Status::Unreachable;
+            result.message = "Could not verify the API key" + which + ": HTTP " + std::to_string(http_code);
+            return result;
+        }
+        if (cache != nullptr) {
+            cache->remember(baseUrl, keys[i]);
+        }
+    }
+    result.message = keys.size() > 1 ? "API keys valid" : "API key valid";
+    return result;
+}
 
-    if (res != CURLE_OK || http_code != 200) {
-        std::cerr << "[CRITICAL ERROR] Your OpenAI API key (OPENAI_KEY) is invalid or inactive.\n"
+void checkOpenAIKeyOrExit() {
+    // OPENAI_KEY may list several keys separated by commas; requests are spread over all of them
+    KeyCheckResult result = checkApiKeys(configuredApiKeys(), sharedKeyValidationCache());
+    switch (result.status) {
+    case KeyCheckResult::Status::Valid:
+        return;
+    case KeyCheckResult::Status::Missing:
+        std::cerr << "[CRITICAL ERROR] Your OpenAI API key (OPENAI_KEY) is not set.\n"
                   << "Please update your API key by setting the OPENAI_KEY environment variable to a valid key.\n"
                   << "Visit https://platform.openai.com/account/api-keys to create or view your API keys.\nExiting program." << std::endl;
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
-        std::exit(EXIT_FAILURE);
+        break;
+    case KeyCheckResult::Status::Invalid:
+        std::cerr << "[CRITICAL ERROR] " << result.message << ".\n"
+                  << "Please update your API key by setting the OPENAI_KEY environment variable to a valid key.\n"
+                  << "Visit https://platform.openai.com/account/api-keys to create or view your API keys.\nExiting program." << std::endl;
+        break;
+    default:
+        std::cerr << "[CRITICAL ERROR] " << result.message << ". Exiting program." << std::endl;
+        break;
     }
-    curl_easy_cleanup(curl);
-    curl_slist_free_all(headers);
+    std::exit(EXIT_FAILURE);
 }
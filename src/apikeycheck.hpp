@@ -4,14 +4,106 @@
 #ifndef APIKEYCHECK_HPP
 #define APIKEYCHECK_HPP
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// @brief Outcome of checking the configured API keys.
+struct KeyCheckResult {
+    enum class Status {
+        Valid,       // Every key was accepted
+        Invalid,     // The API rejected a key
+        Unreachable, // The API could not be asked; the keys may well be fine
+        Missing,     // No key is configured
+        Cancelled,
+    };
+
+    Status status = Status::Valid;
+    bool fromCache = false; // Every key was validated recently, so none was checked again
+    std::string message;    // One line for the status bar
+};
+
+/// @class KeyValidationCache
+/// @brief Remembers which API keys were validated recently, so most launches can skip the check.
+///
+/// Keys are never stored: each entry is the SHA-256 of the API root and the key, with the time
+/// it was validated, one "digest seconds" line per entry in a small file that is replaced
+/// atomically on every change.
+class KeyValidationCache {
+  public:
+    using Clock = std::chrono::system_clock;
+
+    /**
+     * @brief Uses the cache file at file, which need not exist yet.
+     * @param ttl How long a validation is trusted.
+     */
+    KeyValidationCache(std::filesystem::path file, std::chrono::seconds ttl);
+
+    /**
+     * @brief Returns true if key was validated against baseUrl less than the TTL ago.
+     */
+    bool isFresh(std::string_view baseUrl, std::string_view key, Clock::time_point now = Clock::now()) const;
+
+    /**
+     * @brief Records that key was just validated against baseUrl, dropping expired entries.
+     */
+    void remember(std::string_view baseUrl, std::string_view key, Clock::time_point now = Clock::now());
+
+    /**
+     * @brief Drops the entry for key, e.g. after the API rejected it.
+     */
+    void forget(std::string_view baseUrl, std::string_view key);
+
+  private:
+    std::filesystem::path m_file;
+    std::chrono::seconds m_ttl;
+
+    /**
+     * @brief Returns the entries in the file: digest to validation time in seconds since the epoch.
+     */
+    std::map<std::string, int64_t> _load() const;
+
+    /**
+     * @brief Replaces the file with entries.
+     */
+    void _save(const std::map<std::string, int64_t> &entries) const;
+};
+
+/**
+ * @brief Returns the process-wide key validation cache, or nullptr when it is off.
+ *
+ * The file is CHATGPT_CLI_KEY_CACHE, or "chatgpt-cli/validated-keys" under $XDG_CACHE_HOME
+ * (default ~/.cache); an empty CHATGPT_CLI_KEY_CACHE turns it off. CHATGPT_CLI_KEY_CACHE_TTL_HOURS
+ * sets how long a validation is trusted (default 24). Read once.
+ */
+KeyValidationCache *sharedKeyValidationCache();
+
+/**
+ * @brief Checks keys against the API's /models endpoint, skipping keys the cache vouches for.
+ *
+ * Keys the API accepts are remembered in cache and keys it rejects are forgotten. Each check
+ * leaves a warmed-up connection in the pool for the first chat request.
+ * @param keys The keys to check.
+ * @param cache The validation cache; nullptr checks every key.
+ * @param cancelFlag Aborts the check when raised.
+ */
+KeyCheckResult checkApiKeys(const std::vector<std::string> &keys, KeyValidationCache *cache,
+                            const std::atomic<bool> *cancelFlag = nullptr);
+
 /**
  * @brief Checks the validity of the OpenAI API key at program startup.
  *
- * Makes a minimal request to the OpenAI API to verify the key.
+ * Makes a minimal request to the OpenAI API to verify the key, unless it was validated recently.
  * If the key is missing, invalid, or inactive, prints an error message and terminates the program.
  * This function does not return if the key is not valid.
  *
- * @note This function should be called before any other OpenAI API operations.
+ * @note The interactive UI runs checkApiKeys in the background instead and only calls this
+ * when no key is configured at all.
  */
 void checkOpenAIKeyOrExit();
 
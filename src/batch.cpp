@@ -0,0 +1,464 @@
+//  batch.cpp
+//
+// Non-interactive batch mode: runs a JSONL file of prompts concurrently over curl_multi
+
+#include "batch.hpp"
+#include "chathistory.hpp"
+#include "connectionpool.hpp"
+#include "ratelimiter.hpp"
+#include "request.hpp"
+#include "responsecache.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <curl/curl.h>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+/// @brief One request on the multi handle; owns everything cURL points into.
+struct Transfer
+{
+    size_t index;
+    nlohmann::json id;
+    std::string payload;
+    std::string response;
+    ConnectionPool::Handle handle;
+    std::chrono::steady_clock::time_point started;
+    RateLimiter::Lease lease;
+    RateLimitHeaders rateLimits;
+    int attempt = 0;
+    std::chrono::steady_clock::time_point notBefore; // Earliest start of the next attempt
+};
+
+/**
+ * @brief Builds the request body for one input line with the same code path as makeRequest.
+ * @throws std::runtime_error if the line is not a prompt or a conversation ending in a user message.
+ */
+std::string _payloadForLine(const nlohmann::json &request)
+{
+    ChatHistory history;
+    if (request.contains("prompt") && request["prompt"].is_string())
+    {
+        return buildChatRequestPayload(request["prompt"].get<std::string>(), history, false);
+    }
+    if (!request.contains("messages") || !request["messages"].is_array() || request["messages"].empty())
+    {
+        throw std::runtime_error("expected a \"prompt\" string or a \"messages\" array");
+    }
+
+    const nlohmann::json &messages = request["messages"];
+    for (size_t i = 0; i + 1 < messages.size(); ++i)
+    {
+        history.addDialog(messages[i].at("role").get<std::string>(), messages[i].at("content").get<std::string>());
+    }
+    const nlohmann::json &last = messages.back();
+    if (last.at("role").get<std::string>() != "user")
+    {
+        throw std::runtime_error("the last message must have role \"user\"");
+    }
+    return buildChatRequestPayload(last.at("content").get<std::string>(), history, false);
+}
+
+std::string _resultLine(size_t index, const nlohmann::json &id, const char *field, const std::string &value,
+                        double latencyMs, bool cached = false)
+{
+    nlohmann::json result;
+    result["index"] = index;
+    if (!id.is_null())
+    {
+        result["id"] = id;
+    }
+    result[field] = value;
+    if (latencyMs >= 0)
+    {
+        result["latency_ms"] = std::round(latencyMs * 10) / 10;
+    }
+    if (cached)
+    {
+        result["cached"] = true;
+    }
+    return result.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+} // namespace
+
+double BatchReport::percentile(double p) const
+{
+    if (latenciesMs.empty())
+    {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(p / 100 * latenciesMs.size()));
+    return latenciesMs[std::min(std::max<size_t>(rank, 1), latenciesMs.size()) - 1];
+}
+
+double BatchReport::requestsPerSecond() const
+{
+    return seconds > 0 ? requests / seconds : 0;
+}
+
+BatchReport runBatch(std::istream &input, std::ostream &output, const BatchOptions &options)
+{
+    ConnectionPool &pool = ConnectionPool::instance(); // Also initializes libcurl
+    const std::string url = options.url.empty() ? chatCompletionsUrl() : options.url;
+    const size_t maxInFlight = std::max<size_t>(options.maxInFlight, 1);
+    ResponseCache *cache = options.cache;
+
+    // Requests are paced and spread over the configured keys; one header list per key
+    RateLimiter &limiter = sharedRateLimiter();
+    std::vector<struct curl_slist *> keyHeaders;
+    for (size_t key = 0; key < std::max<size_t>(limiter.keyCount(), 1); ++key)
+    {
+        struct curl_slist *headers = curl_slist_append(nullptr, "Content-Type: application/json");
+        if (key < limiter.keyCount())
+        {
+            std::string auth_header = "Authorization: Bearer " + limiter.key(key);
+            headers = curl_slist_append(headers, auth_header.c_str());
+        }
+        keyHeaders.push_back(headers);
+    }
+
+    CURLM *multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    BatchReport report;
+    std::unordered_map<CURL *, std::unique_ptr<Transfer>> active;
+    std::map<size_t, std::string> finished; // Results waiting for earlier ones, in input order mode
+    std::deque<std::unique_ptr<Transfer>> waiting; // Parsed requests held back by the limiter or a retry
+    size_t nextIndex = 0;
+    size_t nextToWrite = 0;
+    bool inputDone = false;
+    std::string line;
+
+    auto writeResult = [&](size_t index, std::string result) {
+        if (options.completionOrder)
+        {
+            output << result << '\n';
+            return;
+        }
+        finished.emplace(index, std::move(result));
+        while (!finished.empty() && finished.begin()->first == nextToWrite)
+        {
+            output << finished.begin()->second << '\n';
+            finished.erase(finished.begin());
+            ++nextToWrite;
+        }
+    };
+
+    // Parses the next input line into a transfer; answers invalid and cached lines in place
+    auto readTransfer = [&]() -> std::unique_ptr<Transfer> {
+        if (!std::getline(input, line))
+        {
+            inputDone = true;
+            return nullptr;
+        }
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            return nullptr;
+        }
+
+        auto transfer = std::make_unique<Transfer>();
+        transfer->index = nextIndex++;
+        ++report.requests;
+        try
+        {
+            nlohmann::json request = nlohmann::json::parse(line);
+            if (request.is_object() && request.contains("id"))
+            {
+                transfer->id = request["id"];
+            }
+            transfer->payload = _payloadForLine(request);
+        }
+        catch (const std::exception &e)
+        {
+            ++report.failed;
+            writeResult(transfer->index, _resultLine(transfer->index, transfer->id, "error",
+                                                     "Invalid request: " + std::string(e.what()), -1));
+            return nullptr;
+        }
+
+        // A cached reply needs no transfer at all
+        if (cache != nullptr)
+        {
+            auto lookupStart = std::chrono::steady_clock::now();
+            std::string cachedResponse;
+            std::string content;
+            if (cache->lookup(transfer->payload, cachedResponse) &&
+                !(content = getChatGPTResponseContent(cachedResponse)).empty())
+            {
+                double latencyMs =
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lookupStart).count();
+                report.latenciesMs.push_back(latencyMs);
+                writeResult(transfer->index,
+                            _resultLine(transfer->index, transfer->id, "content", content, latencyMs, true));
+                return nullptr;
+            }
+        }
+        transfer->started = std::chrono::steady_clock::now();
+        return transfer;
+    };
+
+    // Adds an attempt of transfer to the multi handle
+    auto startTransfer = [&](std::unique_ptr<Transfer> transfer) {
+        transfer->handle = pool.acquire(url);
+        CURL *curl = transfer->handle.get();
+        if (curl == nullptr)
+        {
+            ++report.failed;
+            writeResult(transfer->index,
+                        _resultLine(transfer->index, transfer->id, "error", "Failed to initialize CURL", -1));
+            if (limiter.keyCount() > 0)
+            {
+                limiter.complete(transfer->lease, 0, RateLimitHeaders());
+            }
+            return;
+        }
+        // The multi handle keeps its own connection cache and multiplexes over it, so the
+        // pool's share is detached for the batch
+        curl_easy_setopt(curl, CURLOPT_SHARE, nullptr);
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, transfer->payload.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(transfer->payload.size()));
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, keyHeaders[transfer->lease.key]);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, rateLimitHeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &transfer->rateLimits);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _writeCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer->response);
+        curl_multi_add_handle(multi, curl);
+        active.emplace(curl, std::move(transfer));
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    while (true)
+    {
+        // Top up to the in-flight limit, retries first, reading the input only as far as needed
+        auto now = std::chrono::steady_clock::now();
+        auto nextWake = now + std::chrono::seconds(1);
+        while (active.size() < maxInFlight)
+        {
+            auto ready = std::find_if(waiting.begin(), waiting.end(),
+                                      [&](const std::unique_ptr<Transfer> &t) { return t->notBefore <= now; });
+            std::unique_ptr<Transfer> transfer;
+            if (ready != waiting.end())
+            {
+                transfer = std::move(*ready);
+                waiting.erase(ready);
+            }
+            else if (!inputDone)
+            {
+                transfer = readTransfer();
+                if (transfer == nullptr)
+                {
+                    continue; // Blank, invalid or cached line, or the end of the input
+                }
+            }
+            else
+            {
+                break;
+            }
+
+            Clock::duration wait;
+            if (limiter.keyCount() > 0 && !limiter.tryAcquire(transfer->payload.size() / 4.0, transfer->lease, wait, now))
+            {
+                transfer->notBefore = now + wait;
+                waiting.push_front(std::move(transfer));
+                break;
+            }
+            startTransfer(std::move(transfer));
+        }
+        for (const std::unique_ptr<Transfer> &transfer : waiting)
+        {
+            nextWake = std::min(nextWake, transfer->notBefore);
+        }
+        if (active.empty() && waiting.empty() && inputDone)
+        {
+            break;
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        bool completed = false;
+        int queued = 0;
+        while (CURLMsg *message = curl_multi_info_read(multi, &queued))
+        {
+            if (message->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+            CURL *curl = message->easy_handle;
+            CURLcode result = message->data.result;
+            auto it = active.find(curl);
+            Transfer &transfer = *it->second;
+            pool.recordTransfer(curl, result);
+            if (result == CURLE_OK)
+            {
+                recordTransferPhases(curl);
+            }
+            curl_multi_remove_handle(multi, curl);
+            completed = true;
+
+            long httpCode = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+            if (limiter.keyCount() > 0)
+            {
+                limiter.complete(transfer.lease, httpCode, transfer.rateLimits);
+            }
+
+            // Rate limited and transiently failed requests go back in line; a 429 has blocked
+            // its key in the limiter, other failures back off here
+            if (transfer.attempt < kMaxRequestRetries &&
+                ((result == CURLE_OK && isRetryableStatus(httpCode)) || isRetryableTransferError(result)))
+            {
+                std::unique_ptr<Transfer> retry = std::move(it->second);
+                active.erase(it);
+                retry->handle.reset();
+                retry->response.clear();
+                retry->rateLimits = RateLimitHeaders();
+                retry->notBefore = std::chrono::steady_clock::now() +
+                                   (httpCode == 429 ? Clock::duration::zero() : limiter.backoff(retry->attempt));
+                ++retry->attempt;
+                waiting.push_back(std::move(retry));
+                continue;
+            }
+
+            double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                         transfer.started)
+                                   .count();
+            report.latenciesMs.push_back(latencyMs);
+            std::string content;
+            std::string error;
+            if (result != CURLE_OK)
+            {
+                error = curl_easy_strerror(result);
+            }
+            else
+            {
+                recordResponseUsage(transfer.response);
+                content = getChatGPTResponseContent(transfer.response);
+                if (content.empty())
+                {
+                    error = "No content in response (HTTP " + std::to_string(httpCode) + ")";
+                }
+                else if (cache != nullptr)
+                {
+                    cache->store(transfer.payload, transfer.response);
+                }
+            }
+
+            if (error.empty())
+            {
+                writeResult(transfer.index, _resultLine(transfer.index, transfer.id, "content", content, latencyMs));
+            }
+            else
+            {
+                ++report.failed;
+                writeResult(transfer.index, _resultLine(transfer.index, transfer.id, "error", error, latencyMs));
+            }
+            active.erase(it); // The handle goes back to the pool
+        }
+
+        // Wait for network activity or the next held-back request, unless a slot just freed up
+        if (!completed)
+        {
+            auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(nextWake - std::chrono::steady_clock::now());
+            curl_multi_poll(multi, nullptr, 0, static_cast<int>(std::max<long long>(timeout.count(), 1)), nullptr);
+        }
+    }
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    output.flush();
+
+    curl_multi_cleanup(multi);
+    for (struct curl_slist *headers : keyHeaders)
+    {
+        curl_slist_free_all(headers);
+    }
+    std::sort(report.latenciesMs.begin(), report.latenciesMs.end());
+    return report;
+}
+
+void printBatchReport(const BatchReport &report, std::ostream &os)
+{
+    os << "Batch: " << report.requests << " requests (" << report.failed << " failed) in " << report.seconds
+       << " s, " << report.requestsPerSecond() << " requests/s\n"
+       << "Latency: p50 " << report.percentile(50) << " ms, p95 " << report.percentile(95) << " ms, p99 "
+       << report.percentile(99) << " ms, max " << (report.latenciesMs.empty() ? 0 : report.latenciesMs.back())
+       << " ms" << std::endl;
+}
+
+int runBatchMain(const std::vector<std::string> &args)
+{
+    BatchOptions options;
+    options.cache = sharedResponseCache();
+    std::string inputPath;
+    std::string outputPath;
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        bool hasValue = i + 1 < args.size();
+        if (args[i] == "--batch" && hasValue)
+        {
+            inputPath = args[++i];
+        }
+        else if (args[i] == "--output" && hasValue)
+        {
+            outputPath = args[++i];
+        }
+        else if (args[i] == "--parallel" && hasValue)
+        {
+            options.maxInFlight = static_cast<size_t>(std::strtoul(args[++i].c_str(), nullptr, 10));
+        }
+        else if (args[i] == "--completion-order")
+        {
+            options.completionOrder = true;
+        }
+        else
+        {
+            std::cerr << "[ERROR] Unknown or incomplete batch argument: " << args[i] << "\n"
+                      << "Usage: chatgpt_cli --batch <input.jsonl|-> [--output <results.jsonl>] [--parallel <n>] "
+                         "[--completion-order]"
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::ifstream inputFile;
+    if (inputPath != "-")
+    {
+        inputFile.open(inputPath);
+        if (!inputFile)
+        {
+            std::cerr << "[ERROR] Unable to open batch input file: " << inputPath << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    std::ofstream outputFile;
+    if (!outputPath.empty())
+    {
+        outputFile.open(outputPath);
+        if (!outputFile)
+        {
+            std::cerr << "[ERROR] Unable to open batch output file: " << outputPath << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    BatchReport report = runBatch(inputPath == "-" ? std::cin : inputFile,
+                                  outputPath.empty() ? std::cout : outputFile, options);
+    printBatchReport(report, std::cerr);
+    if (options.cache != nullptr)
+    {
+        CacheStats stats = options.cache->sessionStats();
+        std::cerr << "Cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.bytesSaved
+                  << " bytes saved" << std::endl;
+    }
+    return report.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,74 @@
+//  batch.hpp
+//
+// Non-interactive batch mode: runs a JSONL file of prompts concurrently over curl_multi
+
+#ifndef batch_hpp
+#define batch_hpp
+
+#include "responsecache.hpp"
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// @brief Settings for a batch run.
+struct BatchOptions
+{
+    size_t maxInFlight = 8;         // Requests running at the same time
+    bool completionOrder = false;   // Write results as they finish instead of in input order
+    std::string url;                // Endpoint to send to; empty means chatCompletionsUrl()
+    ResponseCache *cache = nullptr; // Replies are looked up here first and stored on success
+};
+
+/// @brief Totals and latency distribution of a finished batch run.
+struct BatchReport
+{
+    size_t requests = 0;
+    size_t failed = 0;
+    double seconds = 0;                // Wall time of the whole run
+    std::vector<double> latenciesMs;   // Per successful or failed transfer, sorted ascending
+
+    /**
+     * @brief Returns the latency at percentile p (0-100) by nearest rank, or 0 without samples.
+     */
+    double percentile(double p) const;
+
+    /**
+     * @brief Returns completed requests per second of wall time.
+     */
+    double requestsPerSecond() const;
+};
+
+/**
+ * @brief Runs every request in a JSONL stream and writes one JSONL result per request.
+ *
+ * Each input line is either {"prompt": "..."} or {"messages": [{"role": ..., "content": ...}, ...]}
+ * ending in a user message, optionally with an "id" that is copied to the result. Payloads are
+ * built with buildChatRequestPayload() and replies parsed with getChatGPTResponseContent().
+ * Results look like {"index": n, "id": ..., "content": "...", "latency_ms": t}, with "error"
+ * in place of "content" when a request fails, and "cached": true when the reply came from
+ * options.cache. Input is read lazily, so the file can be larger than memory.
+ *
+ * @param input The JSONL requests.
+ * @param output Where the JSONL results are written.
+ * @param options The in-flight limit, output order, endpoint and cache.
+ * @return Throughput and latency figures for the run.
+ */
+BatchReport runBatch(std::istream &input, std::ostream &output, const BatchOptions &options);
+
+/**
+ * @brief Prints a one-paragraph summary of a batch run.
+ */
+void printBatchReport(const BatchReport &report, std::ostream &os);
+
+/**
+ * @brief Runs batch mode from command line arguments.
+ *
+ * Usage: --batch <input.jsonl|-> [--output <results.jsonl>] [--parallel <n>] [--completion-order]
+ *
+ * @param args The arguments after the program name.
+ * @return The process exit code; failure if the files cannot be opened or any request failed.
+ */
+int runBatchMain(const std::vector<std::string> &args);
+
+#endif /* batch_hpp */
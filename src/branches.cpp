@@ -0,0 +1,86 @@
+//  branches.cpp
+//
+// Named branches of the conversation, for %fork, %branches and %switch
+
+#include "branches.hpp"
+#include <stdexcept>
+
+void ConversationBranches::fork(const std::string &name, ChatHistory &active, size_t messages)
+{
+    if (name.empty())
+    {
+        throw std::invalid_argument("a branch needs a name");
+    }
+    if (name == m_active || m_saved.count(name) != 0)
+    {
+        throw std::invalid_argument("there is already a branch called " + name);
+    }
+    if (messages > active.size())
+    {
+        throw std::invalid_argument("the conversation has only " + std::to_string(active.size()) + " messages");
+    }
+
+    m_saved.insert_or_assign(m_active, active);
+    active.replaceWith(active.prefix(messages));
+    m_active = name;
+}
+
+void ConversationBranches::switchTo(const std::string &name, ChatHistory &active)
+{
+    if (name == m_active)
+    {
+        return;
+    }
+    auto it = m_saved.find(name);
+    if (it == m_saved.end())
+    {
+        throw std::invalid_argument("there is no branch called " + name);
+    }
+
+    ChatHistory target = std::move(it->second);
+    m_saved.erase(it);
+    m_saved.insert_or_assign(m_active, active);
+    active.replaceWith(target);
+    m_active = name;
+}
+
+std::vector<BranchInfo> ConversationBranches::list(const ChatHistory &active) const
+{
+    std::vector<BranchInfo> branches;
+    bool activeListed = false;
+    auto addActive = [&] {
+        branches.push_back(BranchInfo{m_active, active.size(), active.size(), true});
+        activeListed = true;
+    };
+    for (const auto &[name, history] : m_saved)
+    {
+        if (!activeListed && m_active < name)
+        {
+            addActive();
+        }
+        branches.push_back(BranchInfo{name, history.size(), ChatHistory::sharedPrefix(history, active), false});
+    }
+    if (!activeListed)
+    {
+        addActive();
+    }
+    return branches;
+}
+
+const std::string &ConversationBranches::activeName() const
+{
+    return m_active;
+}
+
+void ConversationBranches::clear()
+{
+    m_saved.clear();
+    m_active = kFirstBranch;
+}
+
+ConversationBranches &sharedBranches()
+{
+    // Never destroyed, like the other process-wide stores
+    static ConversationBranches *branches = new ConversationBranches();
+    return *branches;
+}
@@ -0,0 +1,77 @@
+//  branches.hpp
+//
+// Named branches of the conversation, for %fork, %branches and %switch
+
+#ifndef branches_hpp
+#define branches_hpp
+
+#include "chathistory.hpp"
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+/// @brief One branch, as listed by %branches.
+struct BranchInfo
+{
+    std::string name;
+    size_t messages = 0;
+    size_t shared = 0; // Leading messages in common with the active branch
+    bool active = false;
+};
+
+/// @class ConversationBranches
+/// @brief Keeps the branches of a conversation other than the one being shown.
+///
+/// The active branch is the ChatHistory the UI displays and sends; the others are stored here
+/// as copies of it. Copies share storage with the history they were taken from, so forking
+/// takes the same short time at any message of any length of conversation, and every branch
+/// holds only the messages it added since it diverged.
+class ConversationBranches
+{
+  public:
+    /// Name of the branch a conversation starts on
+    static constexpr const char *kFirstBranch = "main";
+
+    /**
+     * @brief Saves active as the current branch and continues on a new branch holding its first
+     * messages entries.
+     * @param name The new branch's name.
+     * @param active The displayed history; becomes the new branch.
+     * @param messages How many leading entries of active the new branch starts with.
+     * @throws std::invalid_argument if name is empty or taken, or messages is more than active holds.
+     */
+    void fork(const std::string &name, ChatHistory &active, size_t messages);
+
+    /**
+     * @brief Saves active as the current branch and replaces it with the branch called name.
+     * @throws std::invalid_argument if there is no such branch.
+     */
+    void switchTo(const std::string &name, ChatHistory &active);
+
+    /**
+     * @brief Returns every branch, the active one included, in order of name.
+     */
+    std::vector<BranchInfo> list(const ChatHistory &active) const;
+
+    /**
+     * @brief Returns the name of the active branch.
+     */
+    const std::string &activeName() const;
+
+    /**
+     * @brief Forgets every stored branch and names the active one kFirstBranch again.
+     */
+    void clear();
+
+  private:
+    std::string m_active = kFirstBranch;
+    std::map<std::string, ChatHistory> m_saved; // Every branch but the active one
+};
+
+/**
+ * @brief Returns the branches of the interactive conversation.
+ */
+ConversationBranches &sharedBranches();
+
+#endif /* branches_hpp */
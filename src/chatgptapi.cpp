@@ -4,7 +4,29 @@
 
 #include "chatgptapi.hpp"
 #include "chathistory.hpp"
+#include "payloadbuilder.hpp"
 #include "request.hpp"
+#include "responseparser.hpp"
+#include <nlohmann/json.hpp>
+
+namespace
+{
+/**
+ * @brief Returns true for a response worth replaying: a completion with choices, not an error.
+ */
+bool _isCacheable(const std::string &response)
+{
+    try
+    {
+        ChatResponse parsed = parseChatResponse(response);
+        return !parsed.hasError && parsed.hasChoices;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+} // namespace
 
 // Implementation with dependency injection
 void callChatGPTAPI(const std::string &input, ChatHistory &chatHistory, RequestFn requestFn) {
@@ -20,3 +42,81 @@ void callChatGPTAPI(const std::string &input, ChatHistory &chatHistory, RequestF
 void callChatGPTAPI(const std::string &input, ChatHistory &chatHistory) {
     callChatGPTAPI(input, chatHistory, makeRequest);
 }
+
+std::string streamChatGPTAPI(const std::string &input, ChatHistory &chatHistory, const DeltaFn &onDelta,
+                             StreamRequestFn requestFn)
+{
+    std::string reply;
+    std::string unstreamed = requestFn(input, chatHistory, [&](const std::string &delta) {
+        reply.append(delta);
+        onDelta(delta);
+    });
+
+    if (reply.empty())
+    {
+        reply = getChatGPTResponseContent(unstreamed);
+    }
+    chatHistory.addDialog("assistant", reply);
+    return reply;
+}
+
+std::string streamChatGPTAPI(const std::string &input, ChatHistory &chatHistory, const DeltaFn &onDelta)
+{
+    return streamChatGPTAPI(input, chatHistory, onDelta,
+                            [](const std::string &message, ChatHistory &history, const DeltaFn &delta) {
+                                return makeStreamingRequest(message, history, delta);
+                            });
+}
+
+RequestFn cachedRequest(ResponseCache &cache, SendFn sendFn)
+{
+    return [&cache, sendFn](const std::string &message, ChatHistory &chatHistory) {
+        std::string payload = buildChatRequestPayload(message, chatHistory, false);
+        std::string response;
+        if (cache.lookup(payload, response))
+        {
+            return response;
+        }
+
+        response = sendFn(payload);
+        if (_isCacheable(response))
+        {
+            cache.store(payload, response);
+        }
+        return response;
+    };
+}
+
+StreamRequestFn cachedStreamingRequest(ResponseCache &cache, StreamSendFn sendFn,
+                                       const std::atomic<bool> *cancelFlag)
+{
+    return [&cache, sendFn, cancelFlag](const std::string &message, ChatHistory &chatHistory,
+                                        const DeltaFn &onDelta) {
+        std::string payload = buildChatRequestPayload(message, chatHistory, false);
+        std::string response;
+        if (cache.lookup(payload, response))
+        {
+            std::string content = getChatGPTResponseContent(response);
+            if (!content.empty())
+            {
+                onDelta(content);
+                return std::string();
+            }
+            return response;
+        }
+
+        std::string reply;
+        std::string unstreamed = sendFn(PayloadBuilder::withStream(payload), [&](const std::string &delta) {
+            reply.append(delta);
+            onDelta(delta);
+        });
+        bool cancelled = cancelFlag != nullptr && cancelFlag->load();
+        if (!reply.empty() && unstreamed.empty() && !cancelled)
+        {
+            nlohmann::json completion = {
+                {"choices", {{{"index", 0}, {"message", {{"role", "assistant"}, {"content", reply}}}}}}};
+            cache.store(payload, completion.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+        }
+        return unstreamed;
+    };
+}
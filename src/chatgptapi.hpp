@@ -6,10 +6,16 @@
 #define chatgptapi_hpp
 
 #include "chathistory.hpp"
+#include "responsecache.hpp"
+#include "streamparser.hpp"
+#include <atomic>
 #include <string>
 #include <functional>
 
 using RequestFn = std::function<std::string(const std::string&, ChatHistory&)>;
+using StreamRequestFn = std::function<std::string(const std::string&, ChatHistory&, const DeltaFn&)>;
+using SendFn = std::function<std::string(const std::string&)>; // Sends a built request body
+using StreamSendFn = std::function<std::string(const std::string&, const DeltaFn&)>; // Sends a streaming body
 
 
 /**
@@ -27,4 +33,52 @@ void callChatGPTAPI(const std::string &input, ChatHistory &chatHistory, RequestF
 // Overload for backward compatibility
 void callChatGPTAPI(const std::string &input, ChatHistory &chatHistory);
 
+/**
+ * @brief Sends a user message to the ChatGPT API (or mock) and streams the response.
+ *
+ * Each content delta is forwarded to onDelta as it arrives. Once the stream has ended, the
+ * assembled reply is stored in the chat history. If nothing was streamed, the text returned
+ * by requestFn is parsed as a regular (error) response instead.
+ *
+ * @param input The user’s input message to send to the ChatGPT API.
+ * @param chatHistory The chat history object to provide context and store the new response.
+ * @param onDelta Callback invoked with each piece of the assistant's reply, in order.
+ * @param requestFn The streaming API request function to use (default: makeStreamingRequest).
+ * @return The assistant's complete reply, or an empty string on error.
+ */
+std::string streamChatGPTAPI(const std::string &input, ChatHistory &chatHistory, const DeltaFn &onDelta,
+                             StreamRequestFn requestFn);
+// Overload using the real streaming request
+std::string streamChatGPTAPI(const std::string &input, ChatHistory &chatHistory, const DeltaFn &onDelta);
+
+/**
+ * @brief Wraps a request function with a response cache.
+ *
+ * The key is the non-streaming request body, which PayloadBuilder already writes in canonical
+ * form (model and messages, sorted keys). The body is built once, adding the user message to the
+ * history; on a hit the stored response is returned, and on a miss the body is sent with sendFn
+ * and a successful response is stored.
+ *
+ * @param cache The cache to use; must outlive the returned function.
+ * @param sendFn Sends the body on a miss, e.g. sendChatRequest.
+ * @return A request function with the same contract as makeRequest.
+ */
+RequestFn cachedRequest(ResponseCache &cache, SendFn sendFn);
+
+/**
+ * @brief Wraps a streaming request function with a response cache.
+ *
+ * Keys are the same as for cachedRequest, so streamed and non-streamed calls share entries.
+ * A hit delivers the stored reply as a single delta. On a miss the key is turned into the
+ * streaming body with PayloadBuilder::withStream and sent with sendFn. A reply is stored only
+ * if the stream finished without an error body and was not cancelled.
+ *
+ * @param cache The cache to use; must outlive the returned function.
+ * @param sendFn Sends the streaming body on a miss, e.g. sendStreamingChatRequest.
+ * @param cancelFlag Optional flag telling whether the request was cancelled.
+ * @return A streaming request function with the same contract as makeStreamingRequest.
+ */
+StreamRequestFn cachedStreamingRequest(ResponseCache &cache, StreamSendFn sendFn,
+                                       const std::atomic<bool> *cancelFlag = nullptr);
+
 #endif /* chatgptapi_hpp */
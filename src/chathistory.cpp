@@ -3,47 +3,332 @@
 // Stores and manipulates a record of user and agent dialogs with/from ChatGPT
 
 #include "chathistory.hpp"
+#include "sessionjournal.hpp"
+#include "tokenizer.hpp"
 #include "formatting.hpp" // Keep if still used by other functions, or remove if not. For now, assuming it might be used by something not being deleted.
+#include <algorithm>
 #include <iostream> // Kept for std::cerr in addDialog and removeLastDialog
+#include <stdexcept>
 #include <string>
 // #include <termcolor/termcolor.hpp> // Removed
 
-void ChatHistory::addDialog(const std::string &participantName, const std::string &message)
+ChatHistory::Entry::Entry(SharedText entryText, uint32_t entryId, uint8_t entryRole)
+    : text(std::move(entryText)), tokenCount(kUncounted), id(entryId), role(entryRole)
+{
+}
+
+ChatHistory::Entry::Entry(const Entry &other)
+    : text(other.text), tokenCount(other.tokenCount.load(std::memory_order_relaxed)), id(other.id), role(other.role)
+{
+}
+
+ChatHistory::Entry &ChatHistory::Entry::operator=(const Entry &other)
+{
+    text = other.text;
+    tokenCount.store(other.tokenCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    id = other.id;
+    role = other.role;
+    return *this;
+}
+
+ChatHistory::ChatHistory()
+    : m_roleNames{"user", "assistant", "system", "error"}, m_nextId(std::make_shared<std::atomic<uint32_t>>(0))
+{
+}
+
+void ChatHistory::addDialog(std::string_view participantName, std::string_view message)
 {
     if (message.empty())
     {
         std::cerr << "Unable to add to ChatHistory. message is empty." << std::endl;
         return;
     }
-    m_chatHistory.push_back({participantName, message});
+    if (message.size() > kMaxMessageSize)
+    {
+        std::cerr << "Unable to add to ChatHistory. message is too large." << std::endl;
+        return;
+    }
+    std::optional<uint8_t> role = _internRole(participantName);
+    if (!role)
+    {
+        std::cerr << "Unable to add to ChatHistory. too many participant names." << std::endl;
+        return;
+    }
+
+    m_entries.push_back(Entry(m_text.append(message), m_nextId->fetch_add(1, std::memory_order_relaxed), *role));
+
+    if (m_journal.journal != nullptr)
+    {
+        m_journal.journal->recordAdd(participantName, message);
+    }
+}
+
+void ChatHistory::appendToLastDialog(std::string_view text)
+{
+    if (m_entries.empty())
+    {
+        std::cerr << "ChatHistory is empty. Cannot append to last dialog." << std::endl;
+        return;
+    }
+
+    // The last entry lives in the vector's own tail, so copies keep the message as it was
+    Entry &last = m_entries.back();
+    if (text.size() > kMaxMessageSize - last.text.size())
+    {
+        std::cerr << "Unable to append to last dialog. message is too large." << std::endl;
+        return;
+    }
+    m_text.extend(last.text, text);
+    last.tokenCount.store(kUncounted, std::memory_order_relaxed);
+
+    // Streamed replies grow one delta at a time; serialize the final text once, when needed
+    if (m_payload.size() == m_entries.size())
+    {
+        m_payload.removeLast();
+    }
+
+    if (m_journal.journal != nullptr)
+    {
+        m_journal.journal->recordAppend(text);
+    }
+}
+
+bool ChatHistory::appendToDialog(uint32_t id, std::string_view text)
+{
+    if (m_entries.empty() || m_entries.back().id != id)
+    {
+        return false;
+    }
+    appendToLastDialog(text);
+    return true;
 }
 
 void ChatHistory::removeLastDialog()
 {
-    if (m_chatHistory.empty())
+    if (m_entries.empty())
     {
         std::cerr << "ChatHistory is empty. Cannot remove last dialog." << std::endl;
         return;
     }
-    m_chatHistory.pop_back();
+
+    // Give the text's space back unless a copy can still see it
+    m_text.release(m_entries.back().text);
+    if (m_payload.size() == m_entries.size())
+    {
+        m_payload.removeLast();
+    }
+    m_entries.pop_back();
+
+    if (m_journal.journal != nullptr)
+    {
+        m_journal.journal->recordRemoveLast();
+    }
 }
 
 void ChatHistory::clearHistory()
 {
-    m_chatHistory.clear();
+    m_entries.clear();
+    m_payload.clear();
+
+    if (m_journal.journal != nullptr)
+    {
+        m_journal.journal->recordClear();
+    }
+}
+
+ChatHistory ChatHistory::prefix(size_t count) const
+{
+    ChatHistory copy = *this;
+    copy.m_entries.truncate(count);
+    copy.m_payload.truncate(count);
+    return copy;
+}
+
+void ChatHistory::replaceWith(const ChatHistory &other)
+{
+    if (m_journal.journal != nullptr)
+    {
+        size_t shared = sharedPrefix(*this, other);
+        for (size_t i = m_entries.size(); i > shared; --i)
+        {
+            m_journal.journal->recordRemoveLast();
+        }
+        for (size_t i = shared; i < other.size(); ++i)
+        {
+            Dialog dialog = other[i];
+            m_journal.journal->recordAdd(dialog.participant, dialog.message);
+        }
+    }
+
+    // Assignment keeps this history's journal attached
+    *this = other;
+}
+
+size_t ChatHistory::sharedPrefix(const ChatHistory &a, const ChatHistory &b)
+{
+    // Ids are never reused between copies, so entries that match at some index match at every
+    // index before it too: the shared entries are a prefix that can be found by bisection
+    auto same = [&](size_t index) {
+        const Entry &left = a.m_entries[index];
+        const Entry &right = b.m_entries[index];
+        return left.id == right.id && left.text.size() == right.text.size();
+    };
+    size_t low = 0;
+    size_t high = std::min(a.size(), b.size());
+    while (low < high)
+    {
+        size_t middle = low + (high - low + 1) / 2;
+        if (same(middle - 1))
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    return low;
 }
 
 std::string ChatHistory::toString() const
 {
+    size_t totalSize = 0;
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        totalSize += m_roleNames[m_entries[i].role].size() + m_entries[i].text.size() + 3;
+    }
+
     std::string output;
-    for (const auto &[role, response] : m_chatHistory)
+    output.reserve(totalSize);
+    for (const auto &dialog : *this)
     {
-        output.append(role + ": " + response + "\n"); 
+        output.append(dialog.participant);
+        output.append(": ");
+        output.append(dialog.message);
+        output += '\n';
     }
 
     return output;
 }
 
+std::string ChatHistory::buildRequestPayload(const std::string &model, bool stream, size_t tokenBudget)
+{
+    _syncPayload();
+
+    // Keep the newest messages that fit in the budget, always including the latest one
+    size_t firstMessage = tokenBudget == 0 ? 0 : m_entries.size();
+    size_t usedTokens = 0;
+    while (firstMessage > 0)
+    {
+        size_t messageTokens = _tokenCount(m_entries[firstMessage - 1]) + kTokensPerMessage;
+        if (firstMessage < m_entries.size() && usedTokens + messageTokens > tokenBudget)
+        {
+            break;
+        }
+        usedTokens += messageTokens;
+        --firstMessage;
+    }
+
+    return m_payload.build(model, stream, firstMessage);
+}
+
+size_t ChatHistory::size() const
+{
+    return m_entries.size();
+}
+
+Dialog ChatHistory::operator[](size_t index) const
+{
+    return _dialog(m_entries[index]);
+}
+
+size_t ChatHistory::tokenCount(size_t index)
+{
+    if (index >= m_entries.size())
+    {
+        throw std::out_of_range("ChatHistory::tokenCount: index out of range");
+    }
+
+    return _tokenCount(m_entries[index]);
+}
+
+size_t ChatHistory::totalTokens()
+{
+    size_t total = 0;
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        total += tokenCount(i) + kTokensPerMessage;
+    }
+    return total;
+}
+
+void ChatHistory::setJournal(SessionJournal *journal)
+{
+    m_journal.journal = journal;
+}
+
+SessionJournal *ChatHistory::journal() const
+{
+    return m_journal.journal;
+}
+
+std::optional<uint8_t> ChatHistory::_internRole(std::string_view participantName)
+{
+    for (size_t id = 0; id < m_roleNames.size(); ++id)
+    {
+        if (m_roleNames[id] == participantName)
+        {
+            return static_cast<uint8_t>(id);
+        }
+    }
+    if (m_roleNames.size() == kMaxRoleNames)
+    {
+        return std::nullopt;
+    }
+    m_roleNames.emplace_back(participantName);
+    return static_cast<uint8_t>(m_roleNames.size() - 1);
+}
+
+std::string_view ChatHistory::_text(const Entry &entry) const
+{
+    return entry.text.view();
+}
+
+size_t ChatHistory::_tokenCount(const Entry &entry) const
+{
+    // Entries may be shared with copies on other threads; counting twice is harmless
+    uint32_t count = entry.tokenCount.load(std::memory_order_relaxed);
+    if (count == kUncounted)
+    {
+        count = static_cast<uint32_t>(countTokens(_text(entry)));
+        entry.tokenCount.store(count, std::memory_order_relaxed);
+    }
+    return count;
+}
+
+Dialog ChatHistory::_dialog(const Entry &entry) const
+{
+    return Dialog{static_cast<Role>(entry.role), m_roleNames[entry.role], _text(entry), entry.id};
+}
+
+void ChatHistory::_syncPayload()
+{
+    if (m_entries.size() - m_payload.size() > 1)
+    {
+        size_t contentBytes = 0;
+        for (size_t i = m_payload.size(); i < m_entries.size(); ++i)
+        {
+            contentBytes += m_entries[i].text.size();
+        }
+        m_payload.reserve(m_entries.size() - m_payload.size(), contentBytes);
+    }
+    for (size_t i = m_payload.size(); i < m_entries.size(); ++i)
+    {
+        const Entry &entry = m_entries[i];
+        m_payload.append(m_roleNames[entry.role], _text(entry));
+    }
+}
+
 // printFormatted function removed
 // ChatHistory::printHistory method removed
 // ChatHistory::printLastDialog method removed
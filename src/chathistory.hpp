@@ -5,20 +5,84 @@
 #ifndef chathistory_hpp
 #define chathistory_hpp
 
+#include "payloadbuilder.hpp"
+#include "persistentvector.hpp"
+#include "textarena.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <vector>
 
+class SessionJournal;
+
+/// @brief Interned participant role. The named roles are pre-registered; any other
+/// participant name is interned on first use and gets the next id.
+enum class Role : uint8_t
+{
+    User = 0,
+    Assistant = 1,
+    System = 2,
+    Error = 3,
+};
+
+/// @brief A read-only view of one dialog entry. The views stay valid until the history is modified.
+struct Dialog
+{
+    Role role;
+    std::string_view participant;
+    std::string_view message;
+    uint32_t id; // Unique per added entry, across copies too; with message.size() it identifies the entry's content
+};
+
 /// @class ChatHistory
 /// @brief Stores and manipulates a record of user and agent dialogs with/from ChatGPT
+///
+/// Message text lives back to back in large chunks rather than in one heap string per message,
+/// and roles are stored as one-byte ids, so an entry costs a few words of bookkeeping plus its
+/// text. Iteration yields Dialog views without copying any strings.
+///
+/// Copies share storage: entries are kept in a PersistentVector and text in a TextArena, so
+/// copying a history, or taking the first messages of one with prefix(), takes the same short
+/// time however long it is, and the copies hold only what they add after diverging. This is what
+/// makes branches of a conversation cheap (see ConversationBranches).
+///
+/// A history can have a SessionJournal attached, which records every modification so the
+/// session can be rebuilt after a restart. Copies of a history are never attached.
 class ChatHistory
 {
   public:
+    ChatHistory();
+
     /**
      * @brief Adds a dialog entry to the chat history.
+     * Empty messages, messages longer than kMaxMessageSize and new participant names past
+     * kMaxRoleNames are rejected.
      * @param participantName The name of the participant ("user" or "assistant").
      * @param message The message content to add.
      */
-    void addDialog(const std::string& participantName, const std::string& message);
+    void addDialog(std::string_view participantName, std::string_view message);
+
+    /**
+     * @brief Appends text to the message of the most recent dialog entry.
+     * Used to grow a streamed reply in place as its deltas arrive.
+     * If the history is empty, no action is taken.
+     * @param text The text to append.
+     */
+    void appendToLastDialog(std::string_view text);
+
+    /**
+     * @brief Appends text to the dialog entry with the given id, if it is still the most recent one.
+     * Streamed replies use this, so a delta never lands in an entry added while the reply streams.
+     * @param id The Dialog::id of the entry.
+     * @param text The text to append.
+     * @return False, with nothing appended, if another entry was added after it or it was removed.
+     */
+    bool appendToDialog(uint32_t id, std::string_view text);
 
     /**
      * @brief Removes the last dialog entry from the chat history.
@@ -35,54 +99,204 @@ class ChatHistory
 
     // printHistory() declaration removed
 
+    /**
+     * @brief Returns a history holding the first count entries of this one, sharing their
+     * storage. The result is not attached to a journal.
+     * @param count The number of entries to keep; all of them if it is not less than size().
+     */
+    ChatHistory prefix(size_t count) const;
+
+    /**
+     * @brief Replaces the contents of this history with those of other, which is typically a
+     * branch of it. The attached journal, if any, records only the entries after the two
+     * histories' shared prefix: removing this history's and adding other's.
+     */
+    void replaceWith(const ChatHistory &other);
+
+    /**
+     * @brief Returns how many leading entries two histories have in common, because one was
+     * copied from the other (or both from a third) and neither changed them since.
+     */
+    static size_t sharedPrefix(const ChatHistory &a, const ChatHistory &b);
+
     /**
      * @brief Converts the chat history to a formatted string.
      * @return A string representation of all chat entries.
      */
     std::string toString() const;
 
+    /**
+     * @brief Builds the chat completion request body for the whole history.
+     * Each message is serialized once, by the first build after it was added, so this is
+     * mostly a concatenation.
+     * @param model The model name to request.
+     * @param stream Whether to request a streamed (SSE) response, with its token usage at the end.
+     * @param tokenBudget Maximum prompt tokens to send; the oldest messages that do not fit are
+     *        left out of the request (the newest message is always sent). 0 means no limit.
+     * @return The serialized JSON request body.
+     */
+    std::string buildRequestPayload(const std::string& model, bool stream, size_t tokenBudget = 0);
+
+    /**
+     * @brief Returns the number of dialog entries.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Returns a view of the entry at index.
+     * @param index The index of the entry; must be less than size().
+     */
+    Dialog operator[](size_t index) const;
+
+    /**
+     * @brief Returns the token count of one entry's message, counting it on first use.
+     * @param index The index of the entry.
+     * @return The number of tokens in the message.
+     */
+    size_t tokenCount(size_t index);
+
+    /**
+     * @brief Returns the total token count of the history, including per-message overhead.
+     */
+    size_t totalTokens();
+
+    /**
+     * @brief Attaches a journal that records every later modification; nullptr detaches.
+     * The journal is not told about entries already in the history.
+     */
+    void setJournal(SessionJournal *journal);
+
+    /**
+     * @brief Returns the attached journal, or nullptr.
+     */
+    SessionJournal *journal() const;
+
+    /// Tokens the API adds around every message for its role and delimiters
+    static constexpr size_t kTokensPerMessage = 4;
+
+    /// Size of the text chunks messages are packed into; longer messages get a chunk of their own
+    static constexpr size_t kChunkSize = TextArena::kChunkSize;
+
+    /// Longest message a single entry can hold
+    static constexpr size_t kMaxMessageSize = UINT32_MAX;
+
+    /// Most distinct participant names a history interns, the named roles included
+    static constexpr size_t kMaxRoleNames = 64;
+
+  private:
+    struct Entry;
+
+  public:
     /// @class iterator.
     /// @brief A helper class to allow ChatHistory to be used in for each loops.
+    /// Dereferencing yields a Dialog of views into the history; nothing is copied.
     class iterator
     {
       private:
-        using PairIterator =
-            typename std::vector<std::pair<std::string, std::string>>::iterator; // iterator for m_chatHistory
-        PairIterator it;
+        const ChatHistory *history;
+        size_t index;
+        mutable const Entry *run = nullptr; // Entries stored contiguously from index on
+        mutable size_t runLeft = 0;
 
       public:
-        iterator(PairIterator iterator) : it(iterator)
+        iterator(const ChatHistory *chatHistory, size_t position) : history(chatHistory), index(position)
         {
         }
 
         bool operator!=(const iterator &other) const
         {
-            return it != other.it;
+            return index != other.index;
         }
 
         void operator++()
         {
-            ++it;
+            ++index;
+            if (runLeft > 0)
+            {
+                ++run;
+                --runLeft;
+            }
         }
 
-        auto operator*() const
+        Dialog operator*() const
         {
-            return *it;
+            if (runLeft == 0)
+            {
+                std::tie(run, runLeft) = history->m_entries.run(index);
+            }
+            return history->_dialog(*run);
         }
     };
 
-    iterator begin()
+    iterator begin() const
     {
-        return iterator(m_chatHistory.begin());
+        return iterator(this, 0);
     }
 
-    iterator end()
+    iterator end() const
     {
-        return iterator(m_chatHistory.end());
+        return iterator(this, m_entries.size());
     }
 
   private:
-    std::vector<std::pair<std::string, std::string>> m_chatHistory;
+    /// @brief Bookkeeping for one message: where its text is and what it costs.
+    struct Entry
+    {
+        SharedText text;
+        mutable std::atomic<uint32_t> tokenCount; // Cached token count; kUncounted until needed
+        uint32_t id;                              // Serial number assigned when the entry was added
+        uint8_t role;                             // Index into m_roleNames
+
+        Entry(SharedText entryText, uint32_t entryId, uint8_t entryRole);
+        Entry(const Entry &other);
+        Entry &operator=(const Entry &other);
+    };
+
+    /// @brief The attached journal. A copied history starts detached and an assigned one keeps
+    /// its own journal, so only the history the journal was attached to records into it.
+    struct JournalLink
+    {
+        SessionJournal *journal = nullptr;
+
+        JournalLink() = default;
+        JournalLink(const JournalLink &) {}
+        JournalLink &operator=(const JournalLink &) { return *this; }
+    };
+
+    PersistentVector<Entry> m_entries;    // Shared with copies; the token counts are cached in place
+    TextArena m_text;                     // Message text
+    std::vector<std::string> m_roleNames; // Interned participant names, indexed by role id
+    PayloadBuilder m_payload;             // Serialized messages; a prefix of m_entries
+    std::shared_ptr<std::atomic<uint32_t>> m_nextId; // Shared with copies, so ids stay unique between them
+    JournalLink m_journal;
+
+    static constexpr uint32_t kUncounted = UINT32_MAX;
+
+    /**
+     * @brief Returns the role id for a participant name, interning new names.
+     * @return The id, or nothing for a new name once kMaxRoleNames are interned.
+     */
+    std::optional<uint8_t> _internRole(std::string_view participantName);
+
+    /**
+     * @brief Returns a view of an entry's text.
+     */
+    std::string_view _text(const Entry &entry) const;
+
+    /**
+     * @brief Returns the token count of an entry's message, counting it on first use.
+     */
+    size_t _tokenCount(const Entry &entry) const;
+
+    /**
+     * @brief Returns the Dialog view of an entry.
+     */
+    Dialog _dialog(const Entry &entry) const;
+
+    /**
+     * @brief Serializes the messages added (or grown) since the payload was last brought up to date.
+     */
+    void _syncPayload();
 };
 
 // printFormatted() declaration removed
@@ -4,100 +4,758 @@
 // Handlers for parsing and executing user commands for special functionality
 
 #include "command.hpp"
+#include "branches.hpp"
+#include "chatgptapi.hpp"
 #include "chathistory.hpp"
 #include "commandcontext.hpp"
+#include "compare.hpp"
+#include "connectionpool.hpp"
+#include "corpusindex.hpp"
+#include "daemon.hpp"
 #include "filereadwrite.hpp"
+#include "historyindex.hpp"
+#include "metrics.hpp"
+#include "request.hpp"
+#include "responsecache.hpp"
+#include "sessionjournal.hpp"
+#include "usageledger.hpp"
 #include "formatting.hpp" // For std::setw, std::left if used in help construction
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdlib>
+#include <filesystem>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream> // For std::ostringstream
 #include <stdexcept>
 #include <string>
+#include <thread>
 // #include <termcolor/termcolor.hpp> // No longer needed
 #include <vector>
 #include <iomanip> // For std::setw, std::left
 
-void handleCommand(const CommandContext &commandContext, ChatHistory &chatHistory)
+namespace
 {
-    std::string command = commandContext.getCommand();
-    if (command == "%save")
-    {
-        std::string outputfileName;
+/// Largest message %readfile adds; longer files are split into parts of at most this size
+constexpr size_t kReadfileChunkBytes = 128 * 1024;
+
+/// Skipped files named in the %readfile status; the rest are only counted
+constexpr size_t kReadfileSkippedListed = 10;
+
+/// Most models %compare asks at once; each one is a request thread
+constexpr size_t kCompareMaxModels = 8;
+
+/// Messages %readfile hands to the history at once, by size; a batch also goes once kProgressInterval passes
+constexpr size_t kReadfileBatchBytes = 1024 * 1024;
+
+/// Least time between two progress reports of the same file job
+constexpr std::chrono::milliseconds kProgressInterval(100);
+
+/// Longest %quit waits for queued saves; an unfinished save leaves the file it replaces intact
+constexpr std::chrono::seconds kQuitIoWait(10);
+
+CommandRunner &_commandRunner()
+{
+    // Until the UI installs its own, background work runs inline and results apply at once
+    static CommandRunner runner{[](BackgroundJob job) {
+                                    std::atomic<bool> notCancelled{false};
+                                    job(notCancelled);
+                                },
+                                [](std::function<void()> task) { task(); }};
+    return runner;
+}
+
+/// File jobs submitted and not yet finished
+std::atomic<size_t> g_pendingIo{0};
+
+/// %readfile commands whose last batch has not reached the history yet
+std::atomic<size_t> g_readfiles{0};
+
+/**
+ * @brief Runs job on the runner's I/O thread, or inline when it has none.
+ */
+void _runIo(BackgroundJob job)
+{
+    CommandRunner &runner = _commandRunner();
+    ++g_pendingIo;
+    BackgroundJob counted = [job = std::move(job)](const std::atomic<bool> &cancelled) {
         try
         {
-            outputfileName = commandContext.getArgument(0);
+            job(cancelled);
         }
-        catch (const std::out_of_range &e)
+        catch (...)
         {
-            outputfileName = "outfile.txt"; // Default filename
-            chatHistory.addDialog("system", "No filename provided for %save. Using default: " + outputfileName);
+            --g_pendingIo;
+            throw;
         }
-        saveCommand(outputfileName, chatHistory);
+        --g_pendingIo;
+    };
+    if (runner.runIo)
+    {
+        runner.runIo(std::move(counted));
+        return;
     }
-    else if (command == "%readfile")
+    std::atomic<bool> notCancelled{false};
+    counted(notCancelled);
+}
+
+/**
+ * @brief Shows (or with an empty line, clears) the runner's progress line, if it has one.
+ */
+void _showProgress(std::string line)
+{
+    CommandRunner &runner = _commandRunner();
+    if (runner.showProgress)
     {
-        std::string inputFilename;
-        try
+        runner.showProgress(std::move(line));
+    }
+}
+
+/// @brief Tells whether a job's next progress report is due, so a fast job does not flood the UI.
+struct _ProgressClock
+{
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+    bool due()
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now - last < kProgressInterval)
         {
-            inputFilename = commandContext.getArgument(0);
+            return false;
         }
-        catch (const std::out_of_range &e)
+        last = now;
+        return true;
+    }
+};
+
+/**
+ * @brief Writes snapshot to path as "participant: message" lines, replacing the file once
+ * complete, and reports the percentage written to progress as it goes.
+ * @return The bytes written.
+ * @throws std::runtime_error if the file cannot be written.
+ */
+uint64_t _writeHistory(const std::filesystem::path &path, const ChatHistory &snapshot,
+                       const std::function<void(int percent)> &progress)
+{
+    uint64_t total = 0;
+    for (const Dialog &dialog : snapshot)
+    {
+        total += dialog.participant.size() + dialog.message.size() + 3;
+    }
+    return writeFileAtomically(path, [&](const WritePieceFn &write) {
+        _ProgressClock clock;
+        uint64_t written = 0;
+        for (const Dialog &dialog : snapshot)
         {
-            chatHistory.addDialog("error", "No filename provided for %readfile command.");
+            write(dialog.participant);
+            write(": ");
+            write(dialog.message);
+            write("\n");
+            written += dialog.participant.size() + dialog.message.size() + 3;
+            if (clock.due())
+            {
+                progress(static_cast<int>(written * 100 / std::max<uint64_t>(total, 1)));
+            }
+        }
+    });
+}
+} // namespace
+
+void setCommandRunner(CommandRunner runner)
+{
+    _commandRunner() = std::move(runner);
+}
+
+namespace
+{
+void _save(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    std::string outputfileName(commandContext.getArgument(0));
+    if (commandContext.getArgumentsSize() == 0)
+    {
+        outputfileName = "outfile.txt"; // Default filename
+        chatHistory.addDialog("system", "No filename provided for %save. Using default: " + outputfileName);
+    }
+    saveCommand(outputfileName, chatHistory);
+}
+
+void _readfile(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    std::vector<std::string> patterns;
+    for (size_t i = 0; i < commandContext.getArgumentsSize(); ++i)
+    {
+        patterns.emplace_back(commandContext.getArgument(i));
+    }
+    readfileCommand(patterns, chatHistory);
+}
+
+void _load(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    loadCommand(std::string(commandContext.getArgument(0)), chatHistory);
+}
+
+void _clear(const CommandContext &, ChatHistory &chatHistory)
+{
+    clearCommand(chatHistory);
+}
+
+void _deletelast(const CommandContext &, ChatHistory &chatHistory)
+{
+    deletelastCommand(chatHistory);
+}
+
+void _printhistory(const CommandContext &, ChatHistory &chatHistory)
+{
+    printhistoryCommand(chatHistory);
+}
+
+void _tokens(const CommandContext &, ChatHistory &chatHistory)
+{
+    tokensCommand(chatHistory);
+}
+
+void _connections(const CommandContext &, ChatHistory &chatHistory)
+{
+    connectionsCommand(chatHistory);
+}
+
+void _cache(const CommandContext &, ChatHistory &chatHistory)
+{
+    cacheCommand(chatHistory);
+}
+
+void _compare(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    // %compare <model> <model> ... [-- prompt]
+    std::vector<std::string> models;
+    std::string prompt;
+    bool inPrompt = false;
+    for (size_t i = 0; i < commandContext.getArgumentsSize(); ++i)
+    {
+        std::string_view argument = commandContext.getArgument(i);
+        if (!inPrompt && argument == "--")
+        {
+            inPrompt = true;
+        }
+        else if (inPrompt)
+        {
+            prompt += (prompt.empty() ? "" : " ");
+            prompt += argument;
+        }
+        else
+        {
+            models.emplace_back(argument);
+        }
+    }
+    if (models.empty())
+    {
+        chatHistory.addDialog("error", "Usage: %compare <model> <model> ... [-- prompt]");
+        return;
+    }
+    compareCommand(models, prompt, chatHistory);
+}
+
+// Drops the line the UI added for this command, so it does not become part of a branch
+void _removeCommandLine(std::string_view command, ChatHistory &chatHistory)
+{
+    if (chatHistory.size() > 0)
+    {
+        Dialog last = chatHistory[chatHistory.size() - 1];
+        if (last.role == Role::User && last.message.substr(0, command.size()) == command)
+        {
+            chatHistory.removeLastDialog();
+        }
+    }
+}
+
+void _fork(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    // %fork <name> [messages]
+    size_t messages = 0;
+    if (commandContext.getArgumentsSize() > 1)
+    {
+        std::string_view count = commandContext.getArgument(1);
+        if (count.empty() || count.find_first_not_of("0123456789") != std::string_view::npos || count.size() > 9)
+        {
+            chatHistory.addDialog("error", "Usage: %fork <name> [messages]");
             return;
         }
-        readfileCommand(inputFilename, chatHistory);
+        messages = std::stoul(std::string(count));
+    }
+    _removeCommandLine("%fork", chatHistory);
+    if (commandContext.getArgumentsSize() == 1)
+    {
+        messages = chatHistory.size();
+    }
+    forkCommand(std::string(commandContext.getArgument(0)), messages, chatHistory);
+}
+
+void _branches(const CommandContext &, ChatHistory &chatHistory)
+{
+    branchesCommand(chatHistory);
+}
+
+void _switch(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    _removeCommandLine("%switch", chatHistory);
+    switchCommand(std::string(commandContext.getArgument(0)), chatHistory);
+}
+
+void _search(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    _removeCommandLine("%search", chatHistory);
+    std::vector<std::string> terms;
+    for (size_t i = 0; i < commandContext.getArgumentsSize(); ++i)
+    {
+        terms.emplace_back(commandContext.getArgument(i));
+    }
+    searchCommand(terms, chatHistory);
+}
+
+void _index(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    indexCommand(std::string(commandContext.getArgument(0)), chatHistory);
+}
+
+void _ask(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    _removeCommandLine("%ask", chatHistory);
+    std::string question;
+    for (size_t i = 0; i < commandContext.getArgumentsSize(); ++i)
+    {
+        question += (question.empty() ? "" : " ");
+        question += commandContext.getArgument(i);
     }
-    else if (command == "%clear")
+    askCommand(question, chatHistory);
+}
+
+void _stats(const CommandContext &, ChatHistory &chatHistory)
+{
+    statsCommand(chatHistory);
+}
+
+void _usage(const CommandContext &, ChatHistory &chatHistory)
+{
+    usageCommand(chatHistory);
+}
+
+void _quit(const CommandContext &, ChatHistory &)
+{
+    quitCommand();
+}
+
+void _help(const CommandContext &, ChatHistory &chatHistory)
+{
+    helpCommand(chatHistory);
+}
+
+/// Every command, in the order %help lists them
+constexpr CommandSpec kCommands[] = {
+    {"%save", "%save [filename]", 0, 1, _save, "Saves your chat as a file."},
+    {"%readfile", "%readfile <paths>", 1, kAnyArguments, _readfile,
+     "Reads files, directories or globs into history as user messages."},
+    {"%load", "%load <journal>", 1, 1, _load, "Replaces the chat with a saved session journal."},
+    {"%clear", "%clear", 0, 0, _clear, "Clears the chat history."},
+    {"%deletelast", "%deletelast", 0, 0, _deletelast, "Deletes the last record in chat history."},
+    {"%printhistory", "%printhistory", 0, 0, _printhistory, "Shows this message (history is above)."},
+    {"%tokens", "%tokens", 0, 0, _tokens, "Shows the token count of the chat history."},
+    {"%connections", "%connections", 0, 0, _connections, "Shows how many connections were opened vs. reused."},
+    {"%cache", "%cache", 0, 0, _cache, "Shows response cache hits, misses and bytes saved."},
+    {"%compare", "%compare <models>", 1, kAnyArguments, _compare,
+     "Asks several models at once (add -- prompt, or re-asks the last one)."},
+    {"%fork", "%fork <name> [n]", 1, 2, _fork, "Continues on a new branch from here, or from message n."},
+    {"%branches", "%branches", 0, 0, _branches, "Lists the branches of the conversation."},
+    {"%switch", "%switch <name>", 1, 1, _switch, "Switches to another branch."},
+    {"%search", "%search [terms]", 0, kAnyArguments, _search,
+     "Finds messages by words, phrases or text; again alone for the next match."},
+    {"%index", "%index <dir>", 1, 1, _index, "Indexes the files under a directory for %ask."},
+    {"%ask", "%ask <question>", 1, kAnyArguments, _ask,
+     "Asks with the best-matching excerpts of the indexed files attached."},
+    {"%stats", "%stats", 0, 0, _stats, "Shows request timing percentiles by phase."},
+    {"%usage", "%usage", 0, 0, _usage, "Shows tokens used this session, today and in the last 30 days."},
+    {"%quit", "%quit", 0, 0, _quit, "Exits the program."},
+    {"%help", "%help", 0, 0, _help, "Prints this help menu."},
+};
+
+constexpr size_t kCommandCount = sizeof(kCommands) / sizeof(kCommands[0]);
+
+/// The perfect hash table has 64 slots, so the seed search below finds a collision-free seed
+/// within a few tries for up to a few dozen commands
+constexpr int kCommandSlotBits = 6;
+constexpr size_t kCommandSlots = size_t(1) << kCommandSlotBits;
+static_assert(kCommandCount < kCommandSlots, "Too many commands for the command hash table");
+
+/// FNV-1a of name, perturbed by seed, folded to a slot
+constexpr size_t _commandSlot(std::string_view name, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    for (char c : name)
     {
-        clearCommand(chatHistory);
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
     }
-    else if (command == "%deletelast")
+    return (hash ^ (hash >> 16)) & (kCommandSlots - 1);
+}
+
+/// The first seed that sends every command to its own slot, or UINT32_MAX
+constexpr uint32_t _findCommandSeed()
+{
+    for (uint32_t seed = 0; seed < 4096; ++seed)
     {
-        deletelastCommand(chatHistory);
+        uint64_t used = 0;
+        bool collides = false;
+        for (const CommandSpec &spec : kCommands)
+        {
+            uint64_t slot = uint64_t(1) << _commandSlot(spec.name, seed);
+            collides = collides || (used & slot) != 0;
+            used |= slot;
+        }
+        if (!collides)
+        {
+            return seed;
+        }
     }
-    else if (command == "%printhistory")
+    return UINT32_MAX;
+}
+
+constexpr uint32_t kCommandSeed = _findCommandSeed();
+static_assert(kCommandSeed != UINT32_MAX, "No collision-free seed for the command table; raise kCommandSlotBits");
+
+/// Slot to kCommands index plus one; 0 marks an empty slot
+constexpr std::array<uint8_t, kCommandSlots> _buildCommandSlots()
+{
+    std::array<uint8_t, kCommandSlots> slots{};
+    for (size_t i = 0; i < kCommandCount; ++i)
     {
-        printhistoryCommand(chatHistory);
+        slots[_commandSlot(kCommands[i].name, kCommandSeed)] = static_cast<uint8_t>(i + 1);
     }
-    else if (command == "%help")
+    return slots;
+}
+
+constexpr std::array<uint8_t, kCommandSlots> kCommandSlotTable = _buildCommandSlots();
+} // namespace
+
+const CommandSpec *findCommand(std::string_view name)
+{
+    uint8_t entry = kCommandSlotTable[_commandSlot(name, kCommandSeed)];
+    if (entry == 0 || kCommands[entry - 1].name != name)
     {
-        helpCommand(chatHistory); // Pass chatHistory to helpCommand
+        return nullptr;
     }
-    else if (command == "%quit")
+    return &kCommands[entry - 1];
+}
+
+void handleCommand(const CommandContext &commandContext, ChatHistory &chatHistory)
+{
+    std::string_view command = commandContext.getCommand();
+    const CommandSpec *spec = findCommand(command);
+    if (spec == nullptr)
     {
-        quitCommand();
+        chatHistory.addDialog("error",
+                              "Unknown command: " + std::string(command) + ". Type %help for a list of commands.");
+        return;
     }
-    else
+    size_t arguments = commandContext.getArgumentsSize();
+    if (arguments < spec->minArguments || arguments > spec->maxArguments)
     {
-        chatHistory.addDialog("error", "Unknown command: " + command + ". Type %help for a list of commands.");
+        chatHistory.addDialog("error", "Usage: " + std::string(spec->usage));
+        return;
     }
+    spec->handler(commandContext, chatHistory);
 }
 
 void saveCommand(const std::string &outputFilename, ChatHistory &chatHistory)
 {
+    // The copy shares the history's storage, so the snapshot is free and later turns do not touch it
+    CommandRunner &runner = _commandRunner();
+    _runIo([&chatHistory, &runner, outputFilename, snapshot = ChatHistory(chatHistory)](const std::atomic<bool> &) {
+        std::string outcome;
+        try
+        {
+            _writeHistory(outputFilename, snapshot, [&](int percent) {
+                _showProgress("Saving chat to " + outputFilename + "... " + std::to_string(percent) + "%");
+            });
+        }
+        catch (const std::exception &e)
+        {
+            outcome = e.what();
+        }
+        _showProgress("");
+        runner.post([&chatHistory, outputFilename, outcome] {
+            if (outcome.empty())
+            {
+                chatHistory.addDialog("system", "Chat history saved to " + outputFilename);
+            }
+            else
+            {
+                chatHistory.addDialog("error", "Error saving chat history to " + outputFilename + ": " + outcome);
+            }
+        });
+    });
+}
+
+bool readfileInProgress()
+{
+    return g_readfiles.load() != 0;
+}
+
+namespace
+{
+/// @brief Messages read by %readfile on the I/O thread and not yet handed to the history,
+/// back to back in one string so a batch costs one allocation rather than one per message.
+struct _ReadfileBatch
+{
+    std::string text;
+    std::vector<size_t> ends; // End of each message in text
+
+    void add(std::string_view header, std::string_view body)
+    {
+        text.append(header).append(body);
+        ends.push_back(text.size());
+    }
+
+    void addTo(ChatHistory &chatHistory) const
+    {
+        size_t begin = 0;
+        for (size_t end : ends)
+        {
+            chatHistory.addDialog("user", std::string_view(text).substr(begin, end - begin));
+            begin = end;
+        }
+    }
+};
+
+/**
+ * @brief The %readfile job: reads the files matching patterns and posts their messages to
+ * chatHistory in batches, then the status line.
+ */
+void _readfileJob(const std::vector<std::string> &patterns, ChatHistory &chatHistory)
+{
+    CommandRunner &runner = _commandRunner();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> errors;
+    std::vector<std::filesystem::path> files;
+    std::vector<std::string> unmatched;
     try
     {
-        writeToFile(outputFilename, chatHistory.toString());
-        chatHistory.addDialog("system", "Chat history saved to " + outputFilename);
+        files = expandFilePatterns(patterns, unmatched);
     }
     catch (const std::exception &e)
     {
-        chatHistory.addDialog("error", "Error saving chat history to " + outputFilename + ": " + e.what());
+        errors.push_back("Error reading files: " + std::string(e.what()));
+    }
+    for (const std::string &pattern : unmatched)
+    {
+        errors.push_back("Error reading file " + pattern + ": no such file or no files match.");
+    }
+    auto postErrors = [&] {
+        if (!errors.empty())
+        {
+            runner.post([&chatHistory, errors = std::move(errors)] {
+                for (const std::string &error : errors)
+                {
+                    chatHistory.addDialog("error", error);
+                }
+            });
+            errors.clear();
+        }
+    };
+    postErrors();
+
+    // A lone file that fits in one message is added as it is; otherwise each message is headed
+    // by the path (and part number) it came from
+    size_t messages = 0;
+    size_t seen = 0;
+    std::string header;
+    std::vector<std::string> skipped;
+    ReadFilesReport report;
+    _ReadfileBatch batch;
+    _ProgressClock clock;
+    auto flush = [&] {
+        if (!batch.ends.empty())
+        {
+            runner.post([&chatHistory, batch = std::move(batch)] { batch.addTo(chatHistory); });
+            batch = _ReadfileBatch();
+        }
+    };
+    bool failed = false;
+    if (!files.empty())
+    {
+        try
+        {
+            report = readFiles(files, ReadFilesOptions(), [&](const FileContent &file) {
+                ++seen;
+                if (!file.skipReason.empty())
+                {
+                    skipped.push_back(file.path.string() + " (" + file.skipReason + ")");
+                    return;
+                }
+                std::vector<std::string_view> chunks = splitIntoChunks(file.text, kReadfileChunkBytes);
+                for (size_t i = 0; i < chunks.size(); ++i)
+                {
+                    header.clear();
+                    if (files.size() != 1 || chunks.size() != 1)
+                    {
+                        header.assign("File: ").append(file.path.string());
+                        if (chunks.size() > 1)
+                        {
+                            header.append(" (part " + std::to_string(i + 1) + " of " + std::to_string(chunks.size()) +
+                                          ")");
+                        }
+                        header.append("\n\n");
+                    }
+                    batch.add(header, chunks[i]);
+                    ++messages;
+                }
+                bool progressDue = clock.due();
+                if (batch.text.size() >= kReadfileBatchBytes || progressDue)
+                {
+                    flush();
+                }
+                if (progressDue)
+                {
+                    _showProgress("Reading files... " + std::to_string(seen) + " of " + std::to_string(files.size()));
+                }
+            });
+        }
+        catch (const std::exception &e)
+        {
+            errors.push_back("Error reading files: " + std::string(e.what()));
+            failed = true;
+        }
+    }
+    flush();
+    _showProgress("");
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::ostringstream status;
+    if (files.empty() || failed)
+    {
+        // Nothing (more) to report than the errors
+    }
+    else if (files.size() == 1 && messages == 1)
+    {
+        status << "Content from " << files[0].string() << " added to chat history as a user message.";
     }
+    else
+    {
+        status << "Read " << report.files << (report.files == 1 ? " file" : " files") << " (" << report.bytes
+               << " bytes) into " << messages << (messages == 1 ? " message" : " messages") << " in "
+               << static_cast<long>(elapsed.count()) << " ms.";
+    }
+    if (!status.str().empty() && !skipped.empty())
+    {
+        status << " Skipped " << skipped.size() << ":";
+        for (size_t i = 0; i < skipped.size() && i < kReadfileSkippedListed; ++i)
+        {
+            status << (i == 0 ? " " : ", ") << skipped[i];
+        }
+        if (skipped.size() > kReadfileSkippedListed)
+        {
+            status << " and " << skipped.size() - kReadfileSkippedListed << " more";
+        }
+        status << ".";
+    }
+    postErrors();
+    runner.post([&chatHistory, text = status.str(), role = report.files == 0 ? "error" : "system"] {
+        if (!text.empty())
+        {
+            chatHistory.addDialog(role, text);
+        }
+        --g_readfiles;
+    });
+}
+} // namespace
+
+void readfileCommand(const std::vector<std::string> &patterns, ChatHistory &chatHistory)
+{
+    ++g_readfiles;
+    _runIo([&chatHistory, patterns](const std::atomic<bool> &) { _readfileJob(patterns, chatHistory); });
+}
+
+void autosaveHistory(const std::filesystem::path &path, ChatHistory &chatHistory)
+{
+    // What the last autosave wrote, and whether the latest one failed; used on the UI thread only
+    static ChatHistory *saved = new ChatHistory();
+    static bool failing = false;
+    if (saved->size() == chatHistory.size() && ChatHistory::sharedPrefix(*saved, chatHistory) == chatHistory.size() &&
+        !failing)
+    {
+        return;
+    }
+    *saved = chatHistory;
+    CommandRunner &runner = _commandRunner();
+    _runIo([&chatHistory, &runner, path, snapshot = ChatHistory(chatHistory)](const std::atomic<bool> &) {
+        std::string outcome;
+        try
+        {
+            _writeHistory(path, snapshot, [](int) {});
+        }
+        catch (const std::exception &e)
+        {
+            outcome = e.what();
+        }
+        runner.post([&chatHistory, path, outcome] {
+            if (outcome.empty())
+            {
+                failing = false;
+                return;
+            }
+            if (!failing)
+            {
+                chatHistory.addDialog("error", "Autosave to " + path.string() + " failed: " + outcome);
+            }
+            failing = true;
+        });
+    });
+}
+
+std::filesystem::path autosavePath()
+{
+    static const std::filesystem::path path = [] {
+        const char *configured = std::getenv("CHATGPT_CLI_AUTOSAVE");
+        return std::filesystem::path(configured != nullptr ? configured : "");
+    }();
+    return path;
 }
 
-void readfileCommand(const std::string &inputFilename, ChatHistory &chatHistory)
+std::chrono::seconds autosaveInterval()
+{
+    static const std::chrono::seconds interval = [] {
+        const char *configured = std::getenv("CHATGPT_CLI_AUTOSAVE_SECONDS");
+        long seconds = configured != nullptr ? std::strtol(configured, nullptr, 10) : 0;
+        return std::chrono::seconds(seconds > 0 ? seconds : 60);
+    }();
+    return interval;
+}
+
+void loadCommand(const std::string &journalFilename, ChatHistory &chatHistory)
 {
     try
     {
-        std::string fileContent = readFileToString(inputFilename);
-        chatHistory.addDialog("user", fileContent); // As per original logic, file content is added as user dialog
-        chatHistory.addDialog("system", "Content from " + inputFilename + " added to chat history as a user message.");
+        auto start = std::chrono::steady_clock::now();
+        JournalReplay replay = replaySessionJournal(journalFilename, chatHistory);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        // Continue the loaded session in this session's own journal
+        if (SessionJournal *journal = chatHistory.journal())
+        {
+            journal->replaceWith(journalFilename, replay.validBytes);
+        }
+        std::ostringstream status;
+        status << "Loaded " << chatHistory.size() << " entries from " << journalFilename << " in " << std::fixed
+               << std::setprecision(1) << elapsed.count() << " ms.";
+        if (replay.tornTail)
+        {
+            status << " An incomplete record at the end of the journal was ignored.";
+        }
+        chatHistory.addDialog("system", status.str());
     }
     catch (const std::exception &e)
     {
-        chatHistory.addDialog("error", "Error reading file " + inputFilename + ": " + e.what());
+        chatHistory.addDialog("error", "Error loading session " + journalFilename + ": " + e.what());
     }
 }
 
@@ -121,23 +779,653 @@ void printhistoryCommand(ChatHistory &chatHistory)
     chatHistory.addDialog("system", "Chat history is displayed in the pane above.");
 }
 
+void tokensCommand(ChatHistory &chatHistory)
+{
+    std::string report = "History holds " + std::to_string(chatHistory.totalTokens()) + " tokens";
+    size_t budget = promptTokenBudget();
+    if (budget != 0)
+    {
+        report += " (prompt budget: " + std::to_string(budget) + ")";
+    }
+    chatHistory.addDialog("system", report + ".");
+}
+
+void connectionsCommand(ChatHistory &chatHistory)
+{
+    ConnectionStats stats = ConnectionPool::instance().stats();
+    chatHistory.addDialog("system", "Connections opened: " + std::to_string(stats.opened) +
+                                        ", reused: " + std::to_string(stats.reused));
+}
+
+void cacheCommand(ChatHistory &chatHistory)
+{
+    ResponseCache *cache = sharedResponseCache();
+    if (cache == nullptr)
+    {
+        chatHistory.addDialog("system", "Response cache is off. Set CHATGPT_CLI_CACHE_DIR to enable it.");
+        return;
+    }
+    CacheStats session = cache->sessionStats();
+    CacheStats total = cache->totalStats();
+    chatHistory.addDialog("system", "Response cache: " + std::to_string(session.hits) + " hits, " +
+                                        std::to_string(session.misses) + " misses, " +
+                                        std::to_string(session.bytesSaved) + " bytes saved this session; " +
+                                        std::to_string(total.hits) + " hits, " + std::to_string(total.misses) +
+                                        " misses, " + std::to_string(total.bytesSaved) + " bytes saved overall; " +
+                                        std::to_string(total.entries) + " entries, " +
+                                        std::to_string(total.liveBytes) + " bytes stored.");
+}
+
+void compareCommand(const std::vector<std::string> &models, const std::string &prompt, ChatHistory &chatHistory)
+{
+    if (models.size() > kCompareMaxModels)
+    {
+        chatHistory.addDialog("error", "%compare asks at most " + std::to_string(kCompareMaxModels) + " models at once.");
+        return;
+    }
+
+    // The context is the history as it stands, without the %compare line the UI added to it
+    ChatHistory context = chatHistory;
+    if (context.size() > 0 && context[context.size() - 1].role == Role::User &&
+        context[context.size() - 1].message.rfind("%compare", 0) == 0)
+    {
+        context.removeLastDialog();
+    }
+    std::string question = prompt;
+    if (question.empty())
+    {
+        // Re-ask the last question, with the conversation as it was when it was asked
+        size_t last = context.size();
+        while (last > 0 && (context[last - 1].role != Role::User || context[last - 1].message.rfind('%', 0) == 0))
+        {
+            --last;
+        }
+        if (last == 0)
+        {
+            chatHistory.addDialog("error", "Nothing to compare yet: ask something first, or give a prompt after --.");
+            return;
+        }
+        question = context[last - 1].message;
+        while (context.size() >= last)
+        {
+            context.removeLastDialog();
+        }
+    }
+
+    try
+    {
+        requestTokenBudget(question, models.size());
+    }
+    catch (const UsageLimitExceeded &e)
+    {
+        chatHistory.addDialog("error", e.what());
+        return;
+    }
+
+    std::string names;
+    for (const std::string &model : models)
+    {
+        names += (names.empty() ? "" : ", ") + model;
+    }
+    chatHistory.addDialog("system", "Asking " + names + " at once...");
+
+    CommandRunner &runner = _commandRunner();
+    runner.runInBackground([&chatHistory, &runner, models, question, context](const std::atomic<bool> &cancelled) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<ModelAnswer> answers;
+        try
+        {
+            answers = compareModels(
+                models, question, context,
+                [&](const ModelAnswer &answer) {
+                    runner.post(
+                        [&chatHistory, text = formatModelAnswer(answer)] { chatHistory.addDialog("system", text); });
+                },
+                &cancelled);
+        }
+        catch (const UsageLimitExceeded &e)
+        {
+            // Another request can use up the budget after the check above
+            runner.post([&chatHistory, message = std::string(e.what())] { chatHistory.addDialog("error", message); });
+            return;
+        }
+        double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        runner.post([&chatHistory, summary = formatComparison(answers, wallMs)] {
+            chatHistory.addDialog("system", summary);
+        });
+    });
+}
+
+void forkCommand(const std::string &name, size_t messages, ChatHistory &chatHistory)
+{
+    ConversationBranches &branches = sharedBranches();
+    std::string from = branches.activeName();
+    try
+    {
+        branches.fork(name, chatHistory, messages);
+    }
+    catch (const std::exception &e)
+    {
+        chatHistory.addDialog("error", "Cannot fork " + name + ": " + e.what() + ".");
+        return;
+    }
+    chatHistory.addDialog("system", "Forked " + name + " from " + from + " with its first " + std::to_string(messages) +
+                                        " messages. Use %switch " + from + " to go back.");
+}
+
+void branchesCommand(ChatHistory &chatHistory)
+{
+    std::vector<BranchInfo> branches = sharedBranches().list(chatHistory);
+    size_t nameWidth = 4;
+    for (const BranchInfo &branch : branches)
+    {
+        nameWidth = std::max(nameWidth, branch.name.size());
+    }
+
+    std::ostringstream oss;
+    oss << "Branches (* is active):";
+    for (const BranchInfo &branch : branches)
+    {
+        oss << "\n" << (branch.active ? "* " : "  ") << std::left << std::setw(static_cast<int>(nameWidth + 2))
+            << branch.name << std::right << std::setw(6) << branch.messages << " messages";
+        if (!branch.active)
+        {
+            oss << ", " << branch.shared << " shared";
+        }
+    }
+    chatHistory.addDialog("system", oss.str());
+}
+
+void switchCommand(const std::string &name, ChatHistory &chatHistory)
+{
+    try
+    {
+        sharedBranches().switchTo(name, chatHistory);
+    }
+    catch (const std::exception &e)
+    {
+        chatHistory.addDialog("error", "Cannot switch to " + name + ": " + e.what() + ". Type %branches for a list.");
+        return;
+    }
+    chatHistory.addDialog("system", "Switched to " + name + " (" + std::to_string(chatHistory.size()) + " messages).");
+}
+
+namespace
+{
+/// Hits %search lists; the rest are only counted
+constexpr size_t kSearchHitsListed = 10;
+
+/// Context %search shows around a hit, in bytes before and after it
+constexpr size_t kSnippetBefore = 30;
+constexpr size_t kSnippetAfter = 50;
+
+/// @brief The index %search keeps in step with the history, and the previous search, whose
+/// matches a bare %search steps through from the newest.
+struct _SearchState
+{
+    HistoryIndex index;
+    SearchQuery query;
+    std::vector<size_t> hits; // Oldest first
+    size_t shown = 0;         // Hits shown so far, counting from the newest
+};
+
+_SearchState &_searchState()
+{
+    // Never destroyed, like the other process-wide stores
+    static _SearchState *state = new _SearchState();
+    return *state;
+}
+
+/**
+ * @brief Returns the line of message around match, on one line, cut at UTF-8 boundaries.
+ */
+std::string _snippet(std::string_view message, const SearchMatch &match)
+{
+    auto boundary = [&](size_t pos) {
+        while (pos > 0 && pos < message.size() && (static_cast<unsigned char>(message[pos]) & 0xC0) == 0x80)
+        {
+            --pos;
+        }
+        return pos;
+    };
+    size_t begin = boundary(match.offset > kSnippetBefore ? match.offset - kSnippetBefore : 0);
+    size_t end = boundary(std::min(message.size(), match.offset + match.length + kSnippetAfter));
+    std::string snippet(message.substr(begin, end - begin));
+    std::replace_if(snippet.begin(), snippet.end(), [](char c) { return c == '\n' || c == '\r' || c == '\t'; }, ' ');
+    return (begin > 0 ? "..." : "") + snippet + (end < message.size() ? "..." : "");
+}
+
+/// @brief What a %search shows: a message for the history and, if something matched, where
+/// to scroll the pane.
+struct _SearchOutcome
+{
+    std::string role = "system";
+    std::string text;
+    bool reveal = false;
+    size_t entry = 0;
+    size_t offset = 0;
+};
+
+/**
+ * @brief Points outcome at the match in the hit-th newest matching message.
+ */
+void _revealHit(const ChatHistory &snapshot, const _SearchState &state, size_t hit, _SearchOutcome &outcome)
+{
+    outcome.entry = state.hits[state.hits.size() - 1 - hit];
+    if (outcome.entry < snapshot.size())
+    {
+        outcome.reveal = true;
+        outcome.offset = HistoryIndex::locate(snapshot[outcome.entry].message, state.query).offset;
+    }
+}
+
+/**
+ * @brief Runs a search, or steps to the next match when terms is empty, against a snapshot of
+ * the history. Called on the I/O thread only, which so owns the search state.
+ */
+_SearchOutcome _search(const std::vector<std::string> &terms, const ChatHistory &snapshot)
+{
+    _SearchState &state = _searchState();
+    _SearchOutcome outcome;
+    if (terms.empty())
+    {
+        if (state.hits.empty())
+        {
+            outcome.role = "error";
+            outcome.text = "Usage: %search <terms>; without terms it steps through the last matches.";
+            return outcome;
+        }
+        state.shown = (state.shown + 1) % state.hits.size();
+        outcome.text = "Match " + std::to_string(state.shown + 1) + " of " + std::to_string(state.hits.size()) +
+                       ": message #" + std::to_string(state.hits[state.hits.size() - 1 - state.shown]) + ".";
+        _revealHit(snapshot, state, state.shown, outcome);
+        return outcome;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    state.index.sync(snapshot);
+    state.query = parseSearchQuery(terms);
+    state.hits = state.index.search(snapshot, state.query);
+    state.shown = 0;
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::string query;
+    for (const std::string &term : terms)
+    {
+        query += (query.empty() ? "" : " ") + term;
+    }
+    std::ostringstream result;
+    result << std::fixed << std::setprecision(1);
+    if (state.hits.empty())
+    {
+        result << "No messages match " << query << " (searched " << state.index.entries() << " in "
+               << elapsed.count() << " ms).";
+        outcome.text = result.str();
+        return outcome;
+    }
+    result << state.hits.size() << (state.hits.size() == 1 ? " message matches " : " messages match ") << query
+           << " (searched " << state.index.entries() << " in " << elapsed.count() << " ms), newest first:";
+    for (size_t i = 0; i < state.hits.size() && i < kSearchHitsListed; ++i)
+    {
+        size_t entry = state.hits[state.hits.size() - 1 - i];
+        Dialog dialog = snapshot[entry];
+        result << "\n  #" << entry << " " << dialog.participant << ": "
+               << _snippet(dialog.message, HistoryIndex::locate(dialog.message, state.query));
+    }
+    if (state.hits.size() > kSearchHitsListed)
+    {
+        result << "\n  and " << state.hits.size() - kSearchHitsListed << " more.";
+    }
+    if (state.hits.size() > 1)
+    {
+        result << "\nType %search again for the next match.";
+    }
+    outcome.text = result.str();
+    _revealHit(snapshot, state, 0, outcome);
+    return outcome;
+}
+} // namespace
+
+void searchCommand(const std::vector<std::string> &terms, ChatHistory &chatHistory)
+{
+    // Indexing what was added since the last search takes as long as reading it, which for a
+    // large %readfile is far too long for the UI thread; the I/O thread works on a snapshot
+    CommandRunner &runner = _commandRunner();
+    _runIo([&chatHistory, &runner, terms, snapshot = ChatHistory(chatHistory)](const std::atomic<bool> &) {
+        _SearchOutcome outcome = _search(terms, snapshot);
+        runner.post([&chatHistory, &runner, outcome] {
+            chatHistory.addDialog(outcome.role, outcome.text);
+            if (outcome.reveal && runner.reveal)
+            {
+                runner.reveal(outcome.entry, outcome.offset);
+            }
+        });
+    });
+}
+
+namespace
+{
+/// Excerpts %ask attaches to a question unless CHATGPT_CLI_ASK_EXCERPTS says otherwise
+constexpr size_t kAskExcerpts = 6;
+
+/// Most excerpts CHATGPT_CLI_ASK_EXCERPTS may ask for
+constexpr size_t kAskMaxExcerpts = 50;
+
+/// %ask requests whose reply has not reached the history yet
+std::atomic<size_t> g_asks{0};
+
+/// @brief The index %ask answers from: the one the last %index built. Each %ask holds on to
+/// the index it started with, so a new %index can replace it meanwhile.
+struct _CorpusState
+{
+    std::mutex mutex;
+    std::shared_ptr<const CorpusIndex> index;
+};
+
+_CorpusState &_corpusState()
+{
+    // Never destroyed, like the other process-wide stores
+    static _CorpusState *state = new _CorpusState();
+    return *state;
+}
+
+size_t _askExcerpts()
+{
+    static const size_t excerpts = [] {
+        const char *configured = std::getenv("CHATGPT_CLI_ASK_EXCERPTS");
+        if (configured == nullptr || *configured == '\0')
+        {
+            return kAskExcerpts;
+        }
+        char *end = nullptr;
+        unsigned long value = std::strtoul(configured, &end, 10);
+        return *end == '\0' && value > 0 ? std::min<size_t>(value, kAskMaxExcerpts) : kAskExcerpts;
+    }();
+    return excerpts;
+}
+
+std::string _megabytes(uint64_t bytes)
+{
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1) << bytes / (1024.0 * 1024.0) << " MB";
+    return text.str();
+}
+
+/**
+ * @brief Returns the message %ask sends: the excerpts, each headed by its file and line, then
+ * the question.
+ */
+std::string _withExcerpts(const std::string &question, const CorpusIndex &index, const std::vector<CorpusHit> &hits)
+{
+    if (hits.empty())
+    {
+        return question;
+    }
+    std::string message = "Answer the question below, using these excerpts of the files in " +
+                          index.root().string() + " where they are relevant. Cite them by file and line.\n";
+    for (const CorpusHit &hit : hits)
+    {
+        message += "\n--- " + hit.path.lexically_relative(index.root()).string() + ":" + std::to_string(hit.line) +
+                   " ---\n" + hit.text;
+        if (!hit.text.empty() && hit.text.back() != '\n')
+        {
+            message += '\n';
+        }
+    }
+    return message + "\nQuestion: " + question;
+}
+} // namespace
+
+void indexCommand(const std::string &directory, ChatHistory &chatHistory)
+{
+    std::error_code error;
+    std::filesystem::path root = std::filesystem::weakly_canonical(directory, error);
+    if (error || !std::filesystem::is_directory(root, error))
+    {
+        chatHistory.addDialog("error", "Not a directory: " + directory);
+        return;
+    }
+
+    // Reading every file takes seconds for a large tree, so the index is built on the I/O
+    // thread; the index in use until then stays in use
+    CommandRunner &runner = _commandRunner();
+    _runIo([&chatHistory, &runner, root](const std::atomic<bool> &) {
+        auto start = std::chrono::steady_clock::now();
+        std::string role = "system";
+        std::ostringstream result;
+        try
+        {
+            _ProgressClock clock;
+            std::filesystem::path indexPath = corpusIndexPath(root);
+            CorpusBuildReport report =
+                buildCorpusIndex(root, indexPath, {}, [&](size_t done, size_t total) {
+                    if (clock.due())
+                    {
+                        _showProgress("Indexing " + root.string() + ": " + std::to_string(done) + " of " +
+                                      std::to_string(total) + " files...");
+                    }
+                });
+            auto index = std::make_shared<const CorpusIndex>(indexPath);
+            {
+                _CorpusState &state = _corpusState();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.index = index;
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            result << std::fixed << std::setprecision(1) << "Indexed " << report.files << " files ("
+                   << _megabytes(report.bytes) << ") of " << root.string() << " into " << report.chunks
+                   << " excerpts in " << elapsed.count() << " s";
+            if (report.skipped > 0)
+            {
+                result << ", skipping " << report.skipped << " binary, empty or very large files";
+            }
+            result << ". %ask now answers from them.";
+        }
+        catch (const std::exception &e)
+        {
+            role = "error";
+            result << "Unable to index " << root.string() << ": " << e.what();
+        }
+        _showProgress("");
+        runner.post([&chatHistory, role, text = result.str()] { chatHistory.addDialog(role, text); });
+    });
+}
+
+void askCommand(const std::string &question, ChatHistory &chatHistory)
+{
+    std::shared_ptr<const CorpusIndex> index;
+    {
+        _CorpusState &state = _corpusState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        index = state.index;
+    }
+    if (!index)
+    {
+        chatHistory.addDialog("error", "Nothing to ask about yet: %index a directory first.");
+        return;
+    }
+
+    // The history keeps the question as asked; only the request carries the excerpts, so they
+    // cost tokens once instead of on every later turn
+    ChatHistory context = chatHistory;
+    chatHistory.addDialog("user", question);
+    ++g_asks;
+    CommandRunner &runner = _commandRunner();
+    runner.runInBackground([&chatHistory, &runner, index, question, context](const std::atomic<bool> &cancelled) mutable {
+        auto start = std::chrono::steady_clock::now();
+        size_t stale = 0;
+        std::vector<CorpusHit> hits = index->search(question, _askExcerpts(), &stale);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::string message = _withExcerpts(question, *index, hits);
+
+        std::ostringstream sources;
+        sources << std::fixed << std::setprecision(1);
+        if (hits.empty())
+        {
+            sources << "No indexed excerpts match; asked without them";
+        }
+        else
+        {
+            sources << "Sent " << hits.size() << (hits.size() == 1 ? " excerpt (" : " excerpts (")
+                    << (message.size() - question.size()) / 1024.0 << " KB of the " << _megabytes(index->bytes())
+                    << " indexed, found in " << elapsed.count() << " ms):";
+            for (const CorpusHit &hit : hits)
+            {
+                sources << " " << hit.path.lexically_relative(index->root()).string() << ":" << hit.line;
+            }
+        }
+        if (stale > 0)
+        {
+            sources << "; left out " << stale << " whose files changed since %index";
+        }
+        sources << ".";
+
+        // As for a turn, deltas only grow the reply's own entry
+        auto replyId = std::make_shared<std::optional<uint32_t>>();
+        auto onDelta = [&chatHistory, &runner, replyId](const std::string &delta) {
+            runner.post([&chatHistory, replyId, delta] {
+                if (!*replyId || !chatHistory.appendToDialog(**replyId, delta))
+                {
+                    chatHistory.addDialog("assistant", delta);
+                    *replyId = chatHistory[chatHistory.size() - 1].id;
+                }
+            });
+        };
+        std::string status;
+        try
+        {
+            if (!cancelled)
+            {
+                StreamRequestFn request = chatStreamingRequest(&cancelled);
+                streamChatGPTAPI(message, context, onDelta, request);
+            }
+            if (cancelled)
+            {
+                status = "Request cancelled.";
+            }
+        }
+        catch (const std::exception &e)
+        {
+            status = "Error calling API: " + std::string(e.what());
+        }
+        runner.post([&chatHistory, sources = sources.str(), status] {
+            chatHistory.addDialog("system", sources);
+            if (!status.empty())
+            {
+                chatHistory.addDialog("system", status);
+            }
+            --g_asks;
+        });
+    });
+}
+
+bool askInProgress()
+{
+    return g_asks.load() != 0;
+}
+
+void statsCommand(ChatHistory &chatHistory)
+{
+    std::ostringstream stats_oss;
+    stats_oss << std::fixed << std::setprecision(2);
+    stats_oss << std::left << std::setw(16) << "Phase (ms)" << std::right << std::setw(8) << "count" << std::setw(10)
+              << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+    bool any = false;
+    for (const MetricEntry *entry : sharedMetrics().entries())
+    {
+        const LatencyHistogram &histogram = entry->histogram;
+        if (histogram.count() == 0)
+        {
+            continue;
+        }
+        any = true;
+        // "chatgpt_cli_payload_build_seconds" is shown as "payload build"
+        std::string label = entry->name;
+        if (label.rfind("chatgpt_cli_", 0) == 0)
+        {
+            label.erase(0, 12);
+        }
+        if (label.size() > 8 && label.compare(label.size() - 8, 8, "_seconds") == 0)
+        {
+            label.resize(label.size() - 8);
+        }
+        std::replace(label.begin(), label.end(), '_', ' ');
+        stats_oss << std::left << std::setw(16) << label << std::right << std::setw(8) << histogram.count();
+        for (double q : {0.5, 0.9, 0.99})
+        {
+            stats_oss << std::setw(10) << histogram.percentileMicroseconds(q) / 1000.0;
+        }
+        stats_oss << std::setw(10) << histogram.maxMicroseconds() / 1000.0 << "\n";
+    }
+    if (!any)
+    {
+        chatHistory.addDialog("system", "No requests have been timed yet.");
+        return;
+    }
+    chatHistory.addDialog("system", stats_oss.str());
+}
+
+void usageCommand(ChatHistory &chatHistory)
+{
+    UsageLedger &ledger = sharedUsageLedger();
+    auto now = std::chrono::system_clock::now();
+    std::ostringstream usage_oss;
+    usage_oss << std::left << std::setw(14) << "Tokens" << std::right << std::setw(10) << "requests" << std::setw(12)
+              << "prompt" << std::setw(12) << "cached" << std::setw(12) << "completion" << std::setw(12) << "total"
+              << "\n";
+    auto row = [&](const char *label, const UsageTotals &totals) {
+        usage_oss << std::left << std::setw(14) << label << std::right << std::setw(10) << totals.requests
+                  << std::setw(12) << totals.promptTokens << std::setw(12) << totals.cachedTokens << std::setw(12)
+                  << totals.completionTokens << std::setw(12) << totals.tokens() << "\n";
+    };
+    row("This session", ledger.session());
+    row("Today", ledger.today());
+    if (!ledger.path().empty())
+    {
+        row("Last 30 days", ledger.totals(now - std::chrono::hours(24 * 30), now + std::chrono::seconds(1)));
+    }
+
+    UsageLimits limits = ledger.limits();
+    auto limit = [](uint64_t tokens, uint64_t used) {
+        if (tokens == 0)
+        {
+            return std::string("none");
+        }
+        return std::to_string(tokens) + " (" + std::to_string(used < tokens ? tokens - used : 0) + " left)";
+    };
+    usage_oss << "Limits: " << limit(limits.sessionTokens, ledger.session().tokens()) << " per session, "
+              << limit(limits.dailyTokens, ledger.today().tokens()) << " per day.\n";
+    if (ledger.path().empty())
+    {
+        usage_oss << "Usage is not kept after this session.";
+    }
+    else
+    {
+        usage_oss << "Ledger: " << ledger.path().string();
+    }
+    chatHistory.addDialog("system", usage_oss.str());
+}
+
 void quitCommand()
 {
+    // Saves still queued would otherwise be cut short; each replaces its file only once complete
+    auto deadline = std::chrono::steady_clock::now() + kQuitIoWait;
+    while (g_pendingIo.load() != 0 && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
     std::exit(0);
 }
 
-void helpCommand(ChatHistory &chatHistory) // Added chatHistory parameter
+void helpCommand(ChatHistory &chatHistory)
 {
     const int maxWidth = 20; // Adjusted for typical chat display
     std::ostringstream help_oss;
     help_oss << "***** HELP MENU *****\n\n"; // Use \n for newlines
-    help_oss << std::left << std::setw(maxWidth) << "%save [filename]" << "Saves your chat as a file.\n";
-    help_oss << std::left << std::setw(maxWidth) << "%readfile [filename]" << "Reads a file into history as user message.\n";
-    help_oss << std::left << std::setw(maxWidth) << "%clear" << "Clears the chat history.\n";
-    help_oss << std::left << std::setw(maxWidth) << "%deletelast" << "Deletes the last record in chat history.\n";
-    help_oss << std::left << std::setw(maxWidth) << "%printhistory" << "Shows this message (history is above).\n";
-    help_oss << std::left << std::setw(maxWidth) << "%quit" << "Exits the program.\n";
-    help_oss << std::left << std::setw(maxWidth) << "%help" << "Prints this help menu.\n";
-    
+    for (const CommandSpec &spec : kCommands)
+    {
+        help_oss << std::left << std::setw(maxWidth) << spec.usage << spec.help << "\n";
+    }
+
     chatHistory.addDialog("system", help_oss.str());
 }
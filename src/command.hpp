@@ -7,7 +7,60 @@
 
 #include "chathistory.hpp"
 #include "commandcontext.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
 #include <string>
+#include <string_view>
+#include <vector>
+
+using BackgroundJob = std::function<void(const std::atomic<bool> &cancelled)>;
+
+/// @brief How commands that wait on the network or on files run: runInBackground takes
+/// network work and runIo file work (%save, %readfile, autosave), and the work hands its
+/// results to post, which applies them on the thread that owns the history. showProgress
+/// puts a transient progress line on screen, and an empty line takes it down again; reveal
+/// scrolls the history pane to a byte offset of a message, as %search does with its hits.
+struct CommandRunner
+{
+    std::function<void(BackgroundJob)> runInBackground;
+    std::function<void(std::function<void()>)> post;
+    std::function<void(BackgroundJob)> runIo = {}; // One job at a time, in order; none if empty
+    std::function<void(std::string)> showProgress = {}; // May be called from any thread; optional
+    std::function<void(size_t entry, size_t offset)> reveal = {}; // Scrolls the pane to a message; optional
+};
+
+/// @brief Installs the runner the UI provides (see main.cpp). Without one, such commands run
+/// to completion on the calling thread before handleCommand returns; so does file work when
+/// the runner has no runIo.
+///
+/// @param runner CommandRunner the background executor and poster to use
+void setCommandRunner(CommandRunner runner);
+
+/// @brief Marks a command that takes any number of arguments past its minimum.
+constexpr size_t kAnyArguments = SIZE_MAX;
+
+/// @brief One entry of the command table: handleCommand looks commands up by name, checks
+/// the argument count against the arity, and calls the handler. %help lists the table in order.
+struct CommandSpec
+{
+    std::string_view name;  // Including the %, e.g. "%save"
+    std::string_view usage; // Shown by %help and when the arguments do not fit, e.g. "%save [filename]"
+    size_t minArguments;
+    size_t maxArguments; // Or kAnyArguments
+    void (*handler)(const CommandContext &commandContext, ChatHistory &chatHistory);
+    std::string_view help;
+};
+
+/// @brief Finds a command in the table through a perfect hash built at compile time: one hash
+/// of name and one string comparison, with no allocation.
+///
+/// @param name std::string_view the command, including the %
+/// @return const CommandSpec* the entry, or nullptr if there is no such command
+const CommandSpec *findCommand(std::string_view name);
 
 /// @brief Determines which command function to enter based on user input and executes the
 /// appropriate command
@@ -18,15 +71,48 @@ void handleCommand(const CommandContext &commandContext, ChatHistory &chatHistor
 
 /// @brief Saves the chat history to a file in the current working directory
 ///
+/// The file is written on the I/O runner from a snapshot of the history taken when the command
+/// runs, so the chat can go on meanwhile, and it replaces an existing file only once complete.
+///
 /// @param outputFilename const std::string& the name of the file to write
 /// @param chatHistory ChatHistory& the chat history to write to the output file, modified with status messages.
 void saveCommand(const std::string &outputFilename, ChatHistory &chatHistory);
 
-/// @brief Reads a file and adds the file as a user dialog to chatHistory
+/// @brief Reads files and adds each as a user dialog to chatHistory, splitting long ones into parts
 ///
-/// @param inputFilename const std::string& the file to read into chatHistory
-/// @param chatHistory ChatHistory& the chat history to update with the contents of the file read in
-void readfileCommand(const std::string &inputFilename, ChatHistory &chatHistory);
+/// The files are read on the I/O runner and their messages posted back to chatHistory in
+/// batches, in order; readfileInProgress() tells when the last batch has arrived.
+///
+/// @param patterns const std::vector<std::string>& files, directories or globs to read (see expandFilePatterns)
+/// @param chatHistory ChatHistory& the chat history to update with the contents of the files read in
+void readfileCommand(const std::vector<std::string> &patterns, ChatHistory &chatHistory);
+
+/// @brief Returns true while %readfile is still adding files to the history. The UI holds back
+/// the next conversation turn and branch changes until then, so the files precede the question
+/// that follows them.
+bool readfileInProgress();
+
+/// @brief Saves chatHistory to path on the I/O runner, as %save does but without a status
+/// message, unless it is unchanged since the last autosave. A failure is reported once, not on
+/// every attempt.
+///
+/// @param path const std::filesystem::path& the file to keep the chat in
+/// @param chatHistory ChatHistory& the chat history to save
+void autosaveHistory(const std::filesystem::path &path, ChatHistory &chatHistory);
+
+/// @brief Returns the file to autosave the chat to: CHATGPT_CLI_AUTOSAVE, or an empty path
+/// when autosave is off (the default). Read once.
+std::filesystem::path autosavePath();
+
+/// @brief Returns how often to autosave: CHATGPT_CLI_AUTOSAVE_SECONDS, default 60. Read once.
+std::chrono::seconds autosaveInterval();
+
+/// @brief Replaces chatHistory with the session recorded in a journal, which then continues in
+/// chatHistory's own journal
+///
+/// @param journalFilename const std::string& the session journal to load
+/// @param chatHistory ChatHistory& the chat history to rebuild, modified with a status message
+void loadCommand(const std::string &journalFilename, ChatHistory &chatHistory);
 
 /// @brief Deletes all prior entries in chatHistory
 ///
@@ -43,7 +129,86 @@ void deletelastCommand(ChatHistory &chatHistory);
 /// @param chatHistory ChatHistory& the ChatHistory to be modified with a status message.
 void printhistoryCommand(ChatHistory &chatHistory);
 
-/// @brief Exits the program
+/// @brief Adds the token count of chatHistory and the prompt token budget to chatHistory
+///
+/// @param chatHistory ChatHistory& the ChatHistory to count and add the report to
+void tokensCommand(ChatHistory &chatHistory);
+
+/// @brief Adds the number of connections opened and reused by API requests to chatHistory
+///
+/// @param chatHistory ChatHistory& the ChatHistory to add the connection counts to
+void connectionsCommand(ChatHistory &chatHistory);
+
+/// @brief Adds the response cache's hit, miss and size counters to chatHistory
+///
+/// @param chatHistory ChatHistory& the ChatHistory to add the counters to
+void cacheCommand(ChatHistory &chatHistory);
+
+/// @brief Sends a prompt to several models at once and adds each answer as it arrives, then a
+/// side-by-side summary of latency and token usage
+///
+/// @param models const std::vector<std::string>& the models to ask
+/// @param prompt const std::string& the prompt; empty re-asks the last user message with the history before it
+/// @param chatHistory ChatHistory& the context to send and the history to add the answers to
+void compareCommand(const std::vector<std::string> &models, const std::string &prompt, ChatHistory &chatHistory);
+
+/// @brief Saves the conversation as the current branch and continues on a new branch that
+/// starts with its first messages entries
+///
+/// @param name const std::string& the new branch's name
+/// @param messages size_t how many leading entries of chatHistory the new branch keeps
+/// @param chatHistory ChatHistory& the displayed history; becomes the new branch, with a status message
+void forkCommand(const std::string &name, size_t messages, ChatHistory &chatHistory);
+
+/// @brief Adds a list of the conversation's branches, their sizes and what they share with the
+/// active one to chatHistory
+///
+/// @param chatHistory ChatHistory& the ChatHistory to add the list to
+void branchesCommand(ChatHistory &chatHistory);
+
+/// @brief Saves the conversation as the current branch and shows the branch called name instead
+///
+/// @param name const std::string& the branch to switch to
+/// @param chatHistory ChatHistory& the displayed history; replaced by the branch, with a status message
+void switchCommand(const std::string &name, ChatHistory &chatHistory);
+
+/// @brief Finds the messages matching terms and scrolls the history pane to the newest one;
+/// without terms, moves on to the next older match of the previous search
+///
+/// @param terms const std::vector<std::string>& the words, phrases or text to find (see parseSearchQuery)
+/// @param chatHistory ChatHistory& the history to search, and to add the results to
+void searchCommand(const std::vector<std::string> &terms, ChatHistory &chatHistory);
+
+/// @brief Builds the BM25 index of the files under a directory on the I/O runner, and makes it
+/// the one %ask answers from once complete
+///
+/// @param directory const std::string& the directory to index (see buildCorpusIndex)
+/// @param chatHistory ChatHistory& the chat history to add the result to
+void indexCommand(const std::string &directory, ChatHistory &chatHistory);
+
+/// @brief Adds question to chatHistory and asks it, with the excerpts of the indexed files that
+/// match it best attached to the request only; the reply streams into chatHistory
+///
+/// @param question const std::string& the question
+/// @param chatHistory ChatHistory& the conversation so far, which the question and reply are added to
+void askCommand(const std::string &question, ChatHistory &chatHistory);
+
+/// @brief Returns true while an %ask reply has yet to reach the history. The UI holds back the
+/// next conversation turn until then, as it does while a turn of its own is in flight.
+bool askInProgress();
+
+/// @brief Adds the count and p50/p90/p99/max of each timed request phase to chatHistory
+///
+/// @param chatHistory ChatHistory& the ChatHistory to add the table to
+void statsCommand(ChatHistory &chatHistory);
+
+/// @brief Adds the token usage of this session, today and the last 30 days to chatHistory, with
+/// what the session and daily limits leave
+///
+/// @param chatHistory ChatHistory& the ChatHistory to add the table to
+void usageCommand(ChatHistory &chatHistory);
+
+/// @brief Exits the program once the file work still queued on the I/O runner has finished
 void quitCommand();
 
 /// @brief Prints a table of possible commands and their functionality
@@ -3,84 +3,108 @@
 // CommandContext holds information about the user command and its arguments.
 
 #include "commandcontext.hpp"
-#include <iostream>
-#include <sstream>
-#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
-std::string CommandContext::getCommand() const
+namespace
 {
-    return m_command;
+bool _isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
 }
 
-std::string CommandContext::getArgument(size_t argumentIndex) const
+// Whether a backslash before c escapes it; elsewhere the backslash is literal, so paths such as
+// "dir\name" survive. Inside double quotes only the quote and the backslash can be escaped.
+bool _isEscapable(char c, char quote)
 {
-    std::string argument;
-    try
-    {
-        argument = m_arguments.at(argumentIndex);
-    }
-    catch (std::out_of_range &e)
+    if (quote == '"')
     {
-        std::cerr << e.what() << std::endl;
-        std::cerr << "Out of range error in m_arguments at index: " << argumentIndex << std::endl;
-        std::cerr << "Returning empty string" << std::endl;
-        return "";
+        return c == '"' || c == '\\';
     }
-    return argument;
+    return c == '"' || c == '\'' || c == '\\' || _isBlank(c);
 }
+} // namespace
 
-size_t CommandContext::getArgumentsSize() const
+std::string_view CommandContext::getCommand() const
 {
-    return m_arguments.size();
+    return _token(0);
 }
 
-void CommandContext::setCommandAndArgs(const std::string& rawCommandInput)
+std::string_view CommandContext::getArgument(size_t argumentIndex) const
 {
-    m_command.clear();
-    m_arguments.clear();
-    _parseCommand(rawCommandInput);
+    return argumentIndex < getArgumentsSize() ? _token(argumentIndex + 1) : std::string_view();
 }
 
-void CommandContext::_parseCommand(const std::string& rawCommandInput)
+size_t CommandContext::getArgumentsSize() const
 {
-    std::string token;
-    std::vector<std::string> commandTokens;
-    std::istringstream iss(rawCommandInput);
-
-    while (iss >> token)
-    {
-        commandTokens.push_back(token);
-    }
+    return m_tokens.empty() ? 0 : m_tokens.size() - 1;
+}
 
-    if (commandTokens.empty())
-    {
-        std::cerr << "Error: Unable to parse rawCommandInput. No tokens parsed." << std::endl;
-        return;
-    }
+void CommandContext::setCommandAndArgs(std::string_view rawCommandInput)
+{
+    m_tokens.clear();
+    _parseCommand(rawCommandInput);
+}
 
-    try
-    {
-        m_command = commandTokens.at(0);
-    }
-    catch (const std::out_of_range &e)
+void CommandContext::_parseCommand(std::string_view rawCommandInput)
+{
+    // Decoding never lengthens a token, so it happens in place: write trails read through the copy
+    m_buffer.assign(rawCommandInput.data(), rawCommandInput.size());
+    char *text = m_buffer.data();
+    size_t size = m_buffer.size();
+    size_t read = 0;
+    size_t write = 0;
+    while (true)
     {
-        std::cerr << "Error: Unable to access commandTokens at index 0" << e.what() << std::endl;
-        return;
-    }
+        while (read < size && _isBlank(text[read]))
+        {
+            ++read;
+        }
+        if (read == size)
+        {
+            return;
+        }
 
-    try
-    {
-        for (auto it = commandTokens.begin() + 1; it != commandTokens.end();
-             ++it) // index 1 is the first possible argument to "%command"
+        size_t start = write;
+        char quote = 0;
+        while (read < size)
         {
-            m_arguments.push_back(*it);
+            char c = text[read];
+            if (quote == 0 && _isBlank(c))
+            {
+                break;
+            }
+            if (c == quote)
+            {
+                quote = 0;
+                ++read;
+            }
+            else if (quote == 0 && (c == '"' || c == '\''))
+            {
+                quote = c;
+                ++read;
+            }
+            else if (c == '\\' && quote != '\'' && read + 1 < size && _isEscapable(text[read + 1], quote))
+            {
+                text[write++] = text[read + 1];
+                read += 2;
+            }
+            else
+            {
+                text[write++] = c;
+                ++read;
+            }
         }
+        m_tokens.push_back({static_cast<uint32_t>(start), static_cast<uint32_t>(write - start)});
     }
-    catch (const std::out_of_range &e)
+}
+
+std::string_view CommandContext::_token(size_t index) const
+{
+    if (index >= m_tokens.size())
     {
-        std::cerr << "Error: Index error when accessing commandTokens." << e.what() << std::endl;
-        return;
+        return std::string_view();
     }
+    return std::string_view(m_buffer.data() + m_tokens[index].offset, m_tokens[index].length);
 }
@@ -5,13 +5,24 @@
 #ifndef commandcontext_hpp
 #define commandcontext_hpp
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 /// @class CommandContext
 /// @brief Container for commands read in from input, in the form of "%command [arg1 arg2]"
 /// Separates the raw command into more easily managed and accessible components of a
 /// command and its arguments.
+///
+/// Tokens are separated by whitespace. Single or double quotes group text that contains
+/// whitespace into one token ("%save 'my chat.txt'"), and a backslash escapes a quote,
+/// a backslash or whitespace outside single quotes; any other backslash is kept as it is.
+/// An unterminated quote runs to the end of the input.
+///
+/// Parsing decodes the input into a buffer the context owns and records each token as a
+/// range of it, so a context that is reused allocates nothing once its buffers have grown
+/// to fit the longest command seen.
 class CommandContext
 {
   public:
@@ -19,22 +30,23 @@ class CommandContext
      * @brief Parses a raw command string and separates it into the command and its arguments.
      * @param rawCommandInput The raw input string in the form "%command [arg1 arg2]".
      */
-    void setCommandAndArgs(const std::string& rawCommandInput);
+    void setCommandAndArgs(std::string_view rawCommandInput);
 
     /**
      * @brief Returns the parsed command string.
-     * @return The command extracted from the raw input.
+     * @return The command extracted from the raw input, or an empty view if there was none.
+     * Valid until the next call to setCommandAndArgs.
      */
-    std::string getCommand() const;
+    std::string_view getCommand() const;
 
     /**
      * @brief Returns the argument at the specified index.
      * @param argumentIndex The index of the argument to return.
-     * @return The argument at the specified index.
-     * @throws std::out_of_range if the index is invalid.
+     * @return The argument at the specified index, or an empty view if the index is invalid.
+     * Valid until the next call to setCommandAndArgs.
      */
-    std::string getArgument(size_t argumentIndex) const;
-    
+    std::string_view getArgument(size_t argumentIndex) const;
+
     /**
      * @brief Returns the number of parsed arguments.
      * @return The number of arguments.
@@ -42,14 +54,23 @@ class CommandContext
     size_t getArgumentsSize() const;
 
   private:
-    std::string m_command;
-    std::vector<std::string> m_arguments;
+    /// @brief Where one token lies in m_buffer. Offsets rather than views, so copies stay valid.
+    struct _Token
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    std::string m_buffer;         // The input with quotes and escapes removed
+    std::vector<_Token> m_tokens; // The command, then its arguments
 
     /**
-     * @brief Parses a raw string containing a command keyword and arguments and updates member variables.
+     * @brief Splits rawCommandInput into m_buffer and m_tokens.
      * @param rawCommandInput The raw string in the form "%command arg1 arg2 arg3".
      */
-    void _parseCommand(const std::string& rawCommandInput);
+    void _parseCommand(std::string_view rawCommandInput);
+
+    std::string_view _token(size_t index) const;
 };
 
 #endif /* commandcontext_hpp */
@@ -0,0 +1,148 @@
+//  compare.cpp
+//
+// Sends one prompt to several models at once, for %compare
+
+#include "compare.hpp"
+#include "request.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+std::string _seconds(double milliseconds)
+{
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2) << milliseconds / 1000 << " s";
+    return oss.str();
+}
+
+ModelAnswer _answerFrom(const std::string &model, const std::string &response, bool cancelled)
+{
+    ModelAnswer answer;
+    answer.model = model;
+    if (cancelled)
+    {
+        answer.text = "Cancelled.";
+        return answer;
+    }
+    if (response.empty())
+    {
+        answer.text = "No response (the request failed).";
+        return answer;
+    }
+    try
+    {
+        ChatResponse parsed = parseChatResponse(response);
+        answer.finishReason = std::move(parsed.finishReason);
+        answer.hasUsage = parsed.hasUsage;
+        answer.usage = parsed.usage;
+        if (parsed.hasError)
+        {
+            answer.text = "API error: " + (parsed.errorMessage.empty() ? "Unknown error" : parsed.errorMessage);
+        }
+        else if (!parsed.hasContent)
+        {
+            answer.text = "The response had no message content.";
+        }
+        else
+        {
+            answer.ok = true;
+            answer.text = std::move(parsed.content);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        answer.text = std::string("Unreadable response: ") + e.what();
+    }
+    return answer;
+}
+} // namespace
+
+std::vector<ModelAnswer> compareModels(const std::vector<std::string> &models, const std::string &prompt,
+                                       const ChatHistory &history, const ModelAnswerFn &onAnswer,
+                                       const std::atomic<bool> *cancelFlag)
+{
+    // One copy of the history serves every model: only the model name differs between the bodies
+    size_t budget = requestTokenBudget(prompt, models.size());
+    ChatHistory requestHistory = history;
+    requestHistory.addDialog("user", prompt);
+    std::vector<std::string> payloads;
+    for (const std::string &model : models)
+    {
+        payloads.push_back(requestHistory.buildRequestPayload(model, false, budget));
+    }
+
+    std::vector<ModelAnswer> answers(models.size());
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        threads.emplace_back([&, i] {
+            auto start = std::chrono::steady_clock::now();
+            std::string response = sendChatRequest(payloads[i], cancelFlag);
+            bool cancelled = cancelFlag != nullptr && cancelFlag->load();
+            ModelAnswer answer = _answerFrom(models[i], response, cancelled);
+            answer.latencyMs =
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (onAnswer)
+            {
+                onAnswer(answer);
+            }
+            answers[i] = std::move(answer);
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    return answers;
+}
+
+std::string formatModelAnswer(const ModelAnswer &answer)
+{
+    std::string text = "[" + answer.model + "] " + _seconds(answer.latencyMs);
+    if (answer.hasUsage)
+    {
+        text += ", " + std::to_string(answer.usage.promptTokens) + " prompt + " +
+                std::to_string(answer.usage.completionTokens) + " completion tokens";
+    }
+    return text + "\n" + answer.text;
+}
+
+std::string formatComparison(const std::vector<ModelAnswer> &answers, double wallMs)
+{
+    size_t modelWidth = 5;
+    double serialMs = 0;
+    for (const ModelAnswer &answer : answers)
+    {
+        modelWidth = std::max(modelWidth, answer.model.size());
+        serialMs += answer.latencyMs;
+    }
+
+    std::ostringstream oss;
+    oss << std::left << std::setw(static_cast<int>(modelWidth + 2)) << "Model" << std::right << std::setw(10)
+        << "Latency" << std::setw(10) << "Prompt" << std::setw(12) << "Completion" << "  Finish\n";
+    for (const ModelAnswer &answer : answers)
+    {
+        oss << std::left << std::setw(static_cast<int>(modelWidth + 2)) << answer.model << std::right << std::setw(10)
+            << _seconds(answer.latencyMs);
+        if (answer.hasUsage)
+        {
+            oss << std::setw(10) << answer.usage.promptTokens << std::setw(12) << answer.usage.completionTokens;
+        }
+        else
+        {
+            oss << std::setw(10) << "-" << std::setw(12) << "-";
+        }
+        oss << "  " << (answer.ok ? (answer.finishReason.empty() ? "-" : answer.finishReason) : "failed") << "\n";
+    }
+    oss << "Compared " << answers.size() << " models in " << _seconds(wallMs) << " (" << _seconds(serialMs)
+        << " one after another).";
+    return oss.str();
+}
@@ -0,0 +1,59 @@
+//  compare.hpp
+//
+// Sends one prompt to several models at once, for %compare
+
+#ifndef compare_hpp
+#define compare_hpp
+
+#include "chathistory.hpp"
+#include "responseparser.hpp"
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// @brief One model's reply to a compared prompt.
+struct ModelAnswer
+{
+    std::string model;
+    bool ok = false;          // The model replied with content
+    std::string text;         // The reply, or what went wrong
+    std::string finishReason; // As reported by the API
+    double latencyMs = 0;     // From sending the request to having the whole reply
+    bool hasUsage = false;
+    ChatUsage usage;
+};
+
+using ModelAnswerFn = std::function<void(const ModelAnswer &)>;
+
+/**
+ * @brief Sends history plus prompt to every model concurrently.
+ *
+ * Each request is a plain (non-streaming) chat completion built from one copy of the history
+ * and sent on its own thread, so the whole comparison takes as long as the slowest model
+ * rather than the sum of all of them.
+ *
+ * @param models The models to ask.
+ * @param prompt The user message to send after the history.
+ * @param history The conversation to send as context; it is not modified.
+ * @param onAnswer Called with each answer as it arrives, one at a time, from the request threads.
+ * @param cancelFlag Optional flag that aborts the requests still running.
+ * @return The answers in the order of models.
+ * @throws UsageLimitExceeded if the token limits leave no room to send prompt to every model.
+ */
+std::vector<ModelAnswer> compareModels(const std::vector<std::string> &models, const std::string &prompt,
+                                       const ChatHistory &history, const ModelAnswerFn &onAnswer,
+                                       const std::atomic<bool> *cancelFlag = nullptr);
+
+/**
+ * @brief Formats one answer with a header line giving its model, latency and token usage.
+ */
+std::string formatModelAnswer(const ModelAnswer &answer);
+
+/**
+ * @brief Formats a side-by-side summary of a comparison: one row per model with latency,
+ * tokens and finish reason, and the wall time against the serial time it saved.
+ */
+std::string formatComparison(const std::vector<ModelAnswer> &answers, double wallMs);
+
+#endif /* compare_hpp */
@@ -0,0 +1,118 @@
+//  connectionpool.cpp
+//
+// Process-wide pool of reusable cURL handles sharing DNS, TLS sessions and connections
+
+#include "connectionpool.hpp"
+
+ConnectionPool &ConnectionPool::instance()
+{
+    // Intentionally never destroyed: a request may still be running on the executor thread
+    // when %quit calls std::exit, and tearing down the share under it would crash.
+    static ConnectionPool *pool = new ConnectionPool();
+    return *pool;
+}
+
+ConnectionPool::ConnectionPool()
+{
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    m_share = curl_share_init();
+    if (m_share != nullptr)
+    {
+        curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, _lockShare);
+        curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, _unlockShare);
+        curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+}
+
+void ConnectionPool::HandleDeleter::operator()(CURL *curl) const
+{
+    ConnectionPool::instance()._release(curl);
+}
+
+ConnectionPool::Handle ConnectionPool::acquire(const std::string &url)
+{
+    CURL *curl = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        if (!m_idleHandles.empty())
+        {
+            curl = m_idleHandles.back();
+            m_idleHandles.pop_back();
+        }
+    }
+
+    if (curl == nullptr)
+    {
+        curl = curl_easy_init();
+        if (curl == nullptr)
+        {
+            return Handle();
+        }
+    }
+
+    _configure(curl, url);
+    return Handle(curl);
+}
+
+void ConnectionPool::recordTransfer(CURL *curl, CURLcode result)
+{
+    if (result != CURLE_OK)
+    {
+        return;
+    }
+
+    long newConnections = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &newConnections);
+    if (newConnections > 0)
+    {
+        m_opened += static_cast<size_t>(newConnections);
+    }
+    else
+    {
+        ++m_reused;
+    }
+}
+
+ConnectionStats ConnectionPool::stats() const
+{
+    ConnectionStats stats;
+    stats.opened = m_opened;
+    stats.reused = m_reused;
+    return stats;
+}
+
+void ConnectionPool::_release(CURL *curl)
+{
+    // Drop per-request options (URL, headers, callbacks) but keep the handle's caches
+    curl_easy_reset(curl);
+
+    std::lock_guard<std::mutex> lock(m_idleMutex);
+    m_idleHandles.push_back(curl);
+}
+
+void ConnectionPool::_configure(CURL *curl, const std::string &url)
+{
+    if (m_share != nullptr)
+    {
+        curl_easy_setopt(curl, CURLOPT_SHARE, m_share);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, url.rfind("https://", 0) == 0 ? 1L : 0L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, 300L);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+}
+
+void ConnectionPool::_lockShare(CURL *, curl_lock_data data, curl_lock_access, void *userp)
+{
+    static_cast<ConnectionPool *>(userp)->m_shareLocks[data].lock();
+}
+
+void ConnectionPool::_unlockShare(CURL *, curl_lock_data data, void *userp)
+{
+    static_cast<ConnectionPool *>(userp)->m_shareLocks[data].unlock();
+}
@@ -0,0 +1,92 @@
+//  connectionpool.hpp
+//
+// Process-wide pool of reusable cURL handles sharing DNS, TLS sessions and connections
+
+#ifndef connectionpool_hpp
+#define connectionpool_hpp
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <curl/curl.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// @brief Counts of connections opened versus reused by transfers made through the pool.
+struct ConnectionStats
+{
+    size_t opened = 0;
+    size_t reused = 0;
+};
+
+/// @class ConnectionPool
+/// @brief Owns reusable easy handles and a CURLSH share for the whole process.
+///
+/// All handles handed out share the DNS cache, TLS session cache and connection cache, so a
+/// later request to the same host skips the TCP and TLS handshakes. Handles prefer HTTP/2 over
+/// TLS and keep idle connections alive.
+class ConnectionPool
+{
+  public:
+    /// @brief Returns a handle to the pool when it goes out of scope.
+    struct HandleDeleter
+    {
+        void operator()(CURL *curl) const;
+    };
+    using Handle = std::unique_ptr<CURL, HandleDeleter>;
+
+    /**
+     * @brief Returns the process-wide pool, initializing libcurl on first use.
+     */
+    static ConnectionPool &instance();
+
+    /**
+     * @brief Hands out an easy handle attached to the shared caches, set up for a URL.
+     * The handle starts from default options plus the pool's connection settings. Transfers
+     * wait to multiplex on an existing connection only for https:// URLs, where HTTP/2 can be
+     * negotiated; on plain HTTP waiting would queue them behind the first response.
+     * @param url The URL the handle's transfers go to.
+     * @return A handle, or an empty Handle if cURL could not create one.
+     */
+    Handle acquire(const std::string &url);
+
+    /**
+     * @brief Records whether the last transfer on curl opened a new connection or reused one.
+     * @param curl The handle that just finished a transfer.
+     * @param result The result of curl_easy_perform; failed transfers are not counted.
+     */
+    void recordTransfer(CURL *curl, CURLcode result);
+
+    /**
+     * @brief Returns the connection counts recorded so far.
+     */
+    ConnectionStats stats() const;
+
+  private:
+    CURLSH *m_share = nullptr;
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> m_shareLocks;
+    std::mutex m_idleMutex;
+    std::vector<CURL *> m_idleHandles;
+    std::atomic<size_t> m_opened{0};
+    std::atomic<size_t> m_reused{0};
+
+    ConnectionPool();
+    ~ConnectionPool() = delete; // Lives until process exit, see instance()
+
+    /**
+     * @brief Resets a handle and puts it back on the idle list.
+     */
+    void _release(CURL *curl);
+
+    /**
+     * @brief Applies the share, the keep-alive/HTTP/2 settings and the URL to a fresh or reset handle.
+     */
+    void _configure(CURL *curl, const std::string &url);
+
+    static void _lockShare(CURL *, curl_lock_data data, curl_lock_access, void *userp);
+    static void _unlockShare(CURL *, curl_lock_data data, void *userp);
+};
+
+#endif /* connectionpool_hpp */
@@ -0,0 +1,680 @@
+//  corpusindex.cpp
+//
+// BM25 index of the files under a directory, for retrieving the excerpts %ask sends
+
+#include "corpusindex.hpp"
+#include "filereadwrite.hpp"
+#include "sha256.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+constexpr char kFileMagic[8] = {'C', 'G', 'P', 'T', 'B', 'M', '0', '1'};
+
+/// BM25 parameters: how fast a term's repetitions saturate, and how much excerpt length counts
+constexpr float kK1 = 1.2f;
+constexpr float kB = 0.75f;
+
+/// Hash ranges the postings are sorted in, in parallel; a power of two
+constexpr size_t kPartitions = 64;
+
+/// How many times the excerpts asked for search ranks, to make up for those whose files changed
+constexpr size_t kStaleLookahead = 4;
+
+/// @brief The start of an index file, giving the size and place of every section.
+struct IndexHeader
+{
+    char magic[8];
+    uint64_t files;
+    uint64_t chunks;
+    uint64_t terms;
+    uint64_t postings;
+    uint64_t bytes;     // Of the files indexed
+    uint64_t termCount; // Terms of all excerpts together, for the average excerpt length
+    uint64_t filesOffset;
+    uint64_t chunksOffset;
+    uint64_t termsOffset;
+    uint64_t postingsOffset;
+    uint64_t textOffset; // The root, then the files' paths relative to it
+    uint64_t textBytes;
+    uint64_t rootLength;
+};
+
+/// @brief One indexed file, relative to the root.
+struct FileRecord
+{
+    uint64_t pathOffset; // In the text section
+    uint32_t pathLength;
+    uint32_t firstChunk;
+    uint64_t size;
+    int64_t modified; // Nanoseconds since the epoch
+};
+
+/// @brief One excerpt: a byte range of a file.
+struct ChunkRecord
+{
+    uint32_t file;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t terms; // Its length for BM25
+    uint32_t line;  // From 1
+};
+
+/// @brief One term, by hash, and where its postings are.
+struct TermRecord
+{
+    uint64_t hash;
+    uint64_t firstPosting;
+    uint32_t postings;
+    uint32_t reserved;
+};
+
+/// @brief One excerpt a term occurs in, and how often.
+struct PostingRecord
+{
+    uint32_t chunk;
+    uint32_t frequency;
+};
+
+/// @brief A posting as the indexing threads find it, before excerpts have their final numbers.
+struct RawPosting
+{
+    uint64_t hash;
+    uint32_t file; // Index in the list of files found
+    uint16_t chunkInFile;
+    uint16_t frequency;
+};
+
+/// @brief What an indexing thread learned about one file.
+struct FileResult
+{
+    bool indexed = false;
+    uint64_t size = 0;
+    int64_t modified = 0;
+    std::vector<ChunkRecord> chunks; // file and line filled in; file is renumbered later
+};
+
+std::runtime_error _systemError(const std::string &what, const std::filesystem::path &path)
+{
+    return std::runtime_error(what + " " + path.string() + ": " + std::strerror(errno));
+}
+
+int64_t _modified(const struct stat &status)
+{
+    return static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+}
+
+bool _isWordByte(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+bool _isUpper(char c)
+{
+    return c >= 'A' && c <= 'Z';
+}
+
+/// FNV-1a over the lowercased bytes of a word
+uint64_t _hash(const char *word, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; ++i)
+    {
+        char c = word[i];
+        hash = (hash ^ static_cast<unsigned char>(_isUpper(c) ? c | 0x20 : c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/**
+ * @brief Calls visit(hash) for each term of text: each word, and each part of at least two
+ * bytes of a word in camelCase or snake_case.
+ */
+template <typename Visit> void _forEachTerm(std::string_view text, Visit &&visit)
+{
+    const char *data = text.data();
+    size_t i = 0;
+    while (i < text.size())
+    {
+        while (i < text.size() && !_isWordByte(static_cast<unsigned char>(data[i])))
+        {
+            ++i;
+        }
+        size_t begin = i;
+        bool split = false;
+        while (i < text.size() && _isWordByte(static_cast<unsigned char>(data[i])))
+        {
+            split = split || data[i] == '_' || (i > begin && _isUpper(data[i]) && !_isUpper(data[i - 1]));
+            ++i;
+        }
+        if (i == begin)
+        {
+            continue;
+        }
+        visit(_hash(data + begin, i - begin));
+        if (!split)
+        {
+            continue;
+        }
+        size_t part = begin;
+        for (size_t j = begin; j <= i; ++j)
+        {
+            bool boundary = j == i || data[j] == '_' || (j > part && _isUpper(data[j]) && !_isUpper(data[j - 1]));
+            if (!boundary)
+            {
+                continue;
+            }
+            if (j - part >= 2)
+            {
+                visit(_hash(data + part, j - part));
+            }
+            part = data[j] == '_' ? j + 1 : j;
+        }
+    }
+}
+
+/// @brief Reads whole files into a buffer reused from one file to the next.
+struct FileReader
+{
+    std::string buffer;
+
+    /// Returns false, leaving the result unindexed, for files that are unreadable, empty, too large or binary
+    bool read(const std::filesystem::path &path, size_t maxBytes, FileResult &result)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat status;
+        bool ok = fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0 &&
+                  static_cast<size_t>(status.st_size) <= maxBytes;
+        size_t filled = 0;
+        if (ok)
+        {
+            buffer.resize(static_cast<size_t>(status.st_size));
+            while (filled < buffer.size())
+            {
+                ssize_t got = ::read(fd, &buffer[filled], buffer.size() - filled);
+                if (got < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (got <= 0)
+                {
+                    break;
+                }
+                filled += static_cast<size_t>(got);
+            }
+        }
+        close(fd);
+        buffer.resize(filled);
+        // Like readFiles, a NUL byte near the start marks a binary file
+        if (!ok || filled == 0 || std::memchr(buffer.data(), '\0', std::min<size_t>(filled, 8000)) != nullptr)
+        {
+            return false;
+        }
+        result.size = filled;
+        result.modified = _modified(status);
+        return true;
+    }
+};
+
+/**
+ * @brief Splits one file into excerpts and appends the postings of each to the partitions.
+ */
+void _indexFile(uint32_t file, std::string_view text, size_t chunkBytes, FileResult &result,
+                std::vector<std::vector<RawPosting>> &partitions, std::vector<uint64_t> &terms)
+{
+    const unsigned shift = 64 - 6; // log2(kPartitions)
+    uint32_t line = 1;
+    size_t counted = 0; // Newlines are counted up to here
+    for (std::string_view chunk : splitIntoChunks(text, chunkBytes))
+    {
+        if (result.chunks.size() == UINT16_MAX)
+        {
+            break; // Files this long are skipped by maxFileBytes long before
+        }
+        size_t offset = static_cast<size_t>(chunk.data() - text.data());
+        line += static_cast<uint32_t>(std::count(text.data() + counted, text.data() + offset, '\n'));
+        counted = offset;
+
+        terms.clear();
+        _forEachTerm(chunk, [&](uint64_t hash) { terms.push_back(hash); });
+        uint16_t chunkInFile = static_cast<uint16_t>(result.chunks.size());
+        result.chunks.push_back(ChunkRecord{file, static_cast<uint32_t>(offset), static_cast<uint32_t>(chunk.size()),
+                                            static_cast<uint32_t>(terms.size()), line});
+
+        // Sorting the excerpt's terms counts them without a hash table
+        std::sort(terms.begin(), terms.end());
+        for (size_t i = 0; i < terms.size();)
+        {
+            size_t j = i + 1;
+            while (j < terms.size() && terms[j] == terms[i])
+            {
+                ++j;
+            }
+            partitions[terms[i] >> shift].push_back(RawPosting{
+                terms[i], file, chunkInFile, static_cast<uint16_t>(std::min<size_t>(j - i, UINT16_MAX))});
+            i = j;
+        }
+    }
+}
+
+/**
+ * @brief Runs work(thread) on count threads, the calling thread being thread 0.
+ */
+void _runOnThreads(size_t count, const std::function<void(size_t thread)> &work)
+{
+    std::vector<std::thread> threads;
+    for (size_t thread = 1; thread < count; ++thread)
+    {
+        threads.emplace_back(work, thread);
+    }
+    work(0);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+template <typename Record> std::string_view _bytes(const std::vector<Record> &records)
+{
+    return std::string_view(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(Record));
+}
+
+uint64_t _aligned(uint64_t offset)
+{
+    return (offset + 7) & ~uint64_t(7);
+}
+} // namespace
+
+CorpusBuildReport buildCorpusIndex(const std::filesystem::path &root, const std::filesystem::path &indexPath,
+                                   const CorpusBuildOptions &options,
+                                   const std::function<void(size_t done, size_t total)> &progress)
+{
+    static_assert(sizeof(ChunkRecord) == 20 && sizeof(TermRecord) == 24 && sizeof(PostingRecord) == 8,
+                  "record layouts are part of the file format");
+    std::error_code error;
+    if (!std::filesystem::is_directory(root, error))
+    {
+        throw std::runtime_error("Not a directory: " + root.string());
+    }
+    std::vector<std::string> unmatched;
+    const std::vector<std::filesystem::path> paths = expandFilePatterns({root.string()}, unmatched);
+    const size_t threads = std::max<size_t>(
+        1, options.threads != 0 ? options.threads : static_cast<size_t>(std::thread::hardware_concurrency()));
+
+    // Read and count the terms of the files on every core; each thread takes the next file
+    std::vector<FileResult> results(paths.size());
+    std::vector<std::vector<std::vector<RawPosting>>> partitions(
+        threads, std::vector<std::vector<RawPosting>>(kPartitions));
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    _runOnThreads(threads, [&](size_t thread) {
+        FileReader reader;
+        std::vector<uint64_t> terms;
+        for (size_t file = next++; file < paths.size(); file = next++)
+        {
+            if (reader.read(paths[file], options.maxFileBytes, results[file]))
+            {
+                results[file].indexed = true;
+                _indexFile(static_cast<uint32_t>(file), reader.buffer, options.chunkBytes, results[file],
+                           partitions[thread], terms);
+            }
+            ++done;
+            if (thread == 0 && progress)
+            {
+                progress(done.load(), paths.size());
+            }
+        }
+    });
+
+    // Number the excerpts in file order, leaving out the files that were skipped
+    CorpusBuildReport report;
+    std::vector<uint32_t> firstChunk(paths.size(), 0);
+    std::vector<FileRecord> files;
+    std::vector<ChunkRecord> chunks;
+    std::string text = root.string();
+    uint64_t termCount = 0;
+    for (size_t file = 0; file < paths.size(); ++file)
+    {
+        FileResult &result = results[file];
+        if (!result.indexed)
+        {
+            ++report.skipped;
+            continue;
+        }
+        std::string relative = paths[file].lexically_relative(root).string();
+        firstChunk[file] = static_cast<uint32_t>(chunks.size());
+        files.push_back(FileRecord{text.size(), static_cast<uint32_t>(relative.size()),
+                                   static_cast<uint32_t>(chunks.size()), result.size, result.modified});
+        text += relative;
+        for (ChunkRecord chunk : result.chunks)
+        {
+            chunk.file = static_cast<uint32_t>(files.size() - 1);
+            termCount += chunk.terms;
+            chunks.push_back(chunk);
+        }
+        report.bytes += result.size;
+        std::vector<ChunkRecord>().swap(result.chunks);
+    }
+    report.files = files.size();
+    report.chunks = chunks.size();
+
+    // Sort each hash range's postings into term order, in parallel; ranges are disjoint and
+    // ordered, so the ranges' terms laid end to end are sorted too
+    std::vector<std::vector<TermRecord>> rangeTerms(kPartitions);
+    std::vector<std::vector<PostingRecord>> rangePostings(kPartitions);
+    std::atomic<size_t> nextRange{0};
+    _runOnThreads(threads, [&](size_t) {
+        for (size_t range = nextRange++; range < kPartitions; range = nextRange++)
+        {
+            std::vector<RawPosting> raw;
+            for (auto &threadPartitions : partitions)
+            {
+                raw.insert(raw.end(), threadPartitions[range].begin(), threadPartitions[range].end());
+                std::vector<RawPosting>().swap(threadPartitions[range]);
+            }
+            std::vector<std::pair<uint64_t, PostingRecord>> sorted;
+            sorted.reserve(raw.size());
+            for (const RawPosting &posting : raw)
+            {
+                sorted.push_back({posting.hash, PostingRecord{firstChunk[posting.file] + posting.chunkInFile,
+                                                              posting.frequency}});
+            }
+            std::vector<RawPosting>().swap(raw);
+            std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+                return a.first < b.first || (a.first == b.first && a.second.chunk < b.second.chunk);
+            });
+            std::vector<TermRecord> &terms = rangeTerms[range];
+            std::vector<PostingRecord> &postings = rangePostings[range];
+            postings.reserve(sorted.size());
+            for (const auto &[hash, posting] : sorted)
+            {
+                if (terms.empty() || terms.back().hash != hash)
+                {
+                    terms.push_back(TermRecord{hash, postings.size(), 0, 0});
+                }
+                ++terms.back().postings;
+                postings.push_back(posting);
+            }
+        }
+    });
+
+    std::vector<TermRecord> terms;
+    uint64_t postingCount = 0;
+    for (size_t range = 0; range < kPartitions; ++range)
+    {
+        for (TermRecord term : rangeTerms[range])
+        {
+            term.firstPosting += postingCount;
+            terms.push_back(term);
+        }
+        postingCount += rangePostings[range].size();
+    }
+    report.terms = terms.size();
+    report.postings = postingCount;
+
+    IndexHeader header{};
+    std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+    header.files = files.size();
+    header.chunks = chunks.size();
+    header.terms = terms.size();
+    header.postings = postingCount;
+    header.bytes = report.bytes;
+    header.termCount = termCount;
+    header.filesOffset = _aligned(sizeof(header));
+    header.chunksOffset = _aligned(header.filesOffset + files.size() * sizeof(FileRecord));
+    header.termsOffset = _aligned(header.chunksOffset + chunks.size() * sizeof(ChunkRecord));
+    header.postingsOffset = _aligned(header.termsOffset + terms.size() * sizeof(TermRecord));
+    header.textOffset = _aligned(header.postingsOffset + postingCount * sizeof(PostingRecord));
+    header.textBytes = text.size();
+    header.rootLength = root.string().size();
+
+    writeFileAtomically(indexPath, [&](const WritePieceFn &write) {
+        const char padding[8] = {};
+        uint64_t written = 0;
+        auto section = [&](uint64_t offset, std::string_view bytes) {
+            write(std::string_view(padding, offset - written));
+            write(bytes);
+            written = offset + bytes.size();
+        };
+        section(0, std::string_view(reinterpret_cast<const char *>(&header), sizeof(header)));
+        section(header.filesOffset, _bytes(files));
+        section(header.chunksOffset, _bytes(chunks));
+        section(header.termsOffset, _bytes(terms));
+        section(header.postingsOffset, {});
+        for (const std::vector<PostingRecord> &postings : rangePostings)
+        {
+            section(written, _bytes(postings));
+        }
+        section(header.textOffset, text);
+    });
+    return report;
+}
+
+namespace
+{
+const IndexHeader &_header(const void *map)
+{
+    return *static_cast<const IndexHeader *>(map);
+}
+} // namespace
+
+CorpusIndex::CorpusIndex(const std::filesystem::path &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw _systemError("Unable to open index", path);
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        close(fd);
+        throw _systemError("Unable to stat index", path);
+    }
+    m_length = static_cast<size_t>(status.st_size);
+    if (m_length < sizeof(IndexHeader))
+    {
+        close(fd);
+        throw std::runtime_error("Not a corpus index: " + path.string());
+    }
+    m_map = mmap(nullptr, m_length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m_map == MAP_FAILED)
+    {
+        m_map = nullptr;
+        throw _systemError("Unable to map index", path);
+    }
+
+    // Every section must lie inside the file, so lookups never need to check again
+    const IndexHeader &header = _header(m_map);
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t size) {
+        return offset <= m_length && count <= (m_length - offset) / size;
+    };
+    if (std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0 ||
+        !fits(header.filesOffset, header.files, sizeof(FileRecord)) ||
+        !fits(header.chunksOffset, header.chunks, sizeof(ChunkRecord)) ||
+        !fits(header.termsOffset, header.terms, sizeof(TermRecord)) ||
+        !fits(header.postingsOffset, header.postings, sizeof(PostingRecord)) ||
+        !fits(header.textOffset, header.textBytes, 1) || header.rootLength > header.textBytes)
+    {
+        munmap(m_map, m_length);
+        m_map = nullptr;
+        throw std::runtime_error("Not a corpus index: " + path.string());
+    }
+}
+
+CorpusIndex::~CorpusIndex()
+{
+    if (m_map != nullptr)
+    {
+        munmap(m_map, m_length);
+    }
+}
+
+std::vector<CorpusHit> CorpusIndex::search(std::string_view query, size_t count, size_t *stale) const
+{
+    const IndexHeader &header = _header(m_map);
+    const FileRecord *files = _section<FileRecord>(header.filesOffset);
+    const ChunkRecord *chunks = _section<ChunkRecord>(header.chunksOffset);
+    const TermRecord *terms = _section<TermRecord>(header.termsOffset);
+    const PostingRecord *postings = _section<PostingRecord>(header.postingsOffset);
+    const char *text = _section<char>(header.textOffset);
+    if (stale != nullptr)
+    {
+        *stale = 0;
+    }
+    std::vector<CorpusHit> hits;
+    if (header.chunks == 0 || count == 0)
+    {
+        return hits;
+    }
+
+    std::vector<uint64_t> queryTerms;
+    _forEachTerm(query, [&](uint64_t hash) { queryTerms.push_back(hash); });
+    std::sort(queryTerms.begin(), queryTerms.end());
+    queryTerms.erase(std::unique(queryTerms.begin(), queryTerms.end()), queryTerms.end());
+
+    // Okapi BM25, accumulated term by term into a score per excerpt
+    const float chunkCount = static_cast<float>(header.chunks);
+    const float averageLength = std::max(1.0f, static_cast<float>(header.termCount) / chunkCount);
+    std::vector<float> scores(header.chunks, 0.0f);
+    std::vector<uint32_t> scored;
+    for (uint64_t hash : queryTerms)
+    {
+        const TermRecord *term = std::lower_bound(terms, terms + header.terms, hash,
+                                                  [](const TermRecord &record, uint64_t value) { return record.hash < value; });
+        if (term == terms + header.terms || term->hash != hash || term->firstPosting + term->postings > header.postings)
+        {
+            continue;
+        }
+        const float frequency = static_cast<float>(term->postings);
+        const float idf = std::log(1.0f + (chunkCount - frequency + 0.5f) / (frequency + 0.5f));
+        for (const PostingRecord *posting = postings + term->firstPosting;
+             posting != postings + term->firstPosting + term->postings; ++posting)
+        {
+            if (posting->chunk >= header.chunks)
+            {
+                continue;
+            }
+            const float tf = static_cast<float>(posting->frequency);
+            const float length = static_cast<float>(chunks[posting->chunk].terms);
+            if (scores[posting->chunk] == 0.0f)
+            {
+                scored.push_back(posting->chunk);
+            }
+            scores[posting->chunk] += idf * tf * (kK1 + 1) / (tf + kK1 * (1 - kB + kB * length / averageLength));
+        }
+    }
+
+    size_t ranked = std::min(scored.size(), count * kStaleLookahead);
+    auto better = [&](uint32_t a, uint32_t b) { return scores[a] > scores[b] || (scores[a] == scores[b] && a < b); };
+    std::partial_sort(scored.begin(), scored.begin() + ranked, scored.end(), better);
+
+    const std::filesystem::path rootPath(std::string(text, header.rootLength));
+    for (size_t i = 0; i < ranked && hits.size() < count; ++i)
+    {
+        const ChunkRecord &chunk = chunks[scored[i]];
+        if (chunk.file >= header.files)
+        {
+            continue;
+        }
+        const FileRecord &file = files[chunk.file];
+        if (file.pathOffset + file.pathLength > header.textBytes)
+        {
+            continue;
+        }
+        CorpusHit hit;
+        hit.path = rootPath / std::string(text + file.pathOffset, file.pathLength);
+        hit.line = chunk.line;
+        hit.score = scores[scored[i]];
+
+        // The excerpt is read from its file, unless the file is no longer what was indexed
+        int fd = open(hit.path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat status;
+        bool unchanged = fd >= 0 && fstat(fd, &status) == 0 && static_cast<uint64_t>(status.st_size) == file.size &&
+                         _modified(status) == file.modified;
+        if (unchanged)
+        {
+            hit.text.resize(chunk.length);
+            unchanged = pread(fd, &hit.text[0], chunk.length, chunk.offset) == static_cast<ssize_t>(chunk.length);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        if (!unchanged)
+        {
+            if (stale != nullptr)
+            {
+                ++*stale;
+            }
+            continue;
+        }
+        hits.push_back(std::move(hit));
+    }
+    return hits;
+}
+
+std::filesystem::path CorpusIndex::root() const
+{
+    const IndexHeader &header = _header(m_map);
+    return std::filesystem::path(std::string(_section<char>(header.textOffset), header.rootLength));
+}
+
+size_t CorpusIndex::files() const
+{
+    return _header(m_map).files;
+}
+
+size_t CorpusIndex::chunks() const
+{
+    return _header(m_map).chunks;
+}
+
+uint64_t CorpusIndex::bytes() const
+{
+    return _header(m_map).bytes;
+}
+
+std::filesystem::path corpusIndexPath(const std::filesystem::path &root)
+{
+    std::filesystem::path directory;
+    if (const char *configured = std::getenv("CHATGPT_CLI_INDEX_DIR"); configured != nullptr && *configured != '\0')
+    {
+        directory = configured;
+    }
+    else if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg != '\0')
+    {
+        directory = std::filesystem::path(xdg) / "chatgpt-cli" / "index";
+    }
+    else if (const char *home = std::getenv("HOME"); home != nullptr && *home != '\0')
+    {
+        directory = std::filesystem::path(home) / ".cache" / "chatgpt-cli" / "index";
+    }
+    else
+    {
+        directory = std::filesystem::temp_directory_path() / "chatgpt-cli-index";
+    }
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(root, error).lexically_normal();
+    if (!absolute.has_filename() && absolute.has_relative_path())
+    {
+        absolute = absolute.parent_path(); // "dir/" and "dir" share an index
+    }
+    return directory / (Sha256::toHex(Sha256::hash(absolute.string())).substr(0, 16) + ".bm25");
+}
@@ -0,0 +1,122 @@
+//  corpusindex.hpp
+//
+// BM25 index of the files under a directory, for retrieving the excerpts %ask sends
+
+#ifndef corpusindex_hpp
+#define corpusindex_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// @brief How buildCorpusIndex reads and splits the files.
+struct CorpusBuildOptions
+{
+    size_t chunkBytes = 2048;             // Largest excerpt; files are split at line ends where possible
+    size_t maxFileBytes = 4 * 1024 * 1024; // Larger files are skipped
+    size_t threads = 0;                   // Indexing threads; 0 for one per core
+};
+
+/// @brief What buildCorpusIndex did.
+struct CorpusBuildReport
+{
+    size_t files = 0;    // Files indexed
+    size_t skipped = 0;  // Files skipped: binary, empty, too large or unreadable
+    size_t bytes = 0;    // Bytes indexed
+    size_t chunks = 0;   // Excerpts the files were split into
+    size_t terms = 0;    // Distinct terms
+    size_t postings = 0; // (term, excerpt) pairs
+};
+
+/// @brief One excerpt retrieved for a query.
+struct CorpusHit
+{
+    std::filesystem::path path; // The file it comes from
+    size_t line = 0;            // Line of the file it starts at, from 1
+    std::string text;
+    float score = 0;
+};
+
+/**
+ * @brief Indexes the files under root and writes the index to indexPath, replacing it once complete.
+ *
+ * Files are found as %readfile finds them in a directory (hidden entries are skipped), split
+ * into excerpts of at most options.chunkBytes, and their terms counted on one thread per core.
+ * Terms are words, lowercased, plus the parts of words written in camelCase or snake_case, so
+ * "parse query" finds parseSearchQuery. The terms' posting lists are then sorted and written
+ * out in parallel, in hash ranges.
+ *
+ * @param root The directory to index.
+ * @param indexPath The index file to write (see corpusIndexPath).
+ * @param options How to read and split the files.
+ * @param progress Called now and then with the files read so far and the total, on the calling thread.
+ * @throws std::runtime_error if root is not a directory or the index cannot be written.
+ */
+CorpusBuildReport buildCorpusIndex(const std::filesystem::path &root, const std::filesystem::path &indexPath,
+                                   const CorpusBuildOptions &options = {},
+                                   const std::function<void(size_t done, size_t total)> &progress = {});
+
+/// @class CorpusIndex
+/// @brief A read-only, memory-mapped index written by buildCorpusIndex, ranking excerpts with BM25.
+///
+/// The file holds fixed-size records only: the files, the excerpts (where each one is in its
+/// file, and its length in terms), the terms sorted by 64-bit hash, and their postings. Opening
+/// it maps it and parses nothing; a query looks each of its terms up by binary search and adds
+/// up the scores of their postings. Excerpt text is not stored but read from the files, so an
+/// excerpt whose file changed since indexing is left out rather than sent out of date.
+///
+/// All methods may be called from any thread.
+class CorpusIndex
+{
+  public:
+    /**
+     * @brief Maps the index file at path.
+     * @throws std::runtime_error if it cannot be read or is not a corpus index.
+     */
+    explicit CorpusIndex(const std::filesystem::path &path);
+    ~CorpusIndex();
+    CorpusIndex(const CorpusIndex &) = delete;
+    CorpusIndex &operator=(const CorpusIndex &) = delete;
+
+    /**
+     * @brief Returns the count best excerpts for query, best first, read from their files.
+     * @param stale If given, receives how many better-ranked excerpts were left out because
+     *        their files changed since indexing.
+     */
+    std::vector<CorpusHit> search(std::string_view query, size_t count, size_t *stale = nullptr) const;
+
+    /**
+     * @brief Returns the directory that was indexed.
+     */
+    std::filesystem::path root() const;
+
+    size_t files() const;
+    size_t chunks() const;
+
+    /**
+     * @brief Returns the total size of the files indexed, in bytes.
+     */
+    uint64_t bytes() const;
+
+  private:
+    void *m_map = nullptr; // Starts with the header that gives the place of each section
+    size_t m_length = 0;
+
+    template <typename Record> const Record *_section(uint64_t offset) const
+    {
+        return reinterpret_cast<const Record *>(static_cast<const char *>(m_map) + offset);
+    }
+};
+
+/**
+ * @brief Returns where the index of root is kept: under CHATGPT_CLI_INDEX_DIR, or
+ * "chatgpt-cli/index" under $XDG_CACHE_HOME (default ~/.cache), named by a hash of root's
+ * absolute path.
+ */
+std::filesystem::path corpusIndexPath(const std::filesystem::path &root);
+
+#endif /* corpusindex_hpp */
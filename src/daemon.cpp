@@ -0,0 +1,1374 @@
+//  daemon.cpp
+//
+// Daemon mode: one long-lived process answering chat requests from many clients over a Unix socket
+
+#include "daemon.hpp"
+#include "connectionpool.hpp"
+#include "ratelimiter.hpp"
+#include "request.hpp"
+#include "usageledger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+/// Longest request line a client may send; its connection stops being read past it
+constexpr size_t kMaxRequestBytes = 256 * 1024 * 1024;
+
+/// Events epoll_wait hands back at once
+constexpr int kMaxEvents = 64;
+
+/// Conversations sent by clients that are kept for their next turn
+constexpr size_t kRememberedConversations = 64;
+
+/// What an epoll event is about, kept in the upper half of its data; the lower half is the descriptor
+enum : uint64_t
+{
+    kListenEvent = 1,
+    kWakeEvent = 2,
+    kClientEvent = 3,
+    kCurlEvent = 4,
+};
+
+uint64_t _tag(uint64_t kind, int fd)
+{
+    return kind << 32 | static_cast<uint32_t>(fd);
+}
+
+/// Appends one message to the key of a conversation; lengths keep the encoding unambiguous, so a
+/// conversation continues another exactly when the other's key is a prefix of its own
+void _appendMessage(std::string &key, std::string_view role, std::string_view content)
+{
+    key += std::to_string(role.size());
+    key += ':';
+    key += role;
+    key += std::to_string(content.size());
+    key += ':';
+    key += content;
+}
+
+std::string _line(const nlohmann::json &value)
+{
+    return value.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n";
+}
+
+/**
+ * @throws std::runtime_error if path does not fit in a socket address.
+ */
+sockaddr_un _address(const std::filesystem::path &path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const std::string &name = path.native();
+    if (name.empty() || name.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Invalid socket path: " + name);
+    }
+    std::memcpy(address.sun_path, name.data(), name.size());
+    return address;
+}
+
+/**
+ * @brief Returns true if the process at the other end of a Unix socket runs as this user.
+ */
+bool _peerIsUser(int fd)
+{
+    ucred peer{};
+    socklen_t size = sizeof(peer);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 && peer.uid == getuid();
+}
+
+/**
+ * @brief Connects to the daemon at path. A listener run by another user is refused, since the
+ * conversation sent to it would be theirs to read and answer.
+ * @return The connected socket, or -1 with errno set if no daemon of this user is listening there.
+ */
+int _connect(const std::filesystem::path &path)
+{
+    sockaddr_un address = _address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    if (!_peerIsUser(fd))
+    {
+        close(fd);
+        errno = EPERM;
+        return -1;
+    }
+    return fd;
+}
+
+/// @brief Closes a socket when it goes out of scope.
+struct _Socket
+{
+    int fd;
+
+    ~_Socket()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+};
+
+bool _sendAll(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+/// @brief Splits what a daemon sends into lines.
+class _LineReader
+{
+  public:
+    explicit _LineReader(int fd) : m_fd(fd)
+    {
+    }
+
+    /**
+     * @brief Reads the next line, without its newline.
+     * @return False at the end of the input, or once cancelFlag (if given) is raised.
+     */
+    bool next(std::string &line, const std::atomic<bool> *cancelFlag)
+    {
+        while (true)
+        {
+            size_t end = m_buffer.find('\n', m_scanned);
+            if (end != std::string::npos)
+            {
+                line.assign(m_buffer, 0, end);
+                m_buffer.erase(0, end + 1);
+                m_scanned = 0;
+                return true;
+            }
+            m_scanned = m_buffer.size();
+            if (cancelFlag != nullptr)
+            {
+                // Woken every 50 ms to notice a cancel, as the in-process transfer's progress callback is
+                pollfd readable{m_fd, POLLIN, 0};
+                int ready = poll(&readable, 1, 50);
+                if (cancelFlag->load())
+                {
+                    return false;
+                }
+                if (ready == 0 || (ready < 0 && errno == EINTR))
+                {
+                    continue;
+                }
+            }
+            char chunk[16384];
+            ssize_t got = read(m_fd, chunk, sizeof(chunk));
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                return false;
+            }
+            m_buffer.append(chunk, static_cast<size_t>(got));
+        }
+    }
+
+  private:
+    int m_fd;
+    std::string m_buffer;
+    size_t m_scanned = 0; // m_buffer holds no newline before this
+};
+} // namespace
+
+/// @brief One connected client.
+struct ChatDaemon::Client
+{
+    int fd = -1;
+    std::string input;            // Received and not handled yet
+    size_t scanned = 0;           // input holds no newline before this
+    std::string output;           // Waiting for the socket to take it
+    bool inputClosed = false;     // The client shut down its side, or sent too long a line
+    bool watchingOutput = false;  // epoll reports writability, because output is waiting
+    Transfer *transfer = nullptr; // Its request in progress
+};
+
+/// @brief One request, from the line that asked it until its final line is sent.
+struct ChatDaemon::Transfer
+{
+    Client *client = nullptr;
+    std::string session;   // Empty when the client sent the conversation itself
+    std::string message;   // The new user message
+    ChatHistory history;   // The conversation it continues; once prepared, with the message added
+    bool prepared = false; // The bodies are built, and the session is held until the reply
+    std::string payload;   // The streamed request body
+    std::string cacheKey;  // The unstreamed body, which the response cache is keyed by
+    std::string reply;     // Content streamed so far
+    std::unique_ptr<SseParser> parser;
+    ConnectionPool::Handle handle;
+    RateLimiter::Lease lease;
+    bool leased = false;
+    RateLimitHeaders rateLimits;
+    int attempt = 0;
+    Clock::time_point notBefore; // Earliest start of the next attempt
+
+    // As in the in-process path, the body of an attempt that will be retried is held back
+    bool decided = false;   // Set once the first body bytes have been seen
+    bool holding = false;   // Body goes to held instead of the parser
+    bool forwarded = false; // Some body already reached the client, so the request cannot be retried
+    std::string held;
+};
+
+ChatDaemon::ChatDaemon(const DaemonOptions &options) : m_options(options)
+{
+    ConnectionPool::instance(); // Initializes libcurl
+    if (m_options.socketPath.empty())
+    {
+        m_options.socketPath = daemonSocketPath();
+    }
+    m_url = m_options.url.empty() ? chatCompletionsUrl() : m_options.url;
+    // Contexts are numbered from a random start, so a client of a daemon that was restarted cannot
+    // continue someone else's conversation in the new one
+    std::random_device random;
+    m_lastConversation = static_cast<uint64_t>(random()) << 32 | random();
+
+    const std::filesystem::path &path = m_options.socketPath;
+    sockaddr_un address = _address(path);
+    if (daemonListening(path))
+    {
+        throw std::runtime_error("A daemon is already listening on " + path.string());
+    }
+    unlink(path.c_str()); // Left by a daemon that did not exit cleanly
+
+    auto fail = [&](const std::string &what) {
+        std::string error = what + " " + path.string() + ": " + std::strerror(errno);
+        for (int fd : {m_listenFd, m_epollFd, m_wakeFd})
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        throw std::runtime_error(error);
+    };
+    m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // The daemon answers with the user's API keys, so only the user may connect: the socket is
+    // created 0600 rather than made so after bind, when someone else could already have connected
+    mode_t umaskBefore = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+    bool bound = m_listenFd >= 0 && bind(m_listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    int bindError = errno;
+    umask(umaskBefore);
+    errno = bindError;
+    if (!bound)
+    {
+        fail("Unable to bind");
+    }
+    if (chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(m_listenFd, SOMAXCONN) != 0)
+    {
+        unlink(path.c_str());
+        fail("Unable to listen on");
+    }
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event listenEvent{};
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.u64 = _tag(kListenEvent, m_listenFd);
+    epoll_event wakeEvent{};
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.u64 = _tag(kWakeEvent, m_wakeFd);
+    if (m_epollFd < 0 || m_wakeFd < 0 || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_listenFd, &listenEvent) != 0 ||
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &wakeEvent) != 0)
+    {
+        unlink(path.c_str());
+        fail("Unable to watch");
+    }
+
+    m_multi = curl_multi_init();
+    curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(m_multi, CURLMOPT_SOCKETFUNCTION, _socketCallback);
+    curl_multi_setopt(m_multi, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(m_multi, CURLMOPT_TIMERFUNCTION, _timerCallback);
+    curl_multi_setopt(m_multi, CURLMOPT_TIMERDATA, this);
+
+    // Requests are paced and spread over the configured keys; one header list per key
+    RateLimiter &limiter = sharedRateLimiter();
+    for (size_t key = 0; key < std::max<size_t>(limiter.keyCount(), 1); ++key)
+    {
+        struct curl_slist *headers = curl_slist_append(nullptr, "Content-Type: application/json");
+        if (key < limiter.keyCount())
+        {
+            std::string auth_header = "Authorization: Bearer " + limiter.key(key);
+            headers = curl_slist_append(headers, auth_header.c_str());
+        }
+        m_keyHeaders.push_back(headers);
+    }
+}
+
+ChatDaemon::~ChatDaemon()
+{
+    RateLimiter &limiter = sharedRateLimiter();
+    for (auto &[curl, transfer] : m_transfers)
+    {
+        curl_multi_remove_handle(m_multi, curl);
+        if (transfer->leased)
+        {
+            limiter.complete(transfer->lease, 0, RateLimitHeaders());
+        }
+    }
+    m_transfers.clear();
+    m_waiting.clear();
+    for (auto &[fd, client] : m_clients)
+    {
+        close(fd);
+    }
+    m_clients.clear();
+    curl_multi_cleanup(m_multi);
+    for (struct curl_slist *headers : m_keyHeaders)
+    {
+        curl_slist_free_all(headers);
+    }
+    close(m_listenFd);
+    close(m_epollFd);
+    close(m_wakeFd);
+    unlink(m_options.socketPath.c_str());
+}
+
+void ChatDaemon::run()
+{
+    epoll_event events[kMaxEvents];
+    std::vector<int> gone;
+    while (!m_stopping.load())
+    {
+        gone.clear();
+        for (auto &[fd, client] : m_clients)
+        {
+            _queueNext(*client);
+        }
+        Clock::time_point wake = _startWaiting();
+        for (auto &[fd, client] : m_clients)
+        {
+            bool finished = client->inputClosed && client->transfer == nullptr &&
+                            client->input.find('\n', client->scanned) == std::string::npos && client->output.empty();
+            if ((!client->output.empty() && !client->watchingOutput && !_flush(*client)) || finished)
+            {
+                gone.push_back(fd);
+            }
+        }
+        for (int fd : gone)
+        {
+            _close(fd);
+        }
+
+        // Sleep until a socket is ready, cURL's timer expires or a held-back request may start
+        if (m_curlTimerSet)
+        {
+            wake = std::min(wake, m_curlDeadline);
+        }
+        auto timeout = std::chrono::ceil<std::chrono::milliseconds>(wake - Clock::now());
+        int count = epoll_wait(m_epollFd, events, kMaxEvents, static_cast<int>(std::max<long long>(timeout.count(), 0)));
+        if (count < 0 && errno != EINTR)
+        {
+            throw std::runtime_error(std::string("epoll_wait failed: ") + std::strerror(errno));
+        }
+        int running = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const uint32_t ready = events[i].events;
+            const int fd = static_cast<int>(events[i].data.u64 & 0xffffffffu);
+            switch (events[i].data.u64 >> 32)
+            {
+            case kListenEvent:
+                _accept();
+                break;
+            case kWakeEvent: {
+                uint64_t value;
+                while (read(m_wakeFd, &value, sizeof(value)) > 0)
+                {
+                }
+                break;
+            }
+            case kClientEvent: {
+                auto it = m_clients.find(fd);
+                if (it == m_clients.end())
+                {
+                    break;
+                }
+                Client &client = *it->second;
+                if ((ready & EPOLLOUT) != 0 && !_flush(client))
+                {
+                    _close(fd);
+                    break;
+                }
+                if ((ready & (EPOLLIN | EPOLLRDHUP)) != 0)
+                {
+                    _read(client);
+                }
+                // A client that closed its socket, rather than only its sending side, has given up
+                if ((ready & (EPOLLHUP | EPOLLERR)) != 0)
+                {
+                    _close(fd);
+                }
+                break;
+            }
+            case kCurlEvent: {
+                int action = ((ready & EPOLLIN) != 0 ? CURL_CSELECT_IN : 0) |
+                             ((ready & EPOLLOUT) != 0 ? CURL_CSELECT_OUT : 0) |
+                             ((ready & (EPOLLERR | EPOLLHUP)) != 0 ? CURL_CSELECT_ERR : 0);
+                curl_multi_socket_action(m_multi, fd, action, &running);
+                break;
+            }
+            }
+        }
+        if (m_curlTimerSet && Clock::now() >= m_curlDeadline)
+        {
+            m_curlTimerSet = false;
+            curl_multi_socket_action(m_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+        _collectFinished();
+    }
+}
+
+void ChatDaemon::stop()
+{
+    // Only an atomic store and a write, which a signal handler may do
+    m_stopping.store(true);
+    uint64_t one = 1;
+    ssize_t written = write(m_wakeFd, &one, sizeof(one));
+    (void)written;
+}
+
+const std::filesystem::path &ChatDaemon::socketPath() const
+{
+    return m_options.socketPath;
+}
+
+DaemonStats ChatDaemon::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+size_t ChatDaemon::sessionSize(const std::string &name) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_sessions.find(name);
+    return it == m_sessions.end() ? 0 : it->second.size();
+}
+
+void ChatDaemon::_accept()
+{
+    while (true)
+    {
+        int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return; // EAGAIN once the backlog is empty; other errors concern that one connection
+        }
+        if (!_peerIsUser(fd))
+        {
+            close(fd); // Another user's requests would be made with this user's API keys
+            continue;
+        }
+        auto client = std::make_unique<Client>();
+        client->fd = fd;
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.u64 = _tag(kClientEvent, fd);
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        m_clients.emplace(fd, std::move(client));
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.clients;
+    }
+}
+
+void ChatDaemon::_read(Client &client)
+{
+    char chunk[65536];
+    while (!client.inputClosed)
+    {
+        ssize_t got = read(client.fd, chunk, sizeof(chunk));
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got < 0)
+        {
+            return; // EAGAIN: all read
+        }
+        if (got == 0 || client.input.size() + static_cast<size_t>(got) > kMaxRequestBytes)
+        {
+            if (got > 0)
+            {
+                _send(client, _line({{"error", "Request too long"}}));
+                client.input.clear();
+                client.scanned = 0;
+            }
+            // Lines already received are still answered, after which the connection is closed
+            client.inputClosed = true;
+            _watch(client);
+            return;
+        }
+        client.input.append(chunk, static_cast<size_t>(got));
+    }
+}
+
+bool ChatDaemon::_flush(Client &client)
+{
+    size_t sent = 0;
+    while (sent < client.output.size())
+    {
+        ssize_t written = send(client.fd, client.output.data() + sent, client.output.size() - sent,
+                               MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<size_t>(written);
+    }
+    client.output.erase(0, sent);
+    if (client.watchingOutput != !client.output.empty())
+    {
+        client.watchingOutput = !client.output.empty();
+        _watch(client);
+    }
+    return true;
+}
+
+void ChatDaemon::_watch(Client &client)
+{
+    epoll_event event{};
+    event.events = (client.inputClosed ? 0u : static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP)) |
+                   (client.watchingOutput ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.u64 = _tag(kClientEvent, client.fd);
+    epoll_ctl(m_epollFd, EPOLL_CTL_MOD, client.fd, &event);
+}
+
+void ChatDaemon::_close(int fd)
+{
+    auto it = m_clients.find(fd);
+    if (it == m_clients.end())
+    {
+        return;
+    }
+    if (Transfer *transfer = it->second->transfer)
+    {
+        // Its request is cancelled: off the multi handle, or out of the queue
+        if (transfer->prepared && !transfer->session.empty())
+        {
+            m_busySessions.erase(transfer->session);
+        }
+        CURL *curl = transfer->handle.get();
+        if (curl != nullptr && m_transfers.count(curl) != 0)
+        {
+            curl_multi_remove_handle(m_multi, curl);
+            if (transfer->leased)
+            {
+                sharedRateLimiter().complete(transfer->lease, 0, RateLimitHeaders());
+            }
+            m_transfers.erase(curl);
+        }
+        else
+        {
+            m_waiting.erase(std::find_if(m_waiting.begin(), m_waiting.end(),
+                                         [&](const std::unique_ptr<Transfer> &waiting) {
+                                             return waiting.get() == transfer;
+                                         }));
+        }
+    }
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    m_clients.erase(it);
+}
+
+void ChatDaemon::_queueNext(Client &client)
+{
+    while (client.transfer == nullptr)
+    {
+        size_t end = client.input.find('\n', client.scanned);
+        if (end == std::string::npos)
+        {
+            client.scanned = client.input.size();
+            return;
+        }
+        std::string line = client.input.substr(0, end);
+        client.input.erase(0, end + 1);
+        client.scanned = 0;
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_stats.requests;
+        }
+        auto transfer = std::make_unique<Transfer>();
+        transfer->client = &client;
+        try
+        {
+            nlohmann::json request = nlohmann::json::parse(line);
+            if (request.is_object() && request.contains("session"))
+            {
+                transfer->session = request["session"].get<std::string>();
+                transfer->message = request.at("message").get<std::string>();
+                if (transfer->session.empty())
+                {
+                    throw std::runtime_error("the session needs a name");
+                }
+            }
+            else if (request.is_object() && request.contains("messages") && request["messages"].is_array() &&
+                     !request["messages"].empty())
+            {
+                const nlohmann::json &messages = request["messages"];
+                if (messages.back().at("role").get<std::string>() != "user")
+                {
+                    throw std::runtime_error("the last message must have role \"user\"");
+                }
+                transfer->message = messages.back().at("content").get<std::string>();
+                if (request.contains("context"))
+                {
+                    // The messages continue a conversation kept from the client's previous turn
+                    auto known = m_conversations.find(request["context"].get<uint64_t>());
+                    if (known == m_conversations.end())
+                    {
+                        _send(client, _line({{"unknownContext", true}}));
+                        continue;
+                    }
+                    transfer->history = known->second; // Copies share the token counts and serialized messages
+                }
+                for (size_t i = 0; i + 1 < messages.size(); ++i)
+                {
+                    std::string role = messages[i].at("role").get<std::string>();
+                    if (role != "user" && role != "assistant" && role != "system" && role != "tool")
+                    {
+                        throw std::runtime_error("unknown role \"" + role + "\"");
+                    }
+                    transfer->history.addDialog(role, messages[i].at("content").get<std::string>());
+                }
+            }
+            else
+            {
+                throw std::runtime_error("expected a \"session\" and a \"message\", or a \"messages\" array");
+            }
+        }
+        catch (const std::exception &e)
+        {
+            _send(client, _line({{"error", "Invalid request: " + std::string(e.what())}}));
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_stats.failed;
+            continue;
+        }
+        client.transfer = transfer.get();
+        m_waiting.push_back(std::move(transfer));
+    }
+}
+
+Clock::time_point ChatDaemon::_startWaiting()
+{
+    ConnectionPool &pool = ConnectionPool::instance();
+    RateLimiter &limiter = sharedRateLimiter();
+    const Clock::time_point now = Clock::now();
+    Clock::time_point wake = now + std::chrono::seconds(1);
+    const size_t maxInFlight = std::max<size_t>(m_options.maxInFlight, 1);
+    for (size_t i = 0; i < m_waiting.size() && m_transfers.size() < maxInFlight;)
+    {
+        Transfer &transfer = *m_waiting[i];
+        if (transfer.notBefore > now)
+        {
+            wake = std::min(wake, transfer.notBefore);
+            ++i;
+            continue;
+        }
+        if (!transfer.prepared)
+        {
+            if (!transfer.session.empty() && m_busySessions.count(transfer.session) != 0)
+            {
+                ++i; // Started once the session's reply is in
+                continue;
+            }
+            if (!_prepare(transfer))
+            {
+                m_waiting.erase(m_waiting.begin() + static_cast<std::ptrdiff_t>(i));
+                continue;
+            }
+        }
+
+        Clock::duration wait;
+        if (limiter.keyCount() > 0 && !limiter.tryAcquire(transfer.payload.size() / 4.0, transfer.lease, wait, now))
+        {
+            transfer.notBefore = now + wait;
+            wake = std::min(wake, transfer.notBefore);
+            ++i;
+            continue;
+        }
+        transfer.leased = limiter.keyCount() > 0;
+
+        transfer.handle = pool.acquire(m_url);
+        CURL *curl = transfer.handle.get();
+        if (curl == nullptr)
+        {
+            if (transfer.leased)
+            {
+                limiter.complete(transfer.lease, 0, RateLimitHeaders());
+            }
+            _answer(transfer, _line({{"error", "Failed to initialize CURL"}}));
+            m_waiting.erase(m_waiting.begin() + static_cast<std::ptrdiff_t>(i));
+            continue;
+        }
+        // As in batch mode, the multi handle keeps the connections and multiplexes over them,
+        // so the pool's share is detached
+        curl_easy_setopt(curl, CURLOPT_SHARE, nullptr);
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, transfer.payload.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(transfer.payload.size()));
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, m_keyHeaders[transfer.leased ? transfer.lease.key : 0]);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, rateLimitHeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &transfer.rateLimits);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _writeCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+        Transfer *streaming = &transfer;
+        transfer.parser = std::make_unique<SseParser>([streaming](const std::string &delta) {
+            streaming->reply += delta;
+            _send(*streaming->client, _line({{"delta", delta}}));
+        });
+        curl_multi_add_handle(m_multi, curl);
+        m_transfers.emplace(curl, std::move(m_waiting[i]));
+        m_waiting.erase(m_waiting.begin() + static_cast<std::ptrdiff_t>(i));
+    }
+    return wake;
+}
+
+bool ChatDaemon::_prepare(Transfer &transfer)
+{
+    if (!transfer.session.empty())
+    {
+        m_busySessions.insert(transfer.session);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_sessions.find(transfer.session);
+        if (it != m_sessions.end())
+        {
+            transfer.history = it->second; // Copies share the session's text
+        }
+    }
+    try
+    {
+        // A cached reply needs no transfer at all
+        if (ResponseCache *cache = m_options.cache)
+        {
+            ChatHistory keyed = transfer.history;
+            transfer.cacheKey = buildChatRequestPayload(transfer.message, keyed, false);
+            std::string response;
+            std::string content;
+            if (cache->lookup(transfer.cacheKey, response) && !(content = getChatGPTResponseContent(response)).empty())
+            {
+                _send(*transfer.client, _line({{"delta", content}}));
+                transfer.history = keyed;
+                transfer.history.addDialog("assistant", content);
+                nlohmann::json done = {{"done", true}, {"cached", true}};
+                if (uint64_t context = _keep(transfer))
+                {
+                    done["context"] = context;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    ++m_stats.cached;
+                }
+                _answer(transfer, _line(done));
+                return false;
+            }
+        }
+        transfer.payload = buildChatRequestPayload(transfer.message, transfer.history, true);
+    }
+    catch (const std::exception &e)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_stats.failed;
+        }
+        _answer(transfer, _line({{"error", e.what()}}));
+        return false;
+    }
+    transfer.prepared = true;
+    return true;
+}
+
+void ChatDaemon::_collectFinished()
+{
+    ConnectionPool &pool = ConnectionPool::instance();
+    RateLimiter &limiter = sharedRateLimiter();
+    int queued = 0;
+    while (CURLMsg *message = curl_multi_info_read(m_multi, &queued))
+    {
+        if (message->msg != CURLMSG_DONE)
+        {
+            continue;
+        }
+        CURL *curl = message->easy_handle;
+        CURLcode result = message->data.result;
+        auto it = m_transfers.find(curl);
+        if (it == m_transfers.end())
+        {
+            continue;
+        }
+        std::unique_ptr<Transfer> transfer = std::move(it->second);
+        m_transfers.erase(it);
+        pool.recordTransfer(curl, result);
+        if (result == CURLE_OK)
+        {
+            recordTransferPhases(curl);
+        }
+        curl_multi_remove_handle(m_multi, curl);
+
+        long httpCode = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+        if (transfer->leased)
+        {
+            limiter.complete(transfer->lease, httpCode, transfer->rateLimits);
+            transfer->leased = false;
+        }
+
+        // Rate limited and transiently failed attempts go back in line; a 429 has blocked its
+        // key in the limiter, other failures back off here
+        if (!transfer->forwarded && transfer->attempt < kMaxRequestRetries &&
+            ((result == CURLE_OK && isRetryableStatus(httpCode)) || isRetryableTransferError(result)))
+        {
+            transfer->handle.reset();
+            transfer->held.clear();
+            transfer->decided = false;
+            transfer->holding = false;
+            transfer->rateLimits = RateLimitHeaders();
+            transfer->notBefore =
+                Clock::now() + (httpCode == 429 ? Clock::duration::zero() : limiter.backoff(transfer->attempt));
+            ++transfer->attempt;
+            m_waiting.push_front(std::move(transfer));
+            continue;
+        }
+
+        if (!transfer->held.empty())
+        {
+            transfer->parser->feed(transfer->held.data(), transfer->held.size());
+        }
+        transfer->parser->finish();
+        if (transfer->parser->hasUsage())
+        {
+            sharedUsageLedger().record(transfer->parser->usage());
+        }
+        const std::string &body = transfer->parser->rawBody();
+        if (result != CURLE_OK || !body.empty())
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_stats.failed;
+        }
+        if (result != CURLE_OK)
+        {
+            _answer(*transfer, _line({{"error", curl_easy_strerror(result)}}));
+            continue;
+        }
+        nlohmann::json done = {{"done", true}};
+        if (!body.empty())
+        {
+            done["body"] = body;
+        }
+        else if (!transfer->reply.empty())
+        {
+            if (m_options.cache != nullptr)
+            {
+                nlohmann::json completion = {
+                    {"choices", {{{"index", 0}, {"message", {{"role", "assistant"}, {"content", transfer->reply}}}}}}};
+                m_options.cache->store(transfer->cacheKey,
+                                       completion.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+            }
+            transfer->history.addDialog("assistant", transfer->reply);
+            if (uint64_t context = _keep(*transfer))
+            {
+                done["context"] = context;
+            }
+        }
+        _answer(*transfer, _line(done));
+        // The handle goes back to the pool with the transfer
+    }
+}
+
+uint64_t ChatDaemon::_keep(Transfer &transfer)
+{
+    if (!transfer.session.empty())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sessions[transfer.session] = std::move(transfer.history);
+        m_stats.sessions = m_sessions.size();
+        return 0;
+    }
+    if (++m_lastConversation == 0)
+    {
+        ++m_lastConversation; // 0 means no context
+    }
+    uint64_t context = m_lastConversation;
+    m_conversations.emplace(context, std::move(transfer.history));
+    m_conversationOrder.push_back(context);
+    if (m_conversationOrder.size() > kRememberedConversations)
+    {
+        m_conversations.erase(m_conversationOrder.front());
+        m_conversationOrder.pop_front();
+    }
+    return context;
+}
+
+void ChatDaemon::_answer(Transfer &transfer, const std::string &line)
+{
+    _send(*transfer.client, line);
+    if (!transfer.session.empty())
+    {
+        m_busySessions.erase(transfer.session);
+    }
+    transfer.client->transfer = nullptr;
+}
+
+void ChatDaemon::_send(Client &client, const std::string &line)
+{
+    client.output += line;
+}
+
+int ChatDaemon::_socketCallback(CURL *, curl_socket_t socket, int what, void *daemon, void *)
+{
+    ChatDaemon &self = *static_cast<ChatDaemon *>(daemon);
+    if (what == CURL_POLL_REMOVE)
+    {
+        epoll_ctl(self.m_epollFd, EPOLL_CTL_DEL, socket, nullptr);
+        return 0;
+    }
+    epoll_event event{};
+    event.events = ((what & CURL_POLL_IN) != 0 ? static_cast<uint32_t>(EPOLLIN) : 0u) |
+                   ((what & CURL_POLL_OUT) != 0 ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.u64 = _tag(kCurlEvent, socket);
+    if (epoll_ctl(self.m_epollFd, EPOLL_CTL_MOD, socket, &event) != 0 && errno == ENOENT)
+    {
+        epoll_ctl(self.m_epollFd, EPOLL_CTL_ADD, socket, &event);
+    }
+    return 0;
+}
+
+int ChatDaemon::_timerCallback(CURLM *, long timeoutMs, void *daemon)
+{
+    ChatDaemon &self = *static_cast<ChatDaemon *>(daemon);
+    self.m_curlTimerSet = timeoutMs >= 0;
+    self.m_curlDeadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    return 0;
+}
+
+size_t ChatDaemon::_writeCallback(char *data, size_t size, size_t nmemb, void *userp)
+{
+    Transfer &transfer = *static_cast<Transfer *>(userp);
+    size_t bytes = size * nmemb;
+    if (!transfer.decided)
+    {
+        long status = 0;
+        curl_easy_getinfo(transfer.handle.get(), CURLINFO_RESPONSE_CODE, &status);
+        transfer.holding = transfer.attempt < kMaxRequestRetries && isRetryableStatus(status);
+        transfer.decided = true;
+    }
+    if (transfer.holding)
+    {
+        transfer.held.append(data, bytes);
+        return bytes;
+    }
+    transfer.forwarded = true;
+    transfer.parser->feed(data, bytes);
+    return bytes;
+}
+
+std::filesystem::path daemonSocketPath()
+{
+    static const std::filesystem::path path = []() -> std::filesystem::path {
+        if (const char *configured = std::getenv("CHATGPT_CLI_SOCKET"); configured != nullptr)
+        {
+            return configured; // Empty turns the daemon off
+        }
+        if (const char *runtime = std::getenv("XDG_RUNTIME_DIR"); runtime != nullptr && *runtime != '\0')
+        {
+            return std::filesystem::path(runtime) / "chatgpt-cli.sock";
+        }
+        // Without a runtime directory the socket goes in a directory of the user's own in /tmp,
+        // where no one else can put a listener first. One made by someone else is not used.
+        std::filesystem::path directory =
+            std::filesystem::temp_directory_path() / ("chatgpt-cli-" + std::to_string(getuid()));
+        mkdir(directory.c_str(), S_IRWXU);
+        struct stat status{};
+        if (lstat(directory.c_str(), &status) != 0 || !S_ISDIR(status.st_mode) || status.st_uid != getuid() ||
+            (status.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+        {
+            return {};
+        }
+        return directory / "daemon.sock";
+    }();
+    return path;
+}
+
+bool daemonListening(const std::filesystem::path &socketPath)
+{
+    try
+    {
+        _Socket connection{_connect(socketPath)};
+        return connection.fd >= 0;
+    }
+    catch (const std::runtime_error &)
+    {
+        return false; // Not a usable socket path
+    }
+}
+
+const std::filesystem::path &activeDaemonSocket()
+{
+    static const std::filesystem::path socket = daemonListening(daemonSocketPath()) ? daemonSocketPath()
+                                                                                    : std::filesystem::path();
+    return socket;
+}
+
+StreamRequestFn chatStreamingRequest(const std::atomic<bool> *cancelFlag)
+{
+    if (!activeDaemonSocket().empty())
+    {
+        return [cancelFlag](const std::string &message, ChatHistory &chatHistory, const DeltaFn &onDelta) {
+            return daemonStreamingRequest(activeDaemonSocket(), message, chatHistory, onDelta, cancelFlag);
+        };
+    }
+    if (ResponseCache *cache = sharedResponseCache())
+    {
+        return cachedStreamingRequest(
+            *cache,
+            [cancelFlag](const std::string &payload, const DeltaFn &onDelta) {
+                return sendStreamingChatRequest(payload, onDelta, cancelFlag);
+            },
+            cancelFlag);
+    }
+    return [cancelFlag](const std::string &message, ChatHistory &chatHistory, const DeltaFn &onDelta) {
+        return makeStreamingRequest(message, chatHistory, onDelta, cancelFlag);
+    };
+}
+
+namespace
+{
+/// @brief The conversation of the last turn this process made through a daemon, which the daemon
+/// keeps as a context the next turn can continue.
+struct _DaemonContext
+{
+    std::mutex mutex;
+    std::filesystem::path socketPath;
+    std::string key; // The conversation with its reply, encoded with _appendMessage
+    size_t messages = 0;
+    uint64_t context = 0;
+};
+
+_DaemonContext &_lastContext()
+{
+    static _DaemonContext *context = new _DaemonContext(); // Never destroyed, like the other process-wide stores
+    return *context;
+}
+} // namespace
+
+std::string daemonStreamingRequest(const std::filesystem::path &socketPath, const std::string &message,
+                                   ChatHistory &chatHistory, const DeltaFn &onDelta,
+                                   const std::atomic<bool> *cancelFlag)
+{
+    // A conversation that continues the last turn's only needs what was added since
+    std::string key;
+    for (const Dialog &dialog : chatHistory)
+    {
+        _appendMessage(key, dialog.participant, dialog.message);
+    }
+    const size_t conversationSize = chatHistory.size();
+    chatHistory.addDialog("user", message);
+    _DaemonContext &last = _lastContext();
+    uint64_t context = 0;
+    size_t known = 0;
+    {
+        std::lock_guard<std::mutex> lock(last.mutex);
+        if (last.context != 0 && last.socketPath == socketPath && key.compare(0, last.key.size(), last.key) == 0)
+        {
+            context = last.context;
+            known = last.messages;
+        }
+    }
+
+    while (true)
+    {
+        nlohmann::json messages = nlohmann::json::array();
+        for (size_t i = known; i < conversationSize; ++i)
+        {
+            Dialog dialog = chatHistory[i];
+            messages.push_back({{"role", dialog.participant}, {"content", dialog.message}});
+        }
+        messages.push_back({{"role", "user"}, {"content", message}});
+        nlohmann::json request = {{"messages", std::move(messages)}};
+        if (context != 0)
+        {
+            request["context"] = context;
+        }
+
+        _Socket connection{_connect(socketPath)};
+        if (connection.fd < 0)
+        {
+            throw std::runtime_error("Unable to reach the daemon at " + socketPath.string() + ": " +
+                                     std::strerror(errno));
+        }
+        if (!_sendAll(connection.fd, _line(request)))
+        {
+            throw std::runtime_error("Lost the connection to the daemon at " + socketPath.string());
+        }
+
+        // Closing the connection, as returning does, cancels the request in the daemon
+        _LineReader reader(connection.fd);
+        std::string line;
+        std::string content;
+        bool forgotten = false;
+        while (!forgotten && reader.next(line, cancelFlag))
+        {
+            nlohmann::json reply = nlohmann::json::parse(line, nullptr, false);
+            if (reply.contains("delta"))
+            {
+                std::string delta = reply["delta"].get<std::string>();
+                content += delta;
+                onDelta(delta);
+            }
+            else if (reply.contains("error"))
+            {
+                throw std::runtime_error(reply["error"].get<std::string>());
+            }
+            else if (reply.contains("unknownContext"))
+            {
+                forgotten = true;
+            }
+            else if (reply.contains("done"))
+            {
+                if (reply.contains("context"))
+                {
+                    _appendMessage(key, "user", message);
+                    _appendMessage(key, "assistant", content);
+                    std::lock_guard<std::mutex> lock(last.mutex);
+                    last.socketPath = socketPath;
+                    last.key = std::move(key);
+                    last.messages = conversationSize + 2;
+                    last.context = reply["context"].get<uint64_t>();
+                }
+                return reply.value("body", std::string());
+            }
+        }
+        if (!forgotten)
+        {
+            break;
+        }
+        context = 0; // The daemon has dropped it; send the whole conversation instead
+        known = 0;
+    }
+    if (cancelFlag != nullptr && cancelFlag->load())
+    {
+        return std::string();
+    }
+    throw std::runtime_error("The daemon at " + socketPath.string() + " closed the connection before the reply ended");
+}
+
+namespace
+{
+ChatDaemon *g_daemon = nullptr; // For the signal handler
+
+void _stopDaemon(int)
+{
+    if (g_daemon != nullptr)
+    {
+        g_daemon->stop();
+    }
+}
+} // namespace
+
+int runDaemonMain(const std::vector<std::string> &args)
+{
+    DaemonOptions options;
+    options.cache = sharedResponseCache();
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        if (args[i] == "--daemon")
+        {
+            continue;
+        }
+        if (args[i] == "--socket" && i + 1 < args.size())
+        {
+            options.socketPath = args[++i];
+            continue;
+        }
+        std::cerr << "[ERROR] Unknown or incomplete daemon argument: " << args[i] << "\n"
+                  << "Usage: chatgpt_cli --daemon [--socket <path>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (options.socketPath.empty() && daemonSocketPath().empty())
+    {
+        std::cerr << "[ERROR] No socket path: CHATGPT_CLI_SOCKET is empty or the socket directory is not "
+                     "private to this user; give the daemon a --socket to listen on."
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        ChatDaemon daemon(options);
+        g_daemon = &daemon;
+        struct sigaction action{};
+        action.sa_handler = _stopDaemon;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        std::cerr << "Listening on " << daemon.socketPath().string() << std::endl;
+        daemon.run();
+        g_daemon = nullptr;
+
+        DaemonStats stats = daemon.stats();
+        std::cerr << "Daemon: " << stats.clients << " clients, " << stats.requests << " requests (" << stats.cached
+                  << " cached, " << stats.failed << " failed), " << stats.sessions << " sessions" << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        g_daemon = nullptr;
+        std::cerr << "[ERROR] " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int runClientMain(const std::vector<std::string> &args)
+{
+    std::string session = "default";
+    std::filesystem::path socketPath = daemonSocketPath();
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        bool hasValue = i + 1 < args.size();
+        if (args[i] == "--client")
+        {
+            continue;
+        }
+        if (args[i] == "--session" && hasValue && !args[i + 1].empty())
+        {
+            session = args[++i];
+            continue;
+        }
+        if (args[i] == "--socket" && hasValue)
+        {
+            socketPath = args[++i];
+            continue;
+        }
+        std::cerr << "[ERROR] Unknown or incomplete client argument: " << args[i] << "\n"
+                  << "Usage: chatgpt_cli --client [--session <name>] [--socket <path>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int fd = -1;
+    try
+    {
+        fd = _connect(socketPath);
+    }
+    catch (const std::runtime_error &)
+    {
+        errno = EINVAL;
+    }
+    if (fd < 0)
+    {
+        std::cerr << "[ERROR] No daemon is listening on " << socketPath.string()
+                  << "; start one with chatgpt_cli --daemon." << std::endl;
+        return EXIT_FAILURE;
+    }
+    _Socket connection{fd};
+    _LineReader reader(fd);
+    bool ok = true;
+    std::string input;
+    std::string line;
+    while (std::getline(std::cin, input))
+    {
+        if (input.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+        if (!_sendAll(fd, _line({{"session", session}, {"message", input}})))
+        {
+            std::cerr << "[ERROR] Lost the connection to the daemon." << std::endl;
+            return EXIT_FAILURE;
+        }
+        bool ended = false;
+        while (!ended && reader.next(line, nullptr))
+        {
+            nlohmann::json reply = nlohmann::json::parse(line, nullptr, false);
+            if (reply.contains("delta"))
+            {
+                std::string delta = reply["delta"].get<std::string>();
+                std::fwrite(delta.data(), 1, delta.size(), stdout);
+                std::fflush(stdout);
+            }
+            else if (reply.contains("error"))
+            {
+                std::cerr << "[ERROR] " << reply["error"].get<std::string>() << std::endl;
+                ok = false;
+                ended = true;
+            }
+            else if (reply.contains("done"))
+            {
+                if (std::string body = reply.value("body", std::string()); !body.empty())
+                {
+                    getChatGPTResponseContent(body); // Reports the API error
+                    ok = false;
+                }
+                ended = true;
+            }
+        }
+        if (!ended)
+        {
+            std::cerr << "[ERROR] The daemon closed the connection." << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::fputc('\n', stdout);
+        std::fflush(stdout);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
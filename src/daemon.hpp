@@ -0,0 +1,280 @@
+//  daemon.hpp
+//
+// Daemon mode: one long-lived process answering chat requests from many clients over a Unix socket
+
+#ifndef daemon_hpp
+#define daemon_hpp
+
+#include "chatgptapi.hpp"
+#include "chathistory.hpp"
+#include "responsecache.hpp"
+#include "streamparser.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <curl/curl.h>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Settings for a ChatDaemon.
+struct DaemonOptions
+{
+    std::filesystem::path socketPath; // Where to listen; empty means daemonSocketPath()
+    std::string url;                  // Endpoint to send to; empty means chatCompletionsUrl()
+    ResponseCache *cache = nullptr;   // Replies are looked up here first and stored on success
+    size_t maxInFlight = 64;          // Transfers at once across all clients; the rest wait their turn
+};
+
+/// @brief Counters of a ChatDaemon.
+struct DaemonStats
+{
+    uint64_t clients = 0;  // Connections accepted
+    uint64_t requests = 0; // Requests received, including invalid ones
+    uint64_t cached = 0;   // Of which were answered from the response cache
+    uint64_t failed = 0;   // Of which ended in an error
+    size_t sessions = 0;   // Named conversations kept
+};
+
+/// @class ChatDaemon
+/// @brief Answers chat requests from any number of clients on a Unix domain socket, streaming
+/// the replies, with one event loop and one connection cache for all of them.
+///
+/// Clients send one JSON request per line and read JSON lines back:
+///
+///     {"session": "notes", "message": "..."}     continues the conversation the daemon keeps as "notes"
+///     {"messages": [{"role": ..., "content": ...}, ..., {"role": "user", ...}]}
+///                                                 asks with a conversation the client keeps;
+///                                                 with "context", the messages continue that one
+///
+///     {"delta": "..."}                            each piece of the reply as it streams in
+///     {"done": true}                              the end of the reply; "body" holds any response
+///                                                 text that was not streamed content (an API
+///                                                 error), "cached" is true for a cache hit, and
+///                                                 "context" names the conversation with the reply
+///     {"error": "..."}                            the request failed before a response
+///     {"unknownContext": true}                    the context has been forgotten; send it all
+///
+/// A client's requests are answered in order, one at a time, and requests on the same session
+/// wait for each other, so every reply lands after the one before it. Closing the connection
+/// cancels the client's request.
+///
+/// run() multiplexes the clients and every transfer on epoll: cURL tells it which sockets to
+/// watch and when to time out through the multi handle's socket and timer callbacks, so an idle
+/// daemon sleeps and a busy one never polls. Transfers share the multi handle's connections,
+/// which stay warm between clients and are multiplexed over HTTP/2 where the endpoint speaks it,
+/// and go through the same rate limiter, key rotation, retries, usage ledger and response cache
+/// as requests made in-process.
+class ChatDaemon
+{
+  public:
+    /**
+     * @brief Listens on the socket, replacing a stale socket file left by a daemon that exited.
+     * @throws std::runtime_error if the socket cannot be bound, or another daemon is listening on it.
+     */
+    explicit ChatDaemon(const DaemonOptions &options = DaemonOptions());
+
+    /**
+     * @brief Cancels the transfers in flight, closes every connection and removes the socket file.
+     */
+    ~ChatDaemon();
+    ChatDaemon(const ChatDaemon &) = delete;
+    ChatDaemon &operator=(const ChatDaemon &) = delete;
+
+    /**
+     * @brief Serves clients until stop() is called.
+     */
+    void run();
+
+    /**
+     * @brief Makes run() return. May be called from any thread, and from a signal handler.
+     */
+    void stop();
+
+    /**
+     * @brief Returns the socket the daemon listens on.
+     */
+    const std::filesystem::path &socketPath() const;
+
+    /**
+     * @brief Returns the counters so far. May be called from any thread.
+     */
+    DaemonStats stats() const;
+
+    /**
+     * @brief Returns the number of messages in a session, 0 if there is none. May be called from any thread.
+     */
+    size_t sessionSize(const std::string &name) const;
+
+  private:
+    struct Client;
+    struct Transfer;
+
+    DaemonOptions m_options;
+    std::string m_url;
+    int m_listenFd = -1;
+    int m_epollFd = -1;
+    int m_wakeFd = -1; // eventfd that stop() writes to
+    std::atomic<bool> m_stopping{false};
+    CURLM *m_multi = nullptr;
+    bool m_curlTimerSet = false;
+    std::chrono::steady_clock::time_point m_curlDeadline;
+    std::vector<struct curl_slist *> m_keyHeaders; // One header list per API key
+
+    std::unordered_map<int, std::unique_ptr<Client>> m_clients;       // By socket
+    std::unordered_map<CURL *, std::unique_ptr<Transfer>> m_transfers; // On the multi handle
+    std::deque<std::unique_ptr<Transfer>> m_waiting; // Received, or held back by the limiter, a retry or their session
+    std::set<std::string> m_busySessions;            // Sessions with a request in progress
+
+    // The latest conversations clients sent, each with its reply, by context; a client's next turn
+    // sends only what it added since, and reuses the token counts and serialized messages
+    std::unordered_map<uint64_t, ChatHistory> m_conversations;
+    std::deque<uint64_t> m_conversationOrder; // Oldest first
+    uint64_t m_lastConversation = 0;
+
+    mutable std::mutex m_mutex; // Guards m_sessions and m_stats, which other threads read
+    std::unordered_map<std::string, ChatHistory> m_sessions;
+    DaemonStats m_stats;
+
+    /**
+     * @brief Accepts every pending connection.
+     */
+    void _accept();
+
+    /**
+     * @brief Reads what a client sent, noting the end of its input.
+     */
+    void _read(Client &client);
+
+    /**
+     * @brief Writes as much of a client's pending output as the socket takes, watching for
+     * writability while some is left.
+     * @return False if the client has gone.
+     */
+    bool _flush(Client &client);
+
+    /**
+     * @brief Updates the events epoll reports for a client.
+     */
+    void _watch(Client &client);
+
+    /**
+     * @brief Cancels a client's request and closes its connection.
+     */
+    void _close(int fd);
+
+    /**
+     * @brief Turns the client's next complete line, if it has no request in progress, into a waiting transfer.
+     */
+    void _queueNext(Client &client);
+
+    /**
+     * @brief Keeps the conversation of a request that was answered, in its session or, when the
+     * client sent it, for the client's next turn, forgetting the oldest such conversation.
+     * @return The context the client's next turn may continue; 0 for a session.
+     */
+    uint64_t _keep(Transfer &transfer);
+
+    /**
+     * @brief Starts the waiting transfers that may start now, up to the in-flight limit.
+     * @return When the first one held back may start, at most a second from now.
+     */
+    std::chrono::steady_clock::time_point _startWaiting();
+
+    /**
+     * @brief Builds the request body of a transfer, or answers it at once from the cache or with an error.
+     * @return False if the transfer was answered and is done.
+     */
+    bool _prepare(Transfer &transfer);
+
+    /**
+     * @brief Hands the transfers cURL has finished to their clients, or queues them again to retry.
+     */
+    void _collectFinished();
+
+    /**
+     * @brief Ends a client's request with a final line, freeing the client for its next one.
+     */
+    void _answer(Transfer &transfer, const std::string &line);
+
+    /**
+     * @brief Adds one line to a client's pending output.
+     */
+    static void _send(Client &client, const std::string &line);
+
+    static int _socketCallback(CURL *curl, curl_socket_t socket, int what, void *daemon, void *socketData);
+    static int _timerCallback(CURLM *multi, long timeoutMs, void *daemon);
+    static size_t _writeCallback(char *data, size_t size, size_t nmemb, void *transfer);
+};
+
+/**
+ * @brief Returns the socket daemon mode listens on and clients connect to: CHATGPT_CLI_SOCKET,
+ * or "chatgpt-cli.sock" in $XDG_RUNTIME_DIR, or "daemon.sock" in a 0700 /tmp/chatgpt-cli-<uid>
+ * directory. Read once; an empty CHATGPT_CLI_SOCKET, or a /tmp directory that is not the
+ * user's own and private, turns the daemon off and returns an empty path.
+ */
+std::filesystem::path daemonSocketPath();
+
+/**
+ * @brief Returns true if a daemon run by this user accepts connections on socketPath.
+ */
+bool daemonListening(const std::filesystem::path &socketPath);
+
+/**
+ * @brief Returns the daemon socket conversation turns go through: daemonSocketPath(), if a
+ * daemon was listening on it when this was first called, or else an empty path.
+ */
+const std::filesystem::path &activeDaemonSocket();
+
+/**
+ * @brief Returns the request function for a conversation turn: daemonStreamingRequest when
+ * activeDaemonSocket() is set, where the daemon's response cache applies, or else
+ * makeStreamingRequest behind the local response cache, if any.
+ * @param cancelFlag Optional flag that cancels the request once true; must outlive the function.
+ */
+StreamRequestFn chatStreamingRequest(const std::atomic<bool> *cancelFlag);
+
+/**
+ * @brief Sends a message with the conversation so far through the daemon at socketPath and
+ * streams the reply, with the same contract as makeStreamingRequest.
+ *
+ * @param socketPath The daemon's socket.
+ * @param message The next user message; it is added to chatHistory.
+ * @param chatHistory The conversation so far, which the daemon receives with the message.
+ * @param onDelta Callback invoked with each piece of the reply, in order.
+ * @param cancelFlag Optional flag polled while waiting; the request is dropped once it is true.
+ * @return Any response text that was not streamed content (e.g. a JSON error body); empty on success.
+ * @throws std::runtime_error if the daemon cannot be reached or reports an error.
+ */
+std::string daemonStreamingRequest(const std::filesystem::path &socketPath, const std::string &message,
+                                   ChatHistory &chatHistory, const DeltaFn &onDelta,
+                                   const std::atomic<bool> *cancelFlag = nullptr);
+
+/**
+ * @brief Runs daemon mode from command line arguments, until SIGINT or SIGTERM.
+ *
+ * Usage: --daemon [--socket <path>]
+ *
+ * @param args The arguments after the program name.
+ * @return The process exit code.
+ */
+int runDaemonMain(const std::vector<std::string> &args);
+
+/**
+ * @brief Runs the pipe client from command line arguments: each line of standard input is
+ * sent to the daemon as the next message of a session, and the reply streamed to standard output.
+ *
+ * Usage: --client [--session <name>] [--socket <path>]
+ *
+ * @param args The arguments after the program name.
+ * @return The process exit code; failure if the daemon cannot be reached or a request failed.
+ */
+int runClientMain(const std::vector<std::string> &args);
+
+#endif /* daemon_hpp */
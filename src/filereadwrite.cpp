@@ -3,9 +3,248 @@
 // File reading and writing utilities
 
 #include "filereadwrite.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <filesystem>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+/// Bytes searched for a NUL to tell binary files from text, as git does
+constexpr size_t kBinaryProbeBytes = 8000;
+
+/**
+ * @brief Reads everything left in fd into out, which is sized from sizeHint first.
+ * Files that turn out longer than sizeHint (pipes, /proc, files still growing) are read until
+ * end of file.
+ */
+bool _readAll(int fd, size_t sizeHint, std::string &out)
+{
+    out.resize(sizeHint);
+    size_t used = 0;
+    while (true)
+    {
+        // Once the expected size is in, a small read tells end of file from more data
+        char probe[4096];
+        bool probing = used == out.size();
+        ssize_t n = probing ? read(fd, probe, sizeof(probe)) : read(fd, &out[used], out.size() - used);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return false;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        if (probing)
+        {
+            out.append(probe, static_cast<size_t>(n));
+        }
+        used += static_cast<size_t>(n);
+    }
+    out.resize(used);
+    return true;
+}
+
+/// @brief A file being read by readFiles: its text, from a buffer or a mapping, or why it was skipped.
+struct _LoadedFile
+{
+    std::string buffer;
+    void *map = nullptr;
+    size_t mapSize = 0;
+    std::string_view text;
+    std::string skipReason;
+    bool ready = false; // Read (or skipped) and waiting for the consumer
+
+    void release()
+    {
+        if (map != nullptr)
+        {
+            munmap(map, mapSize);
+            map = nullptr;
+        }
+        std::string().swap(buffer);
+        text = {};
+    }
+};
+
+void _load(const std::filesystem::path &path, const ReadFilesOptions &options, _LoadedFile &file)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0)
+    {
+        file.skipReason = std::string("unreadable: ") + std::strerror(errno);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+
+    size_t size = static_cast<size_t>(status.st_size);
+    if (!S_ISREG(status.st_mode))
+    {
+        file.skipReason = "not a regular file";
+    }
+    else if (size > options.maxFileBytes)
+    {
+        file.skipReason = "too large";
+    }
+    else if (size >= options.mapThreshold)
+    {
+        // Fault the pages in here, on the reader thread, rather than when the consumer copies them
+        file.map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (file.map == MAP_FAILED)
+        {
+            file.map = nullptr;
+            file.skipReason = std::string("unreadable: ") + std::strerror(errno);
+        }
+        else
+        {
+            file.mapSize = size;
+            file.text = std::string_view(static_cast<const char *>(file.map), size);
+        }
+    }
+    else if (_readAll(fd, size, file.buffer))
+    {
+        file.text = file.buffer;
+    }
+    else
+    {
+        file.skipReason = std::string("unreadable: ") + std::strerror(errno);
+    }
+    close(fd);
+
+    if (file.skipReason.empty())
+    {
+        if (file.text.empty())
+        {
+            file.skipReason = "empty";
+        }
+        else if (std::memchr(file.text.data(), '\0', std::min(file.text.size(), kBinaryProbeBytes)) != nullptr)
+        {
+            file.skipReason = "binary";
+        }
+    }
+    if (!file.skipReason.empty())
+    {
+        file.release();
+    }
+}
+
+bool _hasWildcards(std::string_view text)
+{
+    return text.find_first_of("*?[") != std::string_view::npos;
+}
+
+bool _isHidden(const std::filesystem::path &path)
+{
+    std::string name = path.filename().string();
+    return name.size() > 1 && name[0] == '.' && name != "..";
+}
+
+/**
+ * @brief Matches one character against the set at the start of pattern ("[...]").
+ * @return The length of the set expression, or 0 if c is not in the set or the set is malformed.
+ */
+size_t _matchSet(std::string_view pattern, char c)
+{
+    size_t i = 1;
+    bool negate = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+    if (negate)
+    {
+        ++i;
+    }
+    bool found = false;
+    bool first = true;
+    for (; i < pattern.size() && (first || pattern[i] != ']'); ++i, first = false)
+    {
+        if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']')
+        {
+            found = found || (c >= pattern[i] && c <= pattern[i + 2]);
+            i += 2;
+        }
+        else
+        {
+            found = found || c == pattern[i];
+        }
+    }
+    if (i >= pattern.size() || found == negate || c == '/')
+    {
+        return 0;
+    }
+    return i + 1;
+}
+
+/**
+ * @brief Adds the regular files under directory to files, skipping hidden entries.
+ * @param pattern Only files whose path relative to directory matches this glob are added; all
+ *        files if empty.
+ * @param recursive Whether to descend into subdirectories.
+ * @return The number of files added.
+ */
+size_t _collect(const std::filesystem::path &directory, const std::string &pattern, bool recursive,
+                std::vector<std::filesystem::path> &files)
+{
+    size_t added = 0;
+    auto consider = [&](const std::filesystem::directory_entry &entry) {
+        std::error_code error;
+        if (!entry.is_regular_file(error))
+        {
+            return;
+        }
+        if (pattern.empty() || globMatch(pattern, entry.path().lexically_relative(directory).generic_string()))
+        {
+            files.push_back(entry.path().lexically_normal());
+            ++added;
+        }
+    };
+
+    std::error_code error;
+    const auto options = std::filesystem::directory_options::skip_permission_denied;
+    if (recursive)
+    {
+        std::filesystem::recursive_directory_iterator it(directory, options, error);
+        for (; !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+        {
+            if (_isHidden(it->path()))
+            {
+                it.disable_recursion_pending();
+                continue;
+            }
+            consider(*it);
+        }
+    }
+    else
+    {
+        std::filesystem::directory_iterator it(directory, options, error);
+        for (; !error && it != std::filesystem::directory_iterator(); it.increment(error))
+        {
+            if (!_isHidden(it->path()))
+            {
+                consider(*it);
+            }
+        }
+    }
+    return added;
+}
+} // namespace
 
 std::filesystem::path getCurrentWorkingDirectory()
 {
@@ -37,19 +276,381 @@ void writeToFile(const std::filesystem::path &filepath, const std::string &conte
     }
 }
 
-std::string readFileToString(const std::filesystem::path &filepath)
+uint64_t writeFileAtomically(const std::filesystem::path &filepath, const std::function<void(const WritePieceFn &)> &produce)
 {
-    // Read the entire file into the string using a string stream
-    std::ostringstream ss;
-    std::ifstream ifs(filepath);
+    std::filesystem::path tempPath = filepath;
+    tempPath += ".tmp-" + std::to_string(getpid());
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open file: " + filepath.string() + ": " + std::strerror(errno));
+    }
 
-    if (!ifs.is_open())
+    // Pieces are gathered into large writes; a piece larger than the buffer goes out as it is
+    constexpr size_t kBufferBytes = 1024 * 1024;
+    std::string buffer;
+    buffer.reserve(kBufferBytes);
+    uint64_t written = 0;
+    auto writeOut = [&](std::string_view bytes) {
+        while (!bytes.empty())
+        {
+            ssize_t n = write(fd, bytes.data(), bytes.size());
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                throw std::runtime_error("Failed to write file: " + filepath.string() + ": " + std::strerror(errno));
+            }
+            bytes.remove_prefix(static_cast<size_t>(n));
+            written += static_cast<uint64_t>(n);
+        }
+    };
+    try
+    {
+        produce([&](std::string_view piece) {
+            if (buffer.size() + piece.size() > kBufferBytes)
+            {
+                writeOut(buffer);
+                buffer.clear();
+            }
+            if (piece.size() >= kBufferBytes)
+            {
+                writeOut(piece);
+            }
+            else
+            {
+                buffer.append(piece);
+            }
+        });
+        writeOut(buffer);
+        if (fsync(fd) != 0)
+        {
+            throw std::runtime_error("Failed to write file: " + filepath.string() + ": " + std::strerror(errno));
+        }
+    }
+    catch (...)
+    {
+        close(fd);
+        unlink(tempPath.c_str());
+        throw;
+    }
+    close(fd);
+    if (std::rename(tempPath.c_str(), filepath.c_str()) != 0)
+    {
+        std::string error = std::strerror(errno);
+        unlink(tempPath.c_str());
+        throw std::runtime_error("Failed to replace file: " + filepath.string() + ": " + error);
+    }
+    return written;
+}
+
+std::string readFileToString(const std::filesystem::path &filepath)
+{
+    // Size the string once and read straight into it
+    int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
         throw std::runtime_error("Failed to open file: " + filepath.string());
     }
+    struct stat status;
+    size_t sizeHint = fstat(fd, &status) == 0 ? static_cast<size_t>(status.st_size) : 0;
+    std::string contents;
+    bool complete = _readAll(fd, sizeHint, contents);
+    close(fd);
+    if (!complete)
+    {
+        throw std::runtime_error("Failed to read file: " + filepath.string());
+    }
+    return contents;
+}
 
-    ss << ifs.rdbuf();
-    ifs.close();
+bool globMatch(std::string_view pattern, std::string_view path)
+{
+    while (!pattern.empty())
+    {
+        if (pattern.substr(0, 2) == "**")
+        {
+            // Any number of whole components ("**/"), or anything at all at the end
+            pattern.remove_prefix(2);
+            bool components = !pattern.empty() && pattern[0] == '/';
+            if (components)
+            {
+                pattern.remove_prefix(1);
+            }
+            for (size_t i = 0; i <= path.size(); ++i)
+            {
+                if ((!components || i == 0 || path[i - 1] == '/') && globMatch(pattern, path.substr(i)))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        if (pattern[0] == '*')
+        {
+            pattern.remove_prefix(1);
+            for (size_t i = 0; i <= path.size(); ++i)
+            {
+                if (globMatch(pattern, path.substr(i)))
+                {
+                    return true;
+                }
+                if (i < path.size() && path[i] == '/')
+                {
+                    break;
+                }
+            }
+            return false;
+        }
+        if (path.empty())
+        {
+            return false;
+        }
+        if (pattern[0] == '[')
+        {
+            size_t length = _matchSet(pattern, path[0]);
+            if (length == 0)
+            {
+                return false;
+            }
+            pattern.remove_prefix(length);
+        }
+        else if ((pattern[0] == '?' && path[0] != '/') || pattern[0] == path[0])
+        {
+            pattern.remove_prefix(1);
+        }
+        else
+        {
+            return false;
+        }
+        path.remove_prefix(1);
+    }
+    return path.empty();
+}
+
+std::vector<std::filesystem::path> expandFilePatterns(const std::vector<std::string> &patterns,
+                                                      std::vector<std::string> &unmatched)
+{
+    std::vector<std::filesystem::path> files;
+    for (const std::string &pattern : patterns)
+    {
+        size_t added = 0;
+        std::error_code error;
+        if (!_hasWildcards(pattern))
+        {
+            std::filesystem::file_status status = std::filesystem::status(pattern, error);
+            if (std::filesystem::is_regular_file(status))
+            {
+                files.emplace_back(pattern);
+                added = 1;
+            }
+            else if (std::filesystem::is_directory(status))
+            {
+                added = _collect(pattern, "", true, files);
+            }
+        }
+        else
+        {
+            // Walk from the longest leading directory without wildcards
+            size_t split = 0;
+            for (size_t slash = pattern.find('/'); slash != std::string::npos; slash = pattern.find('/', slash + 1))
+            {
+                if (_hasWildcards(std::string_view(pattern).substr(0, slash)))
+                {
+                    break;
+                }
+                split = slash + 1;
+            }
+            std::filesystem::path directory = split == 0 ? "." : pattern.substr(0, split);
+            std::string rest = pattern.substr(split);
+            bool recursive = rest.find('/') != std::string::npos || rest.find("**") != std::string::npos;
+            if (std::filesystem::is_directory(directory, error))
+            {
+                added = _collect(directory, rest, recursive, files);
+            }
+        }
+        if (added == 0)
+        {
+            unmatched.push_back(pattern);
+        }
+    }
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    return files;
+}
+
+ReadFilesReport readFiles(const std::vector<std::filesystem::path> &paths, const ReadFilesOptions &options,
+                          const std::function<void(const FileContent &)> &consume)
+{
+    std::vector<_LoadedFile> files(paths.size());
+
+    // Apply the size limits in path order up front, so which files fit does not depend on timing
+    size_t total = 0;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(paths[i], error);
+        if (error)
+        {
+            continue; // _load reports why
+        }
+        if (size > options.maxFileBytes)
+        {
+            files[i].skipReason = "too large";
+        }
+        else if (total + size > options.maxTotalBytes)
+        {
+            files[i].skipReason = "over the total size limit";
+        }
+        else
+        {
+            total += size;
+            continue;
+        }
+        files[i].ready = true;
+    }
+
+    // Each side only signals when the other is waiting, which it rarely is, to save wakeups
+    std::mutex mutex;
+    std::condition_variable fileReady;
+    std::condition_variable roomAhead;
+    size_t next = 0;                 // Next file for a reader to take
+    size_t consumed = 0;             // Files handed to consume so far
+    size_t awaited = paths.size();   // File the consumer is waiting for, if any
+    size_t readersWaiting = 0;       // Readers waiting for the consumer to catch up
+    const size_t readAhead = std::max<size_t>(options.readAhead, 1);
+    auto reader = [&] {
+        while (true)
+        {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (next < paths.size() && next >= consumed + readAhead)
+                {
+                    ++readersWaiting;
+                    roomAhead.wait(lock, [&] { return next >= paths.size() || next < consumed + readAhead; });
+                    --readersWaiting;
+                }
+                if (next >= paths.size())
+                {
+                    return;
+                }
+                index = next++;
+                if (files[index].ready)
+                {
+                    continue;
+                }
+            }
+            _load(paths[index], options, files[index]);
+            bool wake;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                files[index].ready = true;
+                wake = index == awaited;
+            }
+            if (wake)
+            {
+                fileReady.notify_one();
+            }
+        }
+    };
 
-    return ss.str();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::min(std::max<size_t>(options.threads, 1), paths.size()); ++i)
+    {
+        threads.emplace_back(reader);
+    }
+    auto stop = [&] {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            next = paths.size();
+        }
+        roomAhead.notify_all();
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        for (_LoadedFile &file : files)
+        {
+            file.release();
+        }
+    };
+
+    ReadFilesReport report;
+    try
+    {
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                awaited = i;
+                fileReady.wait(lock, [&] { return files[i].ready; });
+                awaited = paths.size();
+            }
+            consume(FileContent{paths[i], files[i].text, files[i].skipReason});
+            if (files[i].skipReason.empty())
+            {
+                ++report.files;
+                report.bytes += files[i].text.size();
+            }
+            else
+            {
+                ++report.skipped;
+            }
+            files[i].release();
+            bool wake;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++consumed;
+                wake = readersWaiting > 0;
+            }
+            if (wake)
+            {
+                roomAhead.notify_all();
+            }
+        }
+    }
+    catch (...)
+    {
+        stop();
+        throw;
+    }
+    stop();
+    return report;
+}
+
+std::vector<std::string_view> splitIntoChunks(std::string_view text, size_t maxBytes)
+{
+    std::vector<std::string_view> chunks;
+    while (!text.empty())
+    {
+        if (maxBytes == 0 || text.size() <= maxBytes)
+        {
+            chunks.push_back(text);
+            break;
+        }
+        size_t cut = maxBytes;
+        size_t newline = text.rfind('\n', maxBytes - 1);
+        if (newline != std::string_view::npos && newline + 1 >= maxBytes / 2)
+        {
+            cut = newline + 1;
+        }
+        else
+        {
+            // Back up to the start of a UTF-8 sequence
+            while (cut > 0 && (static_cast<unsigned char>(text[cut]) & 0xC0) == 0x80)
+            {
+                --cut;
+            }
+            if (cut == 0)
+            {
+                cut = maxBytes;
+            }
+        }
+        chunks.push_back(text.substr(0, cut));
+        text.remove_prefix(cut);
+    }
+    return chunks;
 }
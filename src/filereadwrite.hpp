@@ -5,9 +5,14 @@
 #ifndef filereadwrite_hpp
 #define filereadwrite_hpp
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <vector>
 
 /**
  * @brief Returns the current working directory as a std::filesystem::path.
@@ -31,6 +36,20 @@ std::ofstream openFileForWriting(const std::filesystem::path &filepath);
  */
 void writeToFile(const std::filesystem::path &filepath, const std::string &content);
 
+/// @brief Appends the next piece of a file being written by writeFileAtomically.
+using WritePieceFn = std::function<void(std::string_view piece)>;
+
+/**
+ * @brief Writes a file piece by piece into a temporary file next to it, which replaces filepath
+ * only once it is complete and on disk, so neither a reader nor a crash ever sees half a file.
+ * @param filepath The path of the file to write.
+ * @param produce Called once with a function that appends a piece to the file. If it throws,
+ *        the temporary file is removed, filepath is left as it was, and the exception propagates.
+ * @return The number of bytes written.
+ * @throws std::runtime_error If the file cannot be written.
+ */
+uint64_t writeFileAtomically(const std::filesystem::path &filepath, const std::function<void(const WritePieceFn &)> &produce);
+
 /**
  * @brief Opens a file and reads the contents into a string.
  * @param filepath The path of the file to read.
@@ -39,4 +58,67 @@ void writeToFile(const std::filesystem::path &filepath, const std::string &conte
  */
 std::string readFileToString(const std::filesystem::path &filepath);
 
+/// @brief Limits and parallelism for readFiles.
+struct ReadFilesOptions
+{
+    size_t maxFileBytes = 16 * 1024 * 1024;  // Larger files are skipped
+    size_t maxTotalBytes = 64 * 1024 * 1024; // Files that would take the total past this are skipped
+    size_t mapThreshold = 1024 * 1024;       // Files at least this large are mapped instead of read
+    size_t readAhead = 64;                   // Most files read but not yet consumed
+    size_t threads = 4;                      // Reader threads; mostly waiting on the disk, so not per core
+};
+
+/// @brief One file handed to the readFiles consumer.
+struct FileContent
+{
+    const std::filesystem::path &path;
+    std::string_view text;   // The contents; only valid during the callback
+    std::string skipReason;  // Why the file was not read ("binary", "too large", ...); empty if it was
+};
+
+/// @brief What readFiles did.
+struct ReadFilesReport
+{
+    size_t files = 0;   // Files read
+    size_t skipped = 0; // Files skipped
+    size_t bytes = 0;   // Bytes read
+};
+
+/**
+ * @brief Expands %readfile arguments into a sorted list of regular files.
+ *
+ * An argument may name a file, a directory (walked recursively, skipping entries whose names
+ * start with '.'), or a glob: '*' and '?' match within one path component, "**" matches any
+ * number of components, and [abc], [a-z] and [!x] match one character of a set.
+ * @param patterns The arguments.
+ * @param unmatched Receives the arguments that matched nothing.
+ * @return The files, each once, sorted by path.
+ */
+std::vector<std::filesystem::path> expandFilePatterns(const std::vector<std::string> &patterns,
+                                                      std::vector<std::string> &unmatched);
+
+/**
+ * @brief Returns true if pattern matches path, with the glob syntax of expandFilePatterns.
+ */
+bool globMatch(std::string_view pattern, std::string_view path);
+
+/**
+ * @brief Reads files on a pool of threads and hands them to consume in order, on the calling thread.
+ *
+ * Large files are memory-mapped instead of copied. At most options.readAhead files are held
+ * waiting for consume, and each is released as soon as consume returns, so the caller can copy
+ * the contents where they belong without a second full copy ever existing. Files with a NUL
+ * byte near the start are taken to be binary and skipped, as are empty files, files over
+ * options.maxFileBytes and files past options.maxTotalBytes.
+ */
+ReadFilesReport readFiles(const std::vector<std::filesystem::path> &paths, const ReadFilesOptions &options,
+                          const std::function<void(const FileContent &)> &consume);
+
+/**
+ * @brief Splits text into ordered pieces of at most maxBytes bytes.
+ * Pieces end after a newline where there is one in the second half of a piece, and never in the
+ * middle of a UTF-8 sequence.
+ */
+std::vector<std::string_view> splitIntoChunks(std::string_view text, size_t maxBytes);
+
 #endif /* filereadwrite_hpp */
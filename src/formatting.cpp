@@ -6,56 +6,342 @@
 //
 
 #include "formatting.hpp"
+#include <algorithm>
 #include <iostream>
-#include <sstream>
-#include <string>
-#include <vector>
+#include <string_view>
 
-void wrap(std::string const &input, size_t width, std::ostream &os, size_t defaultIndent = 0)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+struct CodePointRange
 {
-    std::istringstream ss(input);
-    std::string line;
+    char32_t first;
+    char32_t last;
+};
+
+// East Asian Wide (W) and Fullwidth (F) ranges, sorted
+constexpr CodePointRange kWideRanges[] = {
+    {0x1100, 0x115F},   {0x231A, 0x231B},   {0x2329, 0x232A},   {0x23E9, 0x23EC},   {0x23F0, 0x23F0},
+    {0x23F3, 0x23F3},   {0x25FD, 0x25FE},   {0x2614, 0x2615},   {0x2648, 0x2653},   {0x267F, 0x267F},
+    {0x2693, 0x2693},   {0x26A1, 0x26A1},   {0x26AA, 0x26AB},   {0x26BD, 0x26BE},   {0x26C4, 0x26C5},
+    {0x26CE, 0x26CE},   {0x26D4, 0x26D4},   {0x26EA, 0x26EA},   {0x26F2, 0x26F3},   {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA},   {0x26FD, 0x26FD},   {0x2705, 0x2705},   {0x270A, 0x270B},   {0x2728, 0x2728},
+    {0x274C, 0x274C},   {0x274E, 0x274E},   {0x2753, 0x2755},   {0x2757, 0x2757},   {0x2795, 0x2797},
+    {0x27B0, 0x27B0},   {0x27BF, 0x27BF},   {0x2B1B, 0x2B1C},   {0x2B50, 0x2B50},   {0x2B55, 0x2B55},
+    {0x2E80, 0x303E},   {0x3041, 0x33FF},   {0x3400, 0x4DBF},   {0x4E00, 0x9FFF},   {0xA000, 0xA4CF},
+    {0xA960, 0xA97F},   {0xAC00, 0xD7A3},   {0xF900, 0xFAFF},   {0xFE10, 0xFE19},   {0xFE30, 0xFE6F},
+    {0xFF00, 0xFF60},   {0xFFE0, 0xFFE6},   {0x16FE0, 0x16FE4}, {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF},
+    {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F202},
+    {0x1F210, 0x1F23B}, {0x1F240, 0x1F248}, {0x1F250, 0x1F251}, {0x1F260, 0x1F265}, {0x1F300, 0x1F64F},
+    {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD},
+    {0x30000, 0x3FFFD},
+};
+
+// Combining marks and zero-width characters, sorted
+constexpr CodePointRange kZeroWidthRanges[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A}, {0x064B, 0x065F},
+    {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF},
+    {0x200B, 0x200F}, {0x2028, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F},
+    {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xE0100, 0xE01EF},
+};
+
+template <size_t N> bool _inRanges(const CodePointRange (&ranges)[N], char32_t codePoint)
+{
+    const CodePointRange *it = std::upper_bound(std::begin(ranges), std::end(ranges), codePoint,
+                                                [](char32_t cp, const CodePointRange &range) { return cp < range.first; });
+    return it != std::begin(ranges) && codePoint <= (it - 1)->last;
+}
 
-    // Iterate through the lines of the input
-    while (std::getline(ss, line))
+bool _isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * @brief Returns the end of the run of printable ASCII starting at p.
+ * Stops at the first blank, newline, control character or non-ASCII byte.
+ */
+const char *_plainRunEnd(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+    // Compared as signed bytes, everything at or below ' ' and every byte >= 0x80 is below '!'
+    const __m128i limit = _mm_set1_epi8('!');
+    while (end - p >= 16)
     {
-        // If the line is empty or only consists of whitespace, print as is.
-        if (line.find_first_not_of(' ') == std::string::npos)
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(_mm_cmplt_epi8(block, limit));
+        if (mask != 0)
         {
-            os << line << '\n';
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        p += 16;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    const int8x16_t limit = vdupq_n_s8('!');
+    while (end - p >= 16)
+    {
+        int8x16_t block = vld1q_s8(reinterpret_cast<const int8_t *>(p));
+        if (vmaxvq_u8(vcltq_s8(block, limit)) != 0)
+        {
+            break; // The scalar loop below finds the byte within this block
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && static_cast<signed char>(*p) >= '!')
+    {
+        ++p;
+    }
+    return p;
+}
+
+/**
+ * @brief Decodes the UTF-8 sequence at text[pos].
+ * @param length Receives the number of bytes consumed; an invalid byte is consumed alone.
+ * @return The code point, or U+FFFD for an invalid sequence.
+ */
+char32_t _decode(std::string_view text, size_t pos, size_t &length)
+{
+    auto byte = [&](size_t i) { return static_cast<unsigned char>(text[pos + i]); };
+    unsigned char lead = byte(0);
+    size_t expected = lead < 0x80 ? 1 : lead < 0xC2 ? 0 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : lead < 0xF5 ? 4 : 0;
+    if (expected == 0 || pos + expected > text.size())
+    {
+        length = 1;
+        return lead < 0x80 ? lead : 0xFFFD;
+    }
+
+    char32_t codePoint = expected == 2 ? (lead & 0x1F) : expected == 3 ? (lead & 0x0F) : (lead & 0x07);
+    for (size_t i = 1; i < expected; ++i)
+    {
+        if ((byte(i) & 0xC0) != 0x80)
+        {
+            length = 1;
+            return 0xFFFD;
+        }
+        codePoint = (codePoint << 6) | (byte(i) & 0x3F);
+    }
+    length = expected;
+    return codePoint;
+}
+
+void _writeSpaces(std::ostream &os, size_t count)
+{
+    static const char spaces[] = "                                ";
+    while (count > 0)
+    {
+        size_t n = std::min(count, sizeof(spaces) - 1);
+        os.write(spaces, static_cast<std::streamsize>(n));
+        count -= n;
+    }
+}
+} // namespace
+
+size_t codePointWidth(char32_t codePoint)
+{
+    if (codePoint < 0x20 || (codePoint >= 0x7F && codePoint < 0xA0))
+    {
+        return 0; // Control characters
+    }
+    if (codePoint < 0x300)
+    {
+        return 1;
+    }
+    if (_inRanges(kZeroWidthRanges, codePoint))
+    {
+        return 0;
+    }
+    return _inRanges(kWideRanges, codePoint) ? 2 : 1;
+}
+
+size_t displayWidth(std::string_view text)
+{
+    size_t columns = 0;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        const char *runEnd = _plainRunEnd(text.data() + pos, text.data() + text.size());
+        size_t run = static_cast<size_t>(runEnd - (text.data() + pos));
+        if (run > 0)
+        {
+            columns += run;
+            pos += run;
             continue;
         }
+        size_t length;
+        char32_t codePoint = _decode(text, pos, length);
+        columns += _isBlank(text[pos]) ? 1 : codePointWidth(codePoint);
+        pos += length;
+    }
+    return columns;
+}
+
+LineWrapper::LineWrapper(std::string_view text, size_t width, bool breakLongWords, size_t firstLineWidth,
+                         bool indentInWidth)
+    : m_text(text), m_width(std::max<size_t>(width, 1)),
+      m_firstLineWidth(firstLineWidth == 0 ? std::max<size_t>(width, 1) : firstLineWidth),
+      m_breakLongWords(breakLongWords), m_indentInWidth(indentInWidth), m_done(text.empty())
+{
+}
+
+bool LineWrapper::next(WrappedLine &line)
+{
+    const char *data = m_text.data();
+    const size_t end = m_text.size();
+    size_t pos = m_pos;
+
+    if (!m_paragraphStart)
+    {
+        // Continuing a paragraph: drop the blanks the previous line broke at
+        while (pos < end && _isBlank(data[pos]))
+        {
+            ++pos;
+        }
+        if (pos < end && data[pos] == '\n')
+        {
+            ++pos;
+            m_paragraphStart = true;
+        }
+        if (pos >= end)
+        {
+            m_done = true;
+        }
+    }
+    if (m_done)
+    {
+        return false;
+    }
+
+    bool paragraphStart = m_paragraphStart;
+    if (paragraphStart)
+    {
+        size_t indentEnd = pos;
+        while (indentEnd < end && data[indentEnd] == ' ')
+        {
+            ++indentEnd;
+        }
+        // A blank paragraph has no indent to carry
+        bool blank = indentEnd >= end || data[indentEnd] == '\n' || data[indentEnd] == '\r';
+        m_indent = blank ? 0 : indentEnd - pos;
+        pos = indentEnd;
+    }
 
-        // Check for preceding whitespace
-        size_t originalIndent = line.find_first_not_of(' ');
-        size_t totalIndent = originalIndent + defaultIndent;
+    size_t lineWidth = m_firstLine ? m_firstLineWidth : m_width;
+    size_t available = !m_indentInWidth ? lineWidth : lineWidth > m_indent ? lineWidth - m_indent : 1;
 
-        // Remove originalIndent from the line before wrapping
-        line = line.substr(originalIndent);
+    const size_t start = pos;
+    size_t columns = 0;       // Width of everything consumed on this line, blanks included
+    size_t contentEnd = pos;  // End of the last word on the line
+    size_t contentColumns = 0;
+    size_t wordStart = pos;   // Start of the word being consumed
+    size_t breakEnd = pos;    // End of the previous word, where the line can break
+    size_t breakColumns = 0;
 
-        // Tokenize line into words
-        std::vector<std::string> words;
-        std::istringstream lineStream(line);
-        std::string word;
+    auto emit = [&](size_t spanEnd, size_t spanColumns, size_t resume) {
+        line = WrappedLine{start, spanEnd - start, spanColumns, m_indent, paragraphStart};
+        m_pos = resume;
+        m_paragraphStart = false;
+        m_firstLine = false;
+        return true;
+    };
 
-        while (lineStream >> word)
+    while (pos < end)
+    {
+        char c = data[pos];
+        if (c == '\n')
         {
-            words.push_back(word);
+            emit(contentEnd, contentColumns, pos + 1);
+            m_paragraphStart = true;
+            m_done = m_pos >= end;
+            return true;
+        }
+        if (_isBlank(c))
+        {
+            if (columns >= available && contentEnd > start)
+            {
+                return emit(contentEnd, contentColumns, pos); // Nothing more fits after this word
+            }
+            ++columns;
+            ++pos;
+            continue;
+        }
+
+        if (pos != contentEnd || pos == start)
+        {
+            // A new word begins after blanks
+            if (pos != start)
+            {
+                breakEnd = contentEnd;
+                breakColumns = contentColumns;
+            }
+            wordStart = pos;
+        }
+
+        size_t length;
+        size_t width;
+        const char *runEnd = _plainRunEnd(data + pos, data + end);
+        if (runEnd > data + pos)
+        {
+            length = static_cast<size_t>(runEnd - (data + pos));
+            width = length;
+        }
+        else
+        {
+            char32_t codePoint = _decode(m_text, pos, length);
+            width = codePointWidth(codePoint);
         }
 
-        // Construct new lines based on the specified width
-        std::string newLine = std::string(totalIndent, ' ');
-        for (const auto &w : words)
+        if (columns + width > available)
         {
-            if (newLine.length() + w.length() > width + totalIndent)
+            if (wordStart > start)
+            {
+                // Move the whole word to the next line
+                return emit(breakEnd, breakColumns, wordStart);
+            }
+            if (m_breakLongWords)
             {
-                os << newLine << '\n';
-                newLine = std::string(totalIndent, ' ');
+                // The word alone is too wide: take what fits, at least one code point
+                size_t fit = available > columns ? available - columns : 0;
+                if (runEnd > data + pos)
+                {
+                    return emit(pos + fit, columns + fit, pos + fit);
+                }
+                if (pos > start)
+                {
+                    return emit(pos, columns, pos);
+                }
+                return emit(pos + length, width, pos + length);
             }
-            if (newLine.length() > totalIndent)
-                newLine += ' ';
-            newLine += w;
+            // Otherwise keep the word whole and let the line overflow
+        }
+
+        pos += length;
+        columns += width;
+        contentEnd = pos;
+        contentColumns = columns;
+    }
+
+    m_done = true;
+    return emit(contentEnd, contentColumns, end);
+}
+
+void wrap(std::string_view input, size_t width, std::ostream &os, size_t indent)
+{
+    // As before the rewrite, width is for the text alone, however far a paragraph is indented
+    LineWrapper wrapper(input, width, false, 0, false);
+    WrappedLine line;
+    while (wrapper.next(line))
+    {
+        if (line.length > 0)
+        {
+            _writeSpaces(os, indent + line.indent);
+            os.write(input.data() + line.offset, static_cast<std::streamsize>(line.length));
         }
-        os << newLine << '\n';
+        os.put('\n');
     }
 }
@@ -5,20 +5,95 @@
 #ifndef formatting_hpp
 #define formatting_hpp
 
+#include <cstddef>
 #include <iostream>
-#include <string>
+#include <string_view>
+
+/**
+ * @brief Returns the number of terminal columns a code point occupies.
+ *
+ * East Asian wide and fullwidth characters (CJK, Hangul, most emoji) take two columns,
+ * combining marks and zero-width characters take none, everything else takes one.
+ *
+ * @param codePoint The Unicode code point.
+ * @return 0, 1 or 2.
+ */
+size_t codePointWidth(char32_t codePoint);
+
+/**
+ * @brief Returns the number of terminal columns a UTF-8 string occupies.
+ * Invalid bytes count as one column each.
+ * @param text The UTF-8 text to measure.
+ */
+size_t displayWidth(std::string_view text);
+
+/// @brief One line produced by LineWrapper, as a span of the wrapped text.
+struct WrappedLine
+{
+    size_t offset;       // Start of the line within the text, after any indent
+    size_t length;       // Length of the line in bytes, without leading or trailing blanks
+    size_t columns;      // Display width of the span
+    size_t indent;       // Leading spaces of the paragraph, repeated on each of its lines
+    bool paragraphStart; // True for the first line of each '\n'-separated paragraph
+};
+
+/// @class LineWrapper
+/// @brief Breaks UTF-8 text into lines no wider than a given number of columns.
+///
+/// Lines are returned one at a time as spans of the input, so wrapping allocates nothing and the
+/// caller decides where the text goes. Width is measured per code point with codePointWidth(),
+/// lines break at blanks, and each '\n' ends a paragraph. A paragraph's leading spaces become
+/// its indent and are applied to all of its lines. The text must outlive the wrapper.
+class LineWrapper
+{
+  public:
+    /**
+     * @brief Prepares to wrap text.
+     * @param text The UTF-8 text to wrap.
+     * @param width The maximum width of a line in columns, including its indent.
+     * @param breakLongWords Whether words wider than a line are split across lines; otherwise
+     *        they are kept whole and overflow.
+     * @param firstLineWidth The width of the very first line, e.g. when it follows a prefix;
+     *        0 means the same as width.
+     * @param indentInWidth Whether a paragraph's indent counts toward the width; otherwise
+     *        the width is for the text alone and indented lines are wider by their indent.
+     */
+    LineWrapper(std::string_view text, size_t width, bool breakLongWords = false, size_t firstLineWidth = 0,
+                bool indentInWidth = true);
+
+    /**
+     * @brief Produces the next line.
+     * @param line Receives the line.
+     * @return False once the text is exhausted.
+     */
+    bool next(WrappedLine &line);
+
+  private:
+    std::string_view m_text;
+    size_t m_width;
+    size_t m_firstLineWidth;
+    bool m_breakLongWords;
+    bool m_indentInWidth;
+    size_t m_pos = 0;
+    size_t m_indent = 0;
+    bool m_paragraphStart = true;
+    bool m_firstLine = true;
+    bool m_done;
+};
 
 /**
  * @brief Wraps and indents text output to a stream, preventing word breaks.
  *
  * Formats the input string so that no line exceeds the specified width,
  * wrapping at word boundaries and indenting each line as specified.
+ * Lines are written straight from the input; width is measured in display columns.
  *
  * @param input The text to be printed to the console.
- * @param width The maximum number of characters per line (excluding indent).
+ * @param width The maximum number of columns per line, excluding indent: neither indent nor
+ *        the leading spaces of an indented paragraph count toward it.
  * @param os The output stream to print to.
  * @param indent The number of spaces to add at the start of each printed line.
  */
-void wrap(const std::string &input, size_t width, std::ostream &os, size_t indent);
+void wrap(std::string_view input, size_t width, std::ostream &os, size_t indent = 0);
 
 #endif /* formatting_hpp */
@@ -0,0 +1,542 @@
+//  historyindex.cpp
+//
+// Positional inverted index over the chat history, for %search
+
+#include "historyindex.hpp"
+#include <algorithm>
+#include <array>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+constexpr uint32_t kNoTerm = std::numeric_limits<uint32_t>::max();
+
+/// Bytes that make up words: ASCII letters, digits and '_', and every byte of a UTF-8 sequence
+constexpr std::array<bool, 256> kWordBytes = [] {
+    std::array<bool, 256> table{};
+    for (int c = 0; c < 256; ++c)
+    {
+        table[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+    }
+    return table;
+}();
+
+bool _isWordByte(char c)
+{
+    return kWordBytes[static_cast<unsigned char>(c)];
+}
+
+char _lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+}
+
+bool _isAsciiLetter(char c)
+{
+    return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+/// @brief A word of a message: where it is, as a half-open byte range.
+struct WordSpan
+{
+    size_t begin;
+    size_t end;
+};
+
+/**
+ * @brief Calls visit(begin, end) for each word of text, in order.
+ */
+template <typename Visit> void _forEachWord(std::string_view text, Visit &&visit)
+{
+    size_t i = 0;
+    while (i < text.size())
+    {
+        while (i < text.size() && !_isWordByte(text[i]))
+        {
+            ++i;
+        }
+        size_t begin = i;
+        while (i < text.size() && _isWordByte(text[i]))
+        {
+            ++i;
+        }
+        if (i > begin)
+        {
+            visit(begin, i);
+        }
+    }
+}
+
+bool _equalsFolded(const char *text, std::string_view lowered)
+{
+    for (size_t k = 0; k < lowered.size(); ++k)
+    {
+        if (_lower(text[k]) != lowered[k])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the first position of needle in text ignoring ASCII case, or npos.
+ * @param needle Already lowercased.
+ *
+ * Candidates are the positions where the needle's first and last bytes both match, sixteen at
+ * a time; a letter is compared with bit 0x20 set, which folds its case (and lets through a few
+ * punctuation bytes that the full comparison then rejects).
+ */
+size_t _findFolded(std::string_view text, std::string_view needle)
+{
+    if (needle.empty())
+    {
+        return 0;
+    }
+    if (needle.size() > text.size())
+    {
+        return std::string_view::npos;
+    }
+    const size_t last = needle.size() - 1;
+    const char *data = text.data();
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i lastByte = _mm_set1_epi8(needle[last]);
+    const __m128i firstFold = _mm_set1_epi8(_isAsciiLetter(needle[0]) ? 0x20 : 0);
+    const __m128i lastFold = _mm_set1_epi8(_isAsciiLetter(needle[last]) ? 0x20 : 0);
+    for (; i + last + 16 <= text.size(); i += 16)
+    {
+        __m128i starts = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), firstFold);
+        __m128i ends = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + last)), lastFold);
+        unsigned mask = static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first), _mm_cmpeq_epi8(ends, lastByte))));
+        while (mask != 0)
+        {
+            size_t candidate = i + static_cast<size_t>(__builtin_ctz(mask));
+            if (_equalsFolded(data + candidate, needle))
+            {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    const uint8x16_t first = vdupq_n_u8(static_cast<uint8_t>(needle[0]));
+    const uint8x16_t lastByte = vdupq_n_u8(static_cast<uint8_t>(needle[last]));
+    const uint8x16_t firstFold = vdupq_n_u8(_isAsciiLetter(needle[0]) ? 0x20 : 0);
+    const uint8x16_t lastFold = vdupq_n_u8(_isAsciiLetter(needle[last]) ? 0x20 : 0);
+    for (; i + last + 16 <= text.size(); i += 16)
+    {
+        uint8x16_t starts = vorrq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(data + i)), firstFold);
+        uint8x16_t ends = vorrq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(data + i + last)), lastFold);
+        if (vmaxvq_u8(vandq_u8(vceqq_u8(starts, first), vceqq_u8(ends, lastByte))) == 0)
+        {
+            continue;
+        }
+        for (size_t candidate = i; candidate < i + 16; ++candidate)
+        {
+            if (_equalsFolded(data + candidate, needle))
+            {
+                return candidate;
+            }
+        }
+    }
+#endif
+    for (; i + last < text.size(); ++i)
+    {
+        if (_lower(data[i]) == needle[0] && _equalsFolded(data + i, needle))
+        {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+/**
+ * @brief Moves cursor forward to the first posting not before target, a (entry, position) pair
+ * packed as entry << 32 | position, and tells whether it is the target. Probes the next few
+ * postings first and then gallops, so a run of increasing targets costs little more than one
+ * pass over the list.
+ */
+template <typename Posting> bool _seek(const std::vector<Posting> &postings, size_t &cursor, uint64_t target)
+{
+    auto key = [](const Posting &posting) { return uint64_t(posting.entry) << 32 | posting.position; };
+    const size_t size = postings.size();
+    size_t low = cursor;
+    for (size_t probe = 0; probe < 8 && low < size; ++probe, ++low)
+    {
+        if (key(postings[low]) >= target)
+        {
+            cursor = low;
+            return key(postings[low]) == target;
+        }
+    }
+    size_t step = 8;
+    size_t high = low;
+    while (high < size && key(postings[high]) < target)
+    {
+        low = high + 1;
+        high += step;
+        step *= 2;
+    }
+    high = std::min(high, size);
+    cursor = static_cast<size_t>(
+        std::partition_point(postings.begin() + low, postings.begin() + high,
+                             [&](const Posting &posting) { return key(posting) < target; }) -
+        postings.begin());
+    return cursor < size && key(postings[cursor]) == target;
+}
+
+/// FNV-1a, over the bytes of a lowercased word
+uint64_t _hash(std::string_view word)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : word)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+std::vector<size_t> _intersect(const std::vector<size_t> &a, const std::vector<size_t> &b)
+{
+    std::vector<size_t> result;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+} // namespace
+
+SearchQuery parseSearchQuery(const std::vector<std::string> &arguments)
+{
+    SearchQuery query;
+    for (const std::string &argument : arguments)
+    {
+        std::string text = argument;
+        bool literal = false;
+        if (!text.empty() && text.back() == '*')
+        {
+            text.pop_back();
+            literal = true;
+        }
+        std::transform(text.begin(), text.end(), text.begin(), _lower);
+        literal = literal || std::any_of(text.begin(), text.end(), [](char c) { return !_isWordByte(c) && c != ' '; });
+
+        SearchClause clause;
+        _forEachWord(text, [&](size_t begin, size_t end) {
+            // Inside text to find, only words with something else on both sides are whole words
+            if (!literal || (begin > 0 && end < text.size()))
+            {
+                clause.words.push_back(text.substr(begin, end - begin));
+            }
+        });
+        if (literal)
+        {
+            clause.substring = text;
+        }
+        if (!clause.words.empty() || !clause.substring.empty())
+        {
+            query.clauses.push_back(std::move(clause));
+        }
+    }
+    return query;
+}
+
+void HistoryIndex::sync(const ChatHistory &chatHistory)
+{
+    // Keep the longest prefix of entries that is unchanged; edits only ever happen at the tail
+    size_t keep = std::min(m_entries.size(), chatHistory.size());
+    while (keep > 0)
+    {
+        Dialog dialog = chatHistory[keep - 1];
+        const IndexedEntry &indexed = m_entries[keep - 1];
+        if (indexed.id == dialog.id && indexed.messageLength == dialog.message.size())
+        {
+            break;
+        }
+        --keep;
+    }
+    while (m_entries.size() > keep)
+    {
+        _removeLast();
+    }
+    for (size_t i = keep; i < chatHistory.size(); ++i)
+    {
+        _add(chatHistory[i]);
+    }
+}
+
+std::vector<size_t> HistoryIndex::search(const ChatHistory &chatHistory, const SearchQuery &query) const
+{
+    // Word clauses narrow the candidates cheaply; substring clauses then only scan what is left
+    std::vector<const SearchClause *> clauses;
+    for (const SearchClause &clause : query.clauses)
+    {
+        clauses.push_back(&clause);
+    }
+    std::stable_partition(clauses.begin(), clauses.end(),
+                          [](const SearchClause *clause) { return clause->substring.empty(); });
+
+    std::vector<size_t> result;
+    bool narrowed = false;
+    for (const SearchClause *clause : clauses)
+    {
+        if (narrowed && result.empty())
+        {
+            break;
+        }
+        std::vector<size_t> matches = _match(chatHistory, *clause, narrowed ? &result : nullptr);
+        result = std::move(matches);
+        narrowed = true;
+    }
+    return result;
+}
+
+SearchMatch HistoryIndex::locate(std::string_view message, const SearchQuery &query)
+{
+    SearchMatch match;
+    if (query.clauses.empty())
+    {
+        return match;
+    }
+    const SearchClause &clause = query.clauses.front();
+    if (!clause.substring.empty())
+    {
+        size_t offset = _findFolded(message, clause.substring);
+        if (offset != std::string_view::npos)
+        {
+            match.offset = offset;
+            match.length = clause.substring.size();
+        }
+        return match;
+    }
+
+    std::vector<WordSpan> words;
+    _forEachWord(message, [&](size_t begin, size_t end) { words.push_back(WordSpan{begin, end}); });
+    const size_t count = clause.words.size();
+    for (size_t first = 0; first + count <= words.size(); ++first)
+    {
+        bool found = true;
+        for (size_t k = 0; k < count && found; ++k)
+        {
+            const WordSpan &word = words[first + k];
+            found = word.end - word.begin == clause.words[k].size() &&
+                    _equalsFolded(message.data() + word.begin, clause.words[k]);
+        }
+        if (found)
+        {
+            match.offset = words[first].begin;
+            match.length = words[first + count - 1].end - words[first].begin;
+            return match;
+        }
+    }
+    return match;
+}
+
+size_t HistoryIndex::entries() const
+{
+    return m_entries.size();
+}
+
+size_t HistoryIndex::terms() const
+{
+    return m_terms.size();
+}
+
+size_t HistoryIndex::postings() const
+{
+    return m_postingCount;
+}
+
+uint32_t HistoryIndex::_find(std::string_view word, uint64_t hash) const
+{
+    if (m_slots.empty())
+    {
+        return kNoTerm;
+    }
+    const size_t mask = m_slots.size() - 1;
+    for (size_t slot = hash & mask; m_slots[slot] != 0; slot = (slot + 1) & mask)
+    {
+        const Term &term = m_terms[m_slots[slot] - 1];
+        if (term.hash == hash && std::string_view(m_termText).substr(term.offset, term.length) == word)
+        {
+            return m_slots[slot] - 1;
+        }
+    }
+    return kNoTerm;
+}
+
+uint32_t HistoryIndex::_insert(std::string_view word, uint64_t hash)
+{
+    // Kept at most half full, so probes stay short
+    if ((m_terms.size() + 1) * 2 > m_slots.size())
+    {
+        m_slots.assign(std::max<size_t>(m_slots.size() * 2, 1024), 0);
+        const size_t mask = m_slots.size() - 1;
+        for (uint32_t id = 0; id < m_terms.size(); ++id)
+        {
+            size_t slot = m_terms[id].hash & mask;
+            while (m_slots[slot] != 0)
+            {
+                slot = (slot + 1) & mask;
+            }
+            m_slots[slot] = id + 1;
+        }
+    }
+    const uint32_t id = static_cast<uint32_t>(m_terms.size());
+    m_terms.push_back(Term{hash, static_cast<uint32_t>(m_termText.size()), static_cast<uint32_t>(word.size())});
+    m_termText.append(word);
+    m_postings.emplace_back();
+    const size_t mask = m_slots.size() - 1;
+    size_t slot = hash & mask;
+    while (m_slots[slot] != 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+    m_slots[slot] = id + 1;
+    return id;
+}
+
+void HistoryIndex::_add(const Dialog &dialog)
+{
+    const uint32_t entry = static_cast<uint32_t>(m_entries.size());
+    IndexedEntry indexed{dialog.id, dialog.message.size(), false, {}};
+    indexed.searchable = dialog.role == Role::Assistant ||
+                         (dialog.role == Role::User && (dialog.message.empty() || dialog.message[0] != '%'));
+    if (indexed.searchable)
+    {
+        std::string lowered;
+        uint32_t position = 0;
+        _forEachWord(dialog.message, [&](size_t begin, size_t end) {
+            lowered.assign(dialog.message.data() + begin, end - begin);
+            std::transform(lowered.begin(), lowered.end(), lowered.begin(), _lower);
+            uint64_t hash = _hash(lowered);
+            uint32_t term = _find(lowered, hash);
+            if (term == kNoTerm)
+            {
+                term = _insert(lowered, hash);
+            }
+            std::vector<Posting> &postings = m_postings[term];
+            if (postings.empty() || postings.back().entry != entry)
+            {
+                indexed.termIds.push_back(term);
+            }
+            postings.push_back(Posting{entry, position++});
+        });
+        m_postingCount += position;
+    }
+    m_entries.push_back(std::move(indexed));
+}
+
+void HistoryIndex::_removeLast()
+{
+    const uint32_t entry = static_cast<uint32_t>(m_entries.size() - 1);
+    for (uint32_t term : m_entries.back().termIds)
+    {
+        std::vector<Posting> &postings = m_postings[term];
+        while (!postings.empty() && postings.back().entry == entry)
+        {
+            postings.pop_back();
+            --m_postingCount;
+        }
+    }
+    m_entries.pop_back();
+}
+
+std::vector<size_t> HistoryIndex::_match(const ChatHistory &chatHistory, const SearchClause &clause,
+                                         const std::vector<size_t> *candidates) const
+{
+    std::vector<size_t> matches;
+    if (clause.substring.empty())
+    {
+        matches = _phrase(clause.words);
+        return candidates != nullptr ? _intersect(*candidates, matches) : matches;
+    }
+
+    // The whole words inside the text must each occur in a message that holds it
+    std::vector<size_t> hinted;
+    bool hintedAny = candidates != nullptr;
+    if (candidates != nullptr)
+    {
+        hinted = *candidates;
+    }
+    for (const std::string &word : clause.words)
+    {
+        std::vector<size_t> holding = _phrase({word});
+        hinted = hintedAny ? _intersect(hinted, holding) : std::move(holding);
+        hintedAny = true;
+    }
+    auto scan = [&](size_t entry) {
+        if (m_entries[entry].searchable &&
+            _findFolded(chatHistory[entry].message, clause.substring) != std::string_view::npos)
+        {
+            matches.push_back(entry);
+        }
+    };
+    if (hintedAny)
+    {
+        std::for_each(hinted.begin(), hinted.end(), scan);
+    }
+    else
+    {
+        for (size_t entry = 0; entry < m_entries.size(); ++entry)
+        {
+            scan(entry);
+        }
+    }
+    return matches;
+}
+
+std::vector<size_t> HistoryIndex::_phrase(const std::vector<std::string> &words) const
+{
+    std::vector<size_t> matches;
+    std::vector<const std::vector<Posting> *> lists;
+    size_t rarest = 0;
+    for (const std::string &word : words)
+    {
+        uint32_t term = _find(word, _hash(word));
+        if (term == kNoTerm || m_postings[term].empty())
+        {
+            return matches;
+        }
+        lists.push_back(&m_postings[term]);
+        if (lists.back()->size() < lists[rarest]->size())
+        {
+            rarest = lists.size() - 1;
+        }
+    }
+    if (lists.empty())
+    {
+        return matches;
+    }
+
+    // Walk the rarest word's postings and look the others up at the positions around each one;
+    // once a message matches, the rest of its postings are skipped
+    const std::vector<Posting> &driver = *lists[rarest];
+    std::vector<size_t> cursors(lists.size(), 0);
+    size_t i = 0;
+    while (i < driver.size())
+    {
+        const Posting posting = driver[i];
+        bool found = posting.position >= rarest;
+        uint64_t start = (uint64_t(posting.entry) << 32 | posting.position) - rarest;
+        for (size_t k = 0; k < lists.size() && found; ++k)
+        {
+            found = k == rarest || _seek(*lists[k], cursors[k], start + k);
+        }
+        if (!found)
+        {
+            ++i;
+            continue;
+        }
+        matches.push_back(posting.entry);
+        _seek(driver, i, uint64_t(posting.entry + 1) << 32);
+    }
+    return matches;
+}
@@ -0,0 +1,148 @@
+//  historyindex.hpp
+//
+// Positional inverted index over the chat history, for %search
+
+#ifndef historyindex_hpp
+#define historyindex_hpp
+
+#include "chathistory.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// @brief One part of a search; a message matches a query when it matches every clause.
+struct SearchClause
+{
+    std::vector<std::string> words; // Lowercased words to find next to each other, in order
+    std::string substring;          // Lowercased text to find anywhere, when not empty; words are then only a hint
+};
+
+/// @brief A parsed %search query.
+struct SearchQuery
+{
+    std::vector<SearchClause> clauses;
+};
+
+/**
+ * @brief Parses %search arguments into a query.
+ *
+ * Each argument is a clause. An argument of letters and digits only, such as `parser` or
+ * `"token budget"`, is a word or phrase. Any other argument, such as `std::vector<int>` or
+ * `vec*` (a trailing `*` is dropped), is found as text inside words too, ignoring case.
+ */
+SearchQuery parseSearchQuery(const std::vector<std::string> &arguments);
+
+/// @brief Where a clause matched inside a message.
+struct SearchMatch
+{
+    size_t offset = 0;
+    size_t length = 0;
+};
+
+/// @class HistoryIndex
+/// @brief Maps each word of the conversation to the messages and positions it occurs at.
+///
+/// Like HistoryLayout, the index follows the history by entry id and message length: sync()
+/// keeps the entries that are unchanged, drops the postings of the rest from the tail of each
+/// posting list, and indexes only the new entries, so a growing transcript, a streamed reply
+/// or a branch switch costs what changed. Only user and assistant messages are indexed,
+/// without the command lines the UI echoes; system output would otherwise match its own
+/// search results.
+///
+/// Words are runs of ASCII letters, digits, '_' and non-ASCII bytes, compared ignoring ASCII
+/// case. Phrases are answered from positional postings, starting with the rarest word; clauses
+/// that are not whole words fall back to a vectorized substring scan of the messages the whole
+/// words inside them leave as candidates.
+class HistoryIndex
+{
+  public:
+    /**
+     * @brief Brings the index up to date with chatHistory.
+     */
+    void sync(const ChatHistory &chatHistory);
+
+    /**
+     * @brief Returns the indexes of the messages matching query, oldest first. The index must
+     * have been synced with chatHistory.
+     */
+    std::vector<size_t> search(const ChatHistory &chatHistory, const SearchQuery &query) const;
+
+    /**
+     * @brief Returns where the first clause of query first matches in message, or a match of
+     * length 0 when it does not.
+     */
+    static SearchMatch locate(std::string_view message, const SearchQuery &query);
+
+    /**
+     * @brief Returns the number of entries indexed, and of distinct words and postings.
+     */
+    size_t entries() const;
+    size_t terms() const;
+    size_t postings() const;
+
+  private:
+    /// @brief One occurrence of a word.
+    struct Posting
+    {
+        uint32_t entry;
+        uint32_t position; // Index of the word within the message
+    };
+
+    struct IndexedEntry
+    {
+        uint32_t id;
+        size_t messageLength;
+        bool searchable;                // False for system output and command lines, which are not indexed
+        std::vector<uint32_t> termIds;  // The distinct words of the message, whose posting lists end with it
+    };
+
+    /// @brief A distinct word: its hash and where its text is in m_termText.
+    struct Term
+    {
+        uint64_t hash;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    std::string m_termText;                       // Every distinct word, back to back
+    std::vector<Term> m_terms;                    // By term id
+    std::vector<uint32_t> m_slots;                // Open-addressing table of term id + 1; 0 is empty
+    std::vector<std::vector<Posting>> m_postings; // By term id, in (entry, position) order
+    std::vector<IndexedEntry> m_entries;
+    size_t m_postingCount = 0;
+
+    /**
+     * @brief Returns the id of a lowercased word with the given hash, or UINT32_MAX if it does not occur.
+     */
+    uint32_t _find(std::string_view word, uint64_t hash) const;
+
+    /**
+     * @brief Adds a word that does not occur yet and returns its id.
+     */
+    uint32_t _insert(std::string_view word, uint64_t hash);
+
+    /**
+     * @brief Adds the words of one entry at the end of the index.
+     */
+    void _add(const Dialog &dialog);
+
+    /**
+     * @brief Drops the last entry and its postings.
+     */
+    void _removeLast();
+
+    /**
+     * @brief Returns the sorted, distinct messages matching one clause, among candidates if given.
+     */
+    std::vector<size_t> _match(const ChatHistory &chatHistory, const SearchClause &clause,
+                               const std::vector<size_t> *candidates) const;
+
+    /**
+     * @brief Returns the sorted, distinct messages holding the words next to each other, in order.
+     */
+    std::vector<size_t> _phrase(const std::vector<std::string> &words) const;
+};
+
+#endif /* historyindex_hpp */
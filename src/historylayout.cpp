@@ -0,0 +1,126 @@
+//  historylayout.cpp
+//
+// Cached line layout of the chat history for the virtualized history pane
+
+#include "historylayout.hpp"
+#include "formatting.hpp"
+#include <algorithm>
+
+void HistoryLayout::sync(const ChatHistory &chatHistory, size_t width)
+{
+    width = std::max<size_t>(width, 1);
+    if (width != m_width)
+    {
+        m_width = width;
+        m_entries.clear();
+    }
+
+    // Keep the longest prefix of entries that is unchanged; edits only ever happen at the tail
+    size_t keep = std::min(m_entries.size(), chatHistory.size());
+    while (keep > 0)
+    {
+        Dialog dialog = chatHistory[keep - 1];
+        const CachedEntry &cached = m_entries[keep - 1];
+        if (cached.id == dialog.id && cached.messageLength == dialog.message.size())
+        {
+            break;
+        }
+        --keep;
+    }
+    m_entries.resize(keep);
+
+    for (size_t i = keep; i < chatHistory.size(); ++i)
+    {
+        m_entries.push_back(_layoutEntry(chatHistory[i], lineCount()));
+    }
+}
+
+size_t HistoryLayout::lineCount() const
+{
+    if (m_entries.empty())
+    {
+        return 0;
+    }
+    return m_entries.back().firstLine + m_entries.back().lines.size();
+}
+
+std::vector<HistoryLine> HistoryLayout::window(size_t firstLine, size_t count) const
+{
+    std::vector<HistoryLine> lines;
+    if (count == 0 || firstLine >= lineCount())
+    {
+        return lines;
+    }
+    lines.reserve(std::min(count, lineCount() - firstLine));
+
+    // Find the entry holding firstLine: the last entry that starts at or before it
+    auto it = std::upper_bound(m_entries.begin(), m_entries.end(), firstLine,
+                               [](size_t line, const CachedEntry &entry) { return line < entry.firstLine; });
+    size_t entry = static_cast<size_t>(it - m_entries.begin()) - 1;
+    size_t lineInEntry = firstLine - m_entries[entry].firstLine;
+
+    while (lines.size() < count && entry < m_entries.size())
+    {
+        const CachedEntry &cached = m_entries[entry];
+        for (; lineInEntry < cached.lines.size() && lines.size() < count; ++lineInEntry)
+        {
+            const LineSpan &span = cached.lines[lineInEntry];
+            lines.push_back(HistoryLine{entry, lineInEntry == 0, span.offset, span.length, span.indent});
+        }
+        ++entry;
+        lineInEntry = 0;
+    }
+    return lines;
+}
+
+std::string HistoryLayout::lineText(const ChatHistory &chatHistory, const HistoryLine &line)
+{
+    Dialog dialog = chatHistory[line.entry];
+    std::string text;
+    if (line.first)
+    {
+        text.reserve(dialog.participant.size() + 2 + line.indent + line.length);
+        text.append(dialog.participant).append(": ");
+    }
+    text.append(line.indent, ' ');
+    text.append(dialog.message.substr(line.offset, line.length));
+    return text;
+}
+
+size_t HistoryLayout::lineOf(size_t entry, size_t offset) const
+{
+    const CachedEntry &cached = m_entries[entry];
+    auto it = std::upper_bound(cached.lines.begin(), cached.lines.end(), offset,
+                               [](size_t value, const LineSpan &span) { return value < span.offset; });
+    size_t line = it == cached.lines.begin() ? 0 : static_cast<size_t>(it - cached.lines.begin()) - 1;
+    return cached.firstLine + line;
+}
+
+size_t HistoryLayout::entriesLaidOut() const
+{
+    return m_entriesLaidOut;
+}
+
+HistoryLayout::CachedEntry HistoryLayout::_layoutEntry(const Dialog &dialog, size_t firstLine)
+{
+    ++m_entriesLaidOut;
+
+    CachedEntry cached;
+    cached.id = dialog.id;
+    cached.messageLength = dialog.message.size();
+    cached.firstLine = firstLine;
+
+    // The first line is shortened by the "participant: " prefix; words wider than the pane are split
+    size_t prefix = displayWidth(dialog.participant) + 2;
+    LineWrapper wrapper(dialog.message, m_width, true, m_width > prefix ? m_width - prefix : 1);
+    WrappedLine line;
+    while (wrapper.next(line))
+    {
+        cached.lines.push_back(LineSpan{line.offset, line.length, line.indent});
+    }
+    if (cached.lines.empty())
+    {
+        cached.lines.push_back(LineSpan{0, 0, 0});
+    }
+    return cached;
+}
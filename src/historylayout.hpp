@@ -0,0 +1,103 @@
+//  historylayout.hpp
+//
+// Cached line layout of the chat history for the virtualized history pane
+
+#ifndef historylayout_hpp
+#define historylayout_hpp
+
+#include "chathistory.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// @brief One laid-out line of the history pane.
+struct HistoryLine
+{
+    size_t entry;  // Index of the dialog entry the line belongs to
+    bool first;    // True for the entry's first line, which carries the "participant: " prefix
+    size_t offset; // Start of the line within the entry's message
+    size_t length; // Length of the line in bytes
+    size_t indent; // Spaces to show before the line, from its paragraph's indentation
+};
+
+/// @class HistoryLayout
+/// @brief Wraps each dialog entry into lines once, with LineWrapper, and keeps the result until
+/// the entry changes.
+///
+/// Entries are cached by their id and message length, so an unchanged transcript costs nothing
+/// to re-layout, a growing streamed reply only re-wraps itself, and a width change re-wraps
+/// everything once. The pane then asks for just the lines it can show.
+class HistoryLayout
+{
+  public:
+    /**
+     * @brief Brings the layout up to date with chatHistory at the given width.
+     *
+     * The history only changes at its tail, so entries are compared from the end until the first
+     * unchanged one; everything before it is kept.
+     *
+     * @param chatHistory The history being displayed.
+     * @param width The width of the pane in columns.
+     */
+    void sync(const ChatHistory &chatHistory, size_t width);
+
+    /**
+     * @brief Returns the total number of laid-out lines.
+     */
+    size_t lineCount() const;
+
+    /**
+     * @brief Returns up to count lines starting at line firstLine.
+     * @param firstLine The index of the first line to return.
+     * @param count The maximum number of lines to return.
+     */
+    std::vector<HistoryLine> window(size_t firstLine, size_t count) const;
+
+    /**
+     * @brief Returns the index of the line showing byte offset of an entry's message, e.g. to
+     * scroll a search hit into view. The entry must be laid out.
+     * @param entry The index of the dialog entry.
+     * @param offset A byte offset within its message.
+     */
+    size_t lineOf(size_t entry, size_t offset) const;
+
+    /**
+     * @brief Returns the text of a line, including the participant prefix on an entry's first line.
+     * @param chatHistory The history the layout was synced with.
+     * @param line A line returned by window().
+     */
+    static std::string lineText(const ChatHistory &chatHistory, const HistoryLine &line);
+
+    /**
+     * @brief Returns how many entries have been wrapped since construction (cache misses).
+     */
+    size_t entriesLaidOut() const;
+
+  private:
+    struct LineSpan
+    {
+        size_t offset;
+        size_t length;
+        size_t indent;
+    };
+
+    struct CachedEntry
+    {
+        uint32_t id;
+        size_t messageLength;
+        size_t firstLine; // Index of the entry's first line in the whole layout
+        std::vector<LineSpan> lines;
+    };
+
+    size_t m_width = 0;
+    std::vector<CachedEntry> m_entries;
+    size_t m_entriesLaidOut = 0;
+
+    /**
+     * @brief Wraps one entry's text into line spans at m_width.
+     */
+    CachedEntry _layoutEntry(const Dialog &dialog, size_t firstLine);
+};
+
+#endif /* historylayout_hpp */
@@ -1,12 +1,31 @@
 // ChatGPT CLI - A CLI interface for chatting with ChatGPT
 // Copyright (C) 2025 - Patrick Brown
 
+#include "batch.hpp"
 #include "chatgptapi.hpp"
 #include "command.hpp"
 #include "commandcontext.hpp"
+#include "daemon.hpp"
 #include "apikeycheck.hpp"
 #include "chathistory.hpp" // Ensure ChatHistory is included
+#include "historylayout.hpp"
+#include "metrics.hpp"
+#include "ratelimiter.hpp"
+#include "request.hpp"
+#include "requestexecutor.hpp"
+#include "sessionjournal.hpp"
+#include "startupprofile.hpp"
+#include "usageledger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <vector>
 // #include <string> // Already included by ftxui headers indirectly
 // #include <termcolor/termcolor.hpp> // No longer needed for main output
 
@@ -16,6 +35,7 @@
 #include <ftxui/component/component_options.hpp> // For InputOption and other component options
 #include <ftxui/dom/elements.hpp>               // For text, vbox, hbox, border, flex, separator, paragraph
 #include <ftxui/screen/color.hpp>               // For ftxui::Color
+#include <ftxui/screen/terminal.hpp>            // For ftxui::Terminal::Size
 #include <string>                               // For std::string
 
 // Global FTXUI Components and Data
@@ -23,22 +43,177 @@ std::string userInput;
 ftxui::Component inputComponent;
 ftxui::Component historyComponent;
 ftxui::ScreenInteractive screen = ftxui::ScreenInteractive::Fullscreen();
+std::filesystem::path metricsFile; // Where to export the request timings at exit, if anywhere
+
+/**
+ * @brief Exit handler that writes the request timings for --metrics-file; %quit exits through here too.
+ */
+void writeMetricsFile()
+{
+    try {
+        sharedMetrics().writePrometheusFile(metricsFile);
+    } catch (const std::exception &e) {
+        std::cerr << "[ERROR] " << e.what() << std::endl;
+    }
+}
 
 /**
  * @brief Entry point for the ChatGPT CLI application.
  *
  * Initializes the environment, validates the OpenAI API key,
- * and runs the main user input loop using FTXUI.
+ * and runs the main user input loop using FTXUI. With --batch, runs a JSONL file of
+ * requests without the UI instead (see runBatchMain). With --resume [journal], continues the
+ * session recorded in the journal instead of starting a new one. With --startup-profile, reports
+ * how long each startup phase took once the first frame is drawn. With --metrics-file <path>,
+ * writes the request phase timings to path in the Prometheus text format on exit. With --daemon,
+ * serves requests from other instances over a Unix socket (see runDaemonMain), which the UI then
+ * sends its turns through; with --client, pipes standard input to such a daemon (see runClientMain).
  *
  * @return int Exit code (0 for normal termination).
  */
-int main()
+int main(int argc, char *argv[])
 {
-    // Check if the OpenAI API key is valid before starting the CLI
-    checkOpenAIKeyOrExit();
+    std::vector<std::string> args(argv + 1, argv + argc);
+    StartupProfile startupProfile;
+    auto profileFlag = std::find(args.begin(), args.end(), "--startup-profile");
+    bool profileStartup = profileFlag != args.end();
+    if (profileStartup) {
+        args.erase(profileFlag);
+    }
+    auto metricsFlag = std::find(args.begin(), args.end(), "--metrics-file");
+    if (metricsFlag != args.end()) {
+        if (metricsFlag + 1 == args.end()) {
+            std::cerr << "[ERROR] --metrics-file needs a file name." << std::endl;
+            return 1;
+        }
+        metricsFile = *(metricsFlag + 1);
+        args.erase(metricsFlag, metricsFlag + 2);
+        std::atexit(writeMetricsFile);
+    }
+    startupProfile.mark("main");
+
+    // The pipe client only talks to a daemon, which holds the keys
+    if (!args.empty() && args[0] == "--client") {
+        return runClientMain(args);
+    }
+
+    // Without a key there is nothing to do; this prints how to set one and exits
+    if (configuredApiKeys().empty()) {
+        checkOpenAIKeyOrExit();
+    }
+    if (!args.empty() && args[0] == "--batch") {
+        // Batch runs have no UI to come up, so the key is checked before the first request as before
+        checkOpenAIKeyOrExit();
+        return runBatchMain(args);
+    }
+    if (!args.empty() && args[0] == "--daemon") {
+        checkOpenAIKeyOrExit();
+        return runDaemonMain(args);
+    }
+
     CommandContext commandContext; 
     ChatHistory chatHistory;       // Actual chat history store
+
+    // Every change to the history is journaled, so the session can be resumed after a restart
+    std::filesystem::path journalPath = sessionJournalPath();
+    bool resume = !args.empty() && args[0] == "--resume";
+    if (resume && args.size() > 1) {
+        journalPath = args[1];
+    }
+    std::unique_ptr<SessionJournal> sessionJournal;
+    if (!journalPath.empty()) {
+        try {
+            std::string status;
+            if (resume && std::filesystem::exists(journalPath)) {
+                auto start = std::chrono::steady_clock::now();
+                JournalReplay replay = replaySessionJournal(journalPath, chatHistory);
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                status = "Resumed " + std::to_string(chatHistory.size()) + " entries from " + journalPath.string() +
+                         " in " + std::to_string(static_cast<int>(elapsed.count())) + " ms";
+                // A crash can leave the last record half written; say so rather than drop it silently
+                status += replay.tornTail ? " (ignored a damaged final record)." : ".";
+            } else if (resume) {
+                status = "No session to resume at " + journalPath.string() + "; starting a new one.";
+            }
+            sessionJournal = std::make_unique<SessionJournal>(journalPath, !resume);
+            chatHistory.setJournal(sessionJournal.get());
+            if (!status.empty()) {
+                chatHistory.addDialog("system", status);
+            }
+        } catch (const std::exception &e) {
+            chatHistory.addDialog("error", "Session journal disabled: " + std::string(e.what()));
+        }
+    }
+    if (const std::filesystem::path &daemon = activeDaemonSocket(); !daemon.empty()) {
+        chatHistory.addDialog("system", "Sending requests through the daemon at " + daemon.string() + ".");
+    }
+    startupProfile.mark("session ready");
     int historyPaneSize{20};
+    bool requestInFlight{false};     // Only read and written on the UI thread
+    bool timeNextFrame{false};       // Set when a reply completes, so the frame showing it is timed
+    RequestExecutor requestExecutor; // Declared after chatHistory so it is joined before history is destroyed
+
+    // Commands that wait on the network (%compare) run here and post their results back; file
+    // work (%save, %readfile, autosave) runs on its own thread against snapshots of the history,
+    // so neither the UI nor a cancelled request ever waits on the disk
+    RequestExecutor commandExecutor;
+    RequestExecutor ioExecutor;
+    std::string ioProgress; // Only read and written on the UI thread
+    std::optional<std::pair<size_t, size_t>> revealTarget; // Entry and offset %search scrolls to next frame
+    std::optional<std::pair<size_t, size_t>> revealedLine; // Entry and line of the last hit, shown highlighted
+    setCommandRunner({[&](BackgroundJob job) { commandExecutor.submit(std::move(job)); },
+                      [](std::function<void()> task) {
+                          screen.Post(std::move(task));
+                          screen.PostEvent(ftxui::Event::Custom);
+                      },
+                      [&](BackgroundJob job) { ioExecutor.submit(std::move(job)); },
+                      [&](std::string line) {
+                          screen.Post([&, line = std::move(line)] { ioProgress = line; });
+                          screen.PostEvent(ftxui::Event::Custom);
+                      },
+                      [&](size_t entry, size_t offset) { revealTarget = {entry, offset}; }});
+
+    // With CHATGPT_CLI_AUTOSAVE set, the history is saved there every CHATGPT_CLI_AUTOSAVE_SECONDS
+    // when it changed; the timer only posts, and the save itself goes to the I/O thread
+    RequestExecutor autosaveTimer; // Declared last of the executors, so it stops first
+    if (std::filesystem::path autosave = autosavePath(); !autosave.empty()) {
+        autosaveTimer.submit([&, autosave](const std::atomic<bool> &) {
+            // Sleeps until each save is due; stopping the timer wakes it at once
+            auto next = std::chrono::steady_clock::now() + autosaveInterval();
+            while (!autosaveTimer.waitCancelled(next)) {
+                next += autosaveInterval();
+                screen.Post([&, autosave] { autosaveHistory(autosave, chatHistory); });
+            }
+        });
+    }
+
+    // The API key is checked in the background so the UI comes up at once; the result goes to
+    // the status line, and a rejected key is reported in the history too. Keys validated
+    // recently are remembered (hashed) on disk and not checked again until the entry expires.
+    std::string keyStatus = "Checking API key...";
+    KeyCheckResult::Status keyStatusKind = KeyCheckResult::Status::Unreachable; // Yellow until the check ends
+    RequestExecutor keyCheckExecutor; // Declared after what its job posts to, so it is joined first
+    keyCheckExecutor.submit([&](const std::atomic<bool> &cancelled) {
+        KeyCheckResult result = checkApiKeys(configuredApiKeys(), sharedKeyValidationCache(), &cancelled);
+        auto finished = std::chrono::steady_clock::now();
+        screen.Post([&, result, finished] {
+            keyStatus = result.message;
+            keyStatusKind = result.status;
+            if (result.status == KeyCheckResult::Status::Invalid) {
+                chatHistory.addDialog("error", result.message +
+                                                   ". Set OPENAI_KEY to a valid key; see "
+                                                   "https://platform.openai.com/account/api-keys.");
+            }
+            if (profileStartup) {
+                startupProfile.mark("API key checked", finished);
+                char elapsed[32];
+                std::snprintf(elapsed, sizeof(elapsed), "%.1f", startupProfile.millisecondsTo("API key checked"));
+                chatHistory.addDialog("system", std::string("Startup profile: API key check finished at ") + elapsed +
+                                                    " ms" + (result.fromCache ? " (validated recently)." : "."));
+            }
+        });
+        screen.PostEvent(ftxui::Event::Custom);
+    });
 
     // Input component options and on_enter handler
     auto input_option = ftxui::InputOption();
@@ -47,7 +222,28 @@ int main()
             return; // Do nothing if input is empty
         }
 
+        // Only one conversation turn can be in flight; the next one needs its reply as context
+        // Files being read go before the question about them, so a turn waits for %readfile too
+        bool asks = userInput.rfind("%ask", 0) == 0;
+        if ((userInput[0] != '%' || asks) && (requestInFlight || askInProgress() || readfileInProgress())) {
+            return; // Keep the typed input until the current request finishes or is cancelled
+        }
+
+        // Replies land in the displayed branch, so it cannot change while one is on its way
+        bool changesBranch = userInput.rfind("%fork", 0) == 0 || userInput.rfind("%switch", 0) == 0;
+        if (changesBranch && (requestInFlight || commandExecutor.busy() || readfileInProgress())) {
+            return;
+        }
+
         std::string originalUserInput = userInput; // Store before clearing
+        revealedLine.reset(); // A search hit stays highlighted until the next input
+
+        // The API request works on a copy of the history from before this turn, because
+        // makeStreamingRequest adds the user message to the history it sends by itself
+        ChatHistory requestHistory;
+        if (originalUserInput[0] != '%') {
+            requestHistory = chatHistory;
+        }
 
         // Add user input to the actual ChatHistory
         chatHistory.addDialog("user", originalUserInput);
@@ -67,13 +263,49 @@ int main()
                     chatHistory.addDialog("system", "Error processing command: " + std::string(e.what()));
                 }
             } else {
-                // callChatGPTAPI is expected to add assistant's response or errors to chatHistory
-                // It might also throw, e.g., if network fails.
-                try {
-                    callChatGPTAPI(originalUserInput, chatHistory);
-                } catch (const std::exception& e) {
-                    chatHistory.addDialog("system", "Error calling API: " + std::string(e.what()));
-                }
+                // The request runs on the executor thread. Streamed deltas and the final status are
+                // applied to the displayed history on the UI thread via screen.Post, so the reply
+                // grows in place while the UI keeps handling input.
+                requestInFlight = true;
+                requestExecutor.submit([&, originalUserInput, requestHistory = std::move(requestHistory)](
+                                           const std::atomic<bool> &cancelled) mutable {
+                    // Deltas grow the reply's own entry; if a command's output was added after it
+                    // meanwhile, the rest of the reply continues in a new entry below that
+                    auto replyId = std::make_shared<std::optional<uint32_t>>();
+                    auto onDelta = [&, replyId](const std::string &delta) {
+                        screen.Post([&, replyId, delta] {
+                            if (!*replyId || !chatHistory.appendToDialog(**replyId, delta)) {
+                                chatHistory.addDialog("assistant", delta);
+                                *replyId = chatHistory[chatHistory.size() - 1].id;
+                            }
+                        });
+                        screen.PostEvent(ftxui::Event::Custom);
+                    };
+                    // It might also throw, e.g., if network fails.
+                    std::string status;
+                    if (cancelled) {
+                        status = "Request cancelled."; // Before it started; the completion below still runs
+                    } else {
+                        try {
+                            // Through the daemon when one is running, which keeps the connections warm
+                            StreamRequestFn request = chatStreamingRequest(&cancelled);
+                            streamChatGPTAPI(originalUserInput, requestHistory, onDelta, request);
+                            if (cancelled) {
+                                status = "Request cancelled.";
+                            }
+                        } catch (const std::exception& e) {
+                            status = "Error calling API: " + std::string(e.what());
+                        }
+                    }
+                    screen.Post([&, status] {
+                        if (!status.empty()) {
+                            chatHistory.addDialog("system", status);
+                        }
+                        requestInFlight = false;
+                        timeNextFrame = true;
+                    });
+                    screen.PostEvent(ftxui::Event::Custom);
+                });
             }
         }
         
@@ -81,33 +313,149 @@ int main()
     };
     inputComponent = ftxui::Input(&userInput, "Enter message or command (e.g. %help, %quit)", input_option);
 
-    // History rendering component
+    // History rendering component. Entries are wrapped once and cached by HistoryLayout, and
+    // only the lines that fit in the pane are turned into elements, so frame time does not grow
+    // with the length of the transcript.
+    HistoryLayout historyLayout;
+    ftxui::Box historyBox;      // Where the pane was drawn last frame; gives its height
+    size_t scrollBack{0};       // Lines scrolled up from the bottom; 0 follows new output
+    auto roleColor = [](Role role) {
+        switch (role) {
+            case Role::User: return ftxui::Color(ftxui::Color::Green);
+            case Role::Assistant: return ftxui::Color(ftxui::Color::Blue);
+            case Role::System: // For command outputs or errors
+            case Role::Error: return ftxui::Color(ftxui::Color::Yellow);
+        }
+        return ftxui::Color(ftxui::Color::GrayDark);
+    };
+    bool firstFrameDrawn{false};
     historyComponent = ftxui::Renderer([&] {
+        auto frameStart = std::chrono::steady_clock::now();
+        if (!firstFrameDrawn) {
+            firstFrameDrawn = true;
+            if (profileStartup) {
+                // Reported from a posted task, which runs once this frame is on the terminal
+                startupProfile.mark("first frame");
+                screen.Post([&] { chatHistory.addDialog("system", startupProfile.report()); });
+                screen.PostEvent(ftxui::Event::Custom);
+            }
+        }
+        size_t width = static_cast<size_t>(std::max(ftxui::Terminal::Size().dimx - 2, 1)); // Inside the border
+        size_t height = static_cast<size_t>(std::max(historyBox.y_max - historyBox.y_min + 1, 1));
+        historyLayout.sync(chatHistory, width);
+
+        size_t totalLines = historyLayout.lineCount();
+        size_t maxScrollBack = totalLines > height ? totalLines - height : 0;
+        scrollBack = std::min(scrollBack, maxScrollBack);
+        if (revealTarget && revealTarget->first < chatHistory.size()) {
+            // A search hit goes a third of the way down the pane, with what led up to it above
+            size_t hitLine = historyLayout.lineOf(revealTarget->first, revealTarget->second);
+            size_t top = hitLine > height / 3 ? hitLine - height / 3 : 0;
+            scrollBack = std::min(totalLines > top + height ? totalLines - top - height : 0, maxScrollBack);
+            revealedLine = std::make_pair(revealTarget->first, hitLine);
+        }
+        revealTarget.reset();
+        size_t firstLine = totalLines > height + scrollBack ? totalLines - height - scrollBack : 0;
+
         ftxui::Elements history_elements;
-        for (const auto& dialog_pair : chatHistory) { // Iterate over ChatHistory
-            std::string participant = dialog_pair.first;
-            std::string message = dialog_pair.second;
-            
-            ftxui::Element element;
-            if (participant == "user") {
-                element = ftxui::paragraph(participant + ": " + message) | ftxui::color(ftxui::Color::Green);
-            } else if (participant == "assistant") { 
-                element = ftxui::paragraph(participant + ": " + message) | ftxui::color(ftxui::Color::Blue);
-            } else if (participant == "system" || participant == "error") { // For command outputs or errors
-                element = ftxui::paragraph(participant + ": " + message) | ftxui::color(ftxui::Color::Yellow);
-            } else { 
-                element = ftxui::paragraph(participant + ": " + message) | ftxui::color(ftxui::Color::GrayDark);
+        size_t lineIndex = firstLine;
+        for (const HistoryLine &line : historyLayout.window(firstLine, height)) {
+            ftxui::Element row = ftxui::text(HistoryLayout::lineText(chatHistory, line)) |
+                                 ftxui::color(roleColor(chatHistory[line.entry].role));
+            if (revealedLine && revealedLine->first == line.entry && revealedLine->second == lineIndex) {
+                row = row | ftxui::inverted;
             }
-            history_elements.push_back(element);
+            history_elements.push_back(std::move(row));
+            ++lineIndex;
         }
-        return ftxui::vbox(history_elements) | ftxui::yframe | ftxui::flex;
+        // Anchor at the bottom so a stale height after a resize clips the oldest lines, not the newest
+        ftxui::Element pane = ftxui::vbox(history_elements) | ftxui::focusPositionRelative(0, 1) | ftxui::yframe |
+                              ftxui::flex | ftxui::reflect(historyBox);
+        if (timeNextFrame) {
+            timeNextFrame = false;
+            recordSince(requestMetrics().render, frameStart);
+        }
+        return pane;
+    });
+
+    // Input pane with an in-flight indicator and the API key status line below the input field
+    auto keyStatusColor = [](KeyCheckResult::Status status) {
+        switch (status) {
+            case KeyCheckResult::Status::Valid: return ftxui::Color(ftxui::Color::GrayDark);
+            case KeyCheckResult::Status::Invalid:
+            case KeyCheckResult::Status::Missing: return ftxui::Color(ftxui::Color::Red);
+            default: return ftxui::Color(ftxui::Color::Yellow);
+        }
+    };
+    // Running token totals from the usage ledger, against the session and daily limits if set;
+    // red once a limit has been reached and requests are refused
+    auto usageStatus = [] {
+        UsageLedger &ledger = sharedUsageLedger();
+        UsageTotals session = ledger.session();
+        UsageTotals today = ledger.today();
+        UsageLimits limits = ledger.limits();
+        std::string status = "Tokens: " + std::to_string(session.tokens());
+        if (limits.sessionTokens != 0) {
+            status += "/" + std::to_string(limits.sessionTokens);
+        }
+        status += " this session";
+        if (session.cachedTokens != 0) {
+            status += " (" + std::to_string(session.cachedTokens) + " cached)";
+        }
+        status += ", " + std::to_string(today.tokens());
+        if (limits.dailyTokens != 0) {
+            status += "/" + std::to_string(limits.dailyTokens);
+        }
+        status += " today";
+        bool exhausted = ledger.remainingTokens() == 0;
+        return ftxui::text(status) | ftxui::color(ftxui::Color(exhausted ? ftxui::Color::Red : ftxui::Color::GrayDark));
+    };
+    auto inputPane = ftxui::Renderer(inputComponent, [&] {
+        ftxui::Elements rows{inputComponent->Render()};
+        if (requestInFlight || askInProgress()) {
+            rows.push_back(ftxui::text("Waiting for response... (Esc to cancel)") | ftxui::color(ftxui::Color::Yellow));
+        }
+        if (!ioProgress.empty()) {
+            rows.push_back(ftxui::text(ioProgress) | ftxui::color(ftxui::Color::Yellow));
+        }
+        rows.push_back(ftxui::hbox({ftxui::text(keyStatus) | ftxui::color(keyStatusColor(keyStatusKind)),
+                                    ftxui::filler(), usageStatus()}));
+        return ftxui::vbox(std::move(rows));
     });
 
     // Layout
-    auto layout = ftxui::ResizableSplitBottom(historyComponent, inputComponent, &historyPaneSize);
+    auto layout = ftxui::ResizableSplitBottom(historyComponent, inputPane, &historyPaneSize);
     layout = layout | ftxui::border; 
 
+    // Esc aborts the request in flight; PageUp/PageDown and the mouse wheel scroll the history
+    layout = ftxui::CatchEvent(layout, [&](ftxui::Event event) {
+        if (event == ftxui::Event::Escape && (requestInFlight || commandExecutor.busy())) {
+            requestExecutor.cancel();
+            commandExecutor.cancel();
+            return true;
+        }
+        size_t page = static_cast<size_t>(std::max(historyBox.y_max - historyBox.y_min, 1));
+        if (event == ftxui::Event::PageUp) {
+            scrollBack += page;
+            return true;
+        }
+        if (event == ftxui::Event::PageDown) {
+            scrollBack -= std::min(scrollBack, page);
+            return true;
+        }
+        if (event.is_mouse() && event.mouse().button == ftxui::Mouse::WheelUp) {
+            scrollBack += 3;
+            return true;
+        }
+        if (event.is_mouse() && event.mouse().button == ftxui::Mouse::WheelDown) {
+            scrollBack -= std::min<size_t>(scrollBack, 3);
+            return true;
+        }
+        return false;
+    });
+
     // Run the FTXUI loop
+    startupProfile.mark("UI built");
     screen.Loop(layout);
 
     return 0;
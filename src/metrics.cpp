@@ -0,0 +1,230 @@
+//  metrics.cpp
+//
+// Latency histograms of the phases of a request, kept in a process-wide registry
+
+#include "metrics.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace
+{
+/// Bucket bounds of the Prometheus export, in microseconds: 1-2-5 steps from 100 us to 100 s
+const std::vector<uint64_t> &_exportBounds()
+{
+    static const std::vector<uint64_t> bounds = [] {
+        std::vector<uint64_t> result;
+        for (uint64_t decade = 100; decade <= 100000000; decade *= 10)
+        {
+            for (uint64_t step : {1, 2, 5})
+            {
+                if (decade * step <= 100000000)
+                {
+                    result.push_back(decade * step);
+                }
+            }
+        }
+        return result;
+    }();
+    return bounds;
+}
+
+std::string _seconds(uint64_t microseconds)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%g", microseconds / 1e6);
+    return buffer;
+}
+} // namespace
+
+void LatencyHistogram::record(std::chrono::microseconds duration)
+{
+    uint64_t value = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+    m_counts[_bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::sumMicroseconds() const
+{
+    return m_sum.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::maxMicroseconds() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentileMicroseconds(double q) const
+{
+    // Counted from the buckets themselves, so a record landing meanwhile cannot leave the walk short
+    uint64_t total = 0;
+    for (const std::atomic<uint64_t> &bucket : m_counts)
+    {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(total)));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; ++i)
+    {
+        seen += m_counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            return std::min(_bucketTop(i), maxMicroseconds());
+        }
+    }
+    return maxMicroseconds();
+}
+
+uint64_t LatencyHistogram::countAtMost(uint64_t limit) const
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < kBucketCount && _bucketTop(i) <= limit; ++i)
+    {
+        total += m_counts[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t LatencyHistogram::_bucketIndex(uint64_t value)
+{
+    value = std::min<uint64_t>(value, (uint64_t{1} << kMaxExponent) - 1);
+    if (value < (uint64_t{1} << kSubBucketBits))
+    {
+        return static_cast<size_t>(value);
+    }
+    // Shift the value down to its top kSubBucketBits bits; the shift picks the power of two
+    int shift = (63 - __builtin_clzll(value)) - (kSubBucketBits - 1);
+    return static_cast<size_t>((shift + 1) * kHalfSubBuckets + static_cast<int>(value >> shift) - kHalfSubBuckets);
+}
+
+uint64_t LatencyHistogram::_bucketTop(size_t index)
+{
+    if (index < (size_t{1} << kSubBucketBits))
+    {
+        return index;
+    }
+    int shift = static_cast<int>(index / kHalfSubBuckets) - 1;
+    uint64_t subBucket = index % kHalfSubBuckets + kHalfSubBuckets;
+    return ((subBucket + 1) << shift) - 1;
+}
+
+LatencyHistogram &MetricsRegistry::histogram(std::string_view name, std::string_view help)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (MetricEntry &entry : m_entries)
+    {
+        if (entry.name == name)
+        {
+            return entry.histogram;
+        }
+    }
+    MetricEntry &entry = m_entries.emplace_back();
+    entry.name = name;
+    entry.help = help;
+    return entry.histogram;
+}
+
+std::vector<const MetricEntry *> MetricsRegistry::entries() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<const MetricEntry *> result;
+    for (const MetricEntry &entry : m_entries)
+    {
+        result.push_back(&entry);
+    }
+    return result;
+}
+
+std::string MetricsRegistry::prometheusText() const
+{
+    std::string text;
+    for (const MetricEntry *entry : entries())
+    {
+        const LatencyHistogram &histogram = entry->histogram;
+        text += "# HELP " + entry->name + " " + entry->help + "\n";
+        text += "# TYPE " + entry->name + " histogram\n";
+        uint64_t count = histogram.count();
+        for (uint64_t bound : _exportBounds())
+        {
+            // Read together with count, so a bucket never claims more than the total
+            text += entry->name + "_bucket{le=\"" + _seconds(bound) + "\"} " +
+                    std::to_string(std::min(histogram.countAtMost(bound), count)) + "\n";
+        }
+        text += entry->name + "_bucket{le=\"+Inf\"} " + std::to_string(count) + "\n";
+        text += entry->name + "_sum " + _seconds(histogram.sumMicroseconds()) + "\n";
+        text += entry->name + "_count " + std::to_string(count) + "\n";
+    }
+    return text;
+}
+
+void MetricsRegistry::writePrometheusFile(const std::filesystem::path &file) const
+{
+    std::filesystem::path tempPath = file;
+    tempPath += ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tempPath, std::ios::trunc);
+        out << prometheusText();
+        if (!out.flush())
+        {
+            throw std::runtime_error("Unable to write " + tempPath.string());
+        }
+    }
+    if (std::rename(tempPath.c_str(), file.c_str()) != 0)
+    {
+        int error = errno;
+        std::filesystem::remove(tempPath);
+        throw std::runtime_error("Unable to replace " + file.string() + ": " + std::strerror(error));
+    }
+}
+
+MetricsRegistry &sharedMetrics()
+{
+    // Never destroyed: an exit handler may still export it
+    static MetricsRegistry *registry = new MetricsRegistry();
+    return *registry;
+}
+
+RequestMetrics &requestMetrics()
+{
+    static RequestMetrics *metrics = [] {
+        MetricsRegistry &registry = sharedMetrics();
+        return new RequestMetrics{
+            registry.histogram("chatgpt_cli_payload_build_seconds", "Time to serialize a request body."),
+            registry.histogram("chatgpt_cli_dns_seconds", "Name lookup time of requests that opened a connection."),
+            registry.histogram("chatgpt_cli_connect_seconds", "TCP connect time of requests that opened a connection."),
+            registry.histogram("chatgpt_cli_tls_seconds", "TLS handshake time of requests that opened a connection."),
+            registry.histogram("chatgpt_cli_ttfb_seconds", "Time from sending a request to its first response byte."),
+            registry.histogram("chatgpt_cli_transfer_seconds", "Time from the first to the last response byte."),
+            registry.histogram("chatgpt_cli_request_seconds", "Total time of each HTTP attempt."),
+            registry.histogram("chatgpt_cli_parse_seconds", "Time spent parsing responses."),
+            registry.histogram("chatgpt_cli_render_seconds", "Time to build the first frame after a reply."),
+        };
+    }();
+    return *metrics;
+}
+
+void recordSince(LatencyHistogram &histogram, std::chrono::steady_clock::time_point start)
+{
+    histogram.record(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+}
@@ -0,0 +1,145 @@
+//  metrics.hpp
+//
+// Latency histograms of the phases of a request, kept in a process-wide registry
+
+#ifndef metrics_hpp
+#define metrics_hpp
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// @class LatencyHistogram
+/// @brief HDR-style histogram of durations in microseconds, recorded without locks.
+///
+/// Buckets are log-linear: each power of two is split into 64 sub-buckets, so any recorded
+/// value is reported within 1/64 (about 1.6%) of its true value, from 1 microsecond up to
+/// about 19 hours. Longer durations are clamped to the largest bucket.
+class LatencyHistogram
+{
+  public:
+    /**
+     * @brief Records one duration. Safe to call from any thread.
+     */
+    void record(std::chrono::microseconds duration);
+
+    /**
+     * @brief Returns the number of durations recorded.
+     */
+    uint64_t count() const;
+
+    /**
+     * @brief Returns the sum of the durations recorded, in microseconds.
+     */
+    uint64_t sumMicroseconds() const;
+
+    /**
+     * @brief Returns the largest duration recorded, in microseconds.
+     */
+    uint64_t maxMicroseconds() const;
+
+    /**
+     * @brief Returns the value at quantile q (0 to 1) in microseconds, or 0 if nothing was recorded.
+     *
+     * The value is the top of the bucket the quantile falls in, so it is never an underestimate.
+     */
+    uint64_t percentileMicroseconds(double q) const;
+
+    /**
+     * @brief Returns how many durations recorded were at most limit microseconds, to bucket precision.
+     */
+    uint64_t countAtMost(uint64_t limit) const;
+
+  private:
+    static constexpr int kSubBucketBits = 7; // 128 sub-buckets, the upper 64 used above the first power
+    static constexpr int kHalfSubBuckets = 1 << (kSubBucketBits - 1);
+    static constexpr int kMaxExponent = 36; // 2^36 us, about 19 hours
+    static constexpr size_t kBucketCount = (kMaxExponent - kSubBucketBits + 2) * kHalfSubBuckets;
+
+    std::array<std::atomic<uint64_t>, kBucketCount> m_counts{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_max{0};
+
+    static size_t _bucketIndex(uint64_t value);
+    static uint64_t _bucketTop(size_t index);
+};
+
+/// @brief A named histogram in the registry.
+struct MetricEntry
+{
+    std::string name; // Prometheus metric name, in seconds, e.g. "chatgpt_cli_ttfb_seconds"
+    std::string help;
+    LatencyHistogram histogram;
+};
+
+/// @class MetricsRegistry
+/// @brief Owns the histograms of the process, in the order they were first used.
+class MetricsRegistry
+{
+  public:
+    /**
+     * @brief Returns the histogram called name, creating it with help text on first use.
+     *
+     * The reference stays valid for the life of the registry.
+     */
+    LatencyHistogram &histogram(std::string_view name, std::string_view help);
+
+    /**
+     * @brief Returns every entry, in the order they were created.
+     */
+    std::vector<const MetricEntry *> entries() const;
+
+    /**
+     * @brief Returns every histogram in the Prometheus text exposition format, in seconds.
+     */
+    std::string prometheusText() const;
+
+    /**
+     * @brief Replaces file with prometheusText(), via a temporary file so scrapers never see half of it.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void writePrometheusFile(const std::filesystem::path &file) const;
+
+  private:
+    mutable std::mutex m_mutex;
+    std::deque<MetricEntry> m_entries; // A deque, so entries never move
+};
+
+/**
+ * @brief Returns the process-wide registry the request path records into.
+ */
+MetricsRegistry &sharedMetrics();
+
+/// @brief The histograms of each phase of a chat request, registered in sharedMetrics().
+struct RequestMetrics
+{
+    LatencyHistogram &payloadBuild; // Serializing the request body
+    LatencyHistogram &dns;          // CURLINFO_NAMELOOKUP_TIME_T; only attempts that opened a connection
+    LatencyHistogram &connect;      // CONNECT_TIME_T less the name lookup; likewise
+    LatencyHistogram &tls;          // APPCONNECT_TIME_T less the connect; likewise, https only
+    LatencyHistogram &ttfb;         // STARTTRANSFER_TIME_T less PRETRANSFER_TIME_T: the server's think time
+    LatencyHistogram &transfer;     // TOTAL_TIME_T less STARTTRANSFER_TIME_T
+    LatencyHistogram &request;      // TOTAL_TIME_T of each attempt
+    LatencyHistogram &parse;        // Extracting the reply, or decoding the stream
+    LatencyHistogram &render;       // Building the first frame after a reply completes
+};
+
+/**
+ * @brief Returns the request phase histograms, creating them on first use.
+ */
+RequestMetrics &requestMetrics();
+
+/**
+ * @brief Records the time from start until now into histogram.
+ */
+void recordSince(LatencyHistogram &histogram, std::chrono::steady_clock::time_point start);
+
+#endif /* metrics_hpp */
@@ -0,0 +1,671 @@
+//  mockserver.cpp
+//
+// Local stand-in for the OpenAI API, used to exercise the real request path without a network
+
+#include "mockserver.hpp"
+#include "tokenizer.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <string_view>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+/// Words the generated replies are made of
+constexpr const char *kVocabulary[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit"};
+
+/// Largest request the server accepts
+constexpr size_t kMaxRequestBytes = 64 * 1024 * 1024;
+
+/**
+ * @brief Writes all of data to fd.
+ * @return False if the peer has gone away.
+ */
+bool _sendAll(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+/**
+ * @brief Compares an HTTP header name case-insensitively.
+ */
+bool _headerIs(std::string_view name, std::string_view expected)
+{
+    return name.size() == expected.size() &&
+           std::equal(name.begin(), name.end(), expected.begin(),
+                      [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; });
+}
+
+const char *_statusText(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 401:
+        return "Unauthorized";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 429:
+        return "Too Many Requests";
+    case 500:
+        return "Internal Server Error";
+    case 502:
+        return "Bad Gateway";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Error";
+    }
+}
+
+/**
+ * @brief Formats a complete response with a Content-Length body.
+ */
+std::string _response(int status, const std::string &body, const std::string &extraHeaders = "",
+                      bool headOnly = false)
+{
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + _statusText(status) +
+                           "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) +
+                           "\r\n" + extraHeaders + "\r\n";
+    if (!headOnly)
+    {
+        response += body;
+    }
+    return response;
+}
+
+/**
+ * @brief Formats an OpenAI-style error body.
+ */
+std::string _errorBody(const std::string &message, const std::string &type, const std::string &code)
+{
+    return nlohmann::json{{"error", {{"message", message}, {"type", type}, {"param", nullptr}, {"code", code}}}}.dump();
+}
+
+/**
+ * @brief Wraps data as one chunk of a chunked transfer-encoded body.
+ */
+std::string _chunk(std::string_view data)
+{
+    char size[32];
+    std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+    std::string chunk = size;
+    chunk.append(data);
+    chunk += "\r\n";
+    return chunk;
+}
+
+/**
+ * @brief Splits content into word-sized pieces that concatenate back to it exactly.
+ */
+std::vector<std::string_view> _splitTokens(std::string_view content)
+{
+    std::vector<std::string_view> tokens;
+    size_t i = 0;
+    while (i < content.size())
+    {
+        size_t j = i;
+        while (j < content.size() && content[j] == ' ')
+        {
+            ++j;
+        }
+        while (j < content.size() && content[j] != ' ')
+        {
+            ++j;
+        }
+        tokens.push_back(content.substr(i, j - i));
+        i = j;
+    }
+    return tokens;
+}
+
+double _threadCpuSeconds()
+{
+    timespec now{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+} // namespace
+
+/// @brief One parsed HTTP request.
+struct MockOpenAIServer::Request
+{
+    std::string method;
+    std::string path;
+    std::string authorization;
+    std::string body;
+    bool keepAlive = true;
+};
+
+MockOpenAIServer::MockOpenAIServer(const MockServerOptions &options) : m_options(options), m_random(options.seed)
+{
+    m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listenFd < 0)
+    {
+        throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+    }
+    int reuse = 1;
+    setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(options.port);
+    socklen_t length = sizeof(addr);
+    if (bind(m_listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(m_listenFd, 512) != 0 ||
+        getsockname(m_listenFd, reinterpret_cast<sockaddr *>(&addr), &length) != 0)
+    {
+        std::string error = std::strerror(errno);
+        close(m_listenFd);
+        throw std::runtime_error("cannot listen on 127.0.0.1:" + std::to_string(options.port) + ": " + error);
+    }
+    m_port = ntohs(addr.sin_port);
+
+    m_acceptThread = std::thread([this] { _acceptLoop(); });
+}
+
+MockOpenAIServer::~MockOpenAIServer()
+{
+    shutdown(m_listenFd, SHUT_RDWR);
+    m_acceptThread.join();
+    close(m_listenFd);
+
+    // No new workers can start now; wake the ones blocked in recv() or sleeping
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (int fd : m_clientFds)
+        {
+            shutdown(fd, SHUT_RDWR);
+        }
+        workers.swap(m_workers);
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+uint16_t MockOpenAIServer::port() const
+{
+    return m_port;
+}
+
+std::string MockOpenAIServer::baseUrl() const
+{
+    return "http://127.0.0.1:" + std::to_string(m_port) + "/v1";
+}
+
+MockServerStats MockOpenAIServer::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void MockOpenAIServer::_acceptLoop()
+{
+    while (true)
+    {
+        int clientFd = accept(m_listenFd, nullptr, nullptr);
+        if (clientFd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break; // Listening socket shut down
+        }
+        int noDelay = 1;
+        setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        _reapWorkers();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.connections;
+        m_clientFds.push_back(clientFd);
+        m_workers.emplace_back([this, clientFd] { _serve(clientFd); });
+    }
+}
+
+void MockOpenAIServer::_reapWorkers()
+{
+    std::vector<std::thread> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (std::thread::id id : m_finishedWorkers)
+        {
+            auto it = std::find_if(m_workers.begin(), m_workers.end(),
+                                   [id](const std::thread &worker) { return worker.get_id() == id; });
+            finished.push_back(std::move(*it));
+            *it = std::move(m_workers.back());
+            m_workers.pop_back();
+        }
+        m_finishedWorkers.clear();
+    }
+    // They have left _serve already, so the joins return at once
+    for (std::thread &worker : finished)
+    {
+        worker.join();
+    }
+}
+
+void MockOpenAIServer::_serve(int clientFd)
+{
+    std::string buffer;
+    char chunk[16384];
+    auto fill = [&]() {
+        ssize_t n = recv(clientFd, chunk, sizeof(chunk), 0);
+        if (n > 0)
+        {
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+        return n > 0 && buffer.size() <= kMaxRequestBytes;
+    };
+
+    bool open = true;
+    while (open)
+    {
+        size_t headerEnd;
+        while (open && (headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+        {
+            open = fill();
+        }
+        if (!open)
+        {
+            break;
+        }
+
+        // Request line and the few headers the server cares about
+        Request request;
+        size_t contentLength = 0;
+        bool expectContinue = false;
+        std::string_view head(buffer.data(), headerEnd);
+        size_t lineEnd = head.find("\r\n");
+        std::string_view requestLine = head.substr(0, lineEnd);
+        size_t methodEnd = requestLine.find(' ');
+        size_t pathEnd = requestLine.find(' ', methodEnd + 1);
+        if (methodEnd == std::string_view::npos || pathEnd == std::string_view::npos)
+        {
+            _sendAll(clientFd, _response(400, _errorBody("Malformed request line", "invalid_request_error", "bad_request"),
+                                         "Connection: close\r\n"));
+            break;
+        }
+        request.method = std::string(requestLine.substr(0, methodEnd));
+        request.path = std::string(requestLine.substr(methodEnd + 1, pathEnd - methodEnd - 1));
+        request.keepAlive = requestLine.substr(pathEnd + 1) != "HTTP/1.0";
+        while (lineEnd != std::string_view::npos && lineEnd < head.size())
+        {
+            size_t next = head.find("\r\n", lineEnd + 2);
+            std::string_view line = head.substr(lineEnd + 2, next == std::string_view::npos ? std::string_view::npos
+                                                                                           : next - lineEnd - 2);
+            lineEnd = next;
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos)
+            {
+                continue;
+            }
+            std::string_view name = line.substr(0, colon);
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ')
+            {
+                value.remove_prefix(1);
+            }
+            if (_headerIs(name, "content-length"))
+            {
+                contentLength = std::strtoull(std::string(value).c_str(), nullptr, 10);
+            }
+            else if (_headerIs(name, "authorization"))
+            {
+                request.authorization = std::string(value);
+            }
+            else if (_headerIs(name, "connection"))
+            {
+                request.keepAlive = !_headerIs(value, "close");
+            }
+            else if (_headerIs(name, "expect"))
+            {
+                expectContinue = _headerIs(value, "100-continue");
+            }
+        }
+
+        if (contentLength > kMaxRequestBytes)
+        {
+            _sendAll(clientFd, _response(400, _errorBody("Request too large", "invalid_request_error", "too_large"),
+                                         "Connection: close\r\n"));
+            break;
+        }
+        if (expectContinue && buffer.size() < headerEnd + 4 + contentLength &&
+            !_sendAll(clientFd, "HTTP/1.1 100 Continue\r\n\r\n"))
+        {
+            break;
+        }
+        while (open && buffer.size() < headerEnd + 4 + contentLength)
+        {
+            open = fill();
+        }
+        if (!open)
+        {
+            break;
+        }
+        request.body = buffer.substr(headerEnd + 4, contentLength);
+        buffer.erase(0, headerEnd + 4 + contentLength);
+
+        open = _respond(clientFd, request) && request.keepAlive;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_clientFds.erase(std::find(m_clientFds.begin(), m_clientFds.end(), clientFd));
+    close(clientFd);
+    m_finishedWorkers.push_back(std::this_thread::get_id());
+}
+
+bool MockOpenAIServer::_respond(int clientFd, const Request &request)
+{
+    double cpuStart = _threadCpuSeconds();
+    const std::string connection = request.keepAlive ? "" : "Connection: close\r\n";
+    bool authorized =
+        m_options.apiKey.empty() ? request.authorization.rfind("Bearer ", 0) == 0
+                                 : request.authorization == "Bearer " + m_options.apiKey;
+    std::string response;
+    bool keepOpen = true;
+    bool counted = false;
+    {
+        // Counted before the reply goes out, so a client that has its reply sees it in stats()
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.requests;
+    }
+
+    if (!authorized)
+    {
+        response = _response(401, _errorBody("Incorrect API key provided.", "invalid_request_error", "invalid_api_key"),
+                             connection, request.method == "HEAD");
+    }
+    else if (request.path == "/v1/models" && (request.method == "GET" || request.method == "HEAD"))
+    {
+        nlohmann::json models = {{"object", "list"},
+                                 {"data",
+                                  {{{"id", "gpt-4o"}, {"object", "model"}, {"created", 0}, {"owned_by", "mock"}},
+                                   {{"id", "gpt-4o-mini"}, {"object", "model"}, {"created", 0}, {"owned_by", "mock"}}}}};
+        response = _response(200, models.dump(), connection, request.method == "HEAD");
+    }
+    else if (request.path == "/v1/chat/completions")
+    {
+        if (request.method != "POST")
+        {
+            response = _response(405, _errorBody("Use POST", "invalid_request_error", "method_not_allowed"), connection);
+        }
+        else
+        {
+            // Timed inside _completion, which sleeps for the injected latency
+            keepOpen = _completion(clientFd, request);
+            counted = true;
+        }
+    }
+    else
+    {
+        response = _response(404, _errorBody("Unknown path " + request.path, "invalid_request_error", "not_found"),
+                             connection);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!counted)
+        {
+            if (response.compare(9, 3, "200") != 0)
+            {
+                ++m_stats.errors;
+            }
+            m_stats.cpuSeconds += _threadCpuSeconds() - cpuStart;
+        }
+    }
+    if (!response.empty())
+    {
+        keepOpen = _sendAll(clientFd, response);
+    }
+    return keepOpen;
+}
+
+bool MockOpenAIServer::_completion(int clientFd, const Request &request)
+{
+    double cpuStart = _threadCpuSeconds();
+    double cpuSeconds = 0;
+    auto finish = [&](bool success, bool streamed) {
+        cpuSeconds += _threadCpuSeconds() - cpuStart;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.cpuSeconds += cpuSeconds;
+        (success ? m_stats.completions : m_stats.errors) += 1;
+        m_stats.streamed += streamed ? 1 : 0;
+    };
+    const std::string connection = request.keepAlive ? "" : "Connection: close\r\n";
+
+    nlohmann::json payload = nlohmann::json::parse(request.body, nullptr, false);
+    if (payload.is_discarded() || !payload.contains("messages") || !payload["messages"].is_array() ||
+        payload["messages"].empty())
+    {
+        finish(false, false);
+        return _sendAll(clientFd, _response(400,
+                                            _errorBody("Expected a JSON body with a non-empty \"messages\" array",
+                                                       "invalid_request_error", "invalid_body"),
+                                            connection));
+    }
+    const bool stream = payload.value("stream", false);
+    const bool includeUsage = stream && payload.contains("stream_options") &&
+                              payload["stream_options"].value("include_usage", false);
+    const std::string model = payload.value("model", "gpt-4o");
+
+    std::string content;
+    if (m_options.replyWords == 0)
+    {
+        const nlohmann::json &last = payload["messages"].back();
+        content = last.contains("content") && last["content"].is_string() ? last["content"].get<std::string>() : "";
+    }
+    else
+    {
+        for (size_t i = 0; i < m_options.replyWords; ++i)
+        {
+            content += i == 0 ? "" : " ";
+            content += kVocabulary[i % (sizeof(kVocabulary) / sizeof(kVocabulary[0]))];
+        }
+    }
+    size_t promptTokens = countTokens(request.body);
+    size_t completionTokens = countTokens(content);
+    nlohmann::json usage = {{"prompt_tokens", promptTokens},
+                            {"completion_tokens", completionTokens},
+                            {"total_tokens", promptTokens + completionTokens}};
+
+    std::string limitHeaders;
+    if (!_admit(request.authorization, promptTokens, limitHeaders))
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_stats.rateLimited;
+        }
+        finish(false, false);
+        return _sendAll(clientFd, _response(429,
+                                            _errorBody("Rate limit reached for requests", "requests",
+                                                       "rate_limit_exceeded"),
+                                            connection + limitHeaders));
+    }
+
+    unsigned delayMs;
+    bool fail;
+    _draw(delayMs, fail);
+    cpuSeconds += _threadCpuSeconds() - cpuStart;
+    std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+    cpuStart = _threadCpuSeconds();
+
+    if (fail)
+    {
+        std::string headers = connection + limitHeaders;
+        if (m_options.errorStatus == 429)
+        {
+            headers += "Retry-After: 1\r\n";
+        }
+        finish(false, false);
+        return _sendAll(clientFd, _response(m_options.errorStatus,
+                                            _errorBody("Injected failure", m_options.errorStatus == 429
+                                                                               ? "rate_limit_exceeded"
+                                                                               : "server_error",
+                                                       std::to_string(m_options.errorStatus)),
+                                            headers));
+    }
+
+    static std::atomic<uint64_t> serial{0};
+    const std::string id = "chatcmpl-mock-" + std::to_string(++serial);
+    const long created = static_cast<long>(std::time(nullptr));
+
+    if (!stream)
+    {
+        nlohmann::json reply = {{"id", id},
+                                {"object", "chat.completion"},
+                                {"created", created},
+                                {"model", model},
+                                {"choices",
+                                 {{{"index", 0},
+                                   {"message", {{"role", "assistant"}, {"content", content}}},
+                                   {"finish_reason", "stop"}}}},
+                                {"usage", usage}};
+        finish(true, false);
+        return _sendAll(clientFd, _response(200, reply.dump(), connection + limitHeaders));
+    }
+
+    // Streamed reply: one chunked-encoding chunk per server-sent event
+    std::string head = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                       "Transfer-Encoding: chunked\r\n" +
+                       connection + limitHeaders + "\r\n";
+    auto event = [&](const nlohmann::json &delta, const nlohmann::json &finishReason) {
+        nlohmann::json chunk = {{"id", id},
+                                {"object", "chat.completion.chunk"},
+                                {"created", created},
+                                {"model", model},
+                                {"choices", {{{"index", 0}, {"delta", delta}, {"finish_reason", finishReason}}}}};
+        return _chunk("data: " + chunk.dump() + "\n\n");
+    };
+    const auto pause = m_options.tokensPerSecond > 0
+                           ? std::chrono::duration<double>(1.0 / m_options.tokensPerSecond)
+                           : std::chrono::duration<double>(0);
+
+    bool sent = _sendAll(clientFd, head + event({{"role", "assistant"}, {"content", ""}}, nullptr));
+    for (std::string_view token : _splitTokens(content))
+    {
+        if (!sent)
+        {
+            break;
+        }
+        if (pause.count() > 0)
+        {
+            cpuSeconds += _threadCpuSeconds() - cpuStart;
+            std::this_thread::sleep_for(pause);
+            cpuStart = _threadCpuSeconds();
+        }
+        sent = _sendAll(clientFd, event({{"content", token}}, nullptr));
+    }
+    if (sent)
+    {
+        std::string tail = event(nlohmann::json::object(), "stop");
+        if (includeUsage)
+        {
+            nlohmann::json chunk = {{"id", id},           {"object", "chat.completion.chunk"},
+                                    {"created", created}, {"model", model},
+                                    {"choices", nlohmann::json::array()}, {"usage", usage}};
+            tail += _chunk("data: " + chunk.dump() + "\n\n");
+        }
+        tail += _chunk("data: [DONE]\n\n") + "0\r\n\r\n";
+        // Counted before the last write so the client never sees the reply ahead of the stats
+        finish(true, true);
+        return _sendAll(clientFd, tail);
+    }
+    finish(false, true);
+    return false;
+}
+
+void MockOpenAIServer::_draw(unsigned &delayMs, bool &fail)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    delayMs = m_options.latencyMs;
+    if (m_options.latencyJitterMs > 0)
+    {
+        delayMs += std::uniform_int_distribution<unsigned>(0, m_options.latencyJitterMs)(m_random);
+    }
+    fail = m_options.errorRate > 0 && std::uniform_real_distribution<double>(0, 1)(m_random) < m_options.errorRate;
+}
+
+bool MockOpenAIServer::_admit(const std::string &authorization, size_t promptTokens, std::string &headers)
+{
+    if (m_options.requestsPerMinute <= 0 && m_options.tokensPerMinute <= 0)
+    {
+        return true;
+    }
+    const double window = m_options.limitWindowSeconds > 0 ? m_options.limitWindowSeconds : 60;
+    const TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_limits.find(authorization);
+    if (it == m_limits.end())
+    {
+        it = m_limits
+                 .emplace(authorization,
+                          std::make_pair(TokenBucket(m_options.requestsPerMinute, m_options.requestsPerMinute / window, now),
+                                         TokenBucket(m_options.tokensPerMinute, m_options.tokensPerMinute / window, now)))
+                 .first;
+    }
+    TokenBucket &requests = it->second.first;
+    TokenBucket &tokens = it->second.second;
+    auto wait = std::max(requests.waitFor(1, now), tokens.waitFor(static_cast<double>(promptTokens), now));
+    bool admitted = wait == TokenBucket::Clock::duration::zero();
+    if (admitted)
+    {
+        requests.take(1, now);
+        tokens.take(static_cast<double>(promptTokens), now);
+    }
+
+    // Remaining allowance and the time until it is full again, as the API reports them
+    auto describe = [&](const char *kind, TokenBucket &bucket, double limit) {
+        if (!bucket.limited())
+        {
+            return;
+        }
+        double level = bucket.level(now);
+        double resetMs = (limit - level) / (limit / window) * 1000;
+        headers += std::string("x-ratelimit-limit-") + kind + ": " + std::to_string(static_cast<long>(limit)) +
+                   "\r\nx-ratelimit-remaining-" + kind + ": " +
+                   std::to_string(static_cast<long>(std::max(0.0, std::floor(level)))) + "\r\nx-ratelimit-reset-" +
+                   kind + ": " + std::to_string(static_cast<long>(std::ceil(resetMs))) + "ms\r\n";
+    };
+    describe("requests", requests, m_options.requestsPerMinute);
+    describe("tokens", tokens, m_options.tokensPerMinute);
+    if (!admitted)
+    {
+        long waitMs = static_cast<long>(std::ceil(std::chrono::duration<double, std::milli>(wait).count()));
+        headers += "retry-after-ms: " + std::to_string(waitMs) + "\r\nretry-after: " +
+                   std::to_string((waitMs + 999) / 1000) + "\r\n";
+    }
+    return admitted;
+}
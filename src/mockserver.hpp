@@ -0,0 +1,141 @@
+//  mockserver.hpp
+//
+// Local stand-in for the OpenAI API, used to exercise the real request path without a network
+
+#ifndef mockserver_hpp
+#define mockserver_hpp
+
+#include "ratelimiter.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief Behaviour of a MockOpenAIServer.
+struct MockServerOptions
+{
+    uint16_t port = 0;              // Port to listen on; 0 picks a free one
+    unsigned latencyMs = 0;         // Delay before the first byte of every completion
+    unsigned latencyJitterMs = 0;   // Extra random delay of up to this many milliseconds
+    double tokensPerSecond = 0;     // Pace of streamed chunks; 0 sends them back to back
+    size_t replyWords = 0;          // Words in each reply; 0 echoes the last message instead
+    double errorRate = 0;           // Fraction of completions answered with errorStatus
+    int errorStatus = 500;          // HTTP status of injected errors (429 adds Retry-After)
+    std::string apiKey;             // Bearer token to require; empty accepts any
+    double requestsPerMinute = 0;   // Per-key request limit enforced with 429s; 0 for none
+    double tokensPerMinute = 0;     // Per-key prompt token limit enforced with 429s; 0 for none
+    double limitWindowSeconds = 60; // Period the two limits refill over; shorten it for tests
+    unsigned seed = 1;              // Seed for jitter and error injection
+};
+
+/// @brief Counters of a MockOpenAIServer.
+struct MockServerStats
+{
+    uint64_t requests = 0;    // Every HTTP request, including /v1/models
+    uint64_t completions = 0; // Successful chat completions
+    uint64_t streamed = 0;    // Of which were sent as server-sent events
+    uint64_t errors = 0;      // Injected errors and rejected requests
+    uint64_t rateLimited = 0; // Of which were 429s from the per-key limits
+    uint64_t connections = 0; // TCP connections accepted
+    double cpuSeconds = 0;    // CPU time spent handling requests
+};
+
+/// @class MockOpenAIServer
+/// @brief Speaks enough of the OpenAI HTTP API on 127.0.0.1 for the CLI to talk to it.
+///
+/// Serves GET/HEAD /v1/models and POST /v1/chat/completions, both plain JSON and "stream": true
+/// (chunked server-sent events ending in [DONE]). Connections are kept alive and each one gets
+/// its own thread, so latency injected into one request does not hold up the others.
+class MockOpenAIServer
+{
+  public:
+    /**
+     * @brief Starts listening and serving in background threads.
+     * @throws std::runtime_error if the socket cannot be bound.
+     */
+    explicit MockOpenAIServer(const MockServerOptions &options = MockServerOptions());
+
+    /**
+     * @brief Closes every connection and joins the server threads.
+     */
+    ~MockOpenAIServer();
+    MockOpenAIServer(const MockOpenAIServer &) = delete;
+    MockOpenAIServer &operator=(const MockOpenAIServer &) = delete;
+
+    /**
+     * @brief Returns the port the server listens on.
+     */
+    uint16_t port() const;
+
+    /**
+     * @brief Returns the API root to use as OPENAI_BASE_URL, e.g. "http://127.0.0.1:8080/v1".
+     */
+    std::string baseUrl() const;
+
+    /**
+     * @brief Returns the counters so far.
+     */
+    MockServerStats stats() const;
+
+  private:
+    struct Request;
+
+    MockServerOptions m_options;
+    int m_listenFd = -1;
+    uint16_t m_port = 0;
+    std::thread m_acceptThread;
+
+    mutable std::mutex m_mutex; // Guards everything below
+    std::vector<std::thread> m_workers;
+    std::vector<std::thread::id> m_finishedWorkers; // Workers done serving, joined at the next accept
+    std::vector<int> m_clientFds;
+    std::mt19937 m_random;
+    MockServerStats m_stats;
+    std::map<std::string, std::pair<TokenBucket, TokenBucket>> m_limits; // Request and token buckets per key
+
+    /**
+     * @brief Accepts connections until the listening socket is shut down.
+     */
+    void _acceptLoop();
+
+    /**
+     * @brief Joins the workers that have finished, so a long run keeps only live connections' threads.
+     */
+    void _reapWorkers();
+
+    /**
+     * @brief Reads and answers requests on one keep-alive connection until it closes.
+     */
+    void _serve(int clientFd);
+
+    /**
+     * @brief Writes the response to one parsed request.
+     * @return False if the connection should be closed.
+     */
+    bool _respond(int clientFd, const Request &request);
+
+    /**
+     * @brief Answers a chat completion, streamed or not.
+     */
+    bool _completion(int clientFd, const Request &request);
+
+    /**
+     * @brief Draws the injected delay and whether this completion fails.
+     */
+    void _draw(unsigned &delayMs, bool &fail);
+
+    /**
+     * @brief Charges a completion of promptTokens to the caller's key.
+     * @param authorization The Authorization header identifying the key.
+     * @param headers Receives the x-ratelimit-* (and, when refused, retry-after) header lines.
+     * @return False if the key is over its limits and the request must get a 429.
+     */
+    bool _admit(const std::string &authorization, size_t promptTokens, std::string &headers);
+};
+
+#endif /* mockserver_hpp */
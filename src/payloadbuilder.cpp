@@ -0,0 +1,223 @@
+//  payloadbuilder.cpp
+//
+// Builds chat completion request bodies from cached, pre-serialized message fragments
+
+#include "payloadbuilder.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <nlohmann/json.hpp>
+#include <utility>
+
+namespace
+{
+/**
+ * @brief Serializes a single value the same way nlohmann::json::dump does for a full payload.
+ * Invalid UTF-8 (e.g. from a binary %readfile) is replaced instead of throwing at request time.
+ */
+std::string _dumpValue(const nlohmann::json &value)
+{
+    return value.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+/**
+ * @brief Returns how many leading bytes of text go into a JSON string unescaped: printable ASCII
+ * other than '"' and '\\'.
+ */
+size_t _plainPrefix(const char *text, size_t size)
+{
+    // Eight bytes at a time; a word with a byte to stop at (or a false alarm after one) is
+    // finished a byte at a time
+    constexpr uint64_t ones = 0x0101010101010101ULL;
+    constexpr uint64_t highBits = 0x8080808080808080ULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, text + i, sizeof(word));
+        uint64_t quote = word ^ (ones * '"');
+        uint64_t backslash = word ^ (ones * '\\');
+        uint64_t stop = ((word - ones * 0x20) & ~word) | ((quote - ones) & ~quote) |
+                        ((backslash - ones) & ~backslash) | word;
+        if ((stop & highBits) != 0)
+        {
+            break;
+        }
+    }
+    for (; i < size; ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\')
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+/**
+ * @brief Appends text as a JSON string, byte-for-byte as _dumpValue would.
+ * ASCII is escaped here; text with any other byte goes through nlohmann, which validates its UTF-8.
+ */
+void _appendString(std::string &out, std::string_view text)
+{
+    const size_t rollback = out.size();
+    out += '"';
+    size_t i = 0;
+    while (true)
+    {
+        size_t plain = _plainPrefix(text.data() + i, text.size() - i);
+        out.append(text.data() + i, plain);
+        i += plain;
+        if (i == text.size())
+        {
+            break;
+        }
+
+        unsigned char c = static_cast<unsigned char>(text[i++]);
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\b':
+            out += "\\b";
+            break;
+        case '\f':
+            out += "\\f";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c >= 0x80)
+            {
+                out.resize(rollback);
+                out += _dumpValue(std::string(text));
+                return;
+            }
+            static const char hex[] = "0123456789abcdef";
+            const char escape[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            out.append(escape, sizeof(escape));
+            break;
+        }
+    }
+    out += '"';
+}
+} // namespace
+
+void PayloadBuilder::append(std::string_view role, std::string_view content)
+{
+    // nlohmann::json objects keep their keys sorted, so "content" precedes "role"
+    m_scratch += ",{\"content\":";
+    _appendString(m_scratch, content);
+    m_scratch += ",\"role\":";
+    _appendString(m_scratch, role);
+    m_scratch += '}';
+
+    size_t endBytes = (m_fragments.empty() ? 0 : m_fragments.back().endBytes) + m_scratch.size();
+    m_fragments.push_back(Fragment{m_arena.append(m_scratch), endBytes});
+    m_scratch.clear();
+}
+
+void PayloadBuilder::reserve(size_t messages, size_t contentBytes)
+{
+    // Each message adds its role, quotes and keys around the content
+    constexpr size_t kMessageOverhead = 40;
+    m_arena.reserve(contentBytes + messages * kMessageOverhead);
+}
+
+void PayloadBuilder::removeLast()
+{
+    if (m_fragments.empty())
+    {
+        return;
+    }
+    m_arena.release(m_fragments.back().json);
+    m_fragments.pop_back();
+}
+
+void PayloadBuilder::truncate(size_t count)
+{
+    m_fragments.truncate(count);
+}
+
+void PayloadBuilder::clear()
+{
+    m_fragments.clear();
+}
+
+size_t PayloadBuilder::size() const
+{
+    return m_fragments.size();
+}
+
+std::string PayloadBuilder::build(const std::string &model, bool stream, size_t firstMessage) const
+{
+    std::string modelJson = _dumpValue(model);
+
+    // Windowing only moves the start of the array
+    size_t count = m_fragments.size();
+    size_t messageBytes = 0;
+    if (firstMessage < count)
+    {
+        size_t skipped = firstMessage > 0 ? m_fragments[firstMessage - 1].endBytes : 0;
+        messageBytes = m_fragments.back().endBytes - skipped;
+    }
+
+    std::string payload;
+    payload.reserve(messageBytes + modelJson.size() + 80); // Room for the stream fields too
+    payload += '{';
+    if (firstMessage < count)
+    {
+        payload += "\"messages\":[";
+        std::string_view pending;
+        for (size_t i = firstMessage; i < count;)
+        {
+            auto [fragments, run] = m_fragments.run(i);
+            run = std::min(run, count - i);
+            for (size_t k = 0; k < run; ++k)
+            {
+                std::string_view json = fragments[k].json.view();
+                if (i + k == firstMessage)
+                {
+                    json.remove_prefix(1); // The first message has no comma before it
+                }
+                if (pending.data() + pending.size() == json.data())
+                {
+                    pending = std::string_view(pending.data(), pending.size() + json.size());
+                }
+                else
+                {
+                    payload.append(pending);
+                    pending = json;
+                }
+            }
+            i += run;
+        }
+        payload.append(pending);
+        payload += "],";
+    }
+    payload += "\"model\":";
+    payload += modelJson;
+    payload += '}';
+    return stream ? withStream(std::move(payload)) : payload;
+}
+
+std::string PayloadBuilder::withStream(std::string payload)
+{
+    // Ask for a last chunk with the token usage, which streams otherwise leave out. The stream
+    // fields sort after "model", the last key of a non-streaming body.
+    payload.pop_back();
+    payload += ",\"stream\":true,\"stream_options\":{\"include_usage\":true}}";
+    return payload;
+}
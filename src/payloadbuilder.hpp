@@ -0,0 +1,91 @@
+//  payloadbuilder.hpp
+//
+// Builds chat completion request bodies from cached, pre-serialized message fragments
+
+#ifndef payloadbuilder_hpp
+#define payloadbuilder_hpp
+
+#include "persistentvector.hpp"
+#include "textarena.hpp"
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/// @class PayloadBuilder
+/// @brief Keeps the JSON "messages" array of a conversation serialized and up to date.
+///
+/// Each message is escaped and serialized exactly once, when it is appended. Building a request
+/// body then only concatenates the cached array with the surrounding object, instead of
+/// rebuilding and dumping a JSON DOM of the whole history on every turn. The output is
+/// byte-for-byte what nlohmann::json produces for the same payload.
+///
+/// The serialized messages are shared with copies of the builder, as the history they belong
+/// to is with its copies, so copying a builder costs the same however long the conversation is.
+class PayloadBuilder
+{
+  public:
+    /**
+     * @brief Serializes a message and appends it to the cached messages array.
+     * @param role The message role ("user", "assistant", ...).
+     * @param content The message content.
+     */
+    void append(std::string_view role, std::string_view content);
+
+    /**
+     * @brief Makes room for messages more messages of about contentBytes bytes in total, so a
+     * bulk append does not regrow the cache as it goes.
+     */
+    void reserve(size_t messages, size_t contentBytes);
+
+    /**
+     * @brief Drops the most recently appended message from the cache.
+     * If the cache is empty, no action is taken.
+     */
+    void removeLast();
+
+    /**
+     * @brief Keeps the first count cached messages.
+     */
+    void truncate(size_t count);
+
+    /**
+     * @brief Drops all cached messages.
+     */
+    void clear();
+
+    /**
+     * @brief Returns the number of cached messages.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Builds a complete chat completion request body.
+     * @param model The model name to request.
+     * @param stream Whether to request a streamed (SSE) response, with its token usage at the end.
+     * @param firstMessage Index of the oldest message to include; earlier ones are left out.
+     * @return The serialized JSON request body.
+     */
+    std::string build(const std::string &model, bool stream, size_t firstMessage = 0) const;
+
+    /**
+     * @brief Turns a non-streaming body from build() into the body build() makes with stream set.
+     * @param payload A request body built with stream false.
+     * @return The same body asking for a streamed response, with its token usage at the end.
+     */
+    static std::string withStream(std::string payload);
+
+  private:
+    /// @brief One serialized message object, after a separating comma. Consecutive fragments
+    /// usually lie back to back in the arena, so a build copies them in a few large pieces.
+    struct Fragment
+    {
+        SharedText json;
+        size_t endBytes; // Bytes of this and every earlier fragment, for sizing a build
+    };
+
+    PersistentVector<Fragment> m_fragments;
+    TextArena m_arena;
+    std::string m_scratch; // Serializes one message at a time; always left empty
+};
+
+#endif /* payloadbuilder_hpp */
@@ -0,0 +1,264 @@
+//  persistentvector.hpp
+//
+// An immutable-by-default vector whose copies share their common elements
+
+#ifndef persistentvector_hpp
+#define persistentvector_hpp
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/// @class PersistentVector
+/// @brief A vector that copies in constant time and shares storage with its copies.
+///
+/// Elements live in a trie of 32-way nodes that are never modified once built, plus a tail of
+/// up to 32 newest elements owned by each vector. Copying a vector copies the root pointer and
+/// the tail; pushing, popping and truncating copy only the nodes on the path they change, so a
+/// vector and its copies share every element they have in common. Lookups take one step per
+/// five bits of the index: at most four steps for a million elements.
+///
+/// Only the tail is ever written, so the last element may be modified through back() without
+/// affecting copies. Distinct vectors may be used from different threads even when they share
+/// nodes.
+template <typename T> class PersistentVector
+{
+  public:
+    PersistentVector() : m_root(std::make_shared<const Node>())
+    {
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    /**
+     * @brief Returns the element at index, which must be less than size().
+     */
+    const T &operator[](size_t index) const
+    {
+        if (index >= _tailOffset())
+        {
+            return m_tail[index - _tailOffset()];
+        }
+        return _leafFor(index)->values[index & kMask];
+    }
+
+    /**
+     * @brief Returns the elements stored contiguously from index on: a pointer to the element
+     * at index and how many elements, itself included, follow it in the same node. Walking a
+     * range run by run costs one lookup per 32 elements instead of one per element.
+     */
+    std::pair<const T *, size_t> run(size_t index) const
+    {
+        if (index >= _tailOffset())
+        {
+            size_t offset = index - _tailOffset();
+            return {m_tail.data() + offset, m_tail.size() - offset};
+        }
+        const Node *leaf = _leafFor(index);
+        return {leaf->values.data() + (index & kMask), kWidth - (index & kMask)};
+    }
+
+    /**
+     * @brief Returns the last element, which lives in the tail and so can be changed in place.
+     * The vector must not be empty.
+     */
+    T &back()
+    {
+        return m_tail.back();
+    }
+
+    const T &back() const
+    {
+        return m_tail.back();
+    }
+
+    void push_back(T value)
+    {
+        if (m_tail.size() == kWidth)
+        {
+            _pushTail();
+        }
+        m_tail.push_back(std::move(value));
+        ++m_size;
+    }
+
+    /**
+     * @brief Removes the last element. The vector must not be empty.
+     */
+    void pop_back()
+    {
+        truncate(m_size - 1);
+    }
+
+    /**
+     * @brief Keeps the first count elements, sharing them with the vector it was cut from.
+     * Does nothing if count is not less than size().
+     */
+    void truncate(size_t count)
+    {
+        if (count >= m_size)
+        {
+            return;
+        }
+        if (count == 0)
+        {
+            clear();
+            return;
+        }
+
+        size_t oldTailOffset = _tailOffset();
+        size_t newTailOffset = _tailOffset(count);
+        if (newTailOffset == oldTailOffset)
+        {
+            m_tail.erase(m_tail.begin() + (count - oldTailOffset), m_tail.end());
+            m_size = count;
+            return;
+        }
+
+        // The new tail is the front of a leaf in the trie; the trie keeps the leaves before it
+        const Node *leaf = _leafFor(newTailOffset);
+        m_tail.assign(leaf->values.begin(), leaf->values.begin() + (count - newTailOffset));
+        if (newTailOffset == 0)
+        {
+            m_root = std::make_shared<const Node>();
+            m_shift = kBits;
+        }
+        else
+        {
+            m_root = _trimmed(*m_root, m_shift, newTailOffset - 1);
+            while (m_shift > kBits && m_root->children.size() == 1)
+            {
+                std::shared_ptr<const Node> child = m_root->children[0];
+                m_root = std::move(child);
+                m_shift -= kBits;
+            }
+        }
+        m_size = count;
+    }
+
+    void clear()
+    {
+        m_root = std::make_shared<const Node>();
+        m_tail.clear();
+        m_shift = kBits;
+        m_size = 0;
+    }
+
+  private:
+    static constexpr size_t kBits = 5;
+    static constexpr size_t kWidth = size_t(1) << kBits;
+    static constexpr size_t kMask = kWidth - 1;
+
+    /// @brief An inner node holds children; a leaf holds exactly kWidth values.
+    struct Node
+    {
+        std::vector<std::shared_ptr<const Node>> children;
+        std::vector<T> values;
+    };
+
+    std::shared_ptr<const Node> m_root; // Holds elements [0, _tailOffset())
+    std::vector<T> m_tail;              // Holds the rest: 1 to kWidth elements unless empty
+    size_t m_shift = kBits;             // Bits of the index below the root's child index
+    size_t m_size = 0;
+
+    static size_t _tailOffset(size_t size)
+    {
+        return size == 0 ? 0 : ((size - 1) >> kBits) << kBits;
+    }
+
+    size_t _tailOffset() const
+    {
+        return _tailOffset(m_size);
+    }
+
+    const Node *_leafFor(size_t index) const
+    {
+        const Node *node = m_root.get();
+        for (size_t level = m_shift; level > 0; level -= kBits)
+        {
+            node = node->children[(index >> level) & kMask].get();
+        }
+        return node;
+    }
+
+    /// Moves the full tail into the trie as a new leaf
+    void _pushTail()
+    {
+        auto leaf = std::make_shared<Node>();
+        leaf->values = std::move(m_tail);
+        m_tail.clear();
+        m_tail.reserve(kWidth);
+
+        size_t leafIndex = _tailOffset();
+        if ((leafIndex >> kBits) >= (size_t(1) << m_shift))
+        {
+            // The trie is full at this height: grow a new root above it
+            auto root = std::make_shared<Node>();
+            root->children.push_back(m_root);
+            root->children.push_back(_path(m_shift, std::move(leaf)));
+            m_root = std::move(root);
+            m_shift += kBits;
+        }
+        else
+        {
+            m_root = _withLeaf(*m_root, m_shift, leafIndex, std::move(leaf));
+        }
+    }
+
+    /// A chain of single-child nodes from level down to leaf
+    static std::shared_ptr<const Node> _path(size_t level, std::shared_ptr<const Node> leaf)
+    {
+        if (level == 0)
+        {
+            return leaf;
+        }
+        auto node = std::make_shared<Node>();
+        node->children.push_back(_path(level - kBits, std::move(leaf)));
+        return node;
+    }
+
+    /// A copy of node with leaf added at leafIndex
+    static std::shared_ptr<const Node> _withLeaf(const Node &node, size_t level, size_t leafIndex,
+                                                 std::shared_ptr<const Node> leaf)
+    {
+        auto copy = std::make_shared<Node>(node);
+        size_t child = (leafIndex >> level) & kMask;
+        if (level == kBits)
+        {
+            copy->children.push_back(std::move(leaf));
+        }
+        else if (child < copy->children.size())
+        {
+            copy->children[child] = _withLeaf(*copy->children[child], level - kBits, leafIndex, std::move(leaf));
+        }
+        else
+        {
+            copy->children.push_back(_path(level - kBits, std::move(leaf)));
+        }
+        return copy;
+    }
+
+    /// A copy of node keeping the leaves up to the one holding lastIndex
+    static std::shared_ptr<const Node> _trimmed(const Node &node, size_t level, size_t lastIndex)
+    {
+        size_t child = (lastIndex >> level) & kMask;
+        auto copy = std::make_shared<Node>();
+        copy->children.assign(node.children.begin(), node.children.begin() + child + 1);
+        if (level > kBits)
+        {
+            copy->children[child] = _trimmed(*node.children[child], level - kBits, lastIndex);
+        }
+        return copy;
+    }
+};
+
+#endif /* persistentvector_hpp */
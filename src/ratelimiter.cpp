@@ -0,0 +1,418 @@
+//  ratelimiter.cpp
+//
+// Client-side pacing of API requests from the rate limit headers, with retries and key sharding
+
+#include "ratelimiter.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <thread>
+
+namespace
+{
+/**
+ * @brief Returns text without surrounding whitespace and line endings.
+ */
+std::string_view _trim(std::string_view text)
+{
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front())))
+    {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back())))
+    {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+/**
+ * @brief Compares a header name case-insensitively against a lower-case name.
+ */
+bool _nameIs(std::string_view name, std::string_view expected)
+{
+    return name.size() == expected.size() &&
+           std::equal(name.begin(), name.end(), expected.begin(),
+                      [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; });
+}
+
+/**
+ * @brief Parses a plain non-negative decimal number such as "12" or "0.25".
+ * @return The number, or -1 if text is anything else.
+ */
+double _parseNumber(std::string_view text)
+{
+    double value = 0;
+    double scale = 0; // 0 before the decimal point, then 0.1, 0.01, ...
+    bool digits = false;
+    for (char c : text)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            digits = true;
+            if (scale == 0)
+            {
+                value = value * 10 + (c - '0');
+            }
+            else
+            {
+                value += (c - '0') * scale;
+                scale /= 10;
+            }
+        }
+        else if (c == '.' && scale == 0)
+        {
+            scale = 0.1;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return digits ? value : -1;
+}
+} // namespace
+
+void RateLimitHeaders::parseLine(std::string_view line)
+{
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos)
+    {
+        return;
+    }
+    std::string_view name = _trim(line.substr(0, colon));
+    std::string_view value = _trim(line.substr(colon + 1));
+
+    if (_nameIs(name, "x-ratelimit-limit-requests"))
+        limitRequests = _parseNumber(value);
+    else if (_nameIs(name, "x-ratelimit-limit-tokens"))
+        limitTokens = _parseNumber(value);
+    else if (_nameIs(name, "x-ratelimit-remaining-requests"))
+        remainingRequests = _parseNumber(value);
+    else if (_nameIs(name, "x-ratelimit-remaining-tokens"))
+        remainingTokens = _parseNumber(value);
+    else if (_nameIs(name, "x-ratelimit-reset-requests"))
+        resetRequestsSeconds = parseResetDuration(value);
+    else if (_nameIs(name, "x-ratelimit-reset-tokens"))
+        resetTokensSeconds = parseResetDuration(value);
+    else if (_nameIs(name, "retry-after-ms"))
+    {
+        double milliseconds = _parseNumber(value);
+        retryAfterSeconds = milliseconds < 0 ? retryAfterSeconds : milliseconds / 1000;
+    }
+    else if (_nameIs(name, "retry-after") && retryAfterSeconds < 0)
+    {
+        retryAfterSeconds = _parseNumber(value); // An HTTP date is not used by the API and stays -1
+    }
+}
+
+double parseResetDuration(std::string_view text)
+{
+    text = _trim(text);
+    double bare = _parseNumber(text);
+    if (bare >= 0)
+    {
+        return bare;
+    }
+
+    double total = 0;
+    bool any = false;
+    while (!text.empty())
+    {
+        size_t numberEnd = 0;
+        while (numberEnd < text.size() && (std::isdigit(static_cast<unsigned char>(text[numberEnd])) || text[numberEnd] == '.'))
+        {
+            ++numberEnd;
+        }
+        double value = _parseNumber(text.substr(0, numberEnd));
+        if (value < 0)
+        {
+            return -1;
+        }
+        text.remove_prefix(numberEnd);
+
+        if (text.rfind("ms", 0) == 0)
+        {
+            total += value / 1000;
+            text.remove_prefix(2);
+        }
+        else if (!text.empty() && (text[0] == 's' || text[0] == 'm' || text[0] == 'h'))
+        {
+            total += value * (text[0] == 's' ? 1 : text[0] == 'm' ? 60 : 3600);
+            text.remove_prefix(1);
+        }
+        else
+        {
+            return -1;
+        }
+        any = true;
+    }
+    return any ? total : -1;
+}
+
+size_t rateLimitHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    static_cast<RateLimitHeaders *>(userdata)->parseLine(std::string_view(buffer, size * nitems));
+    return size * nitems;
+}
+
+bool isRetryableStatus(long status)
+{
+    return status == 429 || status == 500 || status == 502 || status == 503 || status == 504;
+}
+
+bool isRetryableTransferError(CURLcode result)
+{
+    return result == CURLE_COULDNT_CONNECT || result == CURLE_OPERATION_TIMEDOUT || result == CURLE_SEND_ERROR ||
+           result == CURLE_RECV_ERROR || result == CURLE_GOT_NOTHING || result == CURLE_PARTIAL_FILE;
+}
+
+TokenBucket::TokenBucket(double capacity, double refillPerSecond, Clock::time_point now)
+    : m_capacity(capacity), m_refillPerSecond(refillPerSecond), m_level(capacity), m_updated(now)
+{
+}
+
+void TokenBucket::_refill(Clock::time_point now)
+{
+    if (now > m_updated)
+    {
+        double elapsed = std::chrono::duration<double>(now - m_updated).count();
+        m_level = std::min(m_capacity, m_level + elapsed * m_refillPerSecond);
+        m_updated = now;
+    }
+}
+
+TokenBucket::Clock::duration TokenBucket::waitFor(double amount, Clock::time_point now)
+{
+    if (!limited())
+    {
+        return Clock::duration::zero();
+    }
+    _refill(now);
+    amount = std::min(amount, m_capacity);
+    if (m_level >= amount)
+    {
+        return Clock::duration::zero();
+    }
+    if (m_refillPerSecond <= 0)
+    {
+        return std::chrono::seconds(1); // Nothing to go by until the next response syncs the bucket
+    }
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>((amount - m_level) / m_refillPerSecond));
+}
+
+void TokenBucket::take(double amount, Clock::time_point now)
+{
+    if (limited())
+    {
+        _refill(now);
+        m_level -= amount;
+    }
+}
+
+void TokenBucket::sync(double remaining, double limit, double resetSeconds, Clock::time_point now)
+{
+    if (limit <= 0 || remaining < 0)
+    {
+        return;
+    }
+    m_capacity = limit;
+    // The reset time says how long the spent part takes to refill; without one assume the
+    // limit is per minute, as the API's are
+    m_refillPerSecond = resetSeconds > 0 && limit > remaining ? (limit - remaining) / resetSeconds : limit / 60;
+    m_level = std::min(remaining, limit);
+    m_updated = now;
+}
+
+double TokenBucket::level(Clock::time_point now)
+{
+    _refill(now);
+    return m_level;
+}
+
+bool TokenBucket::limited() const
+{
+    return m_capacity > 0;
+}
+
+RateLimiter::RateLimiter(std::vector<std::string> apiKeys, double requestsPerMinute, double tokensPerMinute)
+    : m_random(std::random_device{}())
+{
+    Clock::time_point now = Clock::now();
+    for (std::string &key : apiKeys)
+    {
+        KeyState state;
+        state.key = std::move(key);
+        state.requests = TokenBucket(requestsPerMinute, requestsPerMinute / 60, now);
+        state.tokens = TokenBucket(tokensPerMinute, tokensPerMinute / 60, now);
+        m_keys.push_back(std::move(state));
+    }
+}
+
+size_t RateLimiter::keyCount() const
+{
+    return m_keys.size();
+}
+
+const std::string &RateLimiter::key(size_t index) const
+{
+    return m_keys[index].key;
+}
+
+bool RateLimiter::tryAcquire(double tokens, Lease &lease, Clock::duration &wait, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_keys.empty())
+    {
+        wait = Clock::duration::max();
+        return false;
+    }
+
+    // Soonest available key first, then the one with the fewest requests in flight
+    size_t best = 0;
+    Clock::duration bestWait = Clock::duration::max();
+    for (size_t i = 0; i < m_keys.size(); ++i)
+    {
+        KeyState &state = m_keys[i];
+        Clock::duration keyWait = std::max({state.blockedUntil - now, state.requests.waitFor(1, now),
+                                            state.tokens.waitFor(tokens, now), Clock::duration::zero()});
+        if (keyWait < bestWait || (keyWait == bestWait && state.inFlight < m_keys[best].inFlight))
+        {
+            best = i;
+            bestWait = keyWait;
+        }
+    }
+    if (bestWait > Clock::duration::zero())
+    {
+        wait = bestWait;
+        return false;
+    }
+
+    KeyState &state = m_keys[best];
+    state.requests.take(1, now);
+    state.tokens.take(tokens, now);
+    ++state.inFlight;
+    state.inFlightTokens += tokens;
+    lease.key = best;
+    lease.tokens = tokens;
+    return true;
+}
+
+bool RateLimiter::acquire(double tokens, Lease &lease, const std::atomic<bool> *cancelFlag)
+{
+    while (true)
+    {
+        if (cancelFlag != nullptr && cancelFlag->load())
+        {
+            return false;
+        }
+        Clock::duration wait;
+        if (tryAcquire(tokens, lease, wait))
+        {
+            return true;
+        }
+        if (m_keys.empty())
+        {
+            return false;
+        }
+        // Short naps so a cancel request is noticed promptly
+        std::this_thread::sleep_for(std::min<Clock::duration>(wait, std::chrono::milliseconds(50)));
+    }
+}
+
+void RateLimiter::complete(const Lease &lease, long status, const RateLimitHeaders &headers, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    KeyState &state = m_keys[lease.key];
+    state.inFlight -= state.inFlight > 0 ? 1 : 0;
+    state.inFlightTokens = std::max(0.0, state.inFlightTokens - lease.tokens);
+
+    // The server's count may not include requests still in flight on this key. Taking those off
+    // stops at zero: a negative level would read as an absent header and drop the report
+    auto unspent = [](double remaining, double inFlight) {
+        return remaining < 0 ? remaining : std::max(remaining - inFlight, 0.0);
+    };
+    state.requests.sync(unspent(headers.remainingRequests, static_cast<double>(state.inFlight)),
+                        headers.limitRequests, headers.resetRequestsSeconds, now);
+    state.tokens.sync(unspent(headers.remainingTokens, state.inFlightTokens), headers.limitTokens,
+                      headers.resetTokensSeconds, now);
+
+    if (status == 429)
+    {
+        double seconds = headers.retryAfterSeconds;
+        if (seconds < 0 && headers.remainingRequests == 0)
+        {
+            seconds = headers.resetRequestsSeconds;
+        }
+        if (seconds < 0 && headers.remainingTokens == 0)
+        {
+            seconds = headers.resetTokensSeconds;
+        }
+        Clock::duration delay = seconds >= 0 ? std::chrono::duration_cast<Clock::duration>(
+                                                   std::chrono::duration<double>(seconds))
+                                             : _backoff(state.consecutiveLimited);
+        ++state.consecutiveLimited;
+        state.blockedUntil = std::max(state.blockedUntil, now + delay);
+    }
+    else if (status != 0)
+    {
+        state.consecutiveLimited = 0;
+    }
+}
+
+RateLimiter::Clock::duration RateLimiter::backoff(int attempt)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return _backoff(attempt);
+}
+
+RateLimiter::Clock::duration RateLimiter::_backoff(int attempt)
+{
+    Clock::duration cap = std::min<Clock::duration>(kMaxBackoff, kBaseBackoff * (1LL << std::min(attempt, 16)));
+    Clock::duration half = cap / 2;
+    return half + Clock::duration(std::uniform_int_distribution<Clock::rep>(0, half.count())(m_random));
+}
+
+std::vector<std::string> configuredApiKeys()
+{
+    std::vector<std::string> keys;
+    const char *configured = std::getenv("OPENAI_KEY");
+    std::string_view rest = configured != nullptr ? configured : "";
+    while (!rest.empty())
+    {
+        size_t comma = rest.find(',');
+        std::string_view key = _trim(rest.substr(0, comma));
+        if (!key.empty())
+        {
+            keys.emplace_back(key);
+        }
+        rest.remove_prefix(comma == std::string_view::npos ? rest.size() : comma + 1);
+    }
+    return keys;
+}
+
+RateLimiter &sharedRateLimiter()
+{
+    static const std::pair<double, double> limits = [] {
+        const char *rpm = std::getenv("CHATGPT_CLI_RPM");
+        const char *tpm = std::getenv("CHATGPT_CLI_TPM");
+        return std::make_pair(rpm != nullptr ? std::strtod(rpm, nullptr) : 0.0,
+                              tpm != nullptr ? std::strtod(tpm, nullptr) : 0.0);
+    }();
+    static std::mutex mutex;
+    // Intentionally never destroyed: requests on other threads may still hold leases
+    static std::map<std::string, RateLimiter *> *limiters = new std::map<std::string, RateLimiter *>();
+
+    const char *configured = std::getenv("OPENAI_KEY");
+    std::string keys = configured != nullptr ? configured : "";
+    std::lock_guard<std::mutex> lock(mutex);
+    RateLimiter *&limiter = (*limiters)[keys];
+    if (limiter == nullptr)
+    {
+        limiter = new RateLimiter(configuredApiKeys(), limits.first, limits.second);
+    }
+    return *limiter;
+}
@@ -0,0 +1,227 @@
+//  ratelimiter.hpp
+//
+// Client-side pacing of API requests from the rate limit headers, with retries and key sharding
+
+#ifndef ratelimiter_hpp
+#define ratelimiter_hpp
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <curl/curl.h>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Retries after the first attempt for a request that hit a rate limit or a transient failure
+constexpr int kMaxRequestRetries = 4;
+
+/// @brief Rate limit state reported in the headers of one API response; -1 where absent.
+struct RateLimitHeaders
+{
+    double limitRequests = -1;
+    double limitTokens = -1;
+    double remainingRequests = -1;
+    double remainingTokens = -1;
+    double resetRequestsSeconds = -1; // Until the request allowance is full again
+    double resetTokensSeconds = -1;   // Until the token allowance is full again
+    double retryAfterSeconds = -1;    // From retry-after-ms, or else retry-after
+
+    /**
+     * @brief Takes the value of one raw "Name: value" header line if it is a rate limit header.
+     */
+    void parseLine(std::string_view line);
+};
+
+/**
+ * @brief Parses an OpenAI reset duration such as "20ms", "1s", "6m0s" or "1h2m3.5s".
+ * @return The duration in seconds, or -1 if text is not a duration. A bare number is seconds.
+ */
+double parseResetDuration(std::string_view text);
+
+/**
+ * @brief cURL header callback that feeds each header line to the RateLimitHeaders in userdata.
+ */
+size_t rateLimitHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata);
+
+/**
+ * @brief Returns true for HTTP statuses worth retrying: 429 and the transient 5xx codes.
+ */
+bool isRetryableStatus(long status);
+
+/**
+ * @brief Returns true for transfer errors that say nothing about the request itself, such as a
+ * refused or dropped connection.
+ */
+bool isRetryableTransferError(CURLcode result);
+
+/// @class TokenBucket
+/// @brief A continuously refilling allowance, e.g. of requests or tokens per minute.
+///
+/// The level may go negative when a request takes more than is left; later requests then wait
+/// until the debt has refilled. A bucket without a capacity is unlimited.
+class TokenBucket
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Creates a full bucket.
+     * @param capacity The most the bucket holds; 0 means unlimited.
+     * @param refillPerSecond How fast it refills.
+     */
+    TokenBucket(double capacity = 0, double refillPerSecond = 0, Clock::time_point now = Clock::now());
+
+    /**
+     * @brief Returns how long until amount is available; zero if it is available now.
+     * Amounts above the capacity only wait for a full bucket.
+     */
+    Clock::duration waitFor(double amount, Clock::time_point now);
+
+    /**
+     * @brief Takes amount out of the bucket.
+     */
+    void take(double amount, Clock::time_point now);
+
+    /**
+     * @brief Replaces the local estimate with the level the server reported.
+     * @param remaining What the server says is left.
+     * @param limit The server's capacity.
+     * @param resetSeconds Time until the server's allowance is full; -1 if unknown.
+     */
+    void sync(double remaining, double limit, double resetSeconds, Clock::time_point now);
+
+    /**
+     * @brief Returns the current level; meaningless for an unlimited bucket.
+     */
+    double level(Clock::time_point now);
+
+    /**
+     * @brief Returns true if the bucket has a capacity.
+     */
+    bool limited() const;
+
+  private:
+    double m_capacity;
+    double m_refillPerSecond;
+    double m_level;
+    Clock::time_point m_updated;
+
+    /**
+     * @brief Adds what has refilled since the last update.
+     */
+    void _refill(Clock::time_point now);
+};
+
+/// @class RateLimiter
+/// @brief Paces requests over one or more API keys so they stay within the server's limits.
+///
+/// Each key has a request bucket and a token bucket. They start unlimited, or at the
+/// configured per-minute limits, and track the x-ratelimit-* headers of every response. A
+/// request goes to the key that can take it soonest, and the least busy one on a tie, so load
+/// spreads across keys. A 429 blocks its key until retry-after has passed, or for a jittered
+/// backoff if the server gave none; other keys keep serving in the meantime.
+class RateLimiter
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /// @brief A permit to send one request with a particular key.
+    struct Lease
+    {
+        size_t key = 0;
+        double tokens = 0;
+    };
+
+    /**
+     * @brief Creates a limiter for apiKeys.
+     * @param apiKeys The keys to spread requests over.
+     * @param requestsPerMinute Initial request limit per key; 0 until the server reports one.
+     * @param tokensPerMinute Initial token limit per key; 0 until the server reports one.
+     */
+    explicit RateLimiter(std::vector<std::string> apiKeys, double requestsPerMinute = 0, double tokensPerMinute = 0);
+
+    /**
+     * @brief Returns the number of keys.
+     */
+    size_t keyCount() const;
+
+    /**
+     * @brief Returns key number index.
+     */
+    const std::string &key(size_t index) const;
+
+    /**
+     * @brief Takes a permit for a request of about tokens tokens if some key has room now.
+     * @param tokens Estimated tokens the request will use.
+     * @param lease Receives the permit.
+     * @param wait Receives how long until some key has room, when none has now.
+     * @return True if lease was granted.
+     */
+    bool tryAcquire(double tokens, Lease &lease, Clock::duration &wait, Clock::time_point now = Clock::now());
+
+    /**
+     * @brief Waits until some key has room and takes a permit.
+     * @return False if cancelFlag was raised (or there are no keys) before a permit was granted.
+     */
+    bool acquire(double tokens, Lease &lease, const std::atomic<bool> *cancelFlag = nullptr);
+
+    /**
+     * @brief Reports how a request sent under lease went.
+     * @param lease The permit the request was sent with.
+     * @param status The HTTP status; 0 if no response arrived.
+     * @param headers The rate limit headers of the response.
+     */
+    void complete(const Lease &lease, long status, const RateLimitHeaders &headers,
+                  Clock::time_point now = Clock::now());
+
+    /**
+     * @brief Returns a jittered exponential backoff for retry number attempt (0-based).
+     *
+     * Half of min(kMaxBackoff, kBaseBackoff * 2^attempt) plus a random amount up to the
+     * other half, so clients that failed together do not retry together.
+     */
+    Clock::duration backoff(int attempt);
+
+  private:
+    static constexpr std::chrono::milliseconds kBaseBackoff{500};
+    static constexpr std::chrono::milliseconds kMaxBackoff{30000};
+
+    /// @brief Pacing state of one key.
+    struct KeyState
+    {
+        std::string key;
+        TokenBucket requests;
+        TokenBucket tokens;
+        Clock::time_point blockedUntil;
+        size_t inFlight = 0;
+        double inFlightTokens = 0;
+        int consecutiveLimited = 0; // 429s in a row, for the backoff when retry-after is missing
+    };
+
+    mutable std::mutex m_mutex;
+    std::vector<KeyState> m_keys;
+    std::mt19937 m_random;
+
+    /**
+     * @brief Returns the backoff for attempt; m_mutex must be held.
+     */
+    Clock::duration _backoff(int attempt);
+};
+
+/**
+ * @brief Returns the API keys configured in OPENAI_KEY, which may list several separated by commas.
+ */
+std::vector<std::string> configuredApiKeys();
+
+/**
+ * @brief Returns the process-wide limiter for configuredApiKeys().
+ *
+ * CHATGPT_CLI_RPM and CHATGPT_CLI_TPM set per-key limits to start from before the server has
+ * reported any (read once). A new limiter is made if OPENAI_KEY changes.
+ */
+RateLimiter &sharedRateLimiter();
+
+#endif /* ratelimiter_hpp */
@@ -4,115 +4,419 @@
 
 #include "request.hpp"
 #include "chathistory.hpp"
+#include "connectionpool.hpp"
+#include "metrics.hpp"
+#include "ratelimiter.hpp"
+#include "responseparser.hpp"
+#include "streamparser.hpp"
+#include "tokenizer.hpp"
+#include "usageledger.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <curl/curl.h>
 #include <iostream>
-#include <nlohmann/json.hpp>
+#include <thread>
 
-std::string makeRequest(const std::string &message, ChatHistory &chatHistory)
+namespace
 {
-    // Add new user message to chat history
-    chatHistory.addDialog("user", message);
+/**
+ * @brief cURL progress callback that aborts the transfer once the cancel flag is raised.
+ */
+int _cancelProgressCallback(void *clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+{
+    return static_cast<const std::atomic<bool> *>(clientp)->load() ? 1 : 0;
+}
+
+/// @brief Write target that holds back the body of a response that is about to be retried.
+struct _RetrySink
+{
+    size_t (*writeFn)(void *, size_t, size_t, void *);
+    void *writeData;
+    CURL *curl;
+    bool mayRetry;          // Whether a retryable status may still be retried
+    bool decided = false;   // Set once the first body bytes have been seen
+    bool holding = false;   // Body goes to held instead of writeFn
+    bool forwarded = false; // Some body already reached writeFn, so the request cannot be retried
+    std::string held = {};  // Body of a response that may still be retried
+};
 
-    // Build JSON payload
-    nlohmann::json payload;
-    payload["model"] = "gpt-4o"; // Updated to latest supported model
+size_t _retrySinkWrite(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    _RetrySink &sink = *static_cast<_RetrySink *>(userp);
+    if (!sink.decided)
+    {
+        long status = 0;
+        curl_easy_getinfo(sink.curl, CURLINFO_RESPONSE_CODE, &status);
+        sink.holding = sink.mayRetry && isRetryableStatus(status);
+        sink.decided = true;
+    }
+    if (sink.holding)
+    {
+        sink.held.append(static_cast<char *>(contents), size * nmemb);
+        return size * nmemb;
+    }
+    sink.forwarded = true;
+    return sink.writeFn(contents, size, nmemb, sink.writeData);
+}
 
-    // Add chat history
-    for (const auto &[role, content] : chatHistory)
+/**
+ * @brief Sleeps for delay in short naps.
+ * @return False if cancelFlag was raised in the meantime.
+ */
+bool _sleepUnlessCancelled(std::chrono::steady_clock::duration delay, const std::atomic<bool> *cancelFlag)
+{
+    auto until = std::chrono::steady_clock::now() + delay;
+    while (std::chrono::steady_clock::now() < until)
     {
-        payload["messages"].push_back({{"role", role}, {"content", content}});
+        if (cancelFlag != nullptr && cancelFlag->load())
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(
+            std::min<std::chrono::steady_clock::duration>(until - std::chrono::steady_clock::now(),
+                                                          std::chrono::milliseconds(50)));
     }
+    return cancelFlag == nullptr || !cancelFlag->load();
+}
 
-    // Convert the JSON object to a string
-    std::string payloadStr = payload.dump();
+/**
+ * @brief POSTs payloadStr to the chat completions endpoint, handing the body to writeFn.
+ *
+ * Each attempt waits for a permit from sharedRateLimiter() and goes out with the key it
+ * grants. Rate limited (429) and transiently failed attempts are retried up to
+ * kMaxRequestRetries times; only the final attempt's body reaches writeFn. The transfer is
+ * aborted when cancelFlag (if given) becomes true.
+ */
+void _performChatCompletion(const std::string &payloadStr, size_t (*writeFn)(void *, size_t, size_t, void *),
+                           void *writeData, const std::atomic<bool> *cancelFlag = nullptr)
+{
+    RateLimiter &limiter = sharedRateLimiter();
+    if (limiter.keyCount() == 0)
+    {
+        std::cerr << "[ERROR] OPENAI_KEY environment variable not set. Please set it before running the CLI." << std::endl;
+        return;
+    }
+    // A rough token estimate is enough to pace against the token limit
+    const double tokens = payloadStr.size() / 4.0;
+    const std::string url = chatCompletionsUrl();
 
-    // Set up CURL
-    CURL *curl = curl_easy_init();
+    // Borrow a pooled handle so the connection, TLS session and DNS entry are reused
+    ConnectionPool &pool = ConnectionPool::instance();
+    ConnectionPool::Handle handle = pool.acquire(url);
+    CURL *curl = handle.get();
     CURLcode res;
-    std::string response;
 
     if (curl)
     {
-        // Set the URL for the request
-        curl_easy_setopt(curl, CURLOPT_URL, "https://api.openai.com/v1/chat/completions");
-
         // Set the request method to POST
         curl_easy_setopt(curl, CURLOPT_POST, 1L);
 
         // Add in the payload
         curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payloadStr.c_str());
 
-        // Add necessary headers
-        struct curl_slist *headers = nullptr;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
+        // Allow the caller to abort a request that is in flight
+        if (cancelFlag != nullptr)
+        {
+            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, _cancelProgressCallback);
+            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, const_cast<std::atomic<bool> *>(cancelFlag));
+        }
 
-        // Get API KEY from environment and check for presence
-        const char *api_key = std::getenv("OPENAI_KEY");
-        if (api_key == nullptr || std::string(api_key).empty())
+        for (int attempt = 0;; ++attempt)
         {
-            std::cerr << "[ERROR] OPENAI_KEY environment variable not set. Please set it before running the CLI." << std::endl;
-            curl_easy_cleanup(curl);
+            RateLimiter::Lease lease;
+            if (!limiter.acquire(tokens, lease, cancelFlag))
+            {
+                return; // Cancelled while waiting for the rate limit
+            }
+
+            // Add necessary headers, with the key the limiter picked
+            struct curl_slist *headers = nullptr;
+            headers = curl_slist_append(headers, "Content-Type: application/json");
+            std::string auth_header = "Authorization: Bearer " + limiter.key(lease.key);
+            headers = curl_slist_append(headers, auth_header.c_str());
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+            // Rate limit headers feed the limiter
+            RateLimitHeaders rateLimits;
+            curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, rateLimitHeaderCallback);
+            curl_easy_setopt(curl, CURLOPT_HEADERDATA, &rateLimits);
+
+            // The body goes to writeFn unless this attempt is going to be retried
+            _RetrySink sink{writeFn, writeData, curl, attempt < kMaxRequestRetries};
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _retrySinkWrite);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+
+            // Perform the request
+            res = curl_easy_perform(curl);
+            pool.recordTransfer(curl, res);
+            if (res == CURLE_OK)
+            {
+                recordTransferPhases(curl);
+            }
+            long status = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+            limiter.complete(lease, status, rateLimits);
             curl_slist_free_all(headers);
-            return "";
+
+            bool cancelled = res == CURLE_ABORTED_BY_CALLBACK && cancelFlag != nullptr && cancelFlag->load();
+            bool retry = !cancelled && !sink.forwarded && attempt < kMaxRequestRetries &&
+                         ((res == CURLE_OK && isRetryableStatus(status)) || isRetryableTransferError(res));
+            if (retry)
+            {
+                // A 429 blocks its key in the limiter, which also spaces out the retry; other
+                // failures back off here
+                if (status != 429 && !_sleepUnlessCancelled(limiter.backoff(attempt), cancelFlag))
+                {
+                    return;
+                }
+                continue;
+            }
+
+            if (!sink.held.empty())
+            {
+                writeFn(&sink.held[0], 1, sink.held.size(), writeData);
+            }
+
+            // Check for errors
+            if (cancelled)
+            {
+                // Cancelled on purpose; the caller reports this to the user
+            }
+            else if (res != CURLE_OK)
+            {
+                std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
+            }
+            break;
         }
-        std::string auth_header = "Authorization: Bearer " + std::string(api_key);
-        headers = curl_slist_append(headers, auth_header.c_str());
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        // The handle itself goes back to the pool
+    }
+}
 
-        // Function to receive the response
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _writeCallback);
+/// @brief An SseParser and the time spent in it, which includes handing deltas to the caller.
+struct _TimedSseParser
+{
+    SseParser &parser;
+    std::chrono::steady_clock::duration spent{};
+};
 
-        // Response data
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+/**
+ * @brief Stream write callback that feeds a _TimedSseParser and adds up the time it takes.
+ */
+size_t _timedStreamWriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    _TimedSseParser *timed = static_cast<_TimedSseParser *>(userp);
+    auto start = std::chrono::steady_clock::now();
+    size_t taken = _streamWriteCallback(contents, size, nmemb, &timed->parser);
+    timed->spent += std::chrono::steady_clock::now() - start;
+    return taken;
+}
 
-        // Perform the request
-        res = curl_easy_perform(curl);
+/**
+ * @brief Returns the start of a response for an error message; a reply can run to megabytes.
+ */
+std::string _responseExcerpt(const std::string &response)
+{
+    constexpr size_t kMaxExcerpt = 2048;
+    if (response.size() <= kMaxExcerpt)
+    {
+        return response;
+    }
+    return response.substr(0, kMaxExcerpt) + "\n... (" + std::to_string(response.size() - kMaxExcerpt) +
+           " more bytes)";
+}
+} // namespace
 
-        // Check for errors
-        if (res != CURLE_OK)
+size_t promptTokenBudget()
+{
+    static const size_t budget = [] {
+        const char *configured = std::getenv("CHATGPT_CLI_TOKEN_BUDGET");
+        if (configured != nullptr && *configured != '\0')
         {
-            std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
+            return static_cast<size_t>(std::strtoull(configured, nullptr, 10));
         }
+        return kDefaultPromptTokenBudget;
+    }();
+    return budget;
+}
 
-        // Cleanup
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
+size_t requestTokenBudget(std::string_view message, size_t requests)
+{
+    size_t budget = promptTokenBudget();
+    UsageLedger &ledger = sharedUsageLedger();
+    uint64_t remaining = ledger.remainingTokens();
+    if (remaining == UsageLedger::kUnlimited)
+    {
+        return budget;
     }
 
+    // Each request is charged for its whole prompt, so each gets an equal share of what is left
+    requests = std::max<size_t>(requests, 1);
+    ledger.checkRoomFor((countTokens(message) + ChatHistory::kTokensPerMessage) * requests);
+    uint64_t share = remaining / requests;
+    if (budget == 0 || share < budget)
+    {
+        budget = static_cast<size_t>(share);
+    }
+    return budget;
+}
+
+std::string apiBaseUrl()
+{
+    const char *configured = std::getenv("OPENAI_BASE_URL");
+    if (configured == nullptr || *configured == '\0')
+    {
+        return kDefaultApiBaseUrl;
+    }
+    std::string base = configured;
+    while (!base.empty() && base.back() == '/')
+    {
+        base.pop_back();
+    }
+    return base;
+}
+
+std::string chatCompletionsUrl()
+{
+    return apiBaseUrl() + "/chat/completions";
+}
+
+std::string buildChatRequestPayload(const std::string &message, ChatHistory &chatHistory, bool stream)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Refused before the message is added if the token limits leave no room for it
+    size_t budget = requestTokenBudget(message);
+
+    // Add new user message to chat history
+    chatHistory.addDialog("user", message);
+
+    // Serialized message fragments are cached on the history; only the new message is encoded.
+    // Older messages that do not fit in the prompt token budget are left out of the request.
+    std::string payload = chatHistory.buildRequestPayload(kDefaultChatModel, stream, budget);
+    recordSince(requestMetrics().payloadBuild, start);
+    return payload;
+}
+
+std::string makeRequest(const std::string &message, ChatHistory &chatHistory)
+{
+    std::string payloadStr = buildChatRequestPayload(message, chatHistory, false);
+    return sendChatRequest(payloadStr);
+}
+
+std::string sendChatRequest(const std::string &payload, const std::atomic<bool> *cancelFlag)
+{
+    std::string response;
+    _performChatCompletion(payload, _writeCallback, &response, cancelFlag);
+    recordResponseUsage(response);
     return response;
 }
 
+std::string makeStreamingRequest(const std::string &message, ChatHistory &chatHistory, const DeltaFn &onDelta,
+                                 const std::atomic<bool> *cancelFlag)
+{
+    return sendStreamingChatRequest(buildChatRequestPayload(message, chatHistory, true), onDelta, cancelFlag);
+}
+
+std::string sendStreamingChatRequest(const std::string &payload, const DeltaFn &onDelta,
+                                     const std::atomic<bool> *cancelFlag)
+{
+    SseParser parser(onDelta);
+    _TimedSseParser timed{parser};
+    _performChatCompletion(payload, _timedStreamWriteCallback, &timed, cancelFlag);
+    parser.finish();
+    if (parser.hasUsage())
+    {
+        sharedUsageLedger().record(parser.usage());
+    }
+    requestMetrics().parse.record(std::chrono::duration_cast<std::chrono::microseconds>(timed.spent));
+
+    // Whatever was not streamed content, e.g. an error body, is returned for the caller to parse
+    return parser.rawBody();
+}
+
+void recordResponseUsage(const std::string &response)
+{
+    if (response.empty())
+    {
+        return;
+    }
+    try
+    {
+        ChatResponse parsed = parseChatResponse(response);
+        if (parsed.hasUsage)
+        {
+            sharedUsageLedger().record(parsed.usage);
+        }
+    }
+    catch (const std::exception &)
+    {
+        // Reported to the user by whoever reads the content
+    }
+}
+
+void recordTransferPhases(CURL *curl)
+{
+    curl_off_t nameLookup = 0, connect = 0, appConnect = 0, preTransfer = 0, startTransfer = 0, total = 0;
+    long newConnections = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &nameLookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appConnect);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &preTransfer);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &startTransfer);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &newConnections);
+
+    // All cURL times are microseconds from the start of the transfer
+    RequestMetrics &metrics = requestMetrics();
+    auto since = [](curl_off_t from, curl_off_t to) { return std::chrono::microseconds(to > from ? to - from : 0); };
+    if (newConnections > 0)
+    {
+        // A reused connection has no setup to time; %connections shows how often that happens
+        metrics.dns.record(std::chrono::microseconds(nameLookup));
+        metrics.connect.record(since(nameLookup, connect));
+        if (appConnect > 0)
+        {
+            metrics.tls.record(since(connect, appConnect));
+        }
+    }
+    metrics.ttfb.record(since(preTransfer, startTransfer));
+    metrics.transfer.record(since(startTransfer, total));
+    metrics.request.record(std::chrono::microseconds(total));
+}
+
 std::string getChatGPTResponseContent(const std::string &jsonStr)
 {
-    // Parse the response and extract the assistant's message content
+    // Extract the assistant's message content in one pass, without building a DOM
     try {
-        nlohmann::json jsonResponse = nlohmann::json::parse(jsonStr);
+        auto start = std::chrono::steady_clock::now();
+        ChatResponse response = parseChatResponse(jsonStr);
+        recordSince(requestMetrics().parse, start);
         // If there is an error field, print it for the user
-        if (jsonResponse.contains("error")) {
-            std::string errMsg = jsonResponse["error"].contains("message") ? jsonResponse["error"]["message"].get<std::string>() : "Unknown error";
-            std::cerr << "[OPENAI API ERROR] " << errMsg << std::endl;
+        if (response.hasError) {
+            std::cerr << "[OPENAI API ERROR] " << (response.errorMessage.empty() ? "Unknown error" : response.errorMessage) << std::endl;
             // Optionally print more details if available
-            if (jsonResponse["error"].contains("type")) {
-                std::cerr << "  Type: " << jsonResponse["error"]["type"] << std::endl;
+            if (!response.errorType.empty()) {
+                std::cerr << "  Type: " << response.errorType << std::endl;
             }
-            if (jsonResponse["error"].contains("code")) {
-                std::cerr << "  Code: " << jsonResponse["error"]["code"] << std::endl;
+            if (!response.errorCode.empty()) {
+                std::cerr << "  Code: " << response.errorCode << std::endl;
             }
             return "";
         }
-        if (!jsonResponse.contains("choices") || !jsonResponse["choices"].is_array() || jsonResponse["choices"].empty()) {
-            std::cerr << "[ERROR] API response missing 'choices' array. Full response:\n" << jsonStr << std::endl;
+        if (!response.hasChoices) {
+            std::cerr << "[ERROR] API response missing 'choices' array. Response:\n" << _responseExcerpt(jsonStr) << std::endl;
             return "";
         }
-        if (!jsonResponse["choices"][0].contains("message") || !jsonResponse["choices"][0]["message"].contains("content")) {
-            std::cerr << "[ERROR] API response missing 'message.content'. Full response:\n" << jsonStr << std::endl;
+        if (!response.hasContent) {
+            std::cerr << "[ERROR] API response missing 'message.content'. Response:\n" << _responseExcerpt(jsonStr) << std::endl;
             return "";
         }
-        std::string response = jsonResponse["choices"][0]["message"]["content"];
-        return response;
+        return std::move(response.content);
     } catch (const std::exception &e) {
-        std::cerr << "[ERROR] Failed to parse API response: " << e.what() << "\nFull response:\n" << jsonStr << std::endl;
+        std::cerr << "[ERROR] Failed to parse API response: " << e.what() << "\nResponse:\n" << _responseExcerpt(jsonStr) << std::endl;
         return "";
     }
 }
@@ -6,11 +6,81 @@
 #define request_hpp
 
 #include "chathistory.hpp"
+#include "streamparser.hpp"
+#include <atomic>
+#include <cstddef>
+#include <curl/curl.h>
 #include <string>
+#include <string_view>
+
+/// Prompt token budget used when CHATGPT_CLI_TOKEN_BUDGET is not set: gpt-4o's 128k context
+/// window minus room for the reply
+constexpr size_t kDefaultPromptTokenBudget = 120000;
+
+/**
+ * @brief Returns the maximum number of prompt tokens a request may send.
+ *
+ * Read once from the CHATGPT_CLI_TOKEN_BUDGET environment variable (0 disables the limit),
+ * falling back to kDefaultPromptTokenBudget.
+ *
+ * @return The prompt token budget.
+ */
+size_t promptTokenBudget();
+
+/**
+ * @brief Returns the prompt token budget for sending message in each of requests requests.
+ *
+ * This is promptTokenBudget(), lowered to an equal share per request of what the session and
+ * daily token limits of sharedUsageLedger() leave, so older messages are left out to keep a
+ * request within the limits.
+ *
+ * @param message The new user message, which every request sends whatever the budget.
+ * @param requests How many requests are about to be sent, e.g. one per model for %compare.
+ * @return The prompt token budget; 0 when there is no limit at all.
+ * @throws UsageLimitExceeded if the limits leave too few tokens for message itself.
+ */
+size_t requestTokenBudget(std::string_view message, size_t requests = 1);
+
+/// Model chat requests are sent to, unless a caller such as %compare names others
+constexpr const char *kDefaultChatModel = "gpt-4o";
+
+/// API root used when OPENAI_BASE_URL is not set
+constexpr const char *kDefaultApiBaseUrl = "https://api.openai.com/v1";
+
+/**
+ * @brief Returns the API root that endpoint paths such as "/chat/completions" are appended to.
+ *
+ * Taken from the OPENAI_BASE_URL environment variable (e.g. "http://127.0.0.1:8080/v1" for a
+ * local stand-in server), falling back to kDefaultApiBaseUrl. Read on every call, so a test can
+ * point requests at a server started on an ephemeral port.
+ *
+ * @return The API root without a trailing slash.
+ */
+std::string apiBaseUrl();
+
+/**
+ * @brief Returns the endpoint all chat completion requests are sent to.
+ */
+std::string chatCompletionsUrl();
+
+/**
+ * @brief Adds the next user message to chatHistory and serializes the request body for it.
+ *
+ * The oldest messages are left out of the body when the history exceeds requestTokenBudget().
+ *
+ * @param message The next user message.
+ * @param chatHistory The conversation so far; the message is added to it.
+ * @param stream Whether to request a streamed (SSE) response.
+ * @return The serialized JSON request body.
+ * @throws UsageLimitExceeded if the token limits leave no room for the message; nothing is added.
+ */
+std::string buildChatRequestPayload(const std::string &message, ChatHistory &chatHistory, bool stream);
 
 /**
  * @brief Calls the ChatGPT API using cURL, sending a new message and chat history for context.
  *
+ * The oldest messages are left out of the request when the history exceeds promptTokenBudget().
+ *
  * @param message The next user message to send to ChatGPT.
  * @param chatHistory The chat history to provide context for the API request.
  * @return A JSON-formatted string containing the raw response from ChatGPT.
@@ -18,12 +88,70 @@
  */
 std::string makeRequest(const std::string &message, ChatHistory &chatHistory);
 
+/**
+ * @brief Sends an already built, non-streaming request body to the chat completions endpoint.
+ *
+ * Goes through the same pooled connections, rate limiting and retries as makeRequest.
+ *
+ * @param payload The JSON request body, e.g. from ChatHistory::buildRequestPayload.
+ * @param cancelFlag Optional flag polled during the transfer; the request is aborted once it is true.
+ * @return The raw response body; empty if the transfer failed or was cancelled.
+ */
+std::string sendChatRequest(const std::string &payload, const std::atomic<bool> *cancelFlag = nullptr);
+
+/**
+ * @brief Calls the ChatGPT API with "stream": true, reporting the reply as it is generated.
+ *
+ * Each content delta is passed to onDelta as soon as its server-sent event has been received,
+ * so the caller can display the reply token by token instead of waiting for the full response.
+ *
+ * @param message The next user message to send to ChatGPT.
+ * @param chatHistory The chat history to provide context for the API request.
+ * @param onDelta Callback invoked with each piece of assistant content, in order.
+ * @param cancelFlag Optional flag polled during the transfer; the request is aborted once it is true.
+ * @return Any response text that was not streamed content (e.g. a JSON error body); empty on success.
+ */
+std::string makeStreamingRequest(const std::string &message, ChatHistory &chatHistory, const DeltaFn &onDelta,
+                                 const std::atomic<bool> *cancelFlag = nullptr);
+
+/**
+ * @brief Sends an already built, streaming request body and reports the reply as it arrives.
+ *
+ * @param payload The JSON request body with "stream": true, e.g. from PayloadBuilder::withStream.
+ * @param onDelta Callback invoked with each piece of assistant content, in order.
+ * @param cancelFlag Optional flag polled during the transfer; the request is aborted once it is true.
+ * @return Any response text that was not streamed content, as makeStreamingRequest returns.
+ */
+std::string sendStreamingChatRequest(const std::string &payload, const DeltaFn &onDelta,
+                                     const std::atomic<bool> *cancelFlag = nullptr);
+
+/**
+ * @brief Records the token usage a response body reports in sharedUsageLedger().
+ *
+ * Bodies without usage, such as API errors, and unreadable ones are ignored.
+ *
+ * @param response A raw non-streamed response body.
+ */
+void recordResponseUsage(const std::string &response);
+
+/**
+ * @brief Records the phases of a finished transfer in requestMetrics(), from cURL's own timers.
+ *
+ * Name lookup, connect and TLS times are recorded only when the transfer opened a connection.
+ *
+ * @param curl The handle of a transfer that completed without a transfer error.
+ */
+void recordTransferPhases(CURL *curl);
+
 /**
  * @brief Parses a raw JSON response to extract the content returned by the ChatGPT API.
  *
+ * Uses parseChatResponse, so only the fields needed are decoded. An API error, a malformed
+ * response or one without content is reported on stderr, with at most the first 2 KB of the
+ * response, and yields an empty string.
+ *
  * @param jsonStr The JSON response as a string.
  * @return The assistant's message content as a string.
- * @throws std::runtime_error if parsing fails or the expected fields are missing.
  */
 std::string getChatGPTResponseContent(const std::string &jsonStr);
 
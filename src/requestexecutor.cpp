@@ -0,0 +1,94 @@
+//  requestexecutor.cpp
+//
+// Runs API requests on a background thread so the UI loop never waits on the network
+
+#include "requestexecutor.hpp"
+#include <exception>
+#include <iostream>
+#include <utility>
+
+RequestExecutor::RequestExecutor() : m_worker(&RequestExecutor::_run, this)
+{
+}
+
+RequestExecutor::~RequestExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_jobs.clear();
+        m_cancelled = true;
+    }
+    m_wakeup.notify_all();
+    m_worker.join();
+}
+
+void RequestExecutor::submit(Job job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.emplace_back(std::move(job), false);
+    }
+    m_wakeup.notify_one();
+}
+
+void RequestExecutor::cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &queued : m_jobs)
+        {
+            queued.second = true;
+        }
+        if (m_running)
+        {
+            m_cancelled = true;
+        }
+    }
+    m_wakeup.notify_all();
+}
+
+bool RequestExecutor::waitCancelled(std::chrono::steady_clock::time_point deadline)
+{
+    // Only the worker thread waits on m_wakeup, in _run or here, so a submit waking this wait
+    // is never lost: the worker is busy with this job and picks up new ones when it returns
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_wakeup.wait_until(lock, deadline, [this] { return m_cancelled.load(); });
+}
+
+bool RequestExecutor::busy() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_running || !m_jobs.empty();
+}
+
+void RequestExecutor::_run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wakeup.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+        if (m_stopping)
+        {
+            return;
+        }
+
+        Job job = std::move(m_jobs.front().first);
+        m_cancelled = m_jobs.front().second;
+        m_jobs.pop_front();
+        m_running = true;
+        lock.unlock();
+
+        try
+        {
+            job(m_cancelled);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[ERROR] Request job failed: " << e.what() << std::endl;
+        }
+
+        lock.lock();
+        m_running = false;
+    }
+}
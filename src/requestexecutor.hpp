@@ -0,0 +1,79 @@
+//  requestexecutor.hpp
+//
+// Runs API requests on a background thread so the UI loop never waits on the network
+
+#ifndef requestexecutor_hpp
+#define requestexecutor_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+/// @class RequestExecutor
+/// @brief A single worker thread that runs queued request jobs in submission order.
+///
+/// Each job receives a cancellation flag that is raised by cancel(). Jobs are expected to pass
+/// the flag on to the transfer (see makeStreamingRequest) and to deliver their results to the
+/// UI themselves, e.g. through ScreenInteractive::Post. Jobs that were queued when cancel() was
+/// called still run, with the flag already raised, so they can skip their work and still post
+/// their completion.
+class RequestExecutor
+{
+  public:
+    using Job = std::function<void(const std::atomic<bool> &cancelled)>;
+
+    RequestExecutor();
+
+    /**
+     * @brief Cancels outstanding work and joins the worker thread.
+     */
+    ~RequestExecutor();
+
+    RequestExecutor(const RequestExecutor &) = delete;
+    RequestExecutor &operator=(const RequestExecutor &) = delete;
+
+    /**
+     * @brief Queues a job to run on the worker thread.
+     * @param job The job to run. It is called with the cancellation flag for this job.
+     */
+    void submit(Job job);
+
+    /**
+     * @brief Raises the cancellation flag of the running job and of every job that has not started yet.
+     */
+    void cancel();
+
+    /**
+     * @brief Called from a running job: sleeps until deadline or until the job is cancelled,
+     * whichever comes first. Lets a periodic job wait without polling its flag.
+     * @param deadline When to stop waiting.
+     * @return True if the job was cancelled.
+     */
+    bool waitCancelled(std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * @brief Returns true while a job is running or waiting to run.
+     */
+    bool busy() const;
+
+  private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeup; // Wakes the worker for new jobs, and a waiting job on cancel
+    std::deque<std::pair<Job, bool>> m_jobs; // With whether the job was cancelled before it started
+    std::atomic<bool> m_cancelled{false};
+    bool m_running = false;
+    bool m_stopping = false;
+    std::thread m_worker;
+
+    /**
+     * @brief Worker thread body: pops and runs jobs until the executor is destroyed.
+     */
+    void _run();
+};
+
+#endif /* requestexecutor_hpp */
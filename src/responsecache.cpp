@@ -0,0 +1,485 @@
+//  responsecache.cpp
+//
+// Content-addressed on-disk cache of API responses, shared by all CLI processes on the machine
+
+#include "responsecache.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+struct ResponseCache::Header
+{
+    char magic[8];
+    uint32_t slotCount;
+    uint32_t entries;
+    uint64_t generation; // Bumped whenever the data file is replaced by compaction
+    uint64_t clock;      // LRU clock; every use of an entry takes the next tick
+    uint64_t liveBytes;  // Bytes of the records referenced by slots
+    uint64_t dataEnd;    // Where the next record is appended
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bytesSaved;
+    uint8_t reserved[56];
+};
+
+struct ResponseCache::Slot
+{
+    Sha256Digest key;
+    uint64_t offset; // Record offset in the data file
+    uint32_t length; // Response length
+    uint32_t used;
+    uint64_t lastUsed;
+    uint64_t reserved;
+};
+
+namespace
+{
+constexpr char kIndexMagic[8] = {'C', 'G', 'P', 'T', 'R', 'C', '0', '1'};
+constexpr uint32_t kRecordMagic = 0x31524352; // "RCR1"
+constexpr uint64_t kMinCompactBytes = 1024 * 1024;
+
+/// Each record in the data file: magic, response length, key, then the response bytes
+struct RecordHeader
+{
+    uint32_t magic;
+    uint32_t length;
+    Sha256Digest key;
+};
+
+bool _readFully(int fd, void *buffer, size_t size, uint64_t offset)
+{
+    char *out = static_cast<char *>(buffer);
+    while (size > 0)
+    {
+        ssize_t n = pread(fd, out, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        out += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+bool _writeFully(int fd, const void *buffer, size_t size, uint64_t offset)
+{
+    const char *in = static_cast<const char *>(buffer);
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, in, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        in += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+size_t _homeSlot(const Sha256Digest &key)
+{
+    uint64_t prefix;
+    std::memcpy(&prefix, key.data(), sizeof(prefix));
+    return static_cast<size_t>(prefix % ResponseCache::kSlotCount);
+}
+
+std::runtime_error _systemError(const std::string &what, const std::filesystem::path &path)
+{
+    return std::runtime_error(what + " " + path.string() + ": " + std::strerror(errno));
+}
+} // namespace
+
+ResponseCache::Lock::Lock(ResponseCache &cache) : m_guard(cache.m_mutex), m_fd(cache.m_indexFd)
+{
+    while (flock(m_fd, LOCK_EX) != 0 && errno == EINTR)
+    {
+    }
+}
+
+ResponseCache::Lock::~Lock()
+{
+    flock(m_fd, LOCK_UN);
+}
+
+ResponseCache::ResponseCache(const std::filesystem::path &directory, size_t maxBytes)
+    : m_directory(directory), m_maxBytes(maxBytes)
+{
+    static_assert(sizeof(Header) == 128, "index header layout is part of the file format");
+    static_assert(sizeof(Slot) == 64, "index slot layout is part of the file format");
+
+    std::filesystem::create_directories(m_directory);
+    const std::filesystem::path indexPath = m_directory / "index";
+    m_indexFd = open(indexPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_indexFd < 0)
+    {
+        throw _systemError("Unable to open cache index", indexPath);
+    }
+    m_mapSize = sizeof(Header) + kSlotCount * sizeof(Slot);
+
+    Lock lock(*this);
+    struct stat status;
+    bool fresh = fstat(m_indexFd, &status) != 0 || static_cast<size_t>(status.st_size) != m_mapSize;
+    if (fresh && ftruncate(m_indexFd, static_cast<off_t>(m_mapSize)) != 0)
+    {
+        int error = errno;
+        close(m_indexFd);
+        errno = error;
+        throw _systemError("Unable to size cache index", indexPath);
+    }
+    m_map = mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_indexFd, 0);
+    if (m_map == MAP_FAILED)
+    {
+        int error = errno;
+        close(m_indexFd);
+        errno = error;
+        throw _systemError("Unable to map cache index", indexPath);
+    }
+
+    const std::filesystem::path dataPath = m_directory / "data";
+    m_dataFd = open(dataPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_dataFd < 0)
+    {
+        int error = errno;
+        munmap(m_map, m_mapSize);
+        close(m_indexFd);
+        errno = error;
+        throw _systemError("Unable to open cache data", dataPath);
+    }
+
+    // A new, resized or foreign index starts the cache over
+    Header &header = _header();
+    if (fresh || std::memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) != 0 || header.slotCount != kSlotCount)
+    {
+        std::memset(m_map, 0, m_mapSize);
+        std::memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+        header.slotCount = kSlotCount;
+        if (ftruncate(m_dataFd, 0) != 0)
+        {
+            std::cerr << "[ERROR] Unable to reset cache data: " << std::strerror(errno) << std::endl;
+        }
+    }
+    m_generation = header.generation;
+}
+
+ResponseCache::~ResponseCache()
+{
+    munmap(m_map, m_mapSize);
+    close(m_dataFd);
+    close(m_indexFd);
+}
+
+bool ResponseCache::lookup(std::string_view payload, std::string &response)
+{
+    Sha256Digest key = Sha256::hash(payload);
+    Lock lock(*this);
+    _syncDataFile();
+    Header &header = _header();
+
+    if (Slot *slot = _find(key))
+    {
+        RecordHeader record;
+        std::string stored(slot->length, '\0');
+        bool intact = _readFully(m_dataFd, &record, sizeof(record), slot->offset) && record.magic == kRecordMagic &&
+                      record.length == slot->length && record.key == key &&
+                      _readFully(m_dataFd, stored.data(), stored.size(), slot->offset + sizeof(record));
+        if (intact)
+        {
+            slot->lastUsed = ++header.clock;
+            uint64_t saved = payload.size() + stored.size();
+            ++header.hits;
+            header.bytesSaved += saved;
+            ++m_session.hits;
+            m_session.bytesSaved += saved;
+            response = std::move(stored);
+            return true;
+        }
+        _erase(slot); // Torn or overwritten record, e.g. from a crash mid-store
+    }
+
+    ++header.misses;
+    ++m_session.misses;
+    return false;
+}
+
+void ResponseCache::store(std::string_view payload, std::string_view response)
+{
+    const uint64_t recordBytes = sizeof(RecordHeader) + response.size();
+    if (recordBytes > m_maxBytes || response.size() > UINT32_MAX)
+    {
+        return;
+    }
+
+    Sha256Digest key = Sha256::hash(payload);
+    Lock lock(*this);
+    _syncDataFile();
+    Header &header = _header();
+
+    if (Slot *existing = _find(key))
+    {
+        existing->lastUsed = ++header.clock; // Another process got there first
+        return;
+    }
+    _evictFor(recordBytes);
+
+    RecordHeader record{kRecordMagic, static_cast<uint32_t>(response.size()), key};
+    if (!_writeFully(m_dataFd, &record, sizeof(record), header.dataEnd) ||
+        !_writeFully(m_dataFd, response.data(), response.size(), header.dataEnd + sizeof(record)))
+    {
+        std::cerr << "[ERROR] Unable to write response cache: " << std::strerror(errno) << std::endl;
+        return;
+    }
+
+    Slot *slots = _slots();
+    size_t index = _homeSlot(key);
+    while (slots[index].used)
+    {
+        index = (index + 1) % kSlotCount;
+    }
+    Slot &slot = slots[index];
+    slot.key = key;
+    slot.offset = header.dataEnd;
+    slot.length = static_cast<uint32_t>(response.size());
+    slot.lastUsed = ++header.clock;
+    slot.used = 1;
+    ++header.entries;
+    header.liveBytes += recordBytes;
+    header.dataEnd += recordBytes;
+
+    if (header.dataEnd > kMinCompactBytes && header.dataEnd - header.liveBytes > header.liveBytes)
+    {
+        _compact();
+    }
+}
+
+CacheStats ResponseCache::sessionStats() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_session;
+}
+
+CacheStats ResponseCache::totalStats()
+{
+    Lock lock(*this);
+    const Header &header = _header();
+    CacheStats stats;
+    stats.hits = header.hits;
+    stats.misses = header.misses;
+    stats.bytesSaved = header.bytesSaved;
+    stats.entries = header.entries;
+    stats.liveBytes = header.liveBytes;
+    return stats;
+}
+
+ResponseCache::Header &ResponseCache::_header()
+{
+    return *static_cast<Header *>(m_map);
+}
+
+ResponseCache::Slot *ResponseCache::_slots()
+{
+    return reinterpret_cast<Slot *>(static_cast<char *>(m_map) + sizeof(Header));
+}
+
+void ResponseCache::_syncDataFile()
+{
+    uint64_t generation = _header().generation;
+    if (generation == m_generation)
+    {
+        return;
+    }
+    int fd = open((m_directory / "data").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        std::cerr << "[ERROR] Unable to reopen cache data: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    close(m_dataFd);
+    m_dataFd = fd;
+    m_generation = generation;
+}
+
+ResponseCache::Slot *ResponseCache::_find(const Sha256Digest &key)
+{
+    Slot *slots = _slots();
+    size_t index = _homeSlot(key);
+    for (size_t probes = 0; probes < kSlotCount && slots[index].used; ++probes)
+    {
+        if (slots[index].key == key)
+        {
+            return &slots[index];
+        }
+        index = (index + 1) % kSlotCount;
+    }
+    return nullptr;
+}
+
+void ResponseCache::_erase(Slot *slot)
+{
+    Header &header = _header();
+    Slot *slots = _slots();
+    --header.entries;
+    header.liveBytes -= sizeof(RecordHeader) + slot->length;
+
+    // Backward-shift deletion: pull later entries of the run into the hole unless that would
+    // move them before their home slot
+    size_t hole = static_cast<size_t>(slot - slots);
+    slots[hole].used = 0;
+    for (size_t next = (hole + 1) % kSlotCount; slots[next].used; next = (next + 1) % kSlotCount)
+    {
+        size_t home = _homeSlot(slots[next].key);
+        bool homeBetween = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (!homeBetween)
+        {
+            slots[hole] = slots[next];
+            slots[next].used = 0;
+            hole = next;
+        }
+    }
+}
+
+void ResponseCache::_evictFor(uint64_t recordBytes)
+{
+    Header &header = _header();
+    const uint64_t maxEntries = kSlotCount * 3 / 4;
+    if (header.liveBytes + recordBytes <= m_maxBytes && header.entries < maxEntries)
+    {
+        return;
+    }
+
+    // Evict down to 90% of both limits at once, so the scan is not repeated on every store
+    std::vector<std::pair<uint64_t, Sha256Digest>> byAge;
+    byAge.reserve(header.entries);
+    Slot *slots = _slots();
+    for (size_t i = 0; i < kSlotCount; ++i)
+    {
+        if (slots[i].used)
+        {
+            byAge.emplace_back(slots[i].lastUsed, slots[i].key);
+        }
+    }
+    std::sort(byAge.begin(), byAge.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    const uint64_t targetBytes = m_maxBytes / 10 * 9 > recordBytes ? m_maxBytes / 10 * 9 - recordBytes : 0;
+    const uint64_t targetEntries = maxEntries / 10 * 9;
+    for (const auto &entry : byAge)
+    {
+        if (header.liveBytes <= targetBytes && header.entries < targetEntries)
+        {
+            break;
+        }
+        if (Slot *slot = _find(entry.second)) // Erasing shifts slots, so find each by key
+        {
+            _erase(slot);
+        }
+    }
+}
+
+void ResponseCache::_compact()
+{
+    const std::filesystem::path dataPath = m_directory / "data";
+    const std::filesystem::path tempPath = m_directory / "data.compact";
+    int fd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        std::cerr << "[ERROR] Unable to compact response cache: " << std::strerror(errno) << std::endl;
+        return;
+    }
+
+    // Copy live records in file order so reads and writes stay sequential
+    std::vector<Slot *> live;
+    Slot *slots = _slots();
+    for (size_t i = 0; i < kSlotCount; ++i)
+    {
+        if (slots[i].used)
+        {
+            live.push_back(&slots[i]);
+        }
+    }
+    std::sort(live.begin(), live.end(), [](const Slot *a, const Slot *b) { return a->offset < b->offset; });
+
+    std::vector<uint64_t> newOffsets;
+    newOffsets.reserve(live.size());
+    std::string buffer;
+    uint64_t end = 0;
+    for (const Slot *slot : live)
+    {
+        buffer.resize(sizeof(RecordHeader) + slot->length);
+        if (!_readFully(m_dataFd, buffer.data(), buffer.size(), slot->offset) ||
+            !_writeFully(fd, buffer.data(), buffer.size(), end))
+        {
+            std::cerr << "[ERROR] Unable to compact response cache: " << std::strerror(errno) << std::endl;
+            close(fd);
+            std::filesystem::remove(tempPath);
+            return;
+        }
+        newOffsets.push_back(end);
+        end += buffer.size();
+    }
+    if (rename(tempPath.c_str(), dataPath.c_str()) != 0)
+    {
+        std::cerr << "[ERROR] Unable to compact response cache: " << std::strerror(errno) << std::endl;
+        close(fd);
+        return;
+    }
+
+    for (size_t i = 0; i < live.size(); ++i)
+    {
+        live[i]->offset = newOffsets[i];
+    }
+    Header &header = _header();
+    header.dataEnd = end;
+    ++header.generation;
+    close(m_dataFd);
+    m_dataFd = fd;
+    m_generation = header.generation;
+}
+
+ResponseCache *sharedResponseCache()
+{
+    // Never destroyed, like the connection pool: a request may still be using it at exit
+    static ResponseCache *cache = []() -> ResponseCache * {
+        const char *directory = std::getenv("CHATGPT_CLI_CACHE_DIR");
+        if (directory == nullptr || *directory == '\0')
+        {
+            return nullptr;
+        }
+        size_t maxMegabytes = 256;
+        const char *configured = std::getenv("CHATGPT_CLI_CACHE_MAX_MB");
+        if (configured != nullptr && *configured != '\0')
+        {
+            maxMegabytes = static_cast<size_t>(std::strtoull(configured, nullptr, 10));
+        }
+        try
+        {
+            return new ResponseCache(directory, maxMegabytes * 1024 * 1024);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[ERROR] Response cache disabled: " << e.what() << std::endl;
+            return nullptr;
+        }
+    }();
+    return cache;
+}
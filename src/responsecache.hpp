@@ -0,0 +1,139 @@
+//  responsecache.hpp
+//
+// Content-addressed on-disk cache of API responses, shared by all CLI processes on the machine
+
+#ifndef responsecache_hpp
+#define responsecache_hpp
+
+#include "sha256.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/// @brief Hit and size counters of a ResponseCache.
+struct CacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bytesSaved = 0; // Request and response bytes that did not cross the network
+    uint64_t entries = 0;    // Only filled in by totalStats()
+    uint64_t liveBytes = 0;  // Only filled in by totalStats()
+};
+
+/// @class ResponseCache
+/// @brief Maps request payloads to stored responses, keyed by the SHA-256 of the payload.
+///
+/// The cache lives in a directory holding two files: "index", a memory-mapped open-addressing
+/// table of fixed-size slots (key, record offset, length, last use), and "data", an append-only
+/// file of response records. Every operation holds an exclusive flock() on the index, so any
+/// number of processes can share one directory. When the stored responses exceed the size limit
+/// or the table fills up, the least recently used entries are evicted; the data file is
+/// compacted once dead records make up half of it.
+class ResponseCache
+{
+  public:
+    /// Slots in the index table; at most three quarters of them are used
+    static constexpr uint32_t kSlotCount = 8192;
+
+    /**
+     * @brief Opens (creating if needed) the cache in directory.
+     * @param directory The cache directory; created if missing.
+     * @param maxBytes The size limit for stored responses.
+     * @throws std::runtime_error if the files cannot be created, opened or mapped.
+     */
+    ResponseCache(const std::filesystem::path &directory, size_t maxBytes);
+    ~ResponseCache();
+    ResponseCache(const ResponseCache &) = delete;
+    ResponseCache &operator=(const ResponseCache &) = delete;
+
+    /**
+     * @brief Looks up the response stored for payload.
+     * @param payload The canonical request body.
+     * @param response Receives the stored response on a hit.
+     * @return True on a hit.
+     */
+    bool lookup(std::string_view payload, std::string &response);
+
+    /**
+     * @brief Stores response as the answer to payload, evicting old entries as needed.
+     * Responses larger than the size limit are not stored.
+     */
+    void store(std::string_view payload, std::string_view response);
+
+    /**
+     * @brief Returns the counters of this process since the cache was opened.
+     */
+    CacheStats sessionStats() const;
+
+    /**
+     * @brief Returns the counters of all processes since the cache was created, with its size.
+     */
+    CacheStats totalStats();
+
+  private:
+    struct Header;
+    struct Slot;
+
+    /// @brief Holds the in-process mutex and the cross-process file lock.
+    class Lock
+    {
+      public:
+        explicit Lock(ResponseCache &cache);
+        ~Lock();
+
+      private:
+        std::lock_guard<std::mutex> m_guard;
+        int m_fd;
+    };
+
+    std::filesystem::path m_directory;
+    size_t m_maxBytes;
+    int m_indexFd = -1;
+    int m_dataFd = -1;
+    void *m_map = nullptr;
+    size_t m_mapSize = 0;
+    uint64_t m_generation = 0; // Generation of the data file m_dataFd refers to
+    mutable std::mutex m_mutex;
+    CacheStats m_session;
+
+    Header &_header();
+    Slot *_slots();
+
+    /**
+     * @brief Reopens the data file if another process has compacted it since we opened it.
+     */
+    void _syncDataFile();
+
+    /**
+     * @brief Returns the slot holding key, or nullptr.
+     */
+    Slot *_find(const Sha256Digest &key);
+
+    /**
+     * @brief Frees a slot, shifting later slots of its probe run back so lookups still find them.
+     */
+    void _erase(Slot *slot);
+
+    /**
+     * @brief Evicts least recently used entries until one more record of recordBytes fits.
+     */
+    void _evictFor(uint64_t recordBytes);
+
+    /**
+     * @brief Rewrites the data file with only the live records.
+     */
+    void _compact();
+};
+
+/**
+ * @brief Returns the process-wide response cache, or nullptr when caching is off.
+ *
+ * Enabled by setting CHATGPT_CLI_CACHE_DIR to a directory; CHATGPT_CLI_CACHE_MAX_MB sets the
+ * size limit (default 256). Opened once, on first use.
+ */
+ResponseCache *sharedResponseCache();
+
+#endif /* responsecache_hpp */
@@ -0,0 +1,590 @@
+//  responseparser.cpp
+//
+// One-pass extraction of the fields the CLI uses from a chat completion response
+
+#include "responseparser.hpp"
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+// Deeper documents are refused rather than risk the stack; no API response comes close
+constexpr int kMaxDepth = 512;
+
+/**
+ * @brief Returns how many leading bytes of a JSON string body can be copied as they are: all but
+ * '"', '\\' and control characters.
+ */
+size_t _plainRun(const char *text, size_t size)
+{
+    // Eight bytes at a time, as in PayloadBuilder; bytes from 0x80 up are plain here
+    constexpr uint64_t ones = 0x0101010101010101ULL;
+    constexpr uint64_t highBits = 0x8080808080808080ULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, text + i, sizeof(word));
+        uint64_t quote = word ^ (ones * '"');
+        uint64_t backslash = word ^ (ones * '\\');
+        uint64_t stop = ((word - ones * 0x20) & ~word) | ((quote - ones) & ~quote) | ((backslash - ones) & ~backslash);
+        if ((stop & highBits) != 0)
+        {
+            break;
+        }
+    }
+    for (; i < size; ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c < 0x20 || c == '"' || c == '\\')
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+void _appendUtf8(std::string &out, uint32_t codePoint)
+{
+    if (codePoint < 0x80)
+    {
+        out += static_cast<char>(codePoint);
+    }
+    else if (codePoint < 0x800)
+    {
+        out += static_cast<char>(0xc0 | (codePoint >> 6));
+        out += static_cast<char>(0x80 | (codePoint & 0x3f));
+    }
+    else if (codePoint < 0x10000)
+    {
+        out += static_cast<char>(0xe0 | (codePoint >> 12));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (codePoint & 0x3f));
+    }
+    else
+    {
+        out += static_cast<char>(0xf0 | (codePoint >> 18));
+        out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (codePoint & 0x3f));
+    }
+}
+
+/// @brief Pull scanner over a JSON text: values are either read into C++ values or skipped.
+class _Scanner
+{
+  public:
+    explicit _Scanner(std::string_view text) : m_begin(text.data()), m_p(text.data()), m_end(text.data() + text.size())
+    {
+    }
+
+    /**
+     * @brief Returns the first character of the next token, or '\0' at the end of the text.
+     */
+    char peek()
+    {
+        while (m_p < m_end && (*m_p == ' ' || *m_p == '\n' || *m_p == '\r' || *m_p == '\t'))
+        {
+            ++m_p;
+        }
+        return m_p < m_end ? *m_p : '\0';
+    }
+
+    bool consume(char c)
+    {
+        if (peek() == c && m_p < m_end)
+        {
+            ++m_p;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!consume(c))
+        {
+            fail(std::string("expected '") + c + "'");
+        }
+    }
+
+    bool atEnd()
+    {
+        peek();
+        return m_p == m_end;
+    }
+
+    /**
+     * @brief Reads an object, calling onMember(key) with the scanner at each member's value;
+     * onMember must consume the value. The key may not outlive the next readKey.
+     */
+    template <typename Fn> void members(int depth, Fn &&onMember)
+    {
+        _checkDepth(depth);
+        expect('{');
+        if (consume('}'))
+        {
+            return;
+        }
+        do
+        {
+            std::string_view key = _readKey();
+            expect(':');
+            onMember(key);
+        } while (consume(','));
+        expect('}');
+    }
+
+    /**
+     * @brief Reads an array, calling onElement(index) with the scanner at each element, which
+     * onElement must consume.
+     */
+    template <typename Fn> void elements(int depth, Fn &&onElement)
+    {
+        _checkDepth(depth);
+        expect('[');
+        if (consume(']'))
+        {
+            return;
+        }
+        size_t index = 0;
+        do
+        {
+            onElement(index++);
+        } while (consume(','));
+        expect(']');
+    }
+
+    /**
+     * @brief Reads a string into out, replacing its contents.
+     */
+    void readString(std::string &out)
+    {
+        expect('"');
+        // Find the end first, so a long string is decoded into a buffer allocated once; escapes
+        // only ever shrink, so the raw length is enough
+        const char *body = m_p;
+        _skipStringBody();
+        out.clear();
+        out.reserve(static_cast<size_t>(m_p - body) - 1);
+        m_p = body;
+        _decodeStringBody(out);
+    }
+
+    /**
+     * @brief Reads a number and returns its text, as written.
+     */
+    std::string_view readNumber()
+    {
+        peek();
+        const char *start = m_p;
+        consume('-');
+        // A leading zero stands alone; "01" fails at the '1' that follows it
+        if (!consume('0') && !_skipDigits())
+        {
+            fail("invalid number");
+        }
+        if (m_p < m_end && *m_p == '.')
+        {
+            ++m_p;
+            if (!_skipDigits())
+            {
+                fail("invalid number");
+            }
+        }
+        if (m_p < m_end && (*m_p == 'e' || *m_p == 'E'))
+        {
+            ++m_p;
+            if (m_p < m_end && (*m_p == '+' || *m_p == '-'))
+            {
+                ++m_p;
+            }
+            if (!_skipDigits())
+            {
+                fail("invalid number");
+            }
+        }
+        return std::string_view(start, static_cast<size_t>(m_p - start));
+    }
+
+    /**
+     * @brief Reads an integer; a fraction is dropped, and anything other than a number is skipped and read as 0.
+     */
+    int64_t readInteger(int depth)
+    {
+        char c = peek();
+        if (c != '-' && (c < '0' || c > '9'))
+        {
+            skipValue(depth);
+            return 0;
+        }
+        std::string_view text = readNumber();
+        int64_t value = 0;
+        std::from_chars(text.data(), text.data() + text.size(), value);
+        return value;
+    }
+
+    void skipValue(int depth)
+    {
+        switch (peek())
+        {
+        case '{':
+            members(depth, [&](std::string_view) { skipValue(depth + 1); });
+            break;
+        case '[':
+            elements(depth, [&](size_t) { skipValue(depth + 1); });
+            break;
+        case '"':
+            ++m_p;
+            _skipStringBody();
+            break;
+        case 't':
+            _skipLiteral("true");
+            break;
+        case 'f':
+            _skipLiteral("false");
+            break;
+        case 'n':
+            _skipLiteral("null");
+            break;
+        default:
+            readNumber();
+            break;
+        }
+    }
+
+    [[noreturn]] void fail(const std::string &what) const
+    {
+        throw std::runtime_error("Invalid JSON at byte " + std::to_string(m_p - m_begin) + ": " + what);
+    }
+
+  private:
+    const char *m_begin;
+    const char *m_p;
+    const char *m_end;
+    std::string m_keyScratch; // Decoded keys that had escapes in them
+
+    void _checkDepth(int depth) const
+    {
+        if (depth > kMaxDepth)
+        {
+            fail("nested too deeply");
+        }
+    }
+
+    std::string_view _readKey()
+    {
+        if (peek() != '"')
+        {
+            fail("expected a member name");
+        }
+        const char *start = ++m_p;
+        m_p += _plainRun(m_p, static_cast<size_t>(m_end - m_p));
+        if (m_p < m_end && *m_p == '"')
+        {
+            return std::string_view(start, static_cast<size_t>(m_p++ - start));
+        }
+        m_p = start;
+        m_keyScratch.clear();
+        _decodeStringBody(m_keyScratch);
+        return m_keyScratch;
+    }
+
+    // Both string bodies start after the opening quote and end after the closing one
+    void _skipStringBody()
+    {
+        while (true)
+        {
+            m_p += _plainRun(m_p, static_cast<size_t>(m_end - m_p));
+            if (m_p == m_end)
+            {
+                fail("unterminated string");
+            }
+            char c = *m_p++;
+            if (c == '"')
+            {
+                return;
+            }
+            if (c != '\\')
+            {
+                fail("control character in string");
+            }
+            _decodeEscape(nullptr);
+        }
+    }
+
+    void _decodeStringBody(std::string &out)
+    {
+        while (true)
+        {
+            size_t plain = _plainRun(m_p, static_cast<size_t>(m_end - m_p));
+            out.append(m_p, plain);
+            m_p += plain;
+            if (m_p == m_end)
+            {
+                fail("unterminated string");
+            }
+            char c = *m_p++;
+            if (c == '"')
+            {
+                return;
+            }
+            if (c != '\\')
+            {
+                fail("control character in string");
+            }
+            _decodeEscape(&out);
+        }
+    }
+
+    // Checks the escape after a backslash and appends what it stands for to out, if given
+    void _decodeEscape(std::string *out)
+    {
+        if (m_p == m_end)
+        {
+            fail("unterminated string");
+        }
+        char decoded;
+        switch (*m_p++)
+        {
+        case '"':
+            decoded = '"';
+            break;
+        case '\\':
+            decoded = '\\';
+            break;
+        case '/':
+            decoded = '/';
+            break;
+        case 'b':
+            decoded = '\b';
+            break;
+        case 'f':
+            decoded = '\f';
+            break;
+        case 'n':
+            decoded = '\n';
+            break;
+        case 'r':
+            decoded = '\r';
+            break;
+        case 't':
+            decoded = '\t';
+            break;
+        case 'u':
+            _decodeUnicodeEscape(out);
+            return;
+        default:
+            --m_p;
+            fail("invalid escape");
+        }
+        if (out != nullptr)
+        {
+            *out += decoded;
+        }
+    }
+
+    // Decodes the four hex digits after "\\u", and the low surrogate escape that must follow a high one
+    void _decodeUnicodeEscape(std::string *out)
+    {
+        uint32_t codePoint = _readHex4();
+        if (codePoint >= 0xd800 && codePoint <= 0xdbff)
+        {
+            if (m_end - m_p < 2 || m_p[0] != '\\' || m_p[1] != 'u')
+            {
+                fail("unpaired surrogate");
+            }
+            m_p += 2;
+            uint32_t low = _readHex4();
+            if (low < 0xdc00 || low > 0xdfff)
+            {
+                fail("unpaired surrogate");
+            }
+            codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+        }
+        else if (codePoint >= 0xdc00 && codePoint <= 0xdfff)
+        {
+            fail("unpaired surrogate");
+        }
+        if (out != nullptr)
+        {
+            _appendUtf8(*out, codePoint);
+        }
+    }
+
+    uint32_t _readHex4()
+    {
+        if (m_end - m_p < 4)
+        {
+            fail("truncated \\u escape");
+        }
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            char c = *m_p++;
+            value <<= 4;
+            if (c >= '0' && c <= '9')
+            {
+                value |= static_cast<uint32_t>(c - '0');
+            }
+            else if (c >= 'a' && c <= 'f')
+            {
+                value |= static_cast<uint32_t>(c - 'a' + 10);
+            }
+            else if (c >= 'A' && c <= 'F')
+            {
+                value |= static_cast<uint32_t>(c - 'A' + 10);
+            }
+            else
+            {
+                fail("invalid \\u escape");
+            }
+        }
+        return value;
+    }
+
+    bool _skipDigits()
+    {
+        const char *start = m_p;
+        while (m_p < m_end && *m_p >= '0' && *m_p <= '9')
+        {
+            ++m_p;
+        }
+        return m_p != start;
+    }
+
+    void _skipLiteral(const char *literal)
+    {
+        size_t length = std::strlen(literal);
+        if (static_cast<size_t>(m_end - m_p) < length || std::memcmp(m_p, literal, length) != 0)
+        {
+            fail("invalid literal");
+        }
+        m_p += length;
+    }
+};
+} // namespace
+
+ChatResponse parseChatResponse(std::string_view json)
+{
+    ChatResponse response;
+    _Scanner scanner(json);
+    if (scanner.peek() != '{')
+    {
+        scanner.fail("expected an object");
+    }
+    scanner.members(1, [&](std::string_view key) {
+        if (key == "choices" && scanner.peek() == '[')
+        {
+            scanner.elements(2, [&](size_t index) {
+                response.hasChoices = true;
+                if (index != 0 || scanner.peek() != '{')
+                {
+                    scanner.skipValue(3);
+                    return;
+                }
+                scanner.members(3, [&](std::string_view choiceKey) {
+                    if (choiceKey == "message" && scanner.peek() == '{')
+                    {
+                        scanner.members(4, [&](std::string_view messageKey) {
+                            if (messageKey == "content" && scanner.peek() == '"')
+                            {
+                                scanner.readString(response.content);
+                                response.hasContent = true;
+                            }
+                            else
+                            {
+                                scanner.skipValue(5);
+                            }
+                        });
+                    }
+                    else if (choiceKey == "finish_reason" && scanner.peek() == '"')
+                    {
+                        scanner.readString(response.finishReason);
+                    }
+                    else
+                    {
+                        scanner.skipValue(4);
+                    }
+                });
+            });
+        }
+        else if (key == "usage" && scanner.peek() == '{')
+        {
+            response.hasUsage = true;
+            scanner.members(2, [&](std::string_view usageKey) {
+                if (usageKey == "prompt_tokens")
+                {
+                    response.usage.promptTokens = scanner.readInteger(3);
+                }
+                else if (usageKey == "completion_tokens")
+                {
+                    response.usage.completionTokens = scanner.readInteger(3);
+                }
+                else if (usageKey == "total_tokens")
+                {
+                    response.usage.totalTokens = scanner.readInteger(3);
+                }
+                else if (usageKey == "prompt_tokens_details" && scanner.peek() == '{')
+                {
+                    scanner.members(3, [&](std::string_view detailKey) {
+                        if (detailKey == "cached_tokens")
+                        {
+                            response.usage.cachedTokens = scanner.readInteger(4);
+                        }
+                        else
+                        {
+                            scanner.skipValue(4);
+                        }
+                    });
+                }
+                else
+                {
+                    scanner.skipValue(3);
+                }
+            });
+        }
+        else if (key == "error")
+        {
+            response.hasError = true;
+            if (scanner.peek() != '{')
+            {
+                scanner.skipValue(2);
+                return;
+            }
+            scanner.members(2, [&](std::string_view errorKey) {
+                char next = scanner.peek();
+                if (errorKey == "message" && next == '"')
+                {
+                    scanner.readString(response.errorMessage);
+                }
+                else if (errorKey == "type" && next == '"')
+                {
+                    scanner.readString(response.errorType);
+                }
+                else if (errorKey == "code" && next == '"')
+                {
+                    scanner.readString(response.errorCode);
+                }
+                else if (errorKey == "code" && (next == '-' || (next >= '0' && next <= '9')))
+                {
+                    response.errorCode = scanner.readNumber();
+                }
+                else
+                {
+                    scanner.skipValue(3);
+                }
+            });
+        }
+        else
+        {
+            scanner.skipValue(2);
+        }
+    });
+    if (!scanner.atEnd())
+    {
+        scanner.fail("unexpected text after the response");
+    }
+    return response;
+}
@@ -0,0 +1,50 @@
+//  responseparser.hpp
+//
+// One-pass extraction of the fields the CLI uses from a chat completion response
+
+#ifndef responseparser_hpp
+#define responseparser_hpp
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// @brief Token counts from the "usage" object of a response.
+struct ChatUsage
+{
+    int64_t promptTokens = 0;
+    int64_t completionTokens = 0;
+    int64_t totalTokens = 0;
+    int64_t cachedTokens = 0; // prompt_tokens_details.cached_tokens
+};
+
+/// @brief The parts of a chat completion (or error) response the CLI looks at.
+struct ChatResponse
+{
+    bool hasChoices = false; // "choices" is a non-empty array
+    bool hasContent = false; // choices[0].message.content is a string
+    std::string content;
+    std::string finishReason; // choices[0].finish_reason; empty if absent or null
+    bool hasUsage = false;
+    ChatUsage usage;
+    bool hasError = false; // The response has an "error" member
+    std::string errorMessage;
+    std::string errorType;
+    std::string errorCode; // A string code as is, a numeric one as written
+};
+
+/**
+ * @brief Extracts content, finish_reason, usage and error from a response body in one pass.
+ *
+ * No DOM is built: members other than these are skipped without being decoded, and the
+ * content is unescaped straight into ChatResponse::content, which callers can move out. The
+ * whole body is still checked to be well-formed JSON, as nlohmann::json::parse would; bytes
+ * outside ASCII are passed through without validating their UTF-8.
+ *
+ * @param json The response body.
+ * @return The extracted fields.
+ * @throws std::runtime_error if json is not a well-formed JSON object.
+ */
+ChatResponse parseChatResponse(std::string_view json);
+
+#endif /* responseparser_hpp */
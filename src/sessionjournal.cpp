@@ -0,0 +1,504 @@
+//  sessionjournal.cpp
+//
+// Append-only binary journal of chat history changes, so a session survives a restart
+
+#include "sessionjournal.hpp"
+#include "chathistory.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+constexpr char kFileMagic[8] = {'C', 'G', 'P', 'T', 'S', 'J', '0', '1'};
+constexpr uint16_t kRecordMagic = 0x4a53; // "SJ"
+
+enum RecordType : uint8_t
+{
+    kAddRecord = 1,
+    kAppendRecord = 2,
+    kRemoveLastRecord = 3,
+    kClearRecord = 4,
+};
+
+/// Each record: this header, then participantLength bytes of name and length bytes of text
+struct RecordHeader
+{
+    uint16_t magic;
+    uint8_t type;
+    uint8_t participantLength; // Only add records name a participant
+    uint32_t length;
+};
+
+std::runtime_error _systemError(const std::string &what, const std::filesystem::path &path)
+{
+    return std::runtime_error(what + " " + path.string() + ": " + std::strerror(errno));
+}
+
+/**
+ * @brief Walks the records of a journal image, passing each complete one to apply.
+ * @return What was found; validBytes is where the first incomplete or damaged record starts.
+ */
+template <typename Apply> JournalReplay _scan(const char *data, size_t size, Apply apply)
+{
+    JournalReplay replay;
+    size_t offset = sizeof(kFileMagic);
+    while (size - offset >= sizeof(RecordHeader))
+    {
+        RecordHeader header;
+        std::memcpy(&header, data + offset, sizeof(header));
+        if (header.magic != kRecordMagic || header.type < kAddRecord || header.type > kClearRecord ||
+            (header.type != kAddRecord && header.participantLength != 0))
+        {
+            break;
+        }
+        size_t end = offset + sizeof(header) + header.participantLength;
+        if (end > size || header.length > size - end)
+        {
+            break;
+        }
+        const char *participant = data + offset + sizeof(header);
+        apply(header.type, std::string_view(participant, header.participantLength),
+              std::string_view(participant + header.participantLength, header.length));
+        offset = end + header.length;
+        ++replay.records;
+    }
+    replay.validBytes = offset;
+    replay.tornTail = offset != size;
+    return replay;
+}
+
+/// @brief A read-only mapping of a whole journal file.
+struct _Mapping
+{
+    const char *data = nullptr;
+    size_t size = 0;
+
+    _Mapping(int fd, size_t length, const std::filesystem::path &path) : size(length)
+    {
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            throw _systemError("Unable to map session journal", path);
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(map);
+    }
+
+    ~_Mapping()
+    {
+        munmap(const_cast<char *>(data), size);
+    }
+};
+
+/**
+ * @brief Checks that an open file is a session journal.
+ * @return The file size; 0 for an empty file or one cut short while its magic was written.
+ * @throws std::runtime_error if the file holds something else.
+ */
+size_t _checkedSize(int fd, const std::filesystem::path &path)
+{
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        throw _systemError("Unable to stat session journal", path);
+    }
+    size_t size = static_cast<size_t>(status.st_size);
+    char magic[sizeof(kFileMagic)] = {};
+    size_t prefix = std::min(size, sizeof(magic));
+    if (pread(fd, magic, prefix, 0) != static_cast<ssize_t>(prefix) || std::memcmp(magic, kFileMagic, prefix) != 0)
+    {
+        throw std::runtime_error("Not a session journal: " + path.string());
+    }
+    return size < sizeof(kFileMagic) ? 0 : size;
+}
+
+/**
+ * @brief Opens the journal at path for writing and takes its lock, so only one process writes it.
+ * @throws std::runtime_error if it cannot be opened, or another process holds the lock.
+ */
+int _openLocked(const std::filesystem::path &path)
+{
+    while (true)
+    {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            throw _systemError("Unable to open session journal", path);
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            int error = errno;
+            close(fd);
+            if (error == EWOULDBLOCK)
+            {
+                throw std::runtime_error("Session journal " + path.string() + " is in use by another instance");
+            }
+            errno = error;
+            throw _systemError("Unable to lock session journal", path);
+        }
+        // The holder before us may have moved the file aside while we waited to open it
+        struct stat opened;
+        struct stat named;
+        if (fstat(fd, &opened) == 0 && stat(path.c_str(), &named) == 0 && opened.st_ino == named.st_ino &&
+            opened.st_dev == named.st_dev)
+        {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+bool _copyRange(int in, int out, uint64_t length)
+{
+    loff_t inOffset = 0;
+    loff_t outOffset = 0;
+    while (static_cast<uint64_t>(outOffset) < length)
+    {
+        ssize_t n = copy_file_range(in, &inOffset, out, &outOffset, length - static_cast<uint64_t>(outOffset), 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+    }
+    if (static_cast<uint64_t>(outOffset) == length)
+    {
+        return true;
+    }
+
+    // Not supported between these files; copy through a buffer
+    std::vector<char> buffer(1024 * 1024);
+    while (static_cast<uint64_t>(outOffset) < length)
+    {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(buffer.size(), length - static_cast<uint64_t>(outOffset)));
+        ssize_t n = pread(in, buffer.data(), chunk, outOffset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0 || pwrite(out, buffer.data(), static_cast<size_t>(n), outOffset) != n)
+        {
+            return false;
+        }
+        outOffset += n;
+    }
+    return true;
+}
+} // namespace
+
+SessionJournal::SessionJournal(const std::filesystem::path &path, bool truncate,
+                               std::chrono::milliseconds syncInterval)
+    : m_path(path), m_syncInterval(syncInterval)
+{
+    static_assert(sizeof(RecordHeader) == 8, "record header layout is part of the file format");
+    m_fd = _openLocked(path);
+
+    try
+    {
+        // Only ever truncate a file that is known to be a journal
+        size_t size = _checkedSize(m_fd, path);
+        if (truncate && size > sizeof(kFileMagic))
+        {
+            // A new session keeps the previous one as path.1 instead of overwriting it
+            std::filesystem::path previous = path.string() + ".1";
+            if (rename(path.c_str(), previous.c_str()) != 0)
+            {
+                throw _systemError("Unable to keep the previous session journal as", previous);
+            }
+            int fresh = _openLocked(path);
+            close(m_fd);
+            m_fd = fresh;
+            size = 0;
+        }
+        if (size != 0 && !truncate)
+        {
+            _Mapping mapping(m_fd, size, path);
+            m_size = _scan(mapping.data, mapping.size, [](uint8_t, std::string_view, std::string_view) {}).validBytes;
+        }
+        if (m_size == 0)
+        {
+            if (ftruncate(m_fd, 0) != 0 || pwrite(m_fd, kFileMagic, sizeof(kFileMagic), 0) != sizeof(kFileMagic))
+            {
+                throw _systemError("Unable to write session journal", path);
+            }
+            m_size = sizeof(kFileMagic);
+        }
+        else if (m_size != size && ftruncate(m_fd, static_cast<off_t>(m_size)) != 0)
+        {
+            throw _systemError("Unable to cut the torn tail off session journal", path);
+        }
+    }
+    catch (...)
+    {
+        close(m_fd);
+        throw;
+    }
+    m_stats.bytes = m_size;
+    m_syncThread = std::thread(&SessionJournal::_syncLoop, this);
+}
+
+SessionJournal::~SessionJournal()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_syncThread.join();
+    if (m_dirty)
+    {
+        fdatasync(m_fd);
+    }
+    close(m_fd);
+}
+
+void SessionJournal::recordAdd(std::string_view participantName, std::string_view message)
+{
+    // Participant names are short; a longer one is cut to what the header can describe
+    _record(kAddRecord, participantName.substr(0, UINT8_MAX), message);
+}
+
+void SessionJournal::recordAppend(std::string_view text)
+{
+    _record(kAppendRecord, {}, text);
+}
+
+void SessionJournal::recordRemoveLast()
+{
+    _record(kRemoveLastRecord, {}, {});
+}
+
+void SessionJournal::recordClear()
+{
+    _record(kClearRecord, {}, {});
+}
+
+void SessionJournal::sync()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_dirty = false;
+        ++m_stats.syncs;
+    }
+    fdatasync(m_fd);
+}
+
+void SessionJournal::replaceWith(const std::filesystem::path &source, uint64_t length)
+{
+    std::error_code error;
+    if (std::filesystem::equivalent(source, m_path, error))
+    {
+        return;
+    }
+    int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+    {
+        std::cerr << "[ERROR] " << _systemError("Unable to open session journal", source).what() << std::endl;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (length < sizeof(kFileMagic))
+    {
+        // An empty journal: start over rather than copy a partial magic number
+        length = sizeof(kFileMagic);
+        m_failed = ftruncate(m_fd, 0) != 0 || pwrite(m_fd, kFileMagic, length, 0) != static_cast<ssize_t>(length);
+    }
+    else
+    {
+        m_failed = ftruncate(m_fd, 0) != 0 || !_copyRange(in, m_fd, length);
+    }
+    if (m_failed)
+    {
+        std::cerr << "[ERROR] Unable to copy " << source.string() << " into session journal " << m_path.string()
+                  << "; no longer recording" << std::endl;
+    }
+    else
+    {
+        m_size = length;
+        m_stats.bytes = m_size;
+        m_dirty = true;
+    }
+    close(in);
+}
+
+const std::filesystem::path &SessionJournal::path() const
+{
+    return m_path;
+}
+
+JournalStats SessionJournal::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void SessionJournal::_record(uint8_t type, std::string_view participantName, std::string_view text)
+{
+    RecordHeader header{kRecordMagic, type, static_cast<uint8_t>(participantName.size()),
+                        static_cast<uint32_t>(text.size())};
+    iovec parts[3] = {
+        {&header, sizeof(header)},
+        {const_cast<char *>(participantName.data()), participantName.size()},
+        {const_cast<char *>(text.data()), text.size()},
+    };
+    size_t total = sizeof(header) + participantName.size() + text.size();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_failed)
+    {
+        return;
+    }
+    size_t written = 0;
+    while (written < total)
+    {
+        // Skip the parts already written after a short write
+        iovec remaining[3];
+        int count = 0;
+        size_t skip = written;
+        for (const iovec &part : parts)
+        {
+            if (skip >= part.iov_len)
+            {
+                skip -= part.iov_len;
+                continue;
+            }
+            remaining[count++] = {static_cast<char *>(part.iov_base) + skip, part.iov_len - skip};
+            skip = 0;
+        }
+        ssize_t n = pwritev(m_fd, remaining, count, static_cast<off_t>(m_size + written));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            // Drop the partial record so everything before it stays replayable
+            std::cerr << "[ERROR] " << _systemError("Unable to write session journal", m_path).what()
+                      << "; no longer recording" << std::endl;
+            ftruncate(m_fd, static_cast<off_t>(m_size));
+            m_failed = true;
+            return;
+        }
+        written += static_cast<size_t>(n);
+    }
+    m_size += total;
+    m_stats.bytes = m_size;
+    ++m_stats.records;
+    m_dirty = true;
+}
+
+void SessionJournal::_syncLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        m_wake.wait_for(lock, m_syncInterval, [this] { return m_stopping; });
+        if (m_dirty)
+        {
+            m_dirty = false;
+            ++m_stats.syncs;
+            lock.unlock();
+            fdatasync(m_fd);
+            lock.lock();
+        }
+    }
+}
+
+JournalReplay replaySessionJournal(const std::filesystem::path &path, ChatHistory &history)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw _systemError("Unable to open session journal", path);
+    }
+    size_t size;
+    try
+    {
+        size = _checkedSize(fd, path);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+
+    SessionJournal *journal = history.journal();
+    history.setJournal(nullptr);
+    history.clearHistory();
+    JournalReplay replay;
+    if (size != 0)
+    {
+        try
+        {
+            _Mapping mapping(fd, size, path);
+            replay = _scan(mapping.data, mapping.size,
+                           [&history](uint8_t type, std::string_view participant, std::string_view text) {
+                               switch (type)
+                               {
+                               case kAddRecord:
+                                   history.addDialog(participant, text);
+                                   break;
+                               case kAppendRecord:
+                                   history.appendToLastDialog(text);
+                                   break;
+                               case kRemoveLastRecord:
+                                   history.removeLastDialog();
+                                   break;
+                               case kClearRecord:
+                                   history.clearHistory();
+                                   break;
+                               }
+                           });
+        }
+        catch (...)
+        {
+            history.setJournal(journal);
+            close(fd);
+            throw;
+        }
+    }
+    history.setJournal(journal);
+    close(fd);
+    return replay;
+}
+
+std::filesystem::path sessionJournalPath()
+{
+    static const std::filesystem::path path = []() -> std::filesystem::path {
+        if (const char *configured = std::getenv("CHATGPT_CLI_SESSION"))
+        {
+            return configured;
+        }
+        std::filesystem::path file;
+        if (const char *xdg = std::getenv("XDG_STATE_HOME"); xdg != nullptr && *xdg != '\0')
+        {
+            file = std::filesystem::path(xdg) / "chatgpt-cli" / "session";
+        }
+        else if (const char *home = std::getenv("HOME"); home != nullptr && *home != '\0')
+        {
+            file = std::filesystem::path(home) / ".local" / "state" / "chatgpt-cli" / "session";
+        }
+        if (!file.empty())
+        {
+            std::error_code error;
+            std::filesystem::create_directories(file.parent_path(), error);
+        }
+        return file;
+    }();
+    return path;
+}
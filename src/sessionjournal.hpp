@@ -0,0 +1,149 @@
+//  sessionjournal.hpp
+//
+// Append-only binary journal of chat history changes, so a session survives a restart
+
+#ifndef sessionjournal_hpp
+#define sessionjournal_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+class ChatHistory;
+
+/// @brief Write counters of a SessionJournal.
+struct JournalStats
+{
+    uint64_t records = 0; // Records written since the journal was opened
+    uint64_t bytes = 0;   // Current size of the journal file
+    uint64_t syncs = 0;   // fdatasync() calls made
+};
+
+/// @brief What replaying a journal found.
+struct JournalReplay
+{
+    uint64_t records = 0;    // Records applied
+    uint64_t validBytes = 0; // Length of the journal up to the end of its last complete record
+    bool tornTail = false;   // The file ended in an incomplete or damaged record, which was ignored
+};
+
+/// @class SessionJournal
+/// @brief Records every change to a ChatHistory as one binary record appended to a file.
+///
+/// The file is a magic number followed by records of an 8-byte header (magic, type, participant
+/// name length, text length) and the raw participant name and text, in host byte order. Records
+/// are written to the file as they happen, so a crash of the process loses nothing; a background
+/// thread makes them durable with one fdatasync() per interval in which something was written,
+/// so a crash of the machine loses at most the last interval. A record cut short by such a crash
+/// is detected by its header or its length running past the end of the file, and ignored.
+class SessionJournal
+{
+  public:
+    /// How often written records are flushed to stable storage by default
+    static constexpr std::chrono::milliseconds kDefaultSyncInterval{100};
+
+    /**
+     * @brief Opens the journal at path for appending.
+     * @param path The journal file; created if missing.
+     * @param truncate Start an empty journal instead of continuing the one at path; a previous
+     *        non-empty journal is kept as path.1. A journal that is continued is first cut back
+     *        to the end of its last complete record.
+     * @param syncInterval How often written records are flushed to stable storage.
+     * @throws std::runtime_error if the file cannot be opened, is not a session journal, or is
+     *         open in another process; the file is locked for as long as the journal is.
+     */
+    SessionJournal(const std::filesystem::path &path, bool truncate,
+                   std::chrono::milliseconds syncInterval = kDefaultSyncInterval);
+
+    /**
+     * @brief Flushes what is left to stable storage and closes the file.
+     */
+    ~SessionJournal();
+    SessionJournal(const SessionJournal &) = delete;
+    SessionJournal &operator=(const SessionJournal &) = delete;
+
+    /// @brief Records ChatHistory::addDialog(participantName, message).
+    void recordAdd(std::string_view participantName, std::string_view message);
+
+    /// @brief Records ChatHistory::appendToLastDialog(text).
+    void recordAppend(std::string_view text);
+
+    /// @brief Records ChatHistory::removeLastDialog().
+    void recordRemoveLast();
+
+    /// @brief Records ChatHistory::clearHistory().
+    void recordClear();
+
+    /**
+     * @brief Flushes everything written so far to stable storage now.
+     */
+    void sync();
+
+    /**
+     * @brief Replaces the contents of this journal with the first length bytes of another one,
+     * as after loading that session into the history this journal is attached to.
+     * Nothing is copied if source is this journal's own file.
+     */
+    void replaceWith(const std::filesystem::path &source, uint64_t length);
+
+    /**
+     * @brief Returns the path of the journal file.
+     */
+    const std::filesystem::path &path() const;
+
+    /**
+     * @brief Returns the write counters.
+     */
+    JournalStats stats() const;
+
+  private:
+    std::filesystem::path m_path;
+    int m_fd = -1;
+    uint64_t m_size = 0;  // Where the next record is written
+    bool m_failed = false; // A write failed; recording stopped so the journal stays replayable
+    std::chrono::milliseconds m_syncInterval;
+    JournalStats m_stats;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_dirty = false;
+    bool m_stopping = false;
+    std::thread m_syncThread;
+
+    /**
+     * @brief Writes one record at the end of the file.
+     */
+    void _record(uint8_t type, std::string_view participantName, std::string_view text);
+
+    /**
+     * @brief Body of the background thread: syncs once per interval while there are new records.
+     */
+    void _syncLoop();
+};
+
+/**
+ * @brief Rebuilds history from the journal at path.
+ *
+ * The file is memory-mapped and its records applied in order to the cleared history, with any
+ * attached journal detached meanwhile so the replay is not recorded again. Message text is
+ * copied straight out of the mapping; nothing is parsed or unescaped.
+ * @throws std::runtime_error if the file cannot be opened or is not a session journal.
+ */
+JournalReplay replaySessionJournal(const std::filesystem::path &path, ChatHistory &history);
+
+/**
+ * @brief Returns the journal file of interactive sessions, or an empty path when journaling is off.
+ *
+ * Set by CHATGPT_CLI_SESSION; defaults to "chatgpt-cli/session" under $XDG_STATE_HOME (or
+ * ~/.local/state), whose directory is created. An empty CHATGPT_CLI_SESSION, or no home
+ * directory, turns journaling off.
+ */
+std::filesystem::path sessionJournalPath();
+
+#endif /* sessionjournal_hpp */
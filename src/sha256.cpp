@@ -0,0 +1,234 @@
+//  sha256.cpp
+//
+// SHA-256 digest, used to key cached data by content
+
+#include "sha256.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SHA256_HAVE_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+constexpr uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t _rotateRight(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+/**
+ * @brief Compresses one block in portable code.
+ */
+void _compressScalar(uint32_t *state, const uint8_t *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) | (uint32_t(block[i * 4 + 2]) << 8) |
+               uint32_t(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = _rotateRight(w[i - 15], 7) ^ _rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = _rotateRight(w[i - 2], 17) ^ _rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t s1 = _rotateRight(e, 6) ^ _rotateRight(e, 11) ^ _rotateRight(e, 25);
+        uint32_t choose = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + choose + kRoundConstants[i] + w[i];
+        uint32_t s0 = _rotateRight(a, 2) ^ _rotateRight(a, 13) ^ _rotateRight(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + majority;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+#ifdef SHA256_HAVE_SHANI
+/**
+ * @brief Compresses blocks with the x86 SHA extensions, four rounds per sha256rnds2 pair.
+ */
+__attribute__((target("sha,sse4.1"))) void _compressShaNi(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The instructions want the state as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0])), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4])), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks > 0; --blocks, data += 64)
+    {
+        const __m128i abefSaved = state0;
+        const __m128i cdghSaved = state1;
+        __m128i w[4]; // Message schedule, four words per vector, w[g % 4] holding group g
+
+        for (int g = 0; g < 16; ++g)
+        {
+            if (g < 4)
+            {
+                w[g] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * g)), byteSwap);
+            }
+            else
+            {
+                __m128i next = _mm_sha256msg1_epu32(w[g % 4], w[(g + 1) % 4]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(g + 3) % 4], w[(g + 2) % 4], 4));
+                w[g % 4] = _mm_sha256msg2_epu32(next, w[(g + 3) % 4]);
+            }
+            __m128i message = _mm_add_epi32(
+                w[g % 4], _mm_loadu_si128(reinterpret_cast<const __m128i *>(&kRoundConstants[4 * g])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(message, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, abefSaved);
+        state1 = _mm_add_epi32(state1, cdghSaved);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), _mm_alignr_epi8(state1, tmp, 8));
+}
+
+bool _cpuHasShaNi()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3))
+    {
+        return false;
+    }
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1u << 29)) != 0;
+}
+#endif
+} // namespace
+
+Sha256::Sha256()
+    : m_state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+{
+}
+
+void Sha256::update(std::string_view data)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+    size_t size = data.size();
+    m_totalBytes += size;
+
+    if (m_blockSize > 0)
+    {
+        size_t take = std::min(size, m_block.size() - m_blockSize);
+        std::memcpy(m_block.data() + m_blockSize, bytes, take);
+        m_blockSize += take;
+        bytes += take;
+        size -= take;
+        if (m_blockSize < m_block.size())
+        {
+            return;
+        }
+        _compress(m_block.data(), 1);
+        m_blockSize = 0;
+    }
+    size_t blocks = size / 64;
+    _compress(bytes, blocks);
+    bytes += blocks * 64;
+    size -= blocks * 64;
+    std::memcpy(m_block.data(), bytes, size);
+    m_blockSize = size;
+}
+
+Sha256Digest Sha256::finish()
+{
+    uint64_t bitLength = m_totalBytes * 8;
+    m_block[m_blockSize++] = 0x80;
+    if (m_blockSize > 56)
+    {
+        std::memset(m_block.data() + m_blockSize, 0, 64 - m_blockSize);
+        _compress(m_block.data(), 1);
+        m_blockSize = 0;
+    }
+    std::memset(m_block.data() + m_blockSize, 0, 56 - m_blockSize);
+    for (int i = 0; i < 8; ++i)
+    {
+        m_block[56 + i] = static_cast<uint8_t>(bitLength >> (56 - 8 * i));
+    }
+    _compress(m_block.data(), 1);
+
+    Sha256Digest digest;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        for (size_t j = 0; j < 4; ++j)
+        {
+            digest[i * 4 + j] = static_cast<uint8_t>(m_state[i] >> (24 - 8 * j));
+        }
+    }
+    return digest;
+}
+
+Sha256Digest Sha256::hash(std::string_view data)
+{
+    Sha256 hasher;
+    hasher.update(data);
+    return hasher.finish();
+}
+
+std::string Sha256::toHex(const Sha256Digest &digest)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(digest.size() * 2);
+    for (uint8_t byte : digest)
+    {
+        hex += hexDigits[byte >> 4];
+        hex += hexDigits[byte & 0x0F];
+    }
+    return hex;
+}
+
+void Sha256::_compress(const uint8_t *blocks, size_t count)
+{
+#ifdef SHA256_HAVE_SHANI
+    static const bool shaNi = _cpuHasShaNi();
+    if (shaNi)
+    {
+        _compressShaNi(m_state.data(), blocks, count);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i)
+    {
+        _compressScalar(m_state.data(), blocks + 64 * i);
+    }
+}
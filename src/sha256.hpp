@@ -0,0 +1,56 @@
+//  sha256.hpp
+//
+// SHA-256 digest, used to key cached data by content
+
+#ifndef sha256_hpp
+#define sha256_hpp
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+using Sha256Digest = std::array<uint8_t, 32>;
+
+/// @class Sha256
+/// @brief Incremental SHA-256 (FIPS 180-4), using the x86 SHA extensions where available.
+class Sha256
+{
+  public:
+    Sha256();
+
+    /**
+     * @brief Adds data to the message being hashed.
+     */
+    void update(std::string_view data);
+
+    /**
+     * @brief Pads the message and returns its digest. The object must not be updated afterwards.
+     */
+    Sha256Digest finish();
+
+    /**
+     * @brief Returns the digest of data in one call.
+     */
+    static Sha256Digest hash(std::string_view data);
+
+    /**
+     * @brief Returns a digest as 64 lowercase hex characters.
+     */
+    static std::string toHex(const Sha256Digest &digest);
+
+  private:
+    std::array<uint32_t, 8> m_state;
+    std::array<uint8_t, 64> m_block;
+    size_t m_blockSize = 0;
+    uint64_t m_totalBytes = 0;
+
+    /**
+     * @brief Runs the compression function over count consecutive 64-byte blocks, using the
+     * CPU's SHA instructions when it has them.
+     */
+    void _compress(const uint8_t *blocks, size_t count);
+};
+
+#endif /* sha256_hpp */
@@ -0,0 +1,61 @@
+//  startupprofile.cpp
+//
+// Timestamps of the startup phases, reported with --startup-profile
+
+#include "startupprofile.hpp"
+#include <cstdio>
+
+namespace
+{
+const std::chrono::steady_clock::time_point g_processStart = std::chrono::steady_clock::now();
+
+double _millisecondsBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+} // namespace
+
+std::chrono::steady_clock::time_point processStartTime()
+{
+    return g_processStart;
+}
+
+void StartupProfile::mark(std::string phase, Clock::time_point time)
+{
+    m_marks.emplace_back(std::move(phase), time);
+}
+
+double StartupProfile::millisecondsTo(std::string_view phase) const
+{
+    for (const auto &[name, time] : m_marks)
+    {
+        if (name == phase)
+        {
+            return _millisecondsBetween(g_processStart, time);
+        }
+    }
+    return -1;
+}
+
+std::string StartupProfile::report() const
+{
+    std::string line = "Startup profile (ms since process start):";
+    Clock::time_point previous = g_processStart;
+    char buffer[64];
+    for (size_t i = 0; i < m_marks.size(); ++i)
+    {
+        const auto &[name, time] = m_marks[i];
+        if (i == 0)
+        {
+            std::snprintf(buffer, sizeof(buffer), " %.1f", _millisecondsBetween(g_processStart, time));
+        }
+        else
+        {
+            std::snprintf(buffer, sizeof(buffer), " %.1f (+%.1f)", _millisecondsBetween(g_processStart, time),
+                          _millisecondsBetween(previous, time));
+        }
+        line.append(i == 0 ? " " : ", ").append(name).append(buffer);
+        previous = time;
+    }
+    return line;
+}
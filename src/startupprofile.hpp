@@ -0,0 +1,52 @@
+//  startupprofile.hpp
+//
+// Timestamps of the startup phases, reported with --startup-profile
+
+#ifndef startupprofile_hpp
+#define startupprofile_hpp
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Returns when the process started, taken during static initialization.
+ *
+ * Only dynamic loading and the other static initializers run before it, so it is a close lower
+ * bound on the time since exec.
+ */
+std::chrono::steady_clock::time_point processStartTime();
+
+/// @class StartupProfile
+/// @brief Records when each startup phase was reached, relative to processStartTime().
+///
+/// Not thread safe: phases reached on other threads are marked on the UI thread with the time
+/// they were reached.
+class StartupProfile
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Records that phase was reached at time.
+     */
+    void mark(std::string phase, Clock::time_point time = Clock::now());
+
+    /**
+     * @brief Returns the milliseconds from process start to phase, or a negative value if it was not marked.
+     */
+    double millisecondsTo(std::string_view phase) const;
+
+    /**
+     * @brief Returns one line listing each phase in the order marked, e.g.
+     * "Startup profile (ms since process start): main 0.4, UI built 2.1 (+1.7), first frame 6.0 (+3.9)".
+     */
+    std::string report() const;
+
+  private:
+    std::vector<std::pair<std::string, Clock::time_point>> m_marks;
+};
+
+#endif /* startupprofile_hpp */
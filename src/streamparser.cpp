@@ -0,0 +1,178 @@
+//  streamparser.cpp
+//
+// Incremental parser for server-sent event (SSE) streams returned by the ChatGPT API
+
+#include "streamparser.hpp"
+#include <cstring>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <utility>
+
+SseParser::SseParser(DeltaFn onDelta) : m_onDelta(std::move(onDelta))
+{
+}
+
+void SseParser::feed(const char *data, size_t length)
+{
+    const char *end = data + length;
+    while (data < end)
+    {
+        const char *newline = static_cast<const char *>(std::memchr(data, '\n', end - data));
+        if (newline == nullptr)
+        {
+            // Partial line: keep it until the rest arrives in a later chunk
+            m_lineBuffer.append(data, end - data);
+            return;
+        }
+
+        m_lineBuffer.append(data, newline - data);
+        if (!m_lineBuffer.empty() && m_lineBuffer.back() == '\r')
+        {
+            m_lineBuffer.pop_back();
+        }
+        _processLine(m_lineBuffer);
+        m_lineBuffer.clear();
+        data = newline + 1;
+    }
+}
+
+void SseParser::finish()
+{
+    if (!m_lineBuffer.empty())
+    {
+        _processLine(m_lineBuffer);
+        m_lineBuffer.clear();
+    }
+    if (m_hasEventData)
+    {
+        _dispatchEvent();
+    }
+}
+
+bool SseParser::isDone() const
+{
+    return m_done;
+}
+
+size_t SseParser::deltaCount() const
+{
+    return m_deltaCount;
+}
+
+const std::string &SseParser::rawBody() const
+{
+    return m_rawBody;
+}
+
+bool SseParser::hasUsage() const
+{
+    return m_hasUsage;
+}
+
+const ChatUsage &SseParser::usage() const
+{
+    return m_usage;
+}
+
+void SseParser::_processLine(const std::string &line)
+{
+    // A blank line terminates the current event
+    if (line.empty())
+    {
+        if (m_hasEventData)
+        {
+            _dispatchEvent();
+        }
+        return;
+    }
+
+    // Comment lines (used by some servers as keep-alives)
+    if (line[0] == ':')
+    {
+        return;
+    }
+
+    if (line.compare(0, 5, "data:") == 0)
+    {
+        size_t valueStart = (line.size() > 5 && line[5] == ' ') ? 6 : 5;
+        if (m_hasEventData)
+        {
+            m_eventData += '\n';
+        }
+        m_eventData.append(line, valueStart, std::string::npos);
+        m_hasEventData = true;
+        return;
+    }
+
+    // Other SSE fields carry nothing the chat completion stream needs
+    if (line.compare(0, 6, "event:") == 0 || line.compare(0, 3, "id:") == 0 || line.compare(0, 6, "retry:") == 0)
+    {
+        return;
+    }
+
+    // Anything else is not SSE, e.g. a JSON error body sent instead of a stream
+    m_rawBody.append(line);
+    m_rawBody += '\n';
+}
+
+void SseParser::_dispatchEvent()
+{
+    std::string eventData;
+    eventData.swap(m_eventData);
+    m_hasEventData = false;
+
+    if (eventData == "[DONE]")
+    {
+        m_done = true;
+        return;
+    }
+
+    try
+    {
+        nlohmann::json chunk = nlohmann::json::parse(eventData);
+        if (chunk.contains("error"))
+        {
+            // Errors reported mid-stream are handed back like a non-streamed error body
+            m_rawBody.append(eventData);
+            m_rawBody += '\n';
+            return;
+        }
+        // Usage arrives in a chunk of its own, with an empty choices array
+        if (chunk.contains("usage") && chunk["usage"].is_object())
+        {
+            const nlohmann::json &usage = chunk["usage"];
+            m_usage.promptTokens = usage.value("prompt_tokens", int64_t(0));
+            m_usage.completionTokens = usage.value("completion_tokens", int64_t(0));
+            m_usage.totalTokens = usage.value("total_tokens", int64_t(0));
+            if (usage.contains("prompt_tokens_details") && usage["prompt_tokens_details"].is_object())
+            {
+                m_usage.cachedTokens = usage["prompt_tokens_details"].value("cached_tokens", int64_t(0));
+            }
+            m_hasUsage = true;
+        }
+        if (!chunk.contains("choices") || !chunk["choices"].is_array() || chunk["choices"].empty())
+        {
+            return;
+        }
+        const nlohmann::json &delta = chunk["choices"][0]["delta"];
+        if (delta.is_object() && delta.contains("content") && delta["content"].is_string())
+        {
+            const std::string &content = delta["content"].get_ref<const std::string &>();
+            if (!content.empty())
+            {
+                ++m_deltaCount;
+                m_onDelta(content);
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "[ERROR] Failed to parse stream chunk: " << e.what() << "\nChunk:\n" << eventData << std::endl;
+    }
+}
+
+size_t _streamWriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    static_cast<SseParser *>(userp)->feed(static_cast<const char *>(contents), size * nmemb);
+    return size * nmemb;
+}
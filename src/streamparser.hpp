@@ -0,0 +1,103 @@
+//  streamparser.hpp
+//
+// Incremental parser for server-sent event (SSE) streams returned by the ChatGPT API
+
+#ifndef streamparser_hpp
+#define streamparser_hpp
+
+#include "responseparser.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+
+using DeltaFn = std::function<void(const std::string &)>;
+
+/// @class SseParser
+/// @brief Turns a chunked "stream": true response body into assistant content deltas.
+///
+/// Bytes can be fed in arbitrarily sized pieces, exactly as cURL hands them to the write
+/// callback. Complete events are decoded as soon as their terminating blank line arrives, and
+/// each non-empty `choices[0].delta.content` is passed to the delta callback. The "usage" a
+/// stream reports in its last chunk, when asked to with stream_options.include_usage, is kept
+/// for usage(). Lines that are not
+/// part of the SSE grammar (for example a plain JSON error body) are collected in rawBody().
+class SseParser
+{
+  public:
+    /**
+     * @brief Constructs a parser that reports content deltas to onDelta.
+     * @param onDelta Callback invoked once per content delta, in stream order.
+     */
+    explicit SseParser(DeltaFn onDelta);
+
+    /**
+     * @brief Feeds the next piece of the response body into the parser.
+     * @param data Pointer to the received bytes.
+     * @param length Number of bytes received.
+     */
+    void feed(const char *data, size_t length);
+
+    /**
+     * @brief Flushes any unterminated line and event left at the end of the stream.
+     */
+    void finish();
+
+    /**
+     * @brief Returns true once the "[DONE]" sentinel has been received.
+     */
+    bool isDone() const;
+
+    /**
+     * @brief Returns the number of content deltas reported so far.
+     */
+    size_t deltaCount() const;
+
+    /**
+     * @brief Returns response text that was not part of an SSE event (e.g. an API error body).
+     */
+    const std::string &rawBody() const;
+
+    /**
+     * @brief Returns true once a chunk has reported the token usage of the request.
+     */
+    bool hasUsage() const;
+
+    /**
+     * @brief Returns the reported token usage; all zero unless hasUsage().
+     */
+    const ChatUsage &usage() const;
+
+  private:
+    DeltaFn m_onDelta;
+    std::string m_lineBuffer;
+    std::string m_eventData;
+    std::string m_rawBody;
+    bool m_hasEventData = false;
+    bool m_done = false;
+    size_t m_deltaCount = 0;
+    bool m_hasUsage = false;
+    ChatUsage m_usage;
+
+    /**
+     * @brief Handles one complete line (without its line terminator).
+     */
+    void _processLine(const std::string &line);
+
+    /**
+     * @brief Decodes the accumulated data of one event and reports its content delta.
+     */
+    void _dispatchEvent();
+};
+
+/**
+ * @brief cURL write callback that feeds received bytes into an SseParser.
+ *
+ * @param contents Pointer to the data received.
+ * @param size Size of each data element.
+ * @param nmemb Number of elements.
+ * @param userp Pointer to the SseParser receiving the data.
+ * @return The number of bytes actually taken care of.
+ */
+size_t _streamWriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
+
+#endif /* streamparser_hpp */
@@ -0,0 +1,121 @@
+//  textarena.cpp
+//
+// Append-only text storage in large chunks, shared between copies
+
+#include "textarena.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+TextArena::TextArena(const TextArena &other)
+{
+    // Copying is const for other but freezes what it has written: this copy may now read it.
+    // Concurrent copies all store the same value, so the mark is atomic rather than locked.
+    other.m_shared.store(other.m_used, std::memory_order_relaxed);
+}
+
+TextArena &TextArena::operator=(const TextArena &other)
+{
+    if (this != &other)
+    {
+        other.m_shared.store(other.m_used, std::memory_order_relaxed);
+        m_chunk.reset();
+        m_used = 0;
+        m_shared.store(0, std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+TextArena::TextArena(TextArena &&other) noexcept
+    : m_chunk(std::move(other.m_chunk)), m_used(other.m_used),
+      m_shared(other.m_shared.load(std::memory_order_relaxed))
+{
+    other.m_used = 0;
+    other.m_shared.store(0, std::memory_order_relaxed);
+}
+
+TextArena &TextArena::operator=(TextArena &&other) noexcept
+{
+    if (this != &other)
+    {
+        m_chunk = std::move(other.m_chunk);
+        m_used = other.m_used;
+        m_shared.store(other.m_shared.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        other.m_used = 0;
+        other.m_shared.store(0, std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+SharedText TextArena::append(std::string_view text)
+{
+    if (!m_chunk || text.size() > m_chunk->capacity - m_used)
+    {
+        _newChunk(text.size());
+    }
+    std::memcpy(m_chunk->bytes.get() + m_used, text.data(), text.size());
+
+    SharedText stored;
+    stored.m_chunk = m_chunk;
+    stored.m_offset = static_cast<uint32_t>(m_used);
+    stored.m_length = static_cast<uint32_t>(text.size());
+    m_used += text.size();
+    return stored;
+}
+
+void TextArena::extend(SharedText &text, std::string_view more)
+{
+    bool isNewest = m_chunk && text.m_chunk == m_chunk && text.m_offset + size_t(text.m_length) == m_used;
+    if (isNewest && more.size() <= m_chunk->capacity - m_used)
+    {
+        // Bytes past m_used are invisible to copies even when text itself is shared
+        std::memcpy(m_chunk->bytes.get() + m_used, more.data(), more.size());
+        text.m_length += static_cast<uint32_t>(more.size());
+        m_used += more.size();
+        return;
+    }
+
+    // Streamed replies grow a little at a time: leave as much room again after the move
+    size_t grown = text.size() + more.size();
+    SharedText old = text;
+    release(old);
+    if (!m_chunk || grown > m_chunk->capacity - m_used)
+    {
+        _newChunk(std::max(grown * 2, kChunkSize));
+    }
+    std::string_view oldText = old.view();
+    std::memmove(m_chunk->bytes.get() + m_used, oldText.data(), oldText.size());
+    std::memcpy(m_chunk->bytes.get() + m_used + oldText.size(), more.data(), more.size());
+
+    text.m_chunk = m_chunk;
+    text.m_offset = static_cast<uint32_t>(m_used);
+    text.m_length = static_cast<uint32_t>(grown);
+    m_used += grown;
+}
+
+void TextArena::release(const SharedText &text)
+{
+    if (m_chunk && text.m_chunk == m_chunk && text.m_offset + size_t(text.m_length) == m_used &&
+        text.m_offset >= m_shared.load(std::memory_order_relaxed))
+    {
+        m_used = text.m_offset;
+    }
+}
+
+void TextArena::reserve(size_t bytes)
+{
+    if (!m_chunk || bytes > m_chunk->capacity - m_used)
+    {
+        _newChunk(bytes);
+    }
+}
+
+void TextArena::_newChunk(size_t minimumCapacity)
+{
+    auto chunk = std::make_shared<TextArenaChunk>();
+    chunk->capacity = std::max(minimumCapacity, kChunkSize);
+    chunk->bytes.reset(new char[chunk->capacity]);
+    m_chunk = std::move(chunk);
+    m_used = 0;
+    m_shared.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,98 @@
+//  textarena.hpp
+//
+// Append-only text storage in large chunks, shared between copies
+
+#ifndef textarena_hpp
+#define textarena_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+/// @brief One block of arena memory. Its bytes never move, so views into it stay valid.
+struct TextArenaChunk
+{
+    std::unique_ptr<char[]> bytes;
+    size_t capacity = 0;
+};
+
+/// @brief A piece of text in a TextArena. Holding it keeps its chunk alive, so it stays valid
+/// after the arena that wrote it has moved on or been destroyed.
+class SharedText
+{
+  public:
+    std::string_view view() const
+    {
+        return m_chunk ? std::string_view(m_chunk->bytes.get() + m_offset, m_length) : std::string_view();
+    }
+
+    size_t size() const
+    {
+        return m_length;
+    }
+
+  private:
+    friend class TextArena;
+
+    std::shared_ptr<const TextArenaChunk> m_chunk;
+    uint32_t m_offset = 0;
+    uint32_t m_length = 0;
+};
+
+/// @class TextArena
+/// @brief Packs text back to back in chunks of kChunkSize bytes instead of one heap string per
+/// piece. Text longer than a chunk gets a chunk of its own.
+///
+/// Written bytes are never changed, so copies of an arena share everything written before the
+/// copy: a copy starts writing to a chunk of its own, and the original stops handing back the
+/// space of what the copy can see. Neither ever writes where the other can read, so the two can
+/// be used from different threads.
+///
+/// Copying marks the source's written bytes as shared, so it counts as a read of the source like
+/// any other: several threads may copy an arena at once, but not while its owner writes to it.
+class TextArena
+{
+  public:
+    /// Size of the chunks text is packed into
+    static constexpr size_t kChunkSize = 64 * 1024;
+
+    TextArena() = default;
+    TextArena(const TextArena &other);
+    TextArena &operator=(const TextArena &other);
+    TextArena(TextArena &&other) noexcept;
+    TextArena &operator=(TextArena &&other) noexcept;
+
+    /**
+     * @brief Copies text into the arena.
+     * @return The stored copy.
+     */
+    SharedText append(std::string_view text);
+
+    /**
+     * @brief Appends more to the end of text. Grows it in place when it is the newest text in the
+     * current chunk and there is room; otherwise moves it to a chunk with room to grow further.
+     */
+    void extend(SharedText &text, std::string_view more);
+
+    /**
+     * @brief Hands back the space of text if it is the newest text in the current chunk and no
+     * copy of the arena can see it. The caller must drop text afterwards.
+     */
+    void release(const SharedText &text);
+
+    /**
+     * @brief Makes sure the next bytes bytes of appends fit in the current chunk.
+     */
+    void reserve(size_t bytes);
+
+  private:
+    std::shared_ptr<TextArenaChunk> m_chunk; // The chunk being written; nullptr until the first append
+    size_t m_used = 0;                       // Bytes of m_chunk written
+    mutable std::atomic<size_t> m_shared{0}; // Bytes of m_chunk a copy may see, which are never reused
+
+    void _newChunk(size_t minimumCapacity);
+};
+
+#endif /* textarena_hpp */
@@ -0,0 +1,409 @@
+//  tokenizer.cpp
+//
+// Offline byte-pair-encoding tokenizer for counting the tokens a message will cost
+
+#include "tokenizer.hpp"
+#include "filereadwrite.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+
+namespace
+{
+constexpr uint32_t kNoRank = std::numeric_limits<uint32_t>::max();
+
+/**
+ * @brief Decodes standard base64; returns false on malformed input.
+ */
+bool _decodeBase64(std::string_view encoded, std::string &decoded)
+{
+    decoded.clear();
+    uint32_t buffer = 0;
+    int bits = 0;
+    for (char c : encoded)
+    {
+        int value;
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if (c == '+')
+            value = 62;
+        else if (c == '/')
+            value = 63;
+        else if (c == '=')
+            break;
+        else
+            return false;
+
+        buffer = (buffer << 6) | static_cast<uint32_t>(value);
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            decoded += static_cast<char>((buffer >> bits) & 0xFF);
+        }
+    }
+    return true;
+}
+
+enum class CharClass
+{
+    Letter,
+    Digit,
+    Space,
+    Other
+};
+
+/**
+ * @brief Classifies a byte; bytes of multi-byte UTF-8 sequences count as letters.
+ */
+CharClass _classify(unsigned char c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80)
+        return CharClass::Letter;
+    if (c >= '0' && c <= '9')
+        return CharClass::Digit;
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f')
+        return CharClass::Space;
+    return CharClass::Other;
+}
+
+/**
+ * @brief Returns the length of an English contraction suffix ('s, 't, 're, ...) at pos, or 0.
+ */
+size_t _contractionLength(std::string_view text, size_t pos)
+{
+    if (text[pos] != '\'' || pos + 1 >= text.size())
+        return 0;
+    char a = static_cast<char>(text[pos + 1] | 0x20);
+    char b = pos + 2 < text.size() ? static_cast<char>(text[pos + 2] | 0x20) : '\0';
+    if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') || (a == 'l' && b == 'l'))
+        return 3;
+    if (a == 's' || a == 't' || a == 'm' || a == 'd')
+        return 2;
+    return 0;
+}
+
+/**
+ * @brief Returns the end of the pre-tokenized piece starting at pos.
+ *
+ * Approximates the cl100k split pattern: contractions, an optional non-letter prefix plus a
+ * letter run, up to three digits, an optional space plus a punctuation run with trailing
+ * newlines, and whitespace runs that leave their last space to the following word.
+ */
+size_t _pieceEnd(std::string_view text, size_t pos)
+{
+    const size_t size = text.size();
+    if (size_t contraction = _contractionLength(text, pos))
+        return pos + contraction;
+
+    CharClass first = _classify(static_cast<unsigned char>(text[pos]));
+    size_t i = pos;
+
+    if (first == CharClass::Digit)
+    {
+        while (i < size && i - pos < 3 && _classify(static_cast<unsigned char>(text[i])) == CharClass::Digit)
+            ++i;
+        return i;
+    }
+
+    if (first == CharClass::Space)
+    {
+        // A single space attaches to the following word or punctuation run
+        if (text[pos] == ' ' && pos + 1 < size)
+        {
+            CharClass next = _classify(static_cast<unsigned char>(text[pos + 1]));
+            if (next == CharClass::Letter || next == CharClass::Other)
+            {
+                first = next;
+                i = pos + 1;
+            }
+        }
+        if (first == CharClass::Space)
+        {
+            while (i < size && _classify(static_cast<unsigned char>(text[i])) == CharClass::Space)
+                ++i;
+            if (i < size && i - pos > 1 && text[i - 1] == ' ')
+                --i;
+            return i;
+        }
+    }
+
+    if (first == CharClass::Other)
+    {
+        // A single punctuation character can prefix a word, e.g. "(hello" or "_name"
+        if (i + 1 < size && _classify(static_cast<unsigned char>(text[i + 1])) == CharClass::Letter)
+        {
+            ++i;
+            first = CharClass::Letter;
+        }
+        else
+        {
+            while (i < size && _classify(static_cast<unsigned char>(text[i])) == CharClass::Other)
+                ++i;
+            while (i < size && (text[i] == '\r' || text[i] == '\n'))
+                ++i;
+            return i;
+        }
+    }
+
+    // Letters (possibly after a one-character prefix)
+    while (i < size && _classify(static_cast<unsigned char>(text[i])) == CharClass::Letter)
+        ++i;
+    return i > pos ? i : pos + 1;
+}
+} // namespace
+
+BpeTokenizer BpeTokenizer::fromFile(const std::filesystem::path &filepath)
+{
+    std::string contents = readFileToString(filepath);
+
+    std::vector<std::string> tokens;
+    std::vector<uint32_t> ranks;
+    std::string decoded;
+    size_t lineStart = 0;
+    while (lineStart < contents.size())
+    {
+        size_t lineEnd = contents.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
+            lineEnd = contents.size();
+        std::string_view line(contents.data() + lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+
+        size_t separator = line.find(' ');
+        if (separator == std::string_view::npos || !_decodeBase64(line.substr(0, separator), decoded))
+            continue;
+        tokens.push_back(decoded);
+        ranks.push_back(static_cast<uint32_t>(std::strtoul(std::string(line.substr(separator + 1)).c_str(), nullptr, 10)));
+    }
+
+    if (tokens.empty())
+    {
+        throw std::runtime_error("No BPE tokens found in " + filepath.string());
+    }
+
+    BpeTokenizer tokenizer;
+    tokenizer._index(tokens, ranks);
+    return tokenizer;
+}
+
+BpeTokenizer::BpeTokenizer(const std::vector<std::string> &tokens)
+{
+    std::vector<uint32_t> ranks(tokens.size());
+    for (size_t i = 0; i < ranks.size(); ++i)
+        ranks[i] = static_cast<uint32_t>(i);
+    _index(tokens, ranks);
+}
+
+void BpeTokenizer::_index(const std::vector<std::string> &tokens, const std::vector<uint32_t> &ranks)
+{
+    size_t totalBytes = 0;
+    for (const auto &token : tokens)
+        totalBytes += token.size();
+    m_tokenBytes = std::make_unique<char[]>(totalBytes + 1);
+
+    m_ranks.reserve(tokens.size());
+    size_t offset = 0;
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        tokens[i].copy(m_tokenBytes.get() + offset, tokens[i].size());
+        m_ranks.emplace(std::string_view(m_tokenBytes.get() + offset, tokens[i].size()), ranks[i]);
+        offset += tokens[i].size();
+    }
+}
+
+uint32_t BpeTokenizer::_rank(std::string_view bytes) const
+{
+    auto it = m_ranks.find(bytes);
+    return it == m_ranks.end() ? kNoRank : it->second;
+}
+
+template <typename EmitFn> void BpeTokenizer::_encodePiece(std::string_view piece, EmitFn &&emit) const
+{
+    // Most pieces are whole words already in the vocabulary
+    uint32_t whole = _rank(piece);
+    if (whole != kNoRank)
+    {
+        emit(whole);
+        return;
+    }
+
+    // Long pieces, such as a run of letters with no spaces, go through a heap so they cost
+    // O(n log n) instead of rescanning every pair after each merge
+    constexpr size_t kInlineParts = 64;
+    if (piece.size() > kInlineParts)
+    {
+        _mergeLongPiece(piece, emit);
+        return;
+    }
+
+    // starts[i] is where part i begins; pairRanks[i] is the rank of parts i and i+1 merged.
+    // Pieces are short here, so the working arrays live on the stack.
+    size_t starts[kInlineParts + 1];
+    uint32_t pairRanks[kInlineParts + 1];
+
+    size_t boundaries = piece.size() + 1;
+    for (size_t i = 0; i < boundaries; ++i)
+        starts[i] = i;
+    auto pairRank = [&](size_t i) {
+        return i + 2 < boundaries ? _rank(piece.substr(starts[i], starts[i + 2] - starts[i])) : kNoRank;
+    };
+    for (size_t i = 0; i < boundaries; ++i)
+        pairRanks[i] = pairRank(i);
+
+    while (boundaries > 2)
+    {
+        size_t best = 0;
+        uint32_t bestRank = kNoRank;
+        for (size_t i = 0; i + 2 < boundaries; ++i)
+        {
+            if (pairRanks[i] < bestRank)
+            {
+                bestRank = pairRanks[i];
+                best = i;
+            }
+        }
+        if (bestRank == kNoRank)
+            break;
+
+        // Merge parts best and best+1 by dropping the boundary between them
+        std::copy(starts + best + 2, starts + boundaries, starts + best + 1);
+        std::copy(pairRanks + best + 2, pairRanks + boundaries, pairRanks + best + 1);
+        --boundaries;
+        pairRanks[best] = pairRank(best);
+        if (best > 0)
+            pairRanks[best - 1] = pairRank(best - 1);
+    }
+
+    for (size_t i = 0; i + 1 < boundaries; ++i)
+    {
+        // Bytes missing from a malformed vocabulary still count as one token each
+        uint32_t rank = _rank(piece.substr(starts[i], starts[i + 1] - starts[i]));
+        emit(rank);
+    }
+}
+
+template <typename EmitFn> void BpeTokenizer::_mergeLongPiece(std::string_view piece, EmitFn &&emit) const
+{
+    // Parts are named by the byte they start at and linked to their neighbours. The heap holds
+    // candidate merges ordered by rank, then position, so the same leftmost lowest-rank pair is
+    // merged as in the scan above; a candidate whose parts have changed since is skipped.
+    struct Candidate
+    {
+        uint32_t rank;
+        size_t left;
+        size_t right;
+        size_t end;
+
+        bool operator>(const Candidate &other) const
+        {
+            return std::tie(rank, left) > std::tie(other.rank, other.left);
+        }
+    };
+    const size_t size = piece.size();
+    std::vector<size_t> next(size);
+    std::vector<size_t> previous(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        next[i] = i + 1;
+        previous[i] = i - 1; // Wraps for the first part, which has none
+    }
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+    auto propose = [&](size_t left) {
+        size_t right = next[left];
+        if (right < size)
+        {
+            uint32_t rank = _rank(piece.substr(left, next[right] - left));
+            if (rank != kNoRank)
+                candidates.push({rank, left, right, next[right]});
+        }
+    };
+    for (size_t i = 0; i < size; ++i)
+        propose(i);
+
+    while (!candidates.empty())
+    {
+        Candidate merge = candidates.top();
+        candidates.pop();
+        if (next[merge.left] != merge.right || next[merge.right] != merge.end)
+            continue;
+
+        // The right part joins the left one; its slot is left pointing past the end
+        next[merge.left] = merge.end;
+        next[merge.right] = size;
+        if (merge.end < size)
+            previous[merge.end] = merge.left;
+        propose(merge.left);
+        if (merge.left > 0)
+            propose(previous[merge.left]);
+    }
+
+    for (size_t i = 0; i < size; i = next[i])
+        emit(_rank(piece.substr(i, next[i] - i)));
+}
+
+std::vector<uint32_t> BpeTokenizer::encode(std::string_view text) const
+{
+    std::vector<uint32_t> tokens;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = _pieceEnd(text, pos);
+        _encodePiece(text.substr(pos, end - pos), [&](uint32_t rank) { tokens.push_back(rank); });
+        pos = end;
+    }
+    return tokens;
+}
+
+size_t BpeTokenizer::countTokens(std::string_view text) const
+{
+    size_t count = 0;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = _pieceEnd(text, pos);
+        _encodePiece(text.substr(pos, end - pos), [&](uint32_t) { ++count; });
+        pos = end;
+    }
+    return count;
+}
+
+size_t BpeTokenizer::vocabularySize() const
+{
+    return m_ranks.size();
+}
+
+size_t countTokens(std::string_view text)
+{
+    static const std::unique_ptr<BpeTokenizer> tokenizer = []() -> std::unique_ptr<BpeTokenizer> {
+        const char *bpeFile = std::getenv("CHATGPT_CLI_BPE_FILE");
+        if (bpeFile == nullptr || std::string(bpeFile).empty())
+        {
+            return nullptr;
+        }
+        try
+        {
+            return std::make_unique<BpeTokenizer>(BpeTokenizer::fromFile(bpeFile));
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[ERROR] Failed to load BPE vocabulary, estimating token counts instead: " << e.what()
+                      << std::endl;
+            return nullptr;
+        }
+    }();
+
+    if (tokenizer)
+    {
+        return tokenizer->countTokens(text);
+    }
+    return (text.size() + 3) / 4;
+}
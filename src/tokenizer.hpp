@@ -0,0 +1,97 @@
+//  tokenizer.hpp
+//
+// Offline byte-pair-encoding tokenizer for counting the tokens a message will cost
+
+#ifndef tokenizer_hpp
+#define tokenizer_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// @class BpeTokenizer
+/// @brief Byte-level BPE tokenizer driven by a tiktoken-style vocabulary file.
+///
+/// The vocabulary file has one "<base64 token bytes> <rank>" pair per line, as distributed for
+/// cl100k_base and o200k_base. Text is first split into word-like pieces (an ASCII approximation
+/// of the tiktoken split pattern), then each piece is merged pair by pair, lowest rank first.
+class BpeTokenizer
+{
+  public:
+    /**
+     * @brief Loads a vocabulary file.
+     * @param filepath The path of the tiktoken-style vocabulary file.
+     * @return The tokenizer.
+     * @throws std::runtime_error if the file cannot be read or contains no tokens.
+     */
+    static BpeTokenizer fromFile(const std::filesystem::path &filepath);
+
+    /**
+     * @brief Builds a tokenizer from token byte strings, where a token's rank is its index.
+     * @param tokens The token byte strings, in rank order.
+     */
+    explicit BpeTokenizer(const std::vector<std::string> &tokens);
+
+    /**
+     * @brief Encodes text into token ranks.
+     * @param text The text to encode.
+     * @return The token ranks, in order.
+     */
+    std::vector<uint32_t> encode(std::string_view text) const;
+
+    /**
+     * @brief Counts the tokens text encodes to, without materializing them.
+     * @param text The text to count.
+     * @return The number of tokens.
+     */
+    size_t countTokens(std::string_view text) const;
+
+    /**
+     * @brief Returns the number of tokens in the vocabulary.
+     */
+    size_t vocabularySize() const;
+
+  private:
+    std::unique_ptr<char[]> m_tokenBytes;                   // All token bytes, back to back
+    std::unordered_map<std::string_view, uint32_t> m_ranks; // Views into m_tokenBytes, stable across moves
+
+    BpeTokenizer() = default;
+
+    /**
+     * @brief Indexes tokens, copying their bytes into m_tokenBytes first so the views stay valid.
+     */
+    void _index(const std::vector<std::string> &tokens, const std::vector<uint32_t> &ranks);
+
+    /**
+     * @brief Returns the rank of a byte sequence, or UINT32_MAX if it is not a token.
+     */
+    uint32_t _rank(std::string_view bytes) const;
+
+    /**
+     * @brief Runs BPE merges on one pre-tokenized piece, calling emit for each resulting token.
+     */
+    template <typename EmitFn> void _encodePiece(std::string_view piece, EmitFn &&emit) const;
+
+    /**
+     * @brief Runs the same merges as _encodePiece on a long piece, with a heap of candidate pairs.
+     */
+    template <typename EmitFn> void _mergeLongPiece(std::string_view piece, EmitFn &&emit) const;
+};
+
+/**
+ * @brief Counts tokens with the process-wide tokenizer.
+ *
+ * The tokenizer is loaded once from the file named by the CHATGPT_CLI_BPE_FILE environment
+ * variable. Without one, the count is estimated as one token per four bytes.
+ *
+ * @param text The text to count.
+ * @return The (estimated) number of tokens.
+ */
+size_t countTokens(std::string_view text);
+
+#endif /* tokenizer_hpp */
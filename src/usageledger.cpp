@@ -0,0 +1,385 @@
+//  usageledger.cpp
+//
+// Append-only ledger of the tokens each request used, with per-session and per-day limits
+
+#include "usageledger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <random>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr char kFileMagic[8] = {'C', 'G', 'P', 'T', 'U', 'L', '0', '1'};
+
+/// One request, as stored in the file
+struct UsageRecord
+{
+    int64_t time; // Seconds since the epoch
+    uint32_t session;
+    uint32_t promptTokens;
+    uint32_t completionTokens;
+    uint32_t cachedTokens;
+};
+
+std::runtime_error _systemError(const std::string &what, const std::filesystem::path &path)
+{
+    return std::runtime_error(what + " " + path.string() + ": " + std::strerror(errno));
+}
+
+uint32_t _clamped(int64_t tokens)
+{
+    return static_cast<uint32_t>(std::clamp<int64_t>(tokens, 0, UINT32_MAX));
+}
+
+int64_t _seconds(std::chrono::system_clock::time_point when)
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(when.time_since_epoch()).count();
+}
+
+/// The local midnight that starts the day of when, in seconds since the epoch
+int64_t _localMidnight(std::chrono::system_clock::time_point when)
+{
+    std::time_t time = std::chrono::system_clock::to_time_t(when);
+    std::tm local{};
+    localtime_r(&time, &local);
+    local.tm_hour = 0;
+    local.tm_min = 0;
+    local.tm_sec = 0;
+    local.tm_isdst = -1;
+    return static_cast<int64_t>(std::mktime(&local));
+}
+
+void _add(UsageTotals &totals, const UsageRecord &record)
+{
+    ++totals.requests;
+    totals.promptTokens += record.promptTokens;
+    totals.completionTokens += record.completionTokens;
+    totals.cachedTokens += record.cachedTokens;
+}
+
+uint64_t _left(uint64_t limit, uint64_t used)
+{
+    return used < limit ? limit - used : 0;
+}
+
+/**
+ * @brief Adds up the records with from <= time < to. Records are in the order they were
+ * appended, which is the order of their times but for clock adjustments, so the range is
+ * found by binary search and only the records inside it are read.
+ */
+UsageTotals _sum(const UsageRecord *records, size_t count, int64_t from, int64_t to)
+{
+    const UsageRecord *end = records + count;
+    const UsageRecord *first =
+        std::partition_point(records, end, [from](const UsageRecord &record) { return record.time < from; });
+    const UsageRecord *last =
+        std::partition_point(first, end, [to](const UsageRecord &record) { return record.time < to; });
+    UsageTotals totals;
+    for (const UsageRecord *record = first; record != last; ++record)
+    {
+        _add(totals, *record);
+    }
+    return totals;
+}
+
+/// @brief A read-only mapping of the records in the first size bytes of a ledger file.
+struct _Records
+{
+    void *map = nullptr;
+    size_t length = 0;
+    const UsageRecord *records = nullptr;
+    size_t count = 0;
+
+    _Records(int fd, size_t size, const std::filesystem::path &path)
+    {
+        if (size <= sizeof(kFileMagic))
+        {
+            return;
+        }
+        map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            map = nullptr;
+            throw _systemError("Unable to map usage ledger", path);
+        }
+        length = size;
+        records = reinterpret_cast<const UsageRecord *>(static_cast<const char *>(map) + sizeof(kFileMagic));
+        count = (size - sizeof(kFileMagic)) / sizeof(UsageRecord);
+    }
+
+    ~_Records()
+    {
+        if (map != nullptr)
+        {
+            munmap(map, length);
+        }
+    }
+};
+
+size_t _fileSize(int fd, const std::filesystem::path &path)
+{
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        throw _systemError("Unable to stat usage ledger", path);
+    }
+    return static_cast<size_t>(status.st_size);
+}
+
+/// Size of the whole records in a file of size bytes, magic number included
+size_t _wholeRecords(size_t size)
+{
+    if (size < sizeof(kFileMagic))
+    {
+        return sizeof(kFileMagic);
+    }
+    return size - (size - sizeof(kFileMagic)) % sizeof(UsageRecord);
+}
+
+uint64_t _limitFromEnvironment(const char *name)
+{
+    const char *configured = std::getenv(name);
+    if (configured == nullptr || *configured == '\0')
+    {
+        return 0;
+    }
+    return std::strtoull(configured, nullptr, 10);
+}
+} // namespace
+
+UsageLedger::UsageLedger(const std::filesystem::path &path, UsageLimits limits)
+    : m_path(path), m_limits(limits), m_sessionId(std::random_device()())
+{
+    static_assert(sizeof(UsageRecord) == 24, "record layout is part of the file format");
+    if (path.empty())
+    {
+        return;
+    }
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (m_fd < 0)
+    {
+        throw _systemError("Unable to open usage ledger", path);
+    }
+
+    // Another process may be creating or appending to the file; hold it still while it is checked
+    flock(m_fd, LOCK_EX);
+    try
+    {
+        size_t size = _fileSize(m_fd, path);
+        char magic[sizeof(kFileMagic)] = {};
+        size_t prefix = std::min(size, sizeof(magic));
+        if (pread(m_fd, magic, prefix, 0) != static_cast<ssize_t>(prefix) || std::memcmp(magic, kFileMagic, prefix) != 0)
+        {
+            throw std::runtime_error("Not a usage ledger: " + path.string());
+        }
+        if (size < sizeof(kFileMagic))
+        {
+            // New, or cut short while its magic number was written
+            if (ftruncate(m_fd, 0) != 0 || write(m_fd, kFileMagic, sizeof(kFileMagic)) != sizeof(kFileMagic))
+            {
+                throw _systemError("Unable to write usage ledger", path);
+            }
+        }
+        else if (_wholeRecords(size) != size && ftruncate(m_fd, static_cast<off_t>(_wholeRecords(size))) != 0)
+        {
+            // Appends would land out of step with the records after a torn one
+            throw _systemError("Unable to cut the torn tail off usage ledger", path);
+        }
+    }
+    catch (...)
+    {
+        close(m_fd);
+        throw;
+    }
+    flock(m_fd, LOCK_UN);
+}
+
+UsageLedger::~UsageLedger()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+void UsageLedger::record(const ChatUsage &usage, std::chrono::system_clock::time_point when)
+{
+    UsageRecord record{_seconds(when), m_sessionId, _clamped(usage.promptTokens), _clamped(usage.completionTokens),
+                       _clamped(usage.cachedTokens)};
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    _add(m_session, record);
+    if (m_fd >= 0)
+    {
+        // One write per record, so records of processes appending at once never interleave
+        if (write(m_fd, &record, sizeof(record)) != static_cast<ssize_t>(sizeof(record)))
+        {
+            std::cerr << "[ERROR] " << _systemError("Unable to write usage ledger", m_path).what() << std::endl;
+        }
+        return; // The day's total picks the record up from the file
+    }
+    _refreshToday();
+    if (record.time >= m_todayStart)
+    {
+        _add(m_today, record);
+    }
+}
+
+UsageTotals UsageLedger::session() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_session;
+}
+
+UsageTotals UsageLedger::today() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    _refreshToday();
+    return m_today;
+}
+
+UsageTotals UsageLedger::totals(std::chrono::system_clock::time_point from,
+                                std::chrono::system_clock::time_point to) const
+{
+    if (m_fd < 0)
+    {
+        // Only this session was kept, and without times; it counts if the period covers now
+        auto now = std::chrono::system_clock::now();
+        return from <= now && now < to ? session() : UsageTotals();
+    }
+    _Records file(m_fd, _wholeRecords(_fileSize(m_fd, m_path)), m_path);
+    return _sum(file.records, file.count, _seconds(from), _seconds(to));
+}
+
+uint64_t UsageLedger::remainingTokens() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t remaining = kUnlimited;
+    if (m_limits.sessionTokens != 0)
+    {
+        remaining = std::min(remaining, _left(m_limits.sessionTokens, m_session.tokens()));
+    }
+    if (m_limits.dailyTokens != 0)
+    {
+        _refreshToday();
+        remaining = std::min(remaining, _left(m_limits.dailyTokens, m_today.tokens()));
+    }
+    return remaining;
+}
+
+void UsageLedger::checkRoomFor(uint64_t tokens) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto check = [tokens](uint64_t limit, uint64_t used, const std::string &what) {
+        uint64_t left = _left(limit, used);
+        if (left == 0 || tokens > left)
+        {
+            throw UsageLimitExceeded(what + " token limit reached: " + std::to_string(used) + " of " +
+                                     std::to_string(limit) + " tokens used, and this request needs about " +
+                                     std::to_string(tokens) + ".");
+        }
+    };
+    if (m_limits.sessionTokens != 0)
+    {
+        check(m_limits.sessionTokens, m_session.tokens(), "Session");
+    }
+    if (m_limits.dailyTokens != 0)
+    {
+        _refreshToday();
+        check(m_limits.dailyTokens, m_today.tokens(), "Daily");
+    }
+}
+
+UsageLimits UsageLedger::limits() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_limits;
+}
+
+void UsageLedger::setLimits(UsageLimits limits)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_limits = limits;
+}
+
+const std::filesystem::path &UsageLedger::path() const
+{
+    return m_path;
+}
+
+void UsageLedger::_refreshToday() const
+{
+    int64_t todayStart = _localMidnight(std::chrono::system_clock::now());
+    if (todayStart != m_todayStart)
+    {
+        m_todayStart = todayStart;
+        m_today = UsageTotals();
+        m_scanned = sizeof(kFileMagic);
+    }
+    if (m_fd < 0)
+    {
+        return;
+    }
+
+    // Only the records appended since the last look, by this process or another, are read
+    size_t size = _wholeRecords(_fileSize(m_fd, m_path));
+    if (size <= m_scanned)
+    {
+        return;
+    }
+    _Records file(m_fd, size, m_path);
+    size_t first = (m_scanned - sizeof(kFileMagic)) / sizeof(UsageRecord);
+    UsageTotals added = _sum(file.records + first, file.count - first, m_todayStart, INT64_MAX);
+    m_today.requests += added.requests;
+    m_today.promptTokens += added.promptTokens;
+    m_today.completionTokens += added.completionTokens;
+    m_today.cachedTokens += added.cachedTokens;
+    m_scanned = size;
+}
+
+UsageLedger &sharedUsageLedger()
+{
+    // Never destroyed, like the other process-wide stores: a request may record into it at exit
+    static UsageLedger *ledger = []() -> UsageLedger * {
+        UsageLimits limits{_limitFromEnvironment("CHATGPT_CLI_SESSION_TOKEN_LIMIT"),
+                           _limitFromEnvironment("CHATGPT_CLI_DAILY_TOKEN_LIMIT")};
+        std::filesystem::path file;
+        if (const char *configured = std::getenv("CHATGPT_CLI_USAGE_LEDGER"))
+        {
+            file = configured;
+        }
+        else if (const char *xdg = std::getenv("XDG_DATA_HOME"); xdg != nullptr && *xdg != '\0')
+        {
+            file = std::filesystem::path(xdg) / "chatgpt-cli" / "usage";
+        }
+        else if (const char *home = std::getenv("HOME"); home != nullptr && *home != '\0')
+        {
+            file = std::filesystem::path(home) / ".local" / "share" / "chatgpt-cli" / "usage";
+        }
+        if (file.empty())
+        {
+            return new UsageLedger({}, limits);
+        }
+        try
+        {
+            std::error_code error;
+            std::filesystem::create_directories(file.parent_path(), error);
+            return new UsageLedger(file, limits);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[ERROR] Usage ledger kept in memory only: " << e.what() << std::endl;
+            return new UsageLedger({}, limits);
+        }
+    }();
+    return *ledger;
+}
@@ -0,0 +1,150 @@
+//  usageledger.hpp
+//
+// Append-only ledger of the tokens each request used, with per-session and per-day limits
+
+#ifndef usageledger_hpp
+#define usageledger_hpp
+
+#include "responseparser.hpp"
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+/// @brief Token counts added up over a number of requests.
+struct UsageTotals
+{
+    uint64_t requests = 0;
+    uint64_t promptTokens = 0;
+    uint64_t completionTokens = 0;
+    uint64_t cachedTokens = 0; // Part of promptTokens: served from the API's prompt cache
+
+    /// @brief Prompt and completion tokens together, which is what the limits count.
+    uint64_t tokens() const
+    {
+        return promptTokens + completionTokens;
+    }
+};
+
+/// @brief Token limits of a UsageLedger; 0 means no limit.
+struct UsageLimits
+{
+    uint64_t sessionTokens = 0; // For the lifetime of the ledger, i.e. of this process
+    uint64_t dailyTokens = 0;   // For every process sharing the ledger file, since local midnight
+};
+
+/// @brief Thrown when a request would not fit in what the usage limits leave.
+class UsageLimitExceeded : public std::runtime_error
+{
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+/// @class UsageLedger
+/// @brief Records the "usage" of every response and keeps the running totals limits are checked against.
+///
+/// With a file, each request becomes one fixed-size 24-byte record (time, session, prompt,
+/// completion and cached tokens, in host byte order) appended after an 8-byte magic number.
+/// Appends are single O_APPEND writes, so several processes can share the file, and adding up
+/// any period is a scan over a memory mapping with no parsing. The day's total is kept up to
+/// date by reading only the records appended since it was last read, including those of other
+/// processes. Without a file the ledger only counts this session.
+///
+/// All methods may be called from any thread.
+class UsageLedger
+{
+  public:
+    /// What remainingTokens() returns when no limit is set
+    static constexpr uint64_t kUnlimited = std::numeric_limits<uint64_t>::max();
+
+    /**
+     * @brief Opens the ledger file at path for appending, creating it if missing.
+     * @param path The ledger file; empty to keep no record beyond this session.
+     * @param limits The token limits to enforce.
+     * @throws std::runtime_error if the file cannot be opened or is not a usage ledger.
+     */
+    explicit UsageLedger(const std::filesystem::path &path = {}, UsageLimits limits = {});
+    ~UsageLedger();
+    UsageLedger(const UsageLedger &) = delete;
+    UsageLedger &operator=(const UsageLedger &) = delete;
+
+    /**
+     * @brief Records the usage of one response.
+     * @param usage The token counts from the response.
+     * @param when When the response arrived.
+     */
+    void record(const ChatUsage &usage,
+                std::chrono::system_clock::time_point when = std::chrono::system_clock::now());
+
+    /**
+     * @brief Returns what this session has used.
+     */
+    UsageTotals session() const;
+
+    /**
+     * @brief Returns what every process sharing the file has used since local midnight.
+     */
+    UsageTotals today() const;
+
+    /**
+     * @brief Adds up every record in [from, to), from the file if there is one.
+     */
+    UsageTotals totals(std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to) const;
+
+    /**
+     * @brief Returns how many tokens the limits leave, or kUnlimited when none are set.
+     */
+    uint64_t remainingTokens() const;
+
+    /**
+     * @brief Checks that a request of tokens tokens fits in what the limits leave.
+     * @throws UsageLimitExceeded naming the limit that is in the way.
+     */
+    void checkRoomFor(uint64_t tokens) const;
+
+    /**
+     * @brief Returns the limits being enforced.
+     */
+    UsageLimits limits() const;
+
+    /**
+     * @brief Replaces the limits; the totals they are checked against are kept.
+     */
+    void setLimits(UsageLimits limits);
+
+    /**
+     * @brief Returns the ledger file, or an empty path when there is none.
+     */
+    const std::filesystem::path &path() const;
+
+  private:
+    std::filesystem::path m_path;
+    UsageLimits m_limits;
+    int m_fd = -1;
+    uint32_t m_sessionId; // Written with each record, so sessions can be told apart
+
+    mutable std::mutex m_mutex;
+    UsageTotals m_session;
+    mutable UsageTotals m_today;
+    mutable int64_t m_todayStart = 0; // Local midnight m_today counts from, in seconds since the epoch
+    mutable uint64_t m_scanned = 0;   // Bytes of the file already added to m_today
+
+    /**
+     * @brief Brings m_today up to date with the file and the current day. Called with m_mutex held.
+     */
+    void _refreshToday() const;
+};
+
+/**
+ * @brief Returns the process-wide usage ledger.
+ *
+ * The file is CHATGPT_CLI_USAGE_LEDGER, or "chatgpt-cli/usage" under $XDG_DATA_HOME (default
+ * ~/.local/share); an empty CHATGPT_CLI_USAGE_LEDGER keeps no file. CHATGPT_CLI_SESSION_TOKEN_LIMIT
+ * and CHATGPT_CLI_DAILY_TOKEN_LIMIT set the limits (default none). Read once.
+ */
+UsageLedger &sharedUsageLedger();
+
+#endif /* usageledger_hpp */
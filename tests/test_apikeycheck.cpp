@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+#include "apikeycheck.hpp"
+#include "mockserver.hpp"
+#include "startupprofile.hpp"
+#include "testdirectory.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace {
+
+// A fresh cache file per test; the check itself goes to a local MockOpenAIServer
+class ApiKeyCheckTest : public TempDirectoryTest {
+  protected:
+    std::filesystem::path path;
+
+    void SetUp() override {
+        TempDirectoryTest::SetUp();
+        path = directory / "validated-keys";
+    }
+
+    void TearDown() override {
+        unsetenv("OPENAI_BASE_URL");
+        TempDirectoryTest::TearDown();
+    }
+
+    void use(const MockOpenAIServer &server) {
+        setenv("OPENAI_BASE_URL", server.baseUrl().c_str(), 1);
+        setenv("NO_PROXY", "127.0.0.1", 1);
+    }
+};
+
+} // namespace
+
+TEST_F(ApiKeyCheckTest, CacheEntriesExpireAndNeverContainTheKey) {
+    KeyValidationCache cache(path, std::chrono::hours(1));
+    auto now = KeyValidationCache::Clock::now();
+    EXPECT_FALSE(cache.isFresh("https://api", "sk-secret", now));
+
+    cache.remember("https://api", "sk-secret", now);
+    EXPECT_TRUE(cache.isFresh("https://api", "sk-secret", now + std::chrono::minutes(59)));
+    EXPECT_FALSE(cache.isFresh("https://api", "sk-secret", now + std::chrono::minutes(61)));
+    EXPECT_FALSE(cache.isFresh("https://other", "sk-secret", now));
+    EXPECT_FALSE(cache.isFresh("https://api", "sk-other", now));
+
+    std::ifstream in(path);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(contents.find("sk-secret"), std::string::npos);
+    EXPECT_EQ(contents.size(), 64u + 1 + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(
+                                                             now.time_since_epoch())
+                                                             .count())
+                                           .size() +
+                                   1);
+
+    // Remembering another key later drops the expired entry
+    cache.remember("https://api", "sk-other", now + std::chrono::hours(2));
+    EXPECT_TRUE(cache.isFresh("https://api", "sk-other", now + std::chrono::hours(2)));
+    cache.forget("https://api", "sk-other");
+    EXPECT_FALSE(cache.isFresh("https://api", "sk-other", now + std::chrono::hours(2)));
+    EXPECT_EQ(std::filesystem::file_size(path), 0u);
+}
+
+TEST_F(ApiKeyCheckTest, ValidKeysAreCachedAndNotCheckedAgain) {
+    MockServerOptions options;
+    options.apiKey = "key-check-valid";
+    MockOpenAIServer server(options);
+    use(server);
+    KeyValidationCache cache(path, std::chrono::hours(1));
+
+    KeyCheckResult result = checkApiKeys({"key-check-valid"}, &cache);
+    EXPECT_EQ(result.status, KeyCheckResult::Status::Valid);
+    EXPECT_FALSE(result.fromCache);
+    EXPECT_EQ(server.stats().requests, 1u);
+
+    result = checkApiKeys({"key-check-valid"}, &cache);
+    EXPECT_EQ(result.status, KeyCheckResult::Status::Valid);
+    EXPECT_TRUE(result.fromCache);
+    EXPECT_EQ(server.stats().requests, 1u);
+}
+
+TEST_F(ApiKeyCheckTest, RejectedKeysAreReportedAndForgotten) {
+    MockServerOptions options;
+    options.apiKey = "key-check-right";
+    MockOpenAIServer server(options);
+    use(server);
+    KeyValidationCache cache(path, std::chrono::hours(1));
+
+    KeyCheckResult result = checkApiKeys({"key-check-right", "key-check-wrong"}, &cache);
+    EXPECT_EQ(result.status, KeyCheckResult::Status::Invalid);
+    EXPECT_NE(result.message.find("key 2 of 2"), std::string::npos);
+    EXPECT_TRUE(cache.isFresh(server.baseUrl(), "key-check-right"));
+    EXPECT_FALSE(cache.isFresh(server.baseUrl(), "key-check-wrong"));
+
+    // Only the key that was not validated is checked again
+    result = checkApiKeys({"key-check-right", "key-check-wrong"}, &cache);
+    EXPECT_EQ(result.status, KeyCheckResult::Status::Invalid);
+    EXPECT_EQ(server.stats().requests, 3u);
+}
+
+TEST_F(ApiKeyCheckTest, UnreachableApiIsNotCached) {
+    uint16_t port;
+    {
+        MockOpenAIServer server;
+        port = server.port();
+    }
+    setenv("OPENAI_BASE_URL", ("http://127.0.0.1:" + std::to_string(port) + "/v1").c_str(), 1);
+    setenv("NO_PROXY", "127.0.0.1", 1);
+    KeyValidationCache cache(path, std::chrono::hours(1));
+
+    KeyCheckResult result = checkApiKeys({"key-check-offline"}, &cache);
+    EXPECT_EQ(result.status, KeyCheckResult::Status::Unreachable);
+    EXPECT_FALSE(std::filesystem::exists(path));
+
+    EXPECT_EQ(checkApiKeys({}, &cache).status, KeyCheckResult::Status::Missing);
+}
+
+TEST(StartupProfileTest, ReportsPhasesInOrder) {
+    StartupProfile profile;
+    auto start = processStartTime();
+    profile.mark("main", start + std::chrono::milliseconds(2));
+    profile.mark("first frame", start + std::chrono::milliseconds(7));
+    EXPECT_DOUBLE_EQ(profile.millisecondsTo("first frame"), 7.0);
+    EXPECT_LT(profile.millisecondsTo("never"), 0.0);
+    EXPECT_EQ(profile.report(), "Startup profile (ms since process start): main 2.0, first frame 7.0 (+5.0)");
+}
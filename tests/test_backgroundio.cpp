@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "command.hpp"
+#include "filereadwrite.hpp"
+#include "testdirectory.hpp"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Installs a runner that queues file jobs and posted tasks until the test runs them, standing
+// in for the I/O thread and the UI loop; restores the inline runner afterwards
+class BackgroundIoTest : public TempDirectoryTest {
+  protected:
+    std::filesystem::path root;
+    std::vector<BackgroundJob> ioJobs;
+    std::vector<std::function<void()>> posted;
+    std::vector<std::string> progress;
+
+    void SetUp() override {
+        TempDirectoryTest::SetUp();
+        root = directory;
+        setCommandRunner({[](BackgroundJob job) {
+                              std::atomic<bool> notCancelled{false};
+                              job(notCancelled);
+                          },
+                          [this](std::function<void()> task) { posted.push_back(std::move(task)); },
+                          [this](BackgroundJob job) { ioJobs.push_back(std::move(job)); },
+                          [this](std::string line) { progress.push_back(std::move(line)); }});
+    }
+
+    void TearDown() override {
+        setCommandRunner({[](BackgroundJob job) {
+                              std::atomic<bool> notCancelled{false};
+                              job(notCancelled);
+                          },
+                          [](std::function<void()> task) { task(); }});
+        TempDirectoryTest::TearDown();
+    }
+
+    void runIoJobs() {
+        std::atomic<bool> notCancelled{false};
+        for (size_t i = 0; i < ioJobs.size(); ++i) {
+            ioJobs[i](notCancelled);
+        }
+        ioJobs.clear();
+    }
+
+    void runPosted() {
+        for (size_t i = 0; i < posted.size(); ++i) {
+            posted[i]();
+        }
+        posted.clear();
+    }
+
+    std::string read(const std::filesystem::path &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+};
+
+} // namespace
+
+TEST_F(BackgroundIoTest, SaveWritesTheHistoryAsItWasWhenIssued) {
+    ChatHistory history;
+    history.addDialog("user", "question");
+    history.addDialog("assistant", "answer");
+    std::string file = (root / "chat.txt").string();
+
+    saveCommand(file, history);
+    EXPECT_TRUE(ioJobs.size() == 1 && !std::filesystem::exists(file)); // Nothing written on the caller's thread
+    history.appendToLastDialog(" grown later");
+    history.addDialog("user", "next turn");
+
+    runIoJobs();
+    EXPECT_EQ(read(file), "user: question\nassistant: answer\n");
+    EXPECT_EQ(progress.back(), ""); // Progress line taken down
+    ASSERT_EQ(posted.size(), 1u);
+    runPosted();
+    EXPECT_EQ(history[history.size() - 1].message, "Chat history saved to " + file);
+}
+
+TEST_F(BackgroundIoTest, SaveReportsWriteErrors) {
+    ChatHistory history;
+    history.addDialog("user", "question");
+    saveCommand((root / "missing" / "chat.txt").string(), history);
+    runIoJobs();
+    runPosted();
+    EXPECT_EQ(history[history.size() - 1].role, Role::Error);
+}
+
+TEST_F(BackgroundIoTest, ReadfileAddsTheFilesOnceRead) {
+    std::ofstream(root / "a.txt") << "alpha";
+    std::ofstream(root / "b.txt") << "beta";
+    ChatHistory history;
+    readfileCommand({(root / "*.txt").string(), (root / "none.txt").string()}, history);
+    EXPECT_TRUE(readfileInProgress());
+    EXPECT_EQ(history.size(), 0u);
+
+    runIoJobs();
+    EXPECT_TRUE(readfileInProgress()); // Until the posted batches reach the history
+    runPosted();
+    EXPECT_FALSE(readfileInProgress());
+    ASSERT_EQ(history.size(), 4u);
+    EXPECT_EQ(history[0].role, Role::Error); // The unmatched pattern, reported first
+    EXPECT_EQ(history[1].message, "File: " + (root / "a.txt").string() + "\n\nalpha");
+    EXPECT_EQ(history[2].message, "File: " + (root / "b.txt").string() + "\n\nbeta");
+    EXPECT_EQ(history[3].message.substr(0, 19), "Read 2 files (9 byt");
+}
+
+TEST_F(BackgroundIoTest, AutosaveWritesOnlyWhenTheHistoryChanged) {
+    std::filesystem::path file = root / "autosave.txt";
+    ChatHistory history;
+    history.addDialog("user", "one");
+    autosaveHistory(file, history);
+    ASSERT_EQ(ioJobs.size(), 1u);
+    runIoJobs();
+    runPosted();
+    EXPECT_EQ(read(file), "user: one\n");
+    EXPECT_EQ(history.size(), 1u); // Quiet on success
+
+    autosaveHistory(file, history);
+    EXPECT_TRUE(ioJobs.empty());
+
+    history.appendToLastDialog(" more");
+    autosaveHistory(file, history);
+    runIoJobs();
+    runPosted();
+    EXPECT_EQ(read(file), "user: one more\n");
+
+    // A failure is reported once, however often it is retried
+    std::filesystem::path unwritable = root / "missing" / "autosave.txt";
+    history.addDialog("user", "two");
+    for (int i = 0; i < 3; ++i) {
+        autosaveHistory(unwritable, history);
+        runIoJobs();
+        runPosted();
+    }
+    EXPECT_EQ(history.size(), 3u);
+    EXPECT_EQ(history[2].role, Role::Error);
+    autosaveHistory(file, history);
+    runIoJobs();
+    runPosted();
+    EXPECT_EQ(history.size(), 3u);
+}
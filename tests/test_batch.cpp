@@ -0,0 +1,211 @@
+#include <gtest/gtest.h>
+#include "batch.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <netinet/in.h>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// Chat completions stand-in: one thread per connection, replies with the last message's content
+// reversed after sleeping the number of milliseconds given by a "sleep:<ms>" prefix
+class CompletionServer {
+  public:
+    CompletionServer() {
+        m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(m_listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        listen(m_listenFd, 64);
+        socklen_t length = sizeof(addr);
+        getsockname(m_listenFd, reinterpret_cast<sockaddr *>(&addr), &length);
+        m_port = ntohs(addr.sin_port);
+
+        m_acceptThread = std::thread([this] {
+            while (true) {
+                int clientFd = accept(m_listenFd, nullptr, nullptr);
+                if (clientFd < 0) {
+                    break;
+                }
+                m_workers.emplace_back([this, clientFd] { serve(clientFd); });
+            }
+        });
+    }
+
+    ~CompletionServer() {
+        shutdown(m_listenFd, SHUT_RDWR);
+        close(m_listenFd);
+        m_acceptThread.join();
+        for (std::thread &worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    std::string url() const {
+        return "http://127.0.0.1:" + std::to_string(m_port) + "/v1/chat/completions";
+    }
+
+    int maxConcurrent() const {
+        return m_maxConcurrent;
+    }
+
+  private:
+    int m_listenFd = -1;
+    int m_port = 0;
+    std::thread m_acceptThread;
+    std::vector<std::thread> m_workers;
+    std::atomic<int> m_concurrent{0};
+    std::atomic<int> m_maxConcurrent{0};
+
+    void serve(int clientFd) {
+        std::string buffer;
+        char chunk[4096];
+        while (true) {
+            size_t headerEnd;
+            while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t n = recv(clientFd, chunk, sizeof(chunk), 0);
+                if (n <= 0) {
+                    close(clientFd);
+                    return;
+                }
+                buffer.append(chunk, n);
+            }
+            size_t lengthAt = buffer.find("Content-Length: ");
+            size_t contentLength = lengthAt < headerEnd ? std::stoul(buffer.substr(lengthAt + 16)) : 0;
+            while (buffer.size() < headerEnd + 4 + contentLength) {
+                ssize_t n = recv(clientFd, chunk, sizeof(chunk), 0);
+                if (n <= 0) {
+                    close(clientFd);
+                    return;
+                }
+                buffer.append(chunk, n);
+            }
+            std::string body = buffer.substr(headerEnd + 4, contentLength);
+            buffer.erase(0, headerEnd + 4 + contentLength);
+
+            int now = ++m_concurrent;
+            int seen = m_maxConcurrent;
+            while (now > seen && !m_maxConcurrent.compare_exchange_weak(seen, now)) {
+            }
+
+            std::string content = nlohmann::json::parse(body)["messages"].back()["content"];
+            if (content.rfind("sleep:", 0) == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(std::stoi(content.substr(6))));
+            }
+            std::reverse(content.begin(), content.end());
+            nlohmann::json reply = {{"choices", {{{"message", {{"role", "assistant"}, {"content", content}}}}}}};
+            std::string replyBody = reply.dump();
+            std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+                                   std::to_string(replyBody.size()) + "\r\n\r\n" + replyBody;
+            --m_concurrent;
+            send(clientFd, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+    }
+};
+
+std::vector<nlohmann::json> parseLines(const std::string &output) {
+    std::vector<nlohmann::json> results;
+    std::istringstream lines(output);
+    std::string line;
+    while (std::getline(lines, line)) {
+        results.push_back(nlohmann::json::parse(line));
+    }
+    return results;
+}
+
+BatchOptions localOptions(const CompletionServer &server, size_t maxInFlight, bool completionOrder) {
+    setenv("NO_PROXY", "127.0.0.1", 1);
+    BatchOptions options;
+    options.url = server.url();
+    options.maxInFlight = maxInFlight;
+    options.completionOrder = completionOrder;
+    return options;
+}
+
+} // namespace
+
+TEST(BatchTest, WritesResultsInInputOrder) {
+    CompletionServer server;
+    std::istringstream input("{\"id\": \"slow\", \"prompt\": \"sleep:150\"}\n"
+                             "\n"
+                             "{\"prompt\": \"abc\"}\n"
+                             "{\"messages\": [{\"role\": \"system\", \"content\": \"Be brief.\"},"
+                             " {\"role\": \"user\", \"content\": \"xyz\"}]}\n");
+    std::ostringstream output;
+    BatchReport report = runBatch(input, output, localOptions(server, 4, false));
+
+    std::vector<nlohmann::json> results = parseLines(output.str());
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(results[0]["index"], 0);
+    EXPECT_EQ(results[0]["id"], "slow");
+    EXPECT_EQ(results[0]["content"], "051:peels");
+    EXPECT_EQ(results[1]["content"], "cba");
+    EXPECT_EQ(results[2]["content"], "zyx");
+    EXPECT_EQ(report.requests, 3u);
+    EXPECT_EQ(report.failed, 0u);
+    EXPECT_GE(report.percentile(100), 150.0);
+}
+
+TEST(BatchTest, CompletionOrderWritesFastResultsFirst) {
+    CompletionServer server;
+    std::istringstream input("{\"prompt\": \"sleep:200\"}\n{\"prompt\": \"fast\"}\n");
+    std::ostringstream output;
+    runBatch(input, output, localOptions(server, 2, true));
+
+    std::vector<nlohmann::json> results = parseLines(output.str());
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0]["index"], 1);
+    EXPECT_EQ(results[1]["index"], 0);
+}
+
+TEST(BatchTest, RespectsInFlightLimit) {
+    CompletionServer server;
+    std::string lines;
+    for (int i = 0; i < 12; ++i) {
+        lines += "{\"prompt\": \"sleep:30\"}\n";
+    }
+    std::istringstream input(lines);
+    std::ostringstream output;
+    BatchReport report = runBatch(input, output, localOptions(server, 3, false));
+
+    EXPECT_EQ(report.requests, 12u);
+    EXPECT_EQ(report.failed, 0u);
+    EXPECT_LE(server.maxConcurrent(), 3);
+    EXPECT_GE(server.maxConcurrent(), 2);
+    EXPECT_EQ(parseLines(output.str()).size(), 12u);
+}
+
+TEST(BatchTest, InvalidLinesAreReportedInPlace) {
+    CompletionServer server;
+    std::istringstream input("not json\n{\"messages\": [{\"role\": \"assistant\", \"content\": \"hi\"}]}\n"
+                             "{\"prompt\": \"ok\"}\n");
+    std::ostringstream output;
+    BatchReport report = runBatch(input, output, localOptions(server, 2, false));
+
+    std::vector<nlohmann::json> results = parseLines(output.str());
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_TRUE(results[0].contains("error"));
+    EXPECT_TRUE(results[1].contains("error"));
+    EXPECT_EQ(results[2]["content"], "ko");
+    EXPECT_EQ(report.failed, 2u);
+}
+
+TEST(BatchTest, PercentilesUseNearestRank) {
+    BatchReport report;
+    for (int i = 1; i <= 100; ++i) {
+        report.latenciesMs.push_back(i);
+    }
+    EXPECT_EQ(report.percentile(50), 50);
+    EXPECT_EQ(report.percentile(95), 95);
+    EXPECT_EQ(report.percentile(99), 99);
+    EXPECT_EQ(BatchReport().percentile(50), 0);
+}
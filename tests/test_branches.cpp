@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+#include "branches.hpp"
+#include "chathistory.hpp"
+#include "command.hpp"
+#include "commandcontext.hpp"
+#include "sessionjournal.hpp"
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+ChatHistory conversation(int turns) {
+    ChatHistory history;
+    for (int i = 0; i < turns; ++i) {
+        history.addDialog("user", "question " + std::to_string(i));
+        history.addDialog("assistant", "answer " + std::to_string(i));
+    }
+    return history;
+}
+
+void run(const std::string &input, ChatHistory &history) {
+    history.addDialog("user", input); // As the UI does before handling a command
+    CommandContext context;
+    context.setCommandAndArgs(input);
+    handleCommand(context, history);
+}
+
+} // namespace
+
+TEST(ChatHistoryBranchTest, PrefixSharesEntriesAndDiverges) {
+    ChatHistory history = conversation(50);
+    ChatHistory fork = history.prefix(7);
+    ASSERT_EQ(fork.size(), 7u);
+    EXPECT_EQ(fork[6].message, "question 3");
+    EXPECT_EQ(fork[6].id, history[6].id);
+    EXPECT_EQ(ChatHistory::sharedPrefix(history, fork), 7u);
+
+    fork.addDialog("assistant", "a different answer");
+    history.appendToLastDialog(" (edited)");
+    EXPECT_EQ(fork[7].message, "a different answer");
+    EXPECT_NE(fork[7].id, history[7].id);
+    EXPECT_EQ(history[7].message, "answer 3");
+    EXPECT_EQ(history[99].message, "answer 49 (edited)");
+    EXPECT_EQ(ChatHistory::sharedPrefix(history, fork), 7u);
+    EXPECT_EQ(ChatHistory::sharedPrefix(history, history.prefix(99)), 99u);
+
+    // A grown message is no longer shared, though its id is
+    ChatHistory copy = history;
+    copy.appendToLastDialog("!");
+    EXPECT_EQ(ChatHistory::sharedPrefix(history, copy), 99u);
+
+    ChatHistory reference;
+    for (size_t i = 0; i < fork.size(); ++i) {
+        reference.addDialog(fork[i].participant, fork[i].message);
+    }
+    EXPECT_EQ(fork.buildRequestPayload("gpt-4o", false), reference.buildRequestPayload("gpt-4o", false));
+    EXPECT_EQ(history.prefix(0).buildRequestPayload("gpt-4o", true), reference.prefix(0).buildRequestPayload("gpt-4o", true));
+}
+
+TEST(ChatHistoryBranchTest, ReplaceWithJournalsOnlyTheDivergence) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() /
+                                 ("chatgpt_cli_branch_journal_" + std::to_string(getpid()));
+    ChatHistory history;
+    {
+        SessionJournal journal(path, true);
+        history.setJournal(&journal);
+        history.replaceWith(conversation(20));
+        EXPECT_EQ(journal.stats().records, 40u);
+        ChatHistory other = history.prefix(30);
+        other.addDialog("user", "another question");
+
+        history.replaceWith(other);
+        EXPECT_EQ(journal.stats().records, 40u + 10u + 1u); // Ten removed, one added
+        EXPECT_EQ(history.journal(), &journal);
+        history.addDialog("assistant", "another answer");
+        history.setJournal(nullptr);
+    }
+
+    ChatHistory resumed;
+    replaySessionJournal(path, resumed);
+    EXPECT_EQ(resumed.toString(), history.toString());
+    std::filesystem::remove(path);
+}
+
+TEST(ConversationBranchesTest, ForksListsAndSwitches) {
+    ConversationBranches branches;
+    ChatHistory active = conversation(10);
+
+    branches.fork("alt", active, 4);
+    EXPECT_EQ(branches.activeName(), "alt");
+    ASSERT_EQ(active.size(), 4u);
+    active.addDialog("user", "alternative question");
+    EXPECT_THROW(branches.fork("main", active, 1), std::invalid_argument);
+    EXPECT_THROW(branches.fork("big", active, 6), std::invalid_argument);
+
+    std::vector<BranchInfo> list = branches.list(active);
+    ASSERT_EQ(list.size(), 2u);
+    EXPECT_EQ(list[0].name, "alt");
+    EXPECT_TRUE(list[0].active);
+    EXPECT_EQ(list[0].messages, 5u);
+    EXPECT_EQ(list[1].name, "main");
+    EXPECT_EQ(list[1].messages, 20u);
+    EXPECT_EQ(list[1].shared, 4u);
+
+    branches.switchTo("main", active);
+    EXPECT_EQ(active.size(), 20u);
+    EXPECT_EQ(active[19].message, "answer 9");
+    branches.switchTo("alt", active);
+    EXPECT_EQ(active[4].message, "alternative question");
+    EXPECT_THROW(branches.switchTo("missing", active), std::invalid_argument);
+}
+
+TEST(ConversationBranchesTest, CommandsDropTheirOwnLines) {
+    sharedBranches().clear();
+    ChatHistory history = conversation(3);
+
+    run("%fork retry 2", history);
+    EXPECT_EQ(sharedBranches().activeName(), "retry");
+    ASSERT_EQ(history.size(), 3u);
+    EXPECT_EQ(history[1].message, "answer 0");
+    EXPECT_EQ(history[2].role, Role::System);
+
+    run("%fork again", history);
+    ASSERT_EQ(history.size(), 4u); // The branch it came from, without the %fork line, plus a status
+    run("%branches", history);
+    std::string list(history[history.size() - 1].message);
+    EXPECT_NE(list.find("* again"), std::string::npos);
+    EXPECT_NE(list.find("main"), std::string::npos);
+    EXPECT_NE(list.find("retry"), std::string::npos);
+
+    run("%switch main", history);
+    ASSERT_EQ(history.size(), 7u);
+    EXPECT_EQ(history[5].message, "answer 2");
+    EXPECT_NE(std::string(history[6].message).find("Switched to main"), std::string::npos);
+
+    run("%switch nowhere", history);
+    EXPECT_EQ(history[history.size() - 1].role, Role::Error);
+    run("%fork main", history);
+    EXPECT_EQ(history[history.size() - 1].role, Role::Error);
+    run("%fork x notanumber", history);
+    EXPECT_EQ(history[history.size() - 1].message, "Usage: %fork <name> [messages]");
+    sharedBranches().clear();
+}
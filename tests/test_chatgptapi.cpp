@@ -2,6 +2,7 @@
 #include "chatgptapi.hpp"
 #include "chathistory.hpp"
 #include <string>
+#include <vector>
 #include <nlohmann/json.hpp> // For JSON manipulation
 
 // Mock request function to simulate OpenAI API response
@@ -106,4 +107,46 @@ TEST(ChatGPTAPITest, HandlesAPIErrorResponse) {
     EXPECT_EQ(output.find("assistant:"), std::string::npos); // No assistant message added
 }
 
+// Mock streaming request function that emits the reply in three deltas
+std::string mockStreamRequest(const std::string& input, ChatHistory& chatHistory, const DeltaFn& onDelta) {
+    chatHistory.addDialog("user", input);
+    onDelta("Streamed ");
+    onDelta("reply to: ");
+    onDelta(input);
+    return "";
+}
+
+TEST(ChatGPTAPITest, StreamsDeltasAndStoresFullReply) {
+    ChatHistory history;
+    std::vector<std::string> deltas;
+    std::string reply = streamChatGPTAPI("Hello?", history,
+                                         [&](const std::string& delta) { deltas.push_back(delta); },
+                                         mockStreamRequest);
+
+    ASSERT_EQ(deltas.size(), 3u);
+    EXPECT_EQ(deltas[0], "Streamed ");
+    EXPECT_EQ(reply, "Streamed reply to: Hello?");
+    EXPECT_EQ(history.toString(), "user: Hello?\nassistant: Streamed reply to: Hello?\n");
+}
+
+TEST(ChatGPTAPITest, StreamFallsBackToErrorBody) {
+    ChatHistory history;
+    std::streambuf* oldCerr = std::cerr.rdbuf();
+    std::ostringstream newCerr;
+    std::cerr.rdbuf(newCerr.rdbuf());
+
+    int deltaCalls = 0;
+    std::string reply = streamChatGPTAPI("Hello?", history,
+                                         [&](const std::string&) { ++deltaCalls; },
+                                         [](const std::string& input, ChatHistory& h, const DeltaFn&) {
+                                             return mockErrorRequest(input, h);
+                                         });
+    std::cerr.rdbuf(oldCerr);
+
+    EXPECT_EQ(deltaCalls, 0);
+    EXPECT_TRUE(reply.empty());
+    EXPECT_NE(newCerr.str().find("[OPENAI API ERROR] Test API error"), std::string::npos);
+    EXPECT_EQ(history.toString().find("assistant:"), std::string::npos);
+}
+
 // You can add more tests for error cases, empty input, etc.
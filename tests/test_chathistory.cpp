@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include "chathistory.hpp"
+#include <string>
+#include <vector>
 
 TEST(ChatHistoryTest, AddDialogIncreasesSizeAndContent) {
     ChatHistory history;
@@ -56,4 +58,98 @@ TEST(ChatHistoryTest, ToStringBasicFormatting) {
     EXPECT_EQ(history.toString(), "user: Hello\nassistant: Hi\n");
 }
 
+TEST(ChatHistoryTest, AppendToLastDialogGrowsLastMessage) {
+    ChatHistory history;
+    history.addDialog("user", "Hi");
+    history.addDialog("assistant", "Hel");
+    history.appendToLastDialog("lo");
+    history.appendToLastDialog("!");
+    EXPECT_EQ(history.toString(), "user: Hi\nassistant: Hello!\n");
+}
+
+TEST(ChatHistoryTest, AppendToDialogOnlyGrowsThatEntryWhileItIsLast) {
+    ChatHistory history;
+    history.addDialog("assistant", "Hel");
+    uint32_t reply = history[0].id;
+    EXPECT_TRUE(history.appendToDialog(reply, "lo"));
+    history.addDialog("user", "%tokens");
+    EXPECT_FALSE(history.appendToDialog(reply, "!"));
+    EXPECT_EQ(history.toString(), "assistant: Hello\nuser: %tokens\n");
+    history.removeLastDialog();
+    history.removeLastDialog();
+    EXPECT_FALSE(history.appendToDialog(reply, "!"));
+}
+
+TEST(ChatHistoryTest, AppendToLastDialogOnEmptyHistory) {
+    ChatHistory history;
+    EXPECT_NO_THROW(history.appendToLastDialog("text"));
+    EXPECT_EQ(history.toString().empty(), true);
+}
+
+TEST(ChatHistoryTest, IteratorYieldsRolesAndViews) {
+    ChatHistory history;
+    history.addDialog("user", "Hello!");
+    history.addDialog("assistant", "Hi there!");
+    history.addDialog("tool", "Custom participant");
+
+    std::vector<Dialog> dialogs;
+    for (const auto &dialog : history) {
+        dialogs.push_back(dialog);
+    }
+    ASSERT_EQ(dialogs.size(), 3u);
+    EXPECT_EQ(dialogs[0].role, Role::User);
+    EXPECT_EQ(dialogs[0].message, "Hello!");
+    EXPECT_EQ(dialogs[1].role, Role::Assistant);
+    EXPECT_EQ(dialogs[1].participant, "assistant");
+    EXPECT_EQ(dialogs[2].participant, "tool");
+    EXPECT_EQ(history[2].message, "Custom participant");
+}
+
+TEST(ChatHistoryTest, RejectsNewParticipantNamesPastTheCap) {
+    ChatHistory history;
+    for (size_t i = 4; i < ChatHistory::kMaxRoleNames; ++i) {
+        history.addDialog("participant " + std::to_string(i), "hello");
+    }
+    EXPECT_EQ(history.size(), ChatHistory::kMaxRoleNames - 4);
+    history.addDialog("one too many", "dropped");
+    history.addDialog("participant 4", "kept"); // Names already interned are still accepted
+    ASSERT_EQ(history.size(), ChatHistory::kMaxRoleNames - 3);
+    EXPECT_EQ(history[history.size() - 1].participant, "participant 4");
+    EXPECT_EQ(history[history.size() - 1].message, "kept");
+}
+
+TEST(ChatHistoryTest, MessagesSpanningChunks) {
+    ChatHistory history;
+    const std::string large(ChatHistory::kChunkSize + 10, 'x');
+    const std::string medium(ChatHistory::kChunkSize / 2 + 1, 'y');
+    history.addDialog("user", medium);
+    history.addDialog("assistant", medium); // Does not fit after the first one
+    history.addDialog("user", large);       // Larger than a chunk
+    history.addDialog("assistant", "tail");
+
+    EXPECT_EQ(history.size(), 4u);
+    EXPECT_EQ(history[0].message, medium);
+    EXPECT_EQ(history[1].message, medium);
+    EXPECT_EQ(history[2].message, large);
+    EXPECT_EQ(history[3].message, "tail");
+
+    history.removeLastDialog();
+    history.removeLastDialog();
+    history.appendToLastDialog("z");
+    EXPECT_EQ(history[1].message, medium + "z");
+    history.addDialog("user", "after");
+    EXPECT_EQ(history.toString(), "user: " + medium + "\nassistant: " + medium + "z\nuser: after\n");
+}
+
+TEST(ChatHistoryTest, CopiesAreIndependent) {
+    ChatHistory history;
+    history.addDialog("user", "shared");
+    ChatHistory copy = history;
+    copy.appendToLastDialog(" copy");
+    copy.addDialog("assistant", "only in copy");
+    history.addDialog("assistant", "only in original");
+    EXPECT_EQ(history.toString(), "user: shared\nassistant: only in original\n");
+    EXPECT_EQ(copy.toString(), "user: shared copy\nassistant: only in copy\n");
+}
+
 // Add more tests as you expand functionality!
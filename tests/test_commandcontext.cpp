@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "command.hpp"
 #include "commandcontext.hpp"
+#include <string>
 
 TEST(CommandContextTest, ParsesCommandOnly) {
     CommandContext ctx;
@@ -52,3 +55,67 @@ TEST(CommandContextTest, GetArgumentOutOfBounds) {
     EXPECT_EQ(ctx.getArgument(5), "");
 
 }
+
+TEST(CommandContextTest, QuotesGroupAndEscapesDecode) {
+    CommandContext ctx;
+    ctx.setCommandAndArgs("%save \"my chat.txt\" 'it''s' a\\ b\\\\c \"say \\\"hi\\\"\" \"\" dir\\name 'open end");
+    EXPECT_EQ(ctx.getCommand(), "%save");
+    ASSERT_EQ(ctx.getArgumentsSize(), 7u);
+    EXPECT_EQ(ctx.getArgument(0), "my chat.txt");
+    EXPECT_EQ(ctx.getArgument(1), "its");
+    EXPECT_EQ(ctx.getArgument(2), "a b\\c");
+    EXPECT_EQ(ctx.getArgument(3), "say \"hi\"");
+    EXPECT_EQ(ctx.getArgument(4), "");
+    EXPECT_EQ(ctx.getArgument(5), "dir\\name");
+    EXPECT_EQ(ctx.getArgument(6), "open end");
+}
+
+TEST(CommandContextTest, ReparsingAndCopyingKeepTokensValid) {
+    CommandContext ctx;
+    ctx.setCommandAndArgs("%readfile 'a long file name.txt' b.txt");
+    CommandContext copy = ctx;
+    ctx.setCommandAndArgs("%clear");
+    EXPECT_EQ(ctx.getCommand(), "%clear");
+    EXPECT_EQ(ctx.getArgumentsSize(), 0u);
+    ASSERT_EQ(copy.getArgumentsSize(), 2u);
+    EXPECT_EQ(copy.getArgument(0), "a long file name.txt");
+    EXPECT_EQ(copy.getArgument(1), "b.txt");
+}
+
+TEST(CommandRegistryTest, FindsEveryCommandAndNothingElse) {
+    for (const char *name : {"%save", "%readfile", "%load", "%clear", "%deletelast", "%printhistory", "%tokens",
+                             "%connections", "%cache", "%compare", "%stats", "%quit", "%help"}) {
+        const CommandSpec *spec = findCommand(name);
+        ASSERT_NE(spec, nullptr) << name;
+        EXPECT_EQ(spec->name, name);
+        EXPECT_NE(spec->handler, nullptr);
+    }
+    for (const char *name : {"", "%", "save", "%sav", "%saves", "%SAVE", "%unknown"}) {
+        EXPECT_EQ(findCommand(name), nullptr) << name;
+    }
+}
+
+TEST(CommandRegistryTest, ChecksArityAndGeneratesHelp) {
+    ChatHistory history;
+    CommandContext ctx;
+    ctx.setCommandAndArgs("%load");
+    handleCommand(ctx, history);
+    EXPECT_EQ(history[0].role, Role::Error);
+    EXPECT_EQ(history[0].message, "Usage: %load <journal>");
+
+    ctx.setCommandAndArgs("%clear everything");
+    handleCommand(ctx, history);
+    EXPECT_EQ(history[1].message, "Usage: %clear");
+
+    ctx.setCommandAndArgs("%nope");
+    handleCommand(ctx, history);
+    EXPECT_EQ(history[2].message, "Unknown command: %nope. Type %help for a list of commands.");
+
+    ctx.setCommandAndArgs("%help");
+    handleCommand(ctx, history);
+    std::string help(history[3].message);
+    EXPECT_EQ(help.find("***** HELP MENU *****"), 0u);
+    EXPECT_NE(help.find("%save [filename]    Saves your chat as a file.\n"), std::string::npos);
+    EXPECT_NE(help.find("%compare <models>   Asks several models"), std::string::npos);
+    EXPECT_LT(help.find("%quit"), help.find("%help  "));
+}
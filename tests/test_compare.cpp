@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "command.hpp"
+#include "commandcontext.hpp"
+#include "compare.hpp"
+#include "mockserver.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+// Points requests at a local MockOpenAIServer for the duration of a test
+class CompareTest : public ::testing::Test {
+  protected:
+    void use(const MockOpenAIServer &server) {
+        setenv("OPENAI_BASE_URL", server.baseUrl().c_str(), 1);
+        setenv("NO_PROXY", "127.0.0.1", 1);
+        setenv("OPENAI_KEY", "compare-test-key", 1);
+    }
+
+    void TearDown() override { unsetenv("OPENAI_BASE_URL"); }
+};
+
+} // namespace
+
+TEST_F(CompareTest, AsksEveryModelConcurrently) {
+    MockServerOptions options;
+    options.latencyMs = 300;
+    MockOpenAIServer server(options);
+    use(server);
+
+    ChatHistory history;
+    history.addDialog("user", "earlier question");
+    history.addDialog("assistant", "earlier answer");
+    std::vector<std::string> arrived;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ModelAnswer> answers = compareModels(
+        {"gpt-4o", "gpt-4o-mini", "o3-mini"}, "which is best?", history,
+        [&](const ModelAnswer &answer) { arrived.push_back(answer.model); });
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // Three 300 ms replies side by side, not one after another
+    EXPECT_LT(wallMs, 750);
+    ASSERT_EQ(answers.size(), 3u);
+    EXPECT_EQ(arrived.size(), 3u);
+    EXPECT_EQ(answers[1].model, "gpt-4o-mini");
+    for (const ModelAnswer &answer : answers) {
+        EXPECT_TRUE(answer.ok);
+        EXPECT_EQ(answer.text, "which is best?");
+        EXPECT_GE(answer.latencyMs, 300);
+        EXPECT_TRUE(answer.hasUsage);
+        EXPECT_GT(answer.usage.promptTokens, 0);
+    }
+    EXPECT_EQ(history.size(), 2u);
+
+    std::string summary = formatComparison(answers, wallMs);
+    EXPECT_NE(summary.find("o3-mini"), std::string::npos);
+    EXPECT_NE(summary.find("Compared 3 models in"), std::string::npos);
+}
+
+TEST_F(CompareTest, CommandReasksTheLastQuestion) {
+    MockOpenAIServer server;
+    use(server);
+
+    ChatHistory history;
+    history.addDialog("user", "what is 2 + 2?");
+    history.addDialog("assistant", "4");
+    history.addDialog("user", "%compare gpt-4o gpt-4o-mini");
+    CommandContext context;
+    context.setCommandAndArgs("%compare gpt-4o gpt-4o-mini");
+    handleCommand(context, history); // No runner installed, so it finishes before returning
+
+    // The command line, the notice, two answers and the summary
+    ASSERT_EQ(history.size(), 7u);
+    EXPECT_NE(std::string(history[4].message).find("what is 2 + 2?"), std::string::npos);
+    EXPECT_NE(std::string(history[6].message).find("Compared 2 models"), std::string::npos);
+
+    context.setCommandAndArgs("%compare gpt-4o -- a new prompt");
+    handleCommand(context, history);
+    EXPECT_NE(std::string(history[history.size() - 2].message).find("[gpt-4o]"), std::string::npos);
+    EXPECT_NE(std::string(history[history.size() - 2].message).find("a new prompt"), std::string::npos);
+
+    ChatHistory empty;
+    context.setCommandAndArgs("%compare gpt-4o");
+    handleCommand(context, empty);
+    EXPECT_EQ(empty[0].role, Role::Error);
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include "connectionpool.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+size_t discardBody(void *, size_t size, size_t nmemb, void *) {
+    return size * nmemb;
+}
+
+// Minimal HTTP/1.1 server that accepts one connection and answers `requests` requests on it
+class KeepAliveServer {
+  public:
+    explicit KeepAliveServer(int requests) {
+        m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(m_listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        listen(m_listenFd, 4);
+        socklen_t length = sizeof(addr);
+        getsockname(m_listenFd, reinterpret_cast<sockaddr *>(&addr), &length);
+        m_port = ntohs(addr.sin_port);
+
+        m_thread = std::thread([this, requests] {
+            int clientFd = accept(m_listenFd, nullptr, nullptr);
+            std::string buffer;
+            char chunk[1024];
+            for (int served = 0; served < requests && clientFd >= 0;) {
+                ssize_t n = recv(clientFd, chunk, sizeof(chunk), 0);
+                if (n <= 0) {
+                    break;
+                }
+                buffer.append(chunk, n);
+                size_t end;
+                while ((end = buffer.find("\r\n\r\n")) != std::string::npos) {
+                    buffer.erase(0, end + 4);
+                    const std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+                    send(clientFd, response.data(), response.size(), 0);
+                    ++served;
+                }
+            }
+            if (clientFd >= 0) {
+                close(clientFd);
+            }
+        });
+    }
+
+    ~KeepAliveServer() {
+        shutdown(m_listenFd, SHUT_RDWR);
+        close(m_listenFd);
+        m_thread.join();
+    }
+
+    std::string url() const {
+        return "http://127.0.0.1:" + std::to_string(m_port) + "/v1/models";
+    }
+
+  private:
+    int m_listenFd = -1;
+    int m_port = 0;
+    std::thread m_thread;
+};
+
+} // namespace
+
+TEST(ConnectionPoolTest, ReusesReleasedHandles) {
+    ConnectionPool &pool = ConnectionPool::instance();
+    CURL *first = nullptr;
+    {
+        ConnectionPool::Handle handle = pool.acquire("http://127.0.0.1/");
+        ASSERT_TRUE(handle);
+        first = handle.get();
+    }
+    ConnectionPool::Handle again = pool.acquire("http://127.0.0.1/");
+    EXPECT_EQ(again.get(), first);
+}
+
+TEST(ConnectionPoolTest, SecondRequestReusesConnection) {
+    KeepAliveServer server(2);
+    ConnectionPool &pool = ConnectionPool::instance();
+    ConnectionStats before = pool.stats();
+
+    for (int i = 0; i < 2; ++i) {
+        // Separate acquisitions: the connection must survive the handle going back to the pool
+        ConnectionPool::Handle handle = pool.acquire(server.url());
+        ASSERT_TRUE(handle);
+        curl_easy_setopt(handle.get(), CURLOPT_NOPROXY, "127.0.0.1");
+        curl_easy_setopt(handle.get(), CURLOPT_WRITEFUNCTION, discardBody);
+        CURLcode result = curl_easy_perform(handle.get());
+        ASSERT_EQ(result, CURLE_OK) << curl_easy_strerror(result);
+        pool.recordTransfer(handle.get(), result);
+    }
+
+    ConnectionStats after = pool.stats();
+    EXPECT_EQ(after.opened - before.opened, 1u);
+    EXPECT_EQ(after.reused - before.reused, 1u);
+}
+
+TEST(ConnectionPoolTest, FailedTransfersAreNotCounted) {
+    ConnectionPool &pool = ConnectionPool::instance();
+    ConnectionStats before = pool.stats();
+    ConnectionPool::Handle handle = pool.acquire("http://127.0.0.1/");
+    pool.recordTransfer(handle.get(), CURLE_COULDNT_CONNECT);
+    ConnectionStats after = pool.stats();
+    EXPECT_EQ(after.opened, before.opened);
+    EXPECT_EQ(after.reused, before.reused);
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include "corpusindex.hpp"
+#include "testdirectory.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+class CorpusIndexTest : public TempDirectoryTest {
+  protected:
+    std::filesystem::path root;
+    std::filesystem::path indexPath;
+
+    void SetUp() override {
+        TempDirectoryTest::SetUp();
+        root = directory / "tree";
+        indexPath = directory / "index.bm25";
+        std::filesystem::create_directories(root / "src");
+    }
+
+    void write(const std::string &name, const std::string &content) {
+        std::ofstream(root / name, std::ios::binary) << content;
+    }
+};
+
+TEST_F(CorpusIndexTest, RanksExcerptsByBm25) {
+    write("src/parser.cpp", "parser parser parser tokenizer\n");
+    write("src/lexer.cpp", "the lexer feeds the parser one token at a time\n");
+    write("notes.txt", "shopping list: milk, eggs\n");
+    CorpusBuildReport report = buildCorpusIndex(root, indexPath);
+    EXPECT_EQ(report.files, 3u);
+    EXPECT_EQ(report.chunks, 3u);
+
+    CorpusIndex index(indexPath);
+    EXPECT_EQ(index.root(), root);
+    EXPECT_EQ(index.files(), 3u);
+    std::vector<CorpusHit> hits = index.search("How does the Parser use the tokenizer?", 5);
+    ASSERT_EQ(hits.size(), 2u);
+    EXPECT_EQ(hits[0].path, root / "src/parser.cpp");
+    EXPECT_EQ(hits[0].text, "parser parser parser tokenizer\n");
+    EXPECT_EQ(hits[0].line, 1u);
+    EXPECT_EQ(hits[1].path, root / "src/lexer.cpp");
+    EXPECT_GT(hits[0].score, hits[1].score);
+
+    EXPECT_EQ(index.search("parser", 1).size(), 1u);
+    EXPECT_TRUE(index.search("unrelated words", 5).empty());
+}
+
+TEST_F(CorpusIndexTest, FindsPartsOfIdentifiersAndTheLineOfEachExcerpt) {
+    std::string source;
+    for (int i = 1; i < 40; ++i) {
+        source += "int filler" + std::to_string(i) + " = 0;\n";
+    }
+    source += "SearchQuery parseSearchQuery(const std::vector<std::string> &arguments);\n";
+    write("src/historyindex.hpp", source);
+    CorpusBuildOptions options;
+    options.chunkBytes = 128;
+    CorpusBuildReport report = buildCorpusIndex(root, indexPath, options);
+    EXPECT_GT(report.chunks, 5u);
+
+    CorpusIndex index(indexPath);
+    std::vector<CorpusHit> hits = index.search("where is the search query parsed", 1);
+    ASSERT_EQ(hits.size(), 1u);
+    EXPECT_NE(hits[0].text.find("parseSearchQuery"), std::string::npos);
+    size_t offset = source.find(hits[0].text);
+    ASSERT_NE(offset, std::string::npos);
+    EXPECT_EQ(hits[0].line, static_cast<size_t>(std::count(source.begin(), source.begin() + offset, '\n')) + 1);
+    EXPECT_GT(hits[0].line, 30u);
+}
+
+TEST_F(CorpusIndexTest, SkipsBinaryFilesAndLeavesOutChangedOnes) {
+    write("src/kept.cpp", "connection pool reuse\n");
+    write("src/changed.cpp", "connection pool connection pool\n");
+    write("image.bin", std::string("connection\0pool", 15));
+    CorpusBuildReport report = buildCorpusIndex(root, indexPath);
+    EXPECT_EQ(report.files, 2u);
+    EXPECT_EQ(report.skipped, 1u);
+
+    write("src/changed.cpp", "rewritten since\n");
+    CorpusIndex index(indexPath);
+    size_t stale = 0;
+    std::vector<CorpusHit> hits = index.search("connection pool", 5, &stale);
+    ASSERT_EQ(hits.size(), 1u);
+    EXPECT_EQ(hits[0].path, root / "src/kept.cpp");
+    EXPECT_EQ(stale, 1u);
+}
+
+TEST_F(CorpusIndexTest, RejectsWhatIsNotAnIndex) {
+    EXPECT_THROW(buildCorpusIndex(root / "missing", indexPath), std::runtime_error);
+    EXPECT_THROW(CorpusIndex index(indexPath), std::runtime_error);
+    std::ofstream(indexPath, std::ios::binary) << std::string(4096, 'x');
+    EXPECT_THROW(CorpusIndex index(indexPath), std::runtime_error);
+}
+
+TEST(CorpusIndexPathTest, NamesTheIndexByItsDirectory) {
+    const char *previous = std::getenv("CHATGPT_CLI_INDEX_DIR");
+    std::string saved = previous != nullptr ? previous : "";
+    setenv("CHATGPT_CLI_INDEX_DIR", "/tmp/indexes", 1);
+    std::filesystem::path first = corpusIndexPath("/srv/project");
+    EXPECT_EQ(first.parent_path(), "/tmp/indexes");
+    EXPECT_EQ(corpusIndexPath("/srv/project/"), first);
+    EXPECT_NE(corpusIndexPath("/srv/other"), first);
+    if (previous != nullptr) {
+        setenv("CHATGPT_CLI_INDEX_DIR", saved.c_str(), 1);
+    } else {
+        unsetenv("CHATGPT_CLI_INDEX_DIR");
+    }
+}
+
+} // namespace
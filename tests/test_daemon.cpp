@@ -0,0 +1,238 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "daemon.hpp"
+#include "mockserver.hpp"
+#include "testdirectory.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// Runs a daemon against a local MockOpenAIServer on a socket of its own for each test
+class DaemonTest : public TempDirectoryTest {
+  protected:
+    std::unique_ptr<MockOpenAIServer> server;
+    std::unique_ptr<ChatDaemon> daemon;
+    std::thread loop;
+    std::filesystem::path socketPath;
+
+    void start(const MockServerOptions &serverOptions = MockServerOptions()) {
+        server = std::make_unique<MockOpenAIServer>(serverOptions);
+        setenv("NO_PROXY", "127.0.0.1", 1);
+        setenv("OPENAI_KEY", "daemon-test-key", 1);
+        socketPath = directory / "daemon.sock";
+        DaemonOptions options;
+        options.socketPath = socketPath;
+        options.url = server->baseUrl() + "/chat/completions";
+        daemon = std::make_unique<ChatDaemon>(options);
+        loop = std::thread([this] { daemon->run(); });
+    }
+
+    void TearDown() override {
+        if (daemon) {
+            daemon->stop();
+            loop.join();
+            daemon.reset();
+            EXPECT_FALSE(std::filesystem::exists(socketPath));
+        }
+        TempDirectoryTest::TearDown();
+    }
+
+    // Sends one session message on a new connection and returns the reply lines up to the last
+    std::vector<nlohmann::json> ask(const std::string &session, const std::string &message) {
+        return send({{"session", session}, {"message", message}});
+    }
+
+    // Sends one request line on a new connection and returns the reply lines up to the last
+    std::vector<nlohmann::json> send(const nlohmann::json &requestLine) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath.c_str());
+        EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)), 0);
+        std::string request = requestLine.dump() + "\n";
+        EXPECT_EQ(write(fd, request.data(), request.size()), static_cast<ssize_t>(request.size()));
+
+        std::vector<nlohmann::json> lines;
+        std::string buffer;
+        char chunk[4096];
+        ssize_t got;
+        while ((lines.empty() || lines.back().contains("delta")) && (got = read(fd, chunk, sizeof(chunk))) > 0) {
+            buffer.append(chunk, static_cast<size_t>(got));
+            for (size_t end; (end = buffer.find('\n')) != std::string::npos; buffer.erase(0, end + 1)) {
+                lines.push_back(nlohmann::json::parse(buffer.substr(0, end)));
+            }
+        }
+        close(fd);
+        return lines;
+    }
+};
+
+std::string _content(const std::vector<nlohmann::json> &lines) {
+    std::string content;
+    for (const nlohmann::json &line : lines) {
+        content += line.value("delta", std::string());
+    }
+    return content;
+}
+
+} // namespace
+
+TEST_F(DaemonTest, StreamsARequestWithTheClientsConversation) {
+    start();
+    ChatHistory history;
+    history.addDialog("user", "earlier question");
+    history.addDialog("assistant", "earlier answer");
+    std::string streamed;
+    std::string body = daemonStreamingRequest(socketPath, "echo this back", history,
+                                              [&](const std::string &delta) { streamed += delta; });
+    EXPECT_EQ(body, "");
+    EXPECT_EQ(streamed, "echo this back");
+    ASSERT_EQ(history.size(), 3u); // The message is added, as makeStreamingRequest does
+    EXPECT_EQ(std::string(history[2].message), "echo this back");
+
+    DaemonStats stats = daemon->stats();
+    EXPECT_EQ(stats.clients, 1u);
+    EXPECT_EQ(stats.requests, 1u);
+    EXPECT_EQ(stats.failed, 0u);
+    EXPECT_EQ(stats.sessions, 0u);
+    EXPECT_EQ(server->stats().streamed, 1u);
+}
+
+TEST_F(DaemonTest, ContinuesTheClientsLastConversation) {
+    start();
+    ChatHistory history;
+    auto turn = [&](const std::string &message) {
+        ChatHistory requestHistory = history;
+        history.addDialog("user", message);
+        std::string streamed;
+        daemonStreamingRequest(socketPath, message, requestHistory,
+                               [&](const std::string &delta) { streamed += delta; });
+        history.addDialog("assistant", streamed);
+        return streamed;
+    };
+    EXPECT_EQ(turn("first"), "first");
+    EXPECT_EQ(turn("second"), "second");
+    EXPECT_EQ(daemon->stats().requests, 2u);
+
+    // A new daemon has not kept the conversation, so it is sent again in full
+    daemon->stop();
+    loop.join();
+    daemon.reset();
+    DaemonOptions options;
+    options.socketPath = socketPath;
+    options.url = server->baseUrl() + "/chat/completions";
+    daemon = std::make_unique<ChatDaemon>(options);
+    loop = std::thread([this] { daemon->run(); });
+    EXPECT_EQ(turn("third"), "third");
+    EXPECT_EQ(daemon->stats().requests, 2u);
+    EXPECT_EQ(daemon->stats().failed, 0u);
+    EXPECT_EQ(turn("fourth"), "fourth");
+    EXPECT_EQ(daemon->stats().requests, 3u);
+}
+
+TEST_F(DaemonTest, KeepsSessionsAcrossClients) {
+    start();
+    std::vector<nlohmann::json> first = ask("notes", "first");
+    ASSERT_FALSE(first.empty());
+    EXPECT_EQ(_content(first), "first");
+    EXPECT_TRUE(first.back().value("done", false));
+    std::vector<nlohmann::json> second = ask("notes", "second");
+    EXPECT_EQ(_content(second), "second");
+    ask("other", "elsewhere");
+
+    // Both turns of "notes", each a question and its reply
+    EXPECT_EQ(daemon->sessionSize("notes"), 4u);
+    EXPECT_EQ(daemon->sessionSize("other"), 2u);
+    EXPECT_EQ(daemon->sessionSize("missing"), 0u);
+    EXPECT_EQ(daemon->stats().sessions, 2u);
+    EXPECT_EQ(daemon->stats().clients, 3u);
+}
+
+TEST_F(DaemonTest, ServesClientsConcurrently) {
+    MockServerOptions options;
+    options.latencyMs = 300;
+    start(options);
+
+    std::vector<std::string> replies(6);
+    std::vector<std::thread> clients;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < replies.size(); ++i) {
+        clients.emplace_back([&, i] {
+            replies[i] = _content(ask("session" + std::to_string(i), "client " + std::to_string(i)));
+        });
+    }
+    for (std::thread &client : clients) {
+        client.join();
+    }
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    // Six 300 ms replies side by side on one event loop, not one after another
+    EXPECT_LT(wallMs, 1200);
+    for (size_t i = 0; i < replies.size(); ++i) {
+        EXPECT_EQ(replies[i], "client " + std::to_string(i));
+    }
+    EXPECT_EQ(daemon->stats().requests, 6u);
+}
+
+TEST_F(DaemonTest, AnswersInvalidRequestsWithAnError) {
+    start();
+    std::vector<nlohmann::json> lines = ask("", "no session name");
+    ASSERT_EQ(lines.size(), 1u);
+    EXPECT_NE(lines[0].value("error", std::string()).find("Invalid request"), std::string::npos);
+
+    DaemonStats stats = daemon->stats();
+    EXPECT_EQ(stats.requests, 1u);
+    EXPECT_EQ(stats.failed, 1u);
+    EXPECT_EQ(server->stats().completions, 0u);
+}
+
+TEST_F(DaemonTest, RejectsUnknownRoles) {
+    start();
+    std::vector<nlohmann::json> lines = send({{"messages",
+                                               {{{"role", "narrator"}, {"content", "once upon a time"}},
+                                                {{"role", "user"}, {"content", "go on"}}}}});
+    ASSERT_EQ(lines.size(), 1u);
+    EXPECT_NE(lines[0].value("error", std::string()).find("unknown role"), std::string::npos);
+    EXPECT_EQ(daemon->stats().failed, 1u);
+    EXPECT_EQ(server->stats().completions, 0u);
+}
+
+TEST_F(DaemonTest, ListensOnASocketOnlyTheUserCanOpen) {
+    start();
+    struct stat status{};
+    ASSERT_EQ(lstat(socketPath.c_str(), &status), 0);
+    EXPECT_TRUE(S_ISSOCK(status.st_mode));
+    EXPECT_EQ(status.st_mode & 0777, 0600u);
+    EXPECT_EQ(status.st_uid, getuid());
+    EXPECT_TRUE(daemonListening(socketPath)); // The peer check accepts the same user
+}
+
+TEST_F(DaemonTest, RefusesASecondDaemonOnTheSameSocket) {
+    start();
+    EXPECT_TRUE(daemonListening(socketPath));
+    DaemonOptions options;
+    options.socketPath = socketPath;
+    EXPECT_THROW(ChatDaemon second(options), std::runtime_error);
+    EXPECT_TRUE(daemonListening(socketPath)); // The first one is left alone
+}
+
+TEST(DaemonClientTest, ReportsAnUnreachableDaemon) {
+    std::filesystem::path missing = std::filesystem::temp_directory_path() / "chatgpt_cli_no_daemon.sock";
+    std::filesystem::remove(missing);
+    EXPECT_FALSE(daemonListening(missing));
+    ChatHistory history;
+    EXPECT_THROW(daemonStreamingRequest(missing, "hello", history, [](const std::string &) {}), std::runtime_error);
+}
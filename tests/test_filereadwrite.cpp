@@ -1,7 +1,10 @@
 #include <gtest/gtest.h>
 #include "filereadwrite.hpp"
+#include "testdirectory.hpp"
 #include <fstream>
 #include <filesystem>
+#include <string>
+#include <vector>
 
 TEST(FileReadWriteTest, WriteAndReadBack) {
     std::string testFile = "testfile.txt";
@@ -25,3 +28,135 @@ TEST(FileReadWriteTest, WriteEmptyContent) {
     EXPECT_EQ(readContent, "");
     std::filesystem::remove(testFile);
 }
+
+namespace {
+
+// A small source tree in a fresh temporary directory, removed afterwards
+class ReadFilesTest : public TempDirectoryTest {
+  protected:
+    std::filesystem::path root;
+
+    void SetUp() override {
+        TempDirectoryTest::SetUp();
+        root = directory;
+        write("a.cpp", "int a;\n");
+        write("b.hpp", "int b();\n");
+        write("sub/c.cpp", "int c;\n");
+        write("sub/deeper/d.cpp", "int d;\n");
+        write(".git/config", "hidden\n");
+        write("blob.bin", std::string("\x7f" "ELF\0\0\1", 7));
+    }
+
+    void write(const std::string &name, const std::string &content) {
+        std::filesystem::create_directories((root / name).parent_path());
+        std::ofstream(root / name, std::ios::binary) << content;
+    }
+
+    std::vector<std::string> names(const std::vector<std::filesystem::path> &paths) {
+        std::vector<std::string> result;
+        for (const auto &path : paths) {
+            result.push_back(path.lexically_relative(root).generic_string());
+        }
+        return result;
+    }
+};
+
+} // namespace
+
+TEST(GlobMatchTest, MatchesComponentsAndRecursion) {
+    EXPECT_TRUE(globMatch("*.cpp", "a.cpp"));
+    EXPECT_FALSE(globMatch("*.cpp", "sub/a.cpp"));
+    EXPECT_TRUE(globMatch("**/*.cpp", "a.cpp"));
+    EXPECT_TRUE(globMatch("**/*.cpp", "sub/deeper/a.cpp"));
+    EXPECT_TRUE(globMatch("src/**", "src/x/y"));
+    EXPECT_TRUE(globMatch("?.[ch]pp", "b.hpp"));
+    EXPECT_FALSE(globMatch("?.[!ch]pp", "b.hpp"));
+    EXPECT_TRUE(globMatch("[a-c]*", "c.txt"));
+    EXPECT_FALSE(globMatch("a?b", "a/b"));
+}
+
+TEST_F(ReadFilesTest, ExpandsFilesDirectoriesAndGlobs) {
+    std::vector<std::string> unmatched;
+    auto files = expandFilePatterns({(root / "**/*.cpp").string(), (root / "b.hpp").string(),
+                                     (root / "a.cpp").string(), (root / "*.none").string()},
+                                    unmatched);
+    EXPECT_EQ(names(files), std::vector<std::string>({"a.cpp", "b.hpp", "sub/c.cpp", "sub/deeper/d.cpp"}));
+    EXPECT_EQ(unmatched, std::vector<std::string>({(root / "*.none").string()}));
+
+    // Directories are walked recursively without hidden entries
+    unmatched.clear();
+    files = expandFilePatterns({root.string()}, unmatched);
+    EXPECT_EQ(names(files),
+              std::vector<std::string>({"a.cpp", "b.hpp", "blob.bin", "sub/c.cpp", "sub/deeper/d.cpp"}));
+    EXPECT_TRUE(unmatched.empty());
+}
+
+TEST_F(ReadFilesTest, ReadsInOrderAndSkipsBinaryAndOversizedFiles) {
+    write("big.txt", std::string(3000, 'x'));
+    std::vector<std::string> unmatched;
+    auto files = expandFilePatterns({root.string()}, unmatched);
+
+    ReadFilesOptions options;
+    options.threads = 3;
+    options.readAhead = 2;
+    options.mapThreshold = 8; // Map all but the smallest files
+    options.maxFileBytes = 2000;
+    std::vector<std::string> seen;
+    ReadFilesReport report = readFiles(files, options, [&](const FileContent &file) {
+        seen.push_back(file.path.filename().string() + "=" +
+                       (file.skipReason.empty() ? std::string(file.text) : "skipped " + file.skipReason));
+    });
+
+    EXPECT_EQ(seen, std::vector<std::string>({"a.cpp=int a;\n", "b.hpp=int b();\n", "big.txt=skipped too large",
+                                              "blob.bin=skipped binary", "c.cpp=int c;\n", "d.cpp=int d;\n"}));
+    EXPECT_EQ(report.files, 4u);
+    EXPECT_EQ(report.skipped, 2u);
+    EXPECT_EQ(report.bytes, 30u);
+
+    options.maxFileBytes = 4000;
+    options.maxTotalBytes = 23; // a.cpp, b.hpp and blob.bin fit
+    seen.clear();
+    readFiles(files, options, [&](const FileContent &file) {
+        seen.push_back(file.skipReason);
+    });
+    EXPECT_EQ(seen, std::vector<std::string>({"", "", "over the total size limit", "binary",
+                                              "over the total size limit", "over the total size limit"}));
+}
+
+TEST(SplitIntoChunksTest, PrefersLineBreaksAndKeepsUtf8Whole) {
+    auto chunks = splitIntoChunks("line one\nline two\nline three\n", 20);
+    EXPECT_EQ(chunks, std::vector<std::string_view>({"line one\nline two\n", "line three\n"}));
+
+    // No newline: cut before a multi-byte sequence rather than inside it
+    std::string text = "abcdefgh\xc3\xa9xyz";
+    chunks = splitIntoChunks(text, 9);
+    EXPECT_EQ(chunks, std::vector<std::string_view>({"abcdefgh", "\xc3\xa9xyz"}));
+    EXPECT_EQ(splitIntoChunks("short", 0), std::vector<std::string_view>({"short"}));
+}
+
+TEST_F(ReadFilesTest, WritesAtomicallyOrNotAtAll) {
+    std::filesystem::path target = root / "a.cpp";
+    uint64_t written = writeFileAtomically(target, [](const WritePieceFn &write) {
+        write("int ");
+        write(std::string(3 * 1024 * 1024, 'x')); // Larger than the write buffer
+        write(";\n");
+    });
+    EXPECT_EQ(written, 3u * 1024 * 1024 + 6);
+    EXPECT_EQ(std::filesystem::file_size(target), written);
+
+    // A producer that fails leaves the old file and no temporary file behind
+    EXPECT_THROW(writeFileAtomically(target,
+                                     [](const WritePieceFn &write) {
+                                         write("partial");
+                                         throw std::runtime_error("interrupted");
+                                     }),
+                 std::runtime_error);
+    EXPECT_EQ(std::filesystem::file_size(target), written);
+    size_t entries = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(root)) {
+        entries += entry.path().filename().string().rfind("a.cpp", 0) == 0;
+    }
+    EXPECT_EQ(entries, 1u);
+
+    EXPECT_THROW(writeFileAtomically(root / "missing" / "x.txt", [](const WritePieceFn &) {}), std::runtime_error);
+}
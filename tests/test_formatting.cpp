@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include "formatting.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<std::string> wrapLines(const std::string &text, size_t width, bool breakLongWords = false,
+                                   size_t firstLineWidth = 0) {
+    std::vector<std::string> lines;
+    LineWrapper wrapper(text, width, breakLongWords, firstLineWidth);
+    WrappedLine line;
+    while (wrapper.next(line)) {
+        lines.push_back(std::string(line.indent, ' ') + text.substr(line.offset, line.length));
+    }
+    return lines;
+}
+
+} // namespace
+
+TEST(FormattingTest, DisplayWidthCountsColumnsNotBytes) {
+    EXPECT_EQ(displayWidth("hello"), 5u);
+    EXPECT_EQ(displayWidth("gr\xc3\xbc\xc3\x9f" "e"), 5u);           // grüße
+    EXPECT_EQ(displayWidth("\xe4\xbd\xa0\xe5\xa5\xbd"), 4u);           // 你好
+    EXPECT_EQ(displayWidth("e\xcc\x81"), 1u);                          // e + combining acute
+    EXPECT_EQ(displayWidth("\xf0\x9f\x98\x80"), 2u);                   // 😀
+    EXPECT_EQ(displayWidth("\xff"), 1u);                               // Invalid byte
+}
+
+TEST(FormattingTest, WrapsAtBlanksWithinWidth) {
+    std::vector<std::string> expected{"the quick", "brown fox", "jumps"};
+    EXPECT_EQ(wrapLines("the quick brown fox jumps", 10), expected);
+}
+
+TEST(FormattingTest, KeepsOrBreaksLongWords) {
+    std::vector<std::string> kept{"a", "abcdefghij", "b"};
+    EXPECT_EQ(wrapLines("a abcdefghij b", 4), kept);
+    std::vector<std::string> split{"a", "abcd", "efgh", "ij b"};
+    EXPECT_EQ(wrapLines("a abcdefghij b", 4, true), split);
+}
+
+TEST(FormattingTest, WideCharactersUseTwoColumns) {
+    // Six CJK characters are twelve columns
+    std::string text = "\xe4\xbd\xa0\xe5\xa5\xbd\xe4\xbd\xa0\xe5\xa5\xbd\xe4\xbd\xa0\xe5\xa5\xbd";
+    std::vector<std::string> lines = wrapLines(text, 5, true);
+    ASSERT_EQ(lines.size(), 3u);
+    for (const std::string &line : lines) {
+        EXPECT_EQ(displayWidth(line), 4u);
+    }
+}
+
+TEST(FormattingTest, ParagraphsIndentAndFirstLineWidth) {
+    std::vector<std::string> expected{"one", "two three", "", "  four", "  five"};
+    EXPECT_EQ(wrapLines("one two three\n\n  four five\n", 10, false, 4), expected);
+}
+
+TEST(FormattingTest, WrapWritesIndentedLines) {
+    std::ostringstream os;
+    wrap("alpha beta gamma\n  delta epsilon", 11, os, 2);
+    EXPECT_EQ(os.str(), "  alpha beta\n  gamma\n    delta\n    epsilon\n");
+}
+
+TEST(FormattingTest, WrapWidthExcludesParagraphIndent) {
+    // Thirteen columns of text fit after the paragraph's four spaces, as they did before LineWrapper
+    std::ostringstream os;
+    wrap("    delta epsilon zeta", 13, os);
+    EXPECT_EQ(os.str(), "    delta epsilon\n    zeta\n");
+    std::vector<std::string> counted{"    delta", "    epsilon", "    zeta"};
+    EXPECT_EQ(wrapLines("    delta epsilon zeta", 13), counted);
+}
+
+TEST(FormattingTest, TrailingBlanksBeforeNewlineAddNoLine) {
+    std::vector<std::string> expected{"abcd", "efg"};
+    EXPECT_EQ(wrapLines("abcd   \nefg", 4), expected);
+    EXPECT_TRUE(wrapLines("", 10).empty());
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "command.hpp"
+#include "historyindex.hpp"
+#include "historylayout.hpp"
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<size_t> find(HistoryIndex &index, const ChatHistory &history, const std::vector<std::string> &terms) {
+    index.sync(history);
+    return index.search(history, parseSearchQuery(terms));
+}
+
+ChatHistory sample() {
+    ChatHistory history;
+    history.addDialog("user", "How does the Token Budget work?");              // 0
+    history.addDialog("assistant", "The budget drops the oldest messages.");  // 1
+    history.addDialog("system", "Token budget: 120000");                      // 2, not indexed
+    history.addDialog("user", "%search budget");                              // 3, a command line
+    history.addDialog("user", "Show me std::vector<int> in the parser.");     // 4
+    history.addDialog("assistant", "The token parser reads the budget.");     // 5
+    return history;
+}
+
+} // namespace
+
+TEST(HistoryIndexTest, FindsWordsIgnoringCaseInConversationOnly) {
+    ChatHistory history = sample();
+    HistoryIndex index;
+    EXPECT_EQ(find(index, history, {"BUDGET"}), (std::vector<size_t>{0, 1, 5}));
+    EXPECT_EQ(find(index, history, {"budget", "parser"}), (std::vector<size_t>{5}));
+    EXPECT_TRUE(find(index, history, {"budge"}).empty()); // Whole words only
+    EXPECT_TRUE(find(index, history, {"missing"}).empty());
+    EXPECT_EQ(index.entries(), history.size());
+}
+
+TEST(HistoryIndexTest, MatchesPhrasesByPosition) {
+    ChatHistory history = sample();
+    HistoryIndex index;
+    EXPECT_EQ(find(index, history, {"token budget"}), (std::vector<size_t>{0}));
+    EXPECT_EQ(find(index, history, {"the budget"}), (std::vector<size_t>{1, 5}));
+    EXPECT_TRUE(find(index, history, {"budget token"}).empty());
+}
+
+TEST(HistoryIndexTest, FallsBackToSubstringsForOtherText) {
+    ChatHistory history = sample();
+    HistoryIndex index;
+    EXPECT_EQ(find(index, history, {"std::VECTOR<int>"}), (std::vector<size_t>{4}));
+    EXPECT_EQ(find(index, history, {"budge*"}), (std::vector<size_t>{0, 1, 5}));
+    EXPECT_EQ(find(index, history, {"pars*", "token"}), (std::vector<size_t>{5}));
+
+    // Long messages go through the vectorized scan, with the match past several blocks
+    history.addDialog("assistant", std::string(1000, 'x') + "NeedleInAHaystack" + std::string(100, 'y'));
+    EXPECT_EQ(find(index, history, {"needleinahay*"}), (std::vector<size_t>{6}));
+    SearchMatch match = HistoryIndex::locate(history[6].message, parseSearchQuery({"needleinahay*"}));
+    EXPECT_EQ(match.offset, 1000u);
+    EXPECT_EQ(match.length, 12u);
+}
+
+TEST(HistoryIndexTest, FollowsTheHistoryIncrementally) {
+    ChatHistory history = sample();
+    HistoryIndex index;
+    size_t postings = (find(index, history, {"budget"}), index.postings());
+
+    history.addDialog("assistant", "A streamed");
+    EXPECT_TRUE(find(index, history, {"reply"}).empty());
+    history.appendToLastDialog(" reply");
+    EXPECT_EQ(find(index, history, {"streamed reply"}), (std::vector<size_t>{6}));
+
+    history.removeLastDialog();
+    EXPECT_TRUE(find(index, history, {"reply"}).empty());
+    EXPECT_EQ(index.postings(), postings);
+
+    // A branch cut from the history keeps the shared entries and drops the rest
+    ChatHistory branch = history.prefix(2);
+    branch.addDialog("user", "another budget question");
+    EXPECT_EQ(find(index, branch, {"budget"}), (std::vector<size_t>{0, 1, 2}));
+    history.clearHistory();
+    EXPECT_TRUE(find(index, history, {"budget"}).empty());
+    EXPECT_EQ(index.postings(), 0u);
+}
+
+TEST(HistoryIndexTest, LocatesTheFirstClauseInAMessage) {
+    SearchMatch match = HistoryIndex::locate("Ask about the Token  budget, then the token budget.",
+                                             parseSearchQuery({"token budget"}));
+    EXPECT_EQ(match.offset, 14u);
+    EXPECT_EQ(match.length, 13u);
+    EXPECT_EQ(HistoryIndex::locate("nothing here", parseSearchQuery({"token"})).length, 0u);
+}
+
+TEST(HistoryIndexTest, SearchCommandListsHitsAndRevealsThem) {
+    std::vector<std::pair<size_t, size_t>> revealed;
+    setCommandRunner({[](BackgroundJob job) {
+                          std::atomic<bool> notCancelled{false};
+                          job(notCancelled);
+                      },
+                      [](std::function<void()> task) { task(); }, {}, {},
+                      [&](size_t entry, size_t offset) { revealed.emplace_back(entry, offset); }});
+    ChatHistory history = sample();
+    searchCommand({"budget"}, history);
+    std::string listing(history[history.size() - 1].message);
+    EXPECT_NE(listing.find("3 messages match budget"), std::string::npos);
+    EXPECT_LT(listing.find("#5 assistant"), listing.find("#1 assistant")); // Newest first
+    ASSERT_EQ(revealed.size(), 1u);
+    EXPECT_EQ(revealed[0], std::make_pair(size_t(5), size_t(27)));
+
+    searchCommand({}, history); // Steps to the next older match
+    ASSERT_EQ(revealed.size(), 2u);
+    EXPECT_EQ(revealed[1].first, 1u);
+
+    searchCommand({"nowhere"}, history);
+    EXPECT_EQ(history[history.size() - 1].message.substr(0, 25), "No messages match nowhere");
+    EXPECT_EQ(revealed.size(), 2u);
+
+    setCommandRunner({[](BackgroundJob job) {
+                          std::atomic<bool> notCancelled{false};
+                          job(notCancelled);
+                      },
+                      [](std::function<void()> task) { task(); }});
+}
+
+TEST(HistoryLayoutTest, FindsTheLineOfAnOffset) {
+    ChatHistory history;
+    history.addDialog("user", "short");
+    history.addDialog("assistant", "one two three four five six seven eight nine ten");
+    HistoryLayout layout;
+    layout.sync(history, 20);
+    EXPECT_EQ(layout.lineOf(0, 0), 0u);
+    EXPECT_EQ(layout.lineOf(1, 0), 1u);
+    EXPECT_GT(layout.lineOf(1, 45), layout.lineOf(1, 0));
+    EXPECT_EQ(layout.lineOf(1, 45), layout.lineCount() - 1);
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "historylayout.hpp"
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<std::string> allLines(const HistoryLayout &layout, const ChatHistory &history) {
+    std::vector<std::string> lines;
+    for (const HistoryLine &line : layout.window(0, layout.lineCount())) {
+        lines.push_back(HistoryLayout::lineText(history, line));
+    }
+    return lines;
+}
+
+} // namespace
+
+TEST(HistoryLayoutTest, WrapsAtWordsAndPrefixesFirstLine) {
+    ChatHistory history;
+    history.addDialog("user", "aaa bbb ccc ddd\nsecond paragraph");
+    HistoryLayout layout;
+    layout.sync(history, 10);
+
+    std::vector<std::string> expected{"user: aaa", "bbb ccc", "ddd", "second", "paragraph"};
+    EXPECT_EQ(allLines(layout, history), expected);
+}
+
+TEST(HistoryLayoutTest, SplitsWordsLongerThanALine) {
+    ChatHistory history;
+    history.addDialog("user", "abcdefghijkl");
+    HistoryLayout layout;
+    layout.sync(history, 8);
+
+    std::vector<std::string> expected{"user: ab", "cdefghij", "kl"};
+    EXPECT_EQ(allLines(layout, history), expected);
+}
+
+TEST(HistoryLayoutTest, UnchangedHistoryIsNotLaidOutAgain) {
+    ChatHistory history;
+    for (int i = 0; i < 50; ++i) {
+        history.addDialog(i % 2 ? "assistant" : "user", "message " + std::to_string(i));
+    }
+    HistoryLayout layout;
+    layout.sync(history, 40);
+    EXPECT_EQ(layout.entriesLaidOut(), 50u);
+
+    layout.sync(history, 40);
+    EXPECT_EQ(layout.entriesLaidOut(), 50u);
+}
+
+TEST(HistoryLayoutTest, StreamedAppendRelaysOnlyTheLastEntry) {
+    ChatHistory history;
+    history.addDialog("user", "question");
+    history.addDialog("assistant", "The");
+    HistoryLayout layout;
+    layout.sync(history, 20);
+
+    history.appendToLastDialog(" answer is a rather long sentence");
+    layout.sync(history, 20);
+    EXPECT_EQ(layout.entriesLaidOut(), 3u);
+
+    std::vector<std::string> expected{"user: question", "assistant: The", "answer is a rather", "long sentence"};
+    EXPECT_EQ(allLines(layout, history), expected);
+}
+
+TEST(HistoryLayoutTest, ReplacedEntryIsDetected) {
+    ChatHistory history;
+    history.addDialog("user", "one");
+    history.addDialog("user", "two");
+    HistoryLayout layout;
+    layout.sync(history, 20);
+
+    // Same length, different entry
+    history.removeLastDialog();
+    history.addDialog("user", "six");
+    layout.sync(history, 20);
+    EXPECT_EQ(layout.entriesLaidOut(), 3u);
+    EXPECT_EQ(allLines(layout, history).back(), "user: six");
+
+    history.clearHistory();
+    layout.sync(history, 20);
+    EXPECT_EQ(layout.lineCount(), 0u);
+}
+
+TEST(HistoryLayoutTest, WidthChangeRelaysEverything) {
+    ChatHistory history;
+    history.addDialog("user", "aaa bbb ccc");
+    history.addDialog("assistant", "ddd");
+    HistoryLayout layout;
+    layout.sync(history, 40);
+    EXPECT_EQ(layout.lineCount(), 2u);
+
+    layout.sync(history, 10);
+    EXPECT_EQ(layout.entriesLaidOut(), 4u);
+    EXPECT_EQ(layout.lineCount(), 4u);
+}
+
+TEST(HistoryLayoutTest, WindowReturnsTheRequestedRange) {
+    ChatHistory history;
+    for (int i = 0; i < 10; ++i) {
+        history.addDialog("user", "a b");
+    }
+    HistoryLayout layout;
+    layout.sync(history, 7); // "user: a" / "b" per entry
+    ASSERT_EQ(layout.lineCount(), 20u);
+
+    std::vector<HistoryLine> lines = layout.window(5, 4);
+    ASSERT_EQ(lines.size(), 4u);
+    EXPECT_EQ(lines[0].entry, 2u);
+    EXPECT_FALSE(lines[0].first);
+    EXPECT_EQ(lines[1].entry, 3u);
+    EXPECT_TRUE(lines[1].first);
+
+    EXPECT_EQ(layout.window(18, 10).size(), 2u);
+    EXPECT_TRUE(layout.window(20, 5).empty());
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "command.hpp"
+#include "metrics.hpp"
+#include "mockserver.hpp"
+#include "request.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+
+TEST(LatencyHistogramTest, PercentilesAreWithinBucketPrecision) {
+    LatencyHistogram histogram;
+    for (int i = 1; i <= 10000; ++i) {
+        histogram.record(std::chrono::microseconds(i * 100)); // 0.1 ms to 1 s
+    }
+    EXPECT_EQ(histogram.count(), 10000u);
+    EXPECT_EQ(histogram.maxMicroseconds(), 1000000u);
+    for (double q : {0.5, 0.9, 0.99, 0.999}) {
+        double exact = q * 10000 * 100;
+        double reported = static_cast<double>(histogram.percentileMicroseconds(q));
+        EXPECT_GE(reported, exact);
+        EXPECT_LE(reported, exact * (1 + 1.0 / 64)) << q;
+    }
+    EXPECT_EQ(histogram.percentileMicroseconds(1.0), 1000000u);
+    // The bucket that straddles the limit is left out
+    EXPECT_LE(histogram.countAtMost(500000), 5000u);
+    EXPECT_GE(histogram.countAtMost(500000), 5000u * 63 / 64);
+
+    LatencyHistogram small;
+    EXPECT_EQ(small.percentileMicroseconds(0.5), 0u);
+    small.record(std::chrono::microseconds(3));
+    small.record(std::chrono::hours(100)); // Clamped, not lost
+    EXPECT_EQ(small.percentileMicroseconds(0.5), 3u);
+    EXPECT_EQ(small.count(), 2u);
+}
+
+TEST(MetricsRegistryTest, ExportsPrometheusHistograms) {
+    MetricsRegistry registry;
+    LatencyHistogram &histogram = registry.histogram("test_phase_seconds", "A test phase.");
+    EXPECT_EQ(&registry.histogram("test_phase_seconds", "ignored"), &histogram);
+    histogram.record(std::chrono::microseconds(150));
+    histogram.record(std::chrono::milliseconds(3));
+    histogram.record(std::chrono::seconds(200));
+
+    std::string text = registry.prometheusText();
+    EXPECT_NE(text.find("# HELP test_phase_seconds A test phase.\n# TYPE test_phase_seconds histogram\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("test_phase_seconds_bucket{le=\"0.0001\"} 0\n"), std::string::npos);
+    EXPECT_NE(text.find("test_phase_seconds_bucket{le=\"0.0002\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("test_phase_seconds_bucket{le=\"0.005\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("test_phase_seconds_bucket{le=\"100\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("test_phase_seconds_bucket{le=\"+Inf\"} 3\n"), std::string::npos);
+    EXPECT_NE(text.find("test_phase_seconds_sum 200.003\n"), std::string::npos);
+    EXPECT_NE(text.find("test_phase_seconds_count 3\n"), std::string::npos);
+
+    std::filesystem::path file =
+        std::filesystem::temp_directory_path() / ("chatgpt_cli_metrics_" + std::to_string(getpid()) + ".prom");
+    registry.writePrometheusFile(file);
+    std::ifstream in(file);
+    EXPECT_EQ(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()), text);
+    std::filesystem::remove(file);
+}
+
+TEST(MetricsRegistryTest, RequestsRecordTheirPhases) {
+    MockOpenAIServer server;
+    setenv("OPENAI_BASE_URL", server.baseUrl().c_str(), 1);
+    setenv("NO_PROXY", "127.0.0.1", 1);
+    setenv("OPENAI_KEY", "metrics-test-key", 1);
+    RequestMetrics &metrics = requestMetrics();
+    uint64_t payloads = metrics.payloadBuild.count();
+    uint64_t requests = metrics.request.count();
+    uint64_t parses = metrics.parse.count();
+
+    ChatHistory history;
+    EXPECT_EQ(getChatGPTResponseContent(makeRequest("timed", history)), "timed");
+    makeStreamingRequest("streamed", history, [](const std::string &) {});
+    unsetenv("OPENAI_BASE_URL");
+
+    EXPECT_EQ(metrics.payloadBuild.count(), payloads + 2);
+    EXPECT_EQ(metrics.request.count(), requests + 2);
+    EXPECT_EQ(metrics.ttfb.count(), metrics.request.count());
+    EXPECT_EQ(metrics.parse.count(), parses + 2);
+
+    statsCommand(history);
+    std::string table(history[history.size() - 1].message);
+    EXPECT_NE(table.find("payload build"), std::string::npos);
+    EXPECT_NE(table.find("ttfb"), std::string::npos);
+    EXPECT_NE(table.find("p99"), std::string::npos);
+}
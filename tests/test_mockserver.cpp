@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "mockserver.hpp"
+#include "request.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <curl/curl.h>
+#include <nlohmann/json.hpp>
+#include <string>
+
+namespace {
+
+// Points the real request path at a local MockOpenAIServer for the duration of a test
+class MockServerTest : public ::testing::Test {
+  protected:
+    void use(const MockOpenAIServer &server) {
+        setenv("OPENAI_BASE_URL", server.baseUrl().c_str(), 1);
+        setenv("NO_PROXY", "127.0.0.1", 1);
+        setenv("OPENAI_KEY", "test-key", 1);
+    }
+
+    void TearDown() override {
+        unsetenv("OPENAI_BASE_URL");
+    }
+};
+
+size_t appendBody(char *data, size_t size, size_t nmemb, void *userp) {
+    static_cast<std::string *>(userp)->append(data, size * nmemb);
+    return size * nmemb;
+}
+
+// GETs url with an optional bearer token; returns the status code and fills body
+long httpGet(const std::string &url, const std::string &key, std::string &body) {
+    CURL *curl = curl_easy_init();
+    curl_slist *headers = nullptr;
+    if (!key.empty()) {
+        headers = curl_slist_append(headers, ("Authorization: Bearer " + key).c_str());
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, appendBody);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    long status = 0;
+    if (curl_easy_perform(curl) == CURLE_OK) {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    }
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    return status;
+}
+
+} // namespace
+
+TEST_F(MockServerTest, MakeRequestEchoesTheLastMessage) {
+    MockOpenAIServer server;
+    use(server);
+    ChatHistory history;
+    std::string response = makeRequest("hello mock", history);
+
+    EXPECT_EQ(getChatGPTResponseContent(response), "hello mock");
+    nlohmann::json reply = nlohmann::json::parse(response);
+    EXPECT_EQ(reply["choices"][0]["finish_reason"], "stop");
+    EXPECT_GT(reply["usage"]["prompt_tokens"].get<int>(), 0);
+    EXPECT_EQ(server.stats().completions, 1u);
+}
+
+TEST_F(MockServerTest, StreamingRequestDeliversOneDeltaPerWord) {
+    MockServerOptions options;
+    options.replyWords = 5;
+    MockOpenAIServer server(options);
+    use(server);
+    ChatHistory history;
+    std::string reply;
+    size_t deltas = 0;
+    std::string rest = makeStreamingRequest("go", history, [&](const std::string &delta) {
+        reply += delta;
+        ++deltas;
+    });
+
+    EXPECT_EQ(reply, "lorem ipsum dolor sit amet");
+    EXPECT_EQ(deltas, 5u);
+    EXPECT_TRUE(rest.empty());
+    EXPECT_EQ(server.stats().streamed, 1u);
+}
+
+TEST_F(MockServerTest, InjectsLatencyAndErrors) {
+    MockServerOptions options;
+    options.latencyMs = 100;
+    options.errorRate = 1;
+    options.errorStatus = 400; // Not retried, unlike 429 and 5xx
+    MockOpenAIServer server(options);
+    use(server);
+    ChatHistory history;
+    auto start = std::chrono::steady_clock::now();
+    std::string response = makeRequest("hi", history);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_GE(elapsed, std::chrono::milliseconds(100));
+    EXPECT_EQ(nlohmann::json::parse(response)["error"]["code"], "400");
+    EXPECT_EQ(getChatGPTResponseContent(response), "");
+    EXPECT_EQ(server.stats().errors, 1u);
+    EXPECT_EQ(server.stats().completions, 0u);
+}
+
+TEST_F(MockServerTest, ServesModelsAndChecksTheKey) {
+    MockServerOptions options;
+    options.apiKey = "secret";
+    MockOpenAIServer server(options);
+    use(server);
+    std::string body;
+    EXPECT_EQ(httpGet(server.baseUrl() + "/models", "secret", body), 200);
+    EXPECT_EQ(nlohmann::json::parse(body)["data"][0]["id"], "gpt-4o");
+
+    body.clear();
+    EXPECT_EQ(httpGet(server.baseUrl() + "/models", "wrong", body), 401);
+    EXPECT_EQ(nlohmann::json::parse(body)["error"]["code"], "invalid_api_key");
+    body.clear();
+    EXPECT_EQ(httpGet(server.baseUrl() + "/nowhere", "secret", body), 404);
+}
+
+TEST_F(MockServerTest, KeepsConnectionsAlive) {
+    MockOpenAIServer server;
+    use(server);
+    for (int i = 0; i < 5; ++i) {
+        ChatHistory history;
+        EXPECT_EQ(getChatGPTResponseContent(makeRequest("again", history)), "again");
+    }
+    EXPECT_EQ(server.stats().requests, 5u);
+    EXPECT_EQ(server.stats().connections, 1u);
+}
+
+TEST(ApiBaseUrlTest, DefaultsToOpenAIAndDropsTrailingSlashes) {
+    unsetenv("OPENAI_BASE_URL");
+    EXPECT_EQ(apiBaseUrl(), kDefaultApiBaseUrl);
+    setenv("OPENAI_BASE_URL", "http://localhost:1234/v1//", 1);
+    EXPECT_EQ(chatCompletionsUrl(), "http://localhost:1234/v1/chat/completions");
+    unsetenv("OPENAI_BASE_URL");
+}
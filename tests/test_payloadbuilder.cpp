@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "payloadbuilder.hpp"
+#include <nlohmann/json.hpp>
+#include <string>
+
+namespace {
+
+// The payload as the original makeRequest built it: a full DOM rebuilt from the history
+std::string domPayload(ChatHistory &history, bool stream) {
+    nlohmann::json payload;
+    payload["model"] = "gpt-4o";
+    if (stream) {
+        payload["stream"] = true;
+        payload["stream_options"] = {{"include_usage", true}};
+    }
+    for (const auto &dialog : history) {
+        payload["messages"].push_back(
+            {{"role", std::string(dialog.participant)}, {"content", std::string(dialog.message)}});
+    }
+    return payload.dump();
+}
+
+} // namespace
+
+TEST(PayloadBuilderTest, MatchesDomSerialization) {
+    ChatHistory history;
+    history.addDialog("system", "Be brief.");
+    history.addDialog("user", "Quote \"this\", a tab\t, a newline\n and \\ backslash");
+    history.addDialog("assistant", "Unicode: gr\xc3\xbc\xc3\x9f" "e \xe4\xbd\xa0\xe5\xa5\xbd \x01 control");
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", true), domPayload(history, true));
+    EXPECT_EQ(PayloadBuilder::withStream(history.buildRequestPayload("gpt-4o", false)), domPayload(history, true));
+}
+
+TEST(PayloadBuilderTest, EscapesEveryAsciiByteLikeTheDom) {
+    std::string everyByte;
+    for (int c = 1; c < 0x80; ++c) {
+        everyByte += static_cast<char>(c);
+    }
+    ChatHistory history;
+    history.addDialog("user", everyByte);
+    history.addDialog("assistant", "plain");
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+}
+
+TEST(PayloadBuilderTest, EmptyHistoryOmitsMessages) {
+    ChatHistory history;
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+}
+
+TEST(PayloadBuilderTest, RemoveLastAndClearInvalidateCache) {
+    ChatHistory history;
+    history.addDialog("user", "one");
+    history.addDialog("assistant", "two");
+    history.addDialog("user", "three");
+    history.removeLastDialog();
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+
+    history.removeLastDialog();
+    history.removeLastDialog();
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+
+    history.addDialog("user", "four");
+    history.addDialog("assistant", "five");
+    history.clearHistory();
+    history.addDialog("user", "six");
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+}
+
+TEST(PayloadBuilderTest, StreamedAppendsAreReserialized) {
+    ChatHistory history;
+    history.addDialog("user", "Hi");
+    history.addDialog("assistant", "Hel");
+    history.appendToLastDialog("lo");
+    history.appendToLastDialog(" there");
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+
+    // Adding after a streamed reply keeps the grown message
+    history.appendToLastDialog("!");
+    history.addDialog("user", "Next");
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+
+    // Removing a message that grew after it was cached
+    history.appendToLastDialog(" question");
+    history.removeLastDialog();
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+}
+
+TEST(PayloadBuilderTest, CopiedHistoryKeepsIndependentCache) {
+    ChatHistory history;
+    history.addDialog("user", "Hi");
+    ChatHistory copy = history;
+    copy.addDialog("user", "Only in copy");
+    EXPECT_EQ(history.buildRequestPayload("gpt-4o", false), domPayload(history, false));
+    EXPECT_EQ(copy.buildRequestPayload("gpt-4o", false), domPayload(copy, false));
+}
+
+TEST(PayloadBuilderTest, InvalidUtf8IsReplacedNotThrown) {
+    PayloadBuilder builder;
+    EXPECT_NO_THROW(builder.append("user", std::string("bad \xff byte")));
+    EXPECT_EQ(builder.size(), 1u);
+    EXPECT_NE(builder.build("gpt-4o", false).find("bad \xef\xbf\xbd byte"), std::string::npos);
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include "persistentvector.hpp"
+#include "textarena.hpp"
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+void expectSame(const PersistentVector<int> &actual, const std::vector<int> &expected) {
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQ(actual[i], expected[i]) << "at " << i;
+    }
+}
+
+} // namespace
+
+TEST(PersistentVectorTest, MatchesStdVectorThroughRandomEdits) {
+    std::mt19937 random(7);
+    PersistentVector<int> vector;
+    std::vector<int> reference;
+    for (int step = 0; step < 20000; ++step) {
+        unsigned action = random() % 100;
+        if (action < 70 || reference.empty()) {
+            vector.push_back(step);
+            reference.push_back(step);
+        } else if (action < 90) {
+            vector.pop_back();
+            reference.pop_back();
+        } else if (action < 95) {
+            size_t count = random() % (reference.size() + 1);
+            vector.truncate(count);
+            reference.resize(count);
+        } else {
+            vector.back() = -step;
+            reference.back() = -step;
+        }
+        if (step % 997 == 0) {
+            expectSame(vector, reference);
+        }
+    }
+    expectSame(vector, reference);
+    vector.clear();
+    EXPECT_TRUE(vector.empty());
+}
+
+TEST(PersistentVectorTest, CopiesAreIndependentAndShareTheirPrefix) {
+    PersistentVector<int> original;
+    std::vector<int> reference;
+    for (int i = 0; i < 40000; ++i) { // Three levels of trie
+        original.push_back(i);
+        reference.push_back(i);
+    }
+
+    PersistentVector<int> copy = original;
+    copy.truncate(1234);
+    copy.back() = -1;
+    for (int i = 0; i < 100; ++i) {
+        copy.push_back(100000 + i);
+    }
+    original.pop_back();
+    reference.pop_back();
+    original.back() = -2;
+    reference.back() = -2;
+
+    expectSame(original, reference);
+    ASSERT_EQ(copy.size(), 1334u);
+    EXPECT_EQ(copy[1232], 1232);
+    EXPECT_EQ(copy[1233], -1);
+    EXPECT_EQ(copy[1234], 100000);
+    EXPECT_EQ(copy[1333], 100099);
+}
+
+TEST(TextArenaTest, CopiesNeverSeeLaterWrites) {
+    TextArena arena;
+    SharedText first = arena.append("first");
+    SharedText second = arena.append("second");
+    TextArena copy = arena;
+
+    // second is shared now: growing it moves the original's text, not the copy's view
+    SharedText copyOfSecond = second;
+    arena.extend(second, " grown");
+    arena.release(second);
+    SharedText third = arena.append("third");
+    EXPECT_EQ(first.view(), "first");
+    EXPECT_EQ(copyOfSecond.view(), "second");
+    EXPECT_EQ(third.view(), "third");
+
+    SharedText inCopy = copy.append("copy");
+    EXPECT_EQ(inCopy.view(), "copy");
+    EXPECT_EQ(copyOfSecond.view(), "second");
+
+    // Newest unshared text grows in place and gives its space back
+    SharedText streamed = arena.append("Hel");
+    arena.extend(streamed, "lo");
+    EXPECT_EQ(streamed.view(), "Hello");
+    EXPECT_EQ(third.view().data() + third.size(), streamed.view().data());
+    arena.release(streamed);
+    SharedText reused = arena.append("x");
+    EXPECT_EQ(reused.view().data(), third.view().data() + third.size());
+
+    // Text larger than a chunk gets one of its own, and grows by moving
+    std::string large(TextArena::kChunkSize + 1, 'L');
+    SharedText big = arena.append(large);
+    arena.extend(big, "!");
+    EXPECT_EQ(big.view(), large + "!");
+    EXPECT_EQ(reused.view(), "x");
+}
+
+TEST(TextArenaTest, ConcurrentCopiesAndMovesKeepTheSharedMark) {
+    TextArena arena;
+    SharedText text = arena.append("shared");
+    std::vector<std::thread> copiers;
+    for (int i = 0; i < 4; ++i) {
+        copiers.emplace_back([&arena] {
+            for (int copies = 0; copies < 1000; ++copies) {
+                TextArena copy = arena;
+            }
+        });
+    }
+    for (std::thread &copier : copiers) {
+        copier.join();
+    }
+
+    // The moved arena still knows the text is shared and does not hand its space back
+    TextArena moved = std::move(arena);
+    moved.release(text);
+    SharedText next = moved.append("next");
+    EXPECT_EQ(text.view(), "shared");
+    EXPECT_EQ(next.view().data(), text.view().data() + text.size());
+}
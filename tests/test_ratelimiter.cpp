@@ -0,0 +1,227 @@
+#include <gtest/gtest.h>
+#include "batch.hpp"
+#include "chathistory.hpp"
+#include "mockserver.hpp"
+#include "ratelimiter.hpp"
+#include "request.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Points the real request path at server with its own set of keys (and so a fresh shared limiter)
+void useServer(const MockOpenAIServer &server, const char *keys) {
+    setenv("OPENAI_BASE_URL", server.baseUrl().c_str(), 1);
+    setenv("NO_PROXY", "127.0.0.1", 1);
+    setenv("OPENAI_KEY", keys, 1);
+}
+
+} // namespace
+
+TEST(RateLimitHeadersTest, ParsesResetDurations) {
+    EXPECT_DOUBLE_EQ(parseResetDuration("20ms"), 0.02);
+    EXPECT_DOUBLE_EQ(parseResetDuration("1s"), 1);
+    EXPECT_DOUBLE_EQ(parseResetDuration("6m0s"), 360);
+    EXPECT_DOUBLE_EQ(parseResetDuration("1h2m3.5s"), 3723.5);
+    EXPECT_DOUBLE_EQ(parseResetDuration(" 0.5 "), 0.5);
+    EXPECT_EQ(parseResetDuration("soon"), -1);
+    EXPECT_EQ(parseResetDuration(""), -1);
+}
+
+TEST(RateLimitHeadersTest, ReadsHeaderLinesCaseInsensitively) {
+    RateLimitHeaders headers;
+    headers.parseLine("X-RateLimit-Limit-Requests: 500\r\n");
+    headers.parseLine("x-ratelimit-remaining-requests: 499\r\n");
+    headers.parseLine("x-ratelimit-reset-tokens: 6m0s\r\n");
+    headers.parseLine("retry-after: 2\r\n");
+    headers.parseLine("content-type: application/json\r\n");
+    headers.parseLine("HTTP/1.1 429 Too Many Requests\r\n");
+    EXPECT_EQ(headers.limitRequests, 500);
+    EXPECT_EQ(headers.remainingRequests, 499);
+    EXPECT_EQ(headers.resetTokensSeconds, 360);
+    EXPECT_EQ(headers.limitTokens, -1);
+    EXPECT_EQ(headers.retryAfterSeconds, 2);
+
+    // The millisecond header is more precise and wins in either order
+    headers.parseLine("retry-after-ms: 250\r\n");
+    EXPECT_DOUBLE_EQ(headers.retryAfterSeconds, 0.25);
+    headers.parseLine("retry-after: 3\r\n");
+    EXPECT_DOUBLE_EQ(headers.retryAfterSeconds, 0.25);
+}
+
+TEST(TokenBucketTest, RefillsOverTime) {
+    auto t0 = TokenBucket::Clock::now();
+    TokenBucket bucket(10, 5, t0);
+    EXPECT_EQ(bucket.waitFor(10, t0), 0ns);
+    bucket.take(10, t0);
+    EXPECT_EQ(std::chrono::duration_cast<std::chrono::milliseconds>(bucket.waitFor(1, t0)), 200ms);
+    EXPECT_EQ(bucket.waitFor(1, t0 + 200ms), 0ns);
+    // Amounts above the capacity only wait for a full bucket
+    EXPECT_EQ(std::chrono::duration_cast<std::chrono::milliseconds>(bucket.waitFor(50, t0 + 200ms)), 1800ms);
+
+    TokenBucket unlimited;
+    unlimited.take(1e9, t0);
+    EXPECT_FALSE(unlimited.limited());
+    EXPECT_EQ(unlimited.waitFor(1e9, t0), 0ns);
+}
+
+TEST(TokenBucketTest, SyncAdoptsTheServerLevelAndRate) {
+    auto t0 = TokenBucket::Clock::now();
+    TokenBucket bucket;
+    bucket.sync(0, 100, 2, t0); // Empty, full again in 2 s: 50 per second
+    EXPECT_TRUE(bucket.limited());
+    EXPECT_EQ(std::chrono::duration_cast<std::chrono::milliseconds>(bucket.waitFor(10, t0)), 200ms);
+    EXPECT_DOUBLE_EQ(bucket.level(t0 + 1s), 50);
+}
+
+TEST(RateLimiterTest, SpreadsRequestsOverKeys) {
+    RateLimiter limiter({"a", "b", "c"});
+    std::vector<int> uses(3);
+    RateLimiter::Lease lease;
+    RateLimiter::Clock::duration wait;
+    for (int i = 0; i < 6; ++i) {
+        ASSERT_TRUE(limiter.tryAcquire(10, lease, wait));
+        ++uses[lease.key];
+    }
+    EXPECT_EQ(uses, std::vector<int>({2, 2, 2}));
+}
+
+TEST(RateLimiterTest, RateLimitedKeyIsSkippedUntilRetryAfter) {
+    auto t0 = RateLimiter::Clock::now();
+    RateLimiter limiter({"a", "b"});
+    RateLimiter::Lease first;
+    RateLimiter::Clock::duration wait;
+    ASSERT_TRUE(limiter.tryAcquire(1, first, wait, t0));
+    RateLimitHeaders headers;
+    headers.retryAfterSeconds = 5;
+    limiter.complete(first, 429, headers, t0);
+
+    for (int i = 0; i < 3; ++i) {
+        RateLimiter::Lease lease;
+        ASSERT_TRUE(limiter.tryAcquire(1, lease, wait, t0 + 1s));
+        EXPECT_NE(lease.key, first.key);
+        limiter.complete(lease, 200, RateLimitHeaders(), t0 + 1s);
+    }
+
+    RateLimiter single({"a"});
+    ASSERT_TRUE(single.tryAcquire(1, first, wait, t0));
+    single.complete(first, 429, headers, t0);
+    RateLimiter::Lease lease;
+    EXPECT_FALSE(single.tryAcquire(1, lease, wait, t0 + 1s));
+    EXPECT_EQ(std::chrono::duration_cast<std::chrono::seconds>(wait), 4s);
+    EXPECT_TRUE(single.tryAcquire(1, lease, wait, t0 + 5s));
+}
+
+TEST(RateLimiterTest, PacesToTheReportedLimits) {
+    auto t0 = RateLimiter::Clock::now();
+    RateLimiter limiter({"a"});
+    RateLimiter::Lease lease;
+    RateLimiter::Clock::duration wait;
+    ASSERT_TRUE(limiter.tryAcquire(1, lease, wait, t0));
+    RateLimitHeaders headers;
+    headers.limitRequests = 2;
+    headers.remainingRequests = 0;
+    headers.resetRequestsSeconds = 1; // Two requests per second
+    limiter.complete(lease, 200, headers, t0);
+
+    EXPECT_FALSE(limiter.tryAcquire(1, lease, wait, t0));
+    EXPECT_EQ(std::chrono::duration_cast<std::chrono::milliseconds>(wait), 500ms);
+    EXPECT_TRUE(limiter.tryAcquire(1, lease, wait, t0 + 500ms));
+}
+
+TEST(RateLimiterTest, NoneRemainingWithOthersInFlightStillThrottles) {
+    auto t0 = RateLimiter::Clock::now();
+    RateLimiter limiter({"a"});
+    RateLimiter::Lease first;
+    RateLimiter::Lease second;
+    RateLimiter::Clock::duration wait;
+    ASSERT_TRUE(limiter.tryAcquire(1, first, wait, t0));
+    ASSERT_TRUE(limiter.tryAcquire(1, second, wait, t0));
+    RateLimitHeaders headers;
+    headers.limitRequests = 2;
+    headers.remainingRequests = 0; // With the second request still in flight
+    headers.resetRequestsSeconds = 1;
+    limiter.complete(first, 200, headers, t0);
+
+    RateLimiter::Lease lease;
+    EXPECT_FALSE(limiter.tryAcquire(1, lease, wait, t0));
+    EXPECT_EQ(std::chrono::duration_cast<std::chrono::milliseconds>(wait), 500ms);
+}
+
+TEST(RateLimiterTest, BackoffIsJitteredAndCapped) {
+    RateLimiter limiter({"a"});
+    for (int i = 0; i < 20; ++i) {
+        auto first = limiter.backoff(0);
+        EXPECT_GE(first, 250ms);
+        EXPECT_LE(first, 500ms);
+        auto late = limiter.backoff(12);
+        EXPECT_GE(late, 15s);
+        EXPECT_LE(late, 30s);
+    }
+}
+
+TEST(RateLimiterTest, ConfiguredKeysAreCommaSeparated) {
+    setenv("OPENAI_KEY", " sk-one, sk-two,,sk-three ", 1);
+    EXPECT_EQ(configuredApiKeys(), std::vector<std::string>({"sk-one", "sk-two", "sk-three"}));
+    EXPECT_EQ(sharedRateLimiter().keyCount(), 3u);
+    EXPECT_EQ(&sharedRateLimiter(), &sharedRateLimiter());
+}
+
+TEST(RateLimiterTest, MakeRequestRetriesAfterA429) {
+    MockServerOptions options;
+    options.requestsPerMinute = 1; // One request per 100 ms window
+    options.limitWindowSeconds = 0.1;
+    MockOpenAIServer server(options);
+    useServer(server, "retry-key");
+
+    std::vector<std::string> replies(3);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < replies.size(); ++i) {
+        threads.emplace_back([&, i] {
+            ChatHistory history;
+            replies[i] = getChatGPTResponseContent(makeRequest("hi " + std::to_string(i), history));
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    for (size_t i = 0; i < replies.size(); ++i) {
+        EXPECT_EQ(replies[i], "hi " + std::to_string(i));
+    }
+    EXPECT_EQ(server.stats().completions, 3u);
+    EXPECT_GE(server.stats().rateLimited, 1u);
+    unsetenv("OPENAI_BASE_URL");
+}
+
+TEST(RateLimiterTest, BatchStaysWithinTheLimitAcrossKeys) {
+    MockServerOptions options;
+    options.requestsPerMinute = 4; // Per key and per 200 ms window
+    options.limitWindowSeconds = 0.2;
+    MockOpenAIServer server(options);
+    useServer(server, "batch-key-1,batch-key-2");
+
+    std::string lines;
+    for (int i = 0; i < 40; ++i) {
+        lines += "{\"prompt\": \"p" + std::to_string(i) + "\"}\n";
+    }
+    std::istringstream input(lines);
+    std::ostringstream output;
+    BatchOptions batchOptions;
+    batchOptions.maxInFlight = 8;
+    BatchReport report = runBatch(input, output, batchOptions);
+
+    EXPECT_EQ(report.requests, 40u);
+    EXPECT_EQ(report.failed, 0u);
+    EXPECT_EQ(server.stats().completions, 40u);
+    // Two keys at 20 requests per second each: the 32 beyond the first bursts take about 0.8 s
+    EXPECT_GE(report.seconds, 0.6);
+    // Only the first burst, before any limits were known, may run into 429s
+    EXPECT_LE(server.stats().rateLimited, 8u);
+    unsetenv("OPENAI_BASE_URL");
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include "requestexecutor.hpp"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+TEST(RequestExecutorTest, RunsJobsInSubmissionOrder) {
+    std::mutex mutex;
+    std::vector<int> order;
+    std::promise<void> finished;
+    {
+        RequestExecutor executor;
+        for (int i = 0; i < 5; ++i) {
+            executor.submit([&, i](const std::atomic<bool> &) {
+                std::lock_guard<std::mutex> lock(mutex);
+                order.push_back(i);
+            });
+        }
+        executor.submit([&](const std::atomic<bool> &) { finished.set_value(); });
+        finished.get_future().wait();
+    }
+    EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3, 4}));
+}
+
+TEST(RequestExecutorTest, RunsJobsOffTheCallingThread) {
+    RequestExecutor executor;
+    std::promise<std::thread::id> jobThread;
+    executor.submit([&](const std::atomic<bool> &) { jobThread.set_value(std::this_thread::get_id()); });
+    EXPECT_NE(jobThread.get_future().get(), std::this_thread::get_id());
+}
+
+TEST(RequestExecutorTest, CancelAbortsRunningJobAndQueuedJobs) {
+    RequestExecutor executor;
+    std::promise<void> started;
+    std::promise<bool> sawCancel;
+    std::promise<bool> queuedCancelled;
+
+    executor.submit([&](const std::atomic<bool> &cancelled) {
+        started.set_value();
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!cancelled && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        sawCancel.set_value(cancelled.load());
+    });
+    executor.submit([&](const std::atomic<bool> &cancelled) { queuedCancelled.set_value(cancelled.load()); });
+
+    started.get_future().wait();
+    EXPECT_TRUE(executor.busy());
+    executor.cancel();
+    EXPECT_TRUE(sawCancel.get_future().get());
+
+    // A job queued at the cancel still runs, so it can post its completion, but already cancelled
+    EXPECT_TRUE(queuedCancelled.get_future().get());
+
+    // A job submitted after the cancel runs normally with a fresh flag
+    std::promise<bool> nextCancelled;
+    executor.submit([&](const std::atomic<bool> &cancelled) { nextCancelled.set_value(cancelled.load()); });
+    EXPECT_FALSE(nextCancelled.get_future().get());
+}
+
+TEST(RequestExecutorTest, WaitingJobWakesOnCancel) {
+    RequestExecutor executor;
+    std::promise<std::pair<bool, bool>> waited; // Timed out once, then cancelled
+    executor.submit([&](const std::atomic<bool> &) {
+        bool first = executor.waitCancelled(std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+        bool second = executor.waitCancelled(std::chrono::steady_clock::now() + std::chrono::hours(1));
+        waited.set_value({first, second});
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto start = std::chrono::steady_clock::now();
+    executor.cancel();
+    std::future<std::pair<bool, bool>> result = waited.get_future();
+    ASSERT_EQ(result.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+    EXPECT_EQ(result.get(), std::make_pair(false, true));
+}
+
+TEST(RequestExecutorTest, IdleExecutorIsNotBusy) {
+    RequestExecutor executor;
+    EXPECT_FALSE(executor.busy());
+}
@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+#include "chatgptapi.hpp"
+#include "responsecache.hpp"
+#include "sha256.hpp"
+#include "testdirectory.hpp"
+#include <filesystem>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// A fresh cache directory per test, removed afterwards
+using ResponseCacheTest = TempDirectoryTest;
+
+std::string completion(const std::string &content) {
+    return "{\"choices\":[{\"message\":{\"content\":\"" + content + "\",\"role\":\"assistant\"}}]}";
+}
+
+} // namespace
+
+TEST(Sha256Test, MatchesKnownDigests) {
+    EXPECT_EQ(Sha256::toHex(Sha256::hash("")), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(Sha256::toHex(Sha256::hash("abc")), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    EXPECT_EQ(Sha256::toHex(Sha256::hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")),
+              "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    // A million 'a's fed in uneven pieces
+    Sha256 hasher;
+    std::string piece(997, 'a');
+    size_t remaining = 1000000;
+    while (remaining > 0) {
+        size_t n = std::min(remaining, piece.size());
+        hasher.update(std::string_view(piece.data(), n));
+        remaining -= n;
+    }
+    EXPECT_EQ(Sha256::toHex(hasher.finish()), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+TEST_F(ResponseCacheTest, StoresAndLooksUp) {
+    ResponseCache cache(directory, 1024 * 1024);
+    std::string response;
+    EXPECT_FALSE(cache.lookup("payload", response));
+
+    cache.store("payload", "response");
+    ASSERT_TRUE(cache.lookup("payload", response));
+    EXPECT_EQ(response, "response");
+    EXPECT_FALSE(cache.lookup("other payload", response));
+
+    CacheStats stats = cache.sessionStats();
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.misses, 2u);
+    EXPECT_EQ(stats.bytesSaved, std::string("payload").size() + std::string("response").size());
+    EXPECT_EQ(cache.totalStats().entries, 1u);
+}
+
+TEST_F(ResponseCacheTest, SharedBetweenInstancesAndReopens) {
+    {
+        ResponseCache first(directory, 1024 * 1024);
+        ResponseCache second(directory, 1024 * 1024);
+        first.store("payload", "response");
+        std::string response;
+        ASSERT_TRUE(second.lookup("payload", response));
+        EXPECT_EQ(response, "response");
+    }
+    ResponseCache reopened(directory, 1024 * 1024);
+    std::string response;
+    EXPECT_TRUE(reopened.lookup("payload", response));
+    EXPECT_EQ(reopened.totalStats().hits, 2u);
+}
+
+TEST_F(ResponseCacheTest, EvictsLeastRecentlyUsed) {
+    ResponseCache cache(directory, 4096);
+    std::string body(900, 'x');
+    cache.store("a", body);
+    cache.store("b", body);
+    cache.store("c", body);
+    std::string response;
+    ASSERT_TRUE(cache.lookup("a", response)); // "b" is now the oldest
+
+    cache.store("d", body);
+    cache.store("e", body);
+    EXPECT_TRUE(cache.lookup("a", response));
+    EXPECT_FALSE(cache.lookup("b", response));
+    EXPECT_TRUE(cache.lookup("e", response));
+    EXPECT_LE(cache.totalStats().liveBytes, 4096u);
+
+    // Too large to ever fit
+    cache.store("huge", std::string(5000, 'y'));
+    EXPECT_FALSE(cache.lookup("huge", response));
+}
+
+TEST_F(ResponseCacheTest, CompactionKeepsEntriesReadable) {
+    ResponseCache writer(directory, 256 * 1024);
+    ResponseCache reader(directory, 256 * 1024);
+    std::string body(50 * 1024, 'z');
+    for (int i = 0; i < 60; ++i) {
+        writer.store("payload " + std::to_string(i), body + std::to_string(i));
+    }
+    std::string response;
+    ASSERT_TRUE(reader.lookup("payload 59", response));
+    EXPECT_EQ(response, body + "59");
+    EXPECT_LT(std::filesystem::file_size(directory / "data"), 1024u * 1024u);
+}
+
+TEST_F(ResponseCacheTest, ConcurrentProcessesShareTheCache) {
+    { ResponseCache create(directory, 1024 * 1024); }
+    const int processes = 4;
+    const int perProcess = 50;
+    for (int p = 0; p < processes; ++p) {
+        if (fork() == 0) {
+            ResponseCache cache(directory, 1024 * 1024);
+            for (int i = 0; i < perProcess; ++i) {
+                std::string key = std::to_string(p) + ":" + std::to_string(i);
+                cache.store(key, "value " + key);
+            }
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < processes; ++p) {
+        int status = 0;
+        wait(&status);
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    ResponseCache cache(directory, 1024 * 1024);
+    EXPECT_EQ(cache.totalStats().entries, static_cast<uint64_t>(processes * perProcess));
+    std::string response;
+    ASSERT_TRUE(cache.lookup("3:49", response));
+    EXPECT_EQ(response, "value 3:49");
+}
+
+TEST_F(ResponseCacheTest, CachedRequestSkipsTheRequestOnHit) {
+    ResponseCache cache(directory, 1024 * 1024);
+    int calls = 0;
+    RequestFn request = cachedRequest(cache, [&](const std::string &payload) {
+        ++calls;
+        EXPECT_NE(payload.find("\"Hello\""), std::string::npos);
+        return completion("Hello back");
+    });
+
+    ChatHistory first;
+    callChatGPTAPI("Hello", first, request);
+    ChatHistory second;
+    callChatGPTAPI("Hello", second, request);
+
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(first.toString(), second.toString());
+    ASSERT_EQ(second.size(), 2u);
+    EXPECT_EQ(second[1].message, "Hello back");
+}
+
+TEST_F(ResponseCacheTest, CachedStreamingSharesEntriesAndSkipsCancelled) {
+    ResponseCache cache(directory, 1024 * 1024);
+    std::atomic<bool> cancelled{true};
+    int calls = 0;
+    StreamSendFn stream = [&](const std::string &payload, const DeltaFn &onDelta) {
+        ++calls;
+        EXPECT_NE(payload.find("\"stream\":true"), std::string::npos);
+        onDelta("Part");
+        onDelta("ial");
+        return std::string();
+    };
+
+    // A cancelled stream is not stored
+    ChatHistory history;
+    streamChatGPTAPI("Hi", history, [](const std::string &) {}, cachedStreamingRequest(cache, stream, &cancelled));
+    cancelled = false;
+    ChatHistory again;
+    streamChatGPTAPI("Hi", again, [](const std::string &) {}, cachedStreamingRequest(cache, stream, &cancelled));
+    EXPECT_EQ(calls, 2);
+
+    // The finished one is, and serves non-streaming calls as well
+    ChatHistory replay;
+    callChatGPTAPI("Hi", replay, cachedRequest(cache, [&](const std::string &) {
+                       ADD_FAILURE() << "request should have been served from the cache";
+                       return std::string();
+                   }));
+    ASSERT_EQ(replay.size(), 2u);
+    EXPECT_EQ(replay[1].message, "Partial");
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include "request.hpp"
+#include "responseparser.hpp"
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <string>
+
+TEST(ResponseParserTest, ExtractsContentFinishReasonAndUsage) {
+    const std::string body = R"({
+        "id": "chatcmpl-1", "object": "chat.completion", "created": 1700000000,
+        "choices": [
+            {"index": 0, "logprobs": null, "finish_reason": "length",
+             "message": {"role": "assistant", "content": "Hi \"there\"\né😀", "refusal": null}},
+            {"index": 1, "message": {"role": "assistant", "content": "second choice"}}
+        ],
+        "usage": {"prompt_tokens": 12, "completion_tokens": 34, "total_tokens": 46,
+                  "prompt_tokens_details": {"cached_tokens": 8, "audio_tokens": 0},
+                  "completion_tokens_details": {"reasoning_tokens": 0}},
+        "system_fingerprint": "fp_1"
+    })";
+    ChatResponse response = parseChatResponse(body);
+    EXPECT_TRUE(response.hasChoices);
+    EXPECT_TRUE(response.hasContent);
+    EXPECT_EQ(response.content, "Hi \"there\"\n\xc3\xa9\xf0\x9f\x98\x80");
+    EXPECT_EQ(response.finishReason, "length");
+    EXPECT_TRUE(response.hasUsage);
+    EXPECT_EQ(response.usage.promptTokens, 12);
+    EXPECT_EQ(response.usage.completionTokens, 34);
+    EXPECT_EQ(response.usage.totalTokens, 46);
+    EXPECT_EQ(response.usage.cachedTokens, 8);
+    EXPECT_FALSE(response.hasError);
+}
+
+TEST(ResponseParserTest, ExtractsErrors) {
+    ChatResponse response = parseChatResponse(
+        R"({"error": {"message": "Incorrect API key", "type": "invalid_request_error", "param": null, "code": "invalid_api_key"}})");
+    EXPECT_TRUE(response.hasError);
+    EXPECT_EQ(response.errorMessage, "Incorrect API key");
+    EXPECT_EQ(response.errorType, "invalid_request_error");
+    EXPECT_EQ(response.errorCode, "invalid_api_key");
+    EXPECT_FALSE(response.hasChoices);
+
+    response = parseChatResponse(R"({"error": {"message": "Overloaded", "code": 529}})");
+    EXPECT_EQ(response.errorCode, "529");
+    EXPECT_TRUE(parseChatResponse(R"({"error": "plain"})").hasError);
+}
+
+TEST(ResponseParserTest, MissingOrNullContentIsReported) {
+    EXPECT_FALSE(parseChatResponse(R"({"choices": []})").hasChoices);
+    ChatResponse response = parseChatResponse(
+        R"({"choices": [{"message": {"content": null, "tool_calls": [{"id": "t"}]}, "finish_reason": "tool_calls"}]})");
+    EXPECT_TRUE(response.hasChoices);
+    EXPECT_FALSE(response.hasContent);
+    EXPECT_EQ(response.finishReason, "tool_calls");
+}
+
+TEST(ResponseParserTest, DecodesLikeNlohmann) {
+    // Every byte value nlohmann escapes, plus the ones it passes through
+    std::string content;
+    for (int c = 1; c < 0x80; ++c) {
+        content += static_cast<char>(c);
+    }
+    content += "\xe2\x82\xac tail";
+    nlohmann::json reply = {{"choices", {{{"message", {{"content", content}}}}}}, {"usage", {{"total_tokens", 7}}}};
+    for (bool ensureAscii : {false, true}) {
+        std::string body = reply.dump(2, ' ', ensureAscii);
+        EXPECT_EQ(parseChatResponse(body).content, content);
+        EXPECT_EQ(getChatGPTResponseContent(body), content);
+    }
+}
+
+TEST(ResponseParserTest, RejectsMalformedJson) {
+    const char *malformed[] = {
+        "",
+        "[]",
+        R"({"choices": [)",
+        R"({"choices": [{"message": {"content": "unterminated}}]})",
+        R"({"choices": [{"message": {"content": "bad \q escape"}}]})",
+        R"({"choices": [{"message": {"content": "lone \udc00 surrogate"}}]})",
+        "{\"choices\": [{\"message\": {\"content\": \"raw\nnewline\"}}]}",
+        R"({"skipped": [1, 2,]})",
+        R"({"skipped": 01})",
+        R"({"skipped": tru})",
+        R"({"a": 1} trailing)",
+        R"({"a" 1})",
+    };
+    for (const char *body : malformed) {
+        EXPECT_THROW(parseChatResponse(body), std::runtime_error) << body;
+    }
+    std::string deep = "{\"skipped\": " + std::string(1000, '[') + std::string(1000, ']') + "}";
+    EXPECT_THROW(parseChatResponse(deep), std::runtime_error);
+}
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "sessionjournal.hpp"
+#include "testdirectory.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace {
+
+// A fresh journal path per test, removed afterwards
+class SessionJournalTest : public TempDirectoryTest {
+  protected:
+    std::filesystem::path path;
+
+    void SetUp() override {
+        TempDirectoryTest::SetUp();
+        path = directory / "session";
+    }
+};
+
+} // namespace
+
+TEST_F(SessionJournalTest, ReplayRebuildsTheHistory) {
+    ChatHistory history;
+    {
+        SessionJournal journal(path, true);
+        history.setJournal(&journal);
+        history.addDialog("user", "first");
+        history.addDialog("assistant", "Hel");
+        history.appendToLastDialog("lo!");
+        history.addDialog("tool", "custom participant");
+        history.addDialog("system", "to be removed");
+        history.removeLastDialog();
+        EXPECT_EQ(journal.stats().records, 6u);
+        history.setJournal(nullptr);
+    }
+
+    ChatHistory resumed;
+    JournalReplay replay = replaySessionJournal(path, resumed);
+    EXPECT_EQ(replay.records, 6u);
+    EXPECT_FALSE(replay.tornTail);
+    EXPECT_EQ(resumed.toString(), "user: first\nassistant: Hello!\ntool: custom participant\n");
+    EXPECT_EQ(resumed.buildRequestPayload("m", false), history.buildRequestPayload("m", false));
+}
+
+TEST_F(SessionJournalTest, ClearIsReplayedAndCopiesAreNotRecorded) {
+    ChatHistory history;
+    SessionJournal journal(path, true);
+    history.setJournal(&journal);
+    history.addDialog("user", "old");
+    history.clearHistory();
+    history.addDialog("user", "new");
+
+    ChatHistory copy = history;
+    copy.addDialog("user", "only in the copy");
+    EXPECT_EQ(copy.journal(), nullptr);
+    EXPECT_EQ(journal.stats().records, 3u);
+
+    ChatHistory resumed;
+    replaySessionJournal(path, resumed);
+    EXPECT_EQ(resumed.toString(), "user: new\n");
+}
+
+TEST_F(SessionJournalTest, TornTailIsIgnoredAndCutOffOnResume) {
+    {
+        ChatHistory history;
+        SessionJournal journal(path, true);
+        history.setJournal(&journal);
+        history.addDialog("user", "kept");
+        history.addDialog("assistant", "lost in the crash");
+        history.setJournal(nullptr);
+    }
+    // Simulate a crash partway through writing the last record
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 5);
+
+    ChatHistory resumed;
+    JournalReplay replay = replaySessionJournal(path, resumed);
+    EXPECT_TRUE(replay.tornTail);
+    EXPECT_EQ(replay.records, 1u);
+    EXPECT_EQ(resumed.toString(), "user: kept\n");
+
+    {
+        SessionJournal journal(path, false);
+        EXPECT_EQ(journal.stats().bytes, replay.validBytes);
+        resumed.setJournal(&journal);
+        resumed.addDialog("assistant", "after the restart");
+        resumed.setJournal(nullptr);
+    }
+    ChatHistory again;
+    replay = replaySessionJournal(path, again);
+    EXPECT_FALSE(replay.tornTail);
+    EXPECT_EQ(again.toString(), "user: kept\nassistant: after the restart\n");
+}
+
+TEST_F(SessionJournalTest, ReplaceWithContinuesAnotherSession) {
+    std::filesystem::path other = path.string() + ".copy";
+    {
+        ChatHistory history;
+        SessionJournal journal(other, true);
+        history.setJournal(&journal);
+        history.addDialog("user", "from the other session");
+        history.setJournal(nullptr);
+    }
+
+    ChatHistory history;
+    SessionJournal journal(path, true);
+    history.setJournal(&journal);
+    history.addDialog("user", "replaced");
+    JournalReplay replay = replaySessionJournal(other, history);
+    EXPECT_EQ(history.journal(), &journal);
+    journal.replaceWith(other, replay.validBytes);
+    history.addDialog("assistant", "continued");
+    journal.sync();
+
+    ChatHistory resumed;
+    replaySessionJournal(path, resumed);
+    EXPECT_EQ(resumed.toString(), "user: from the other session\nassistant: continued\n");
+}
+
+TEST_F(SessionJournalTest, ANewSessionKeepsThePreviousOneAndLocksTheFile) {
+    {
+        ChatHistory history;
+        SessionJournal journal(path, true);
+        history.setJournal(&journal);
+        history.addDialog("user", "the previous session");
+        history.setJournal(nullptr);
+    }
+
+    ChatHistory history;
+    SessionJournal journal(path, true);
+    // A second instance must not write, or start over, the journal this one is writing
+    EXPECT_THROW(SessionJournal(path, true), std::runtime_error);
+    EXPECT_THROW(SessionJournal(path, false), std::runtime_error);
+    history.setJournal(&journal);
+    history.addDialog("user", "the new session");
+    journal.sync();
+
+    ChatHistory previous;
+    replaySessionJournal(path.string() + ".1", previous);
+    EXPECT_EQ(previous.toString(), "user: the previous session\n");
+    ChatHistory current;
+    replaySessionJournal(path, current);
+    EXPECT_EQ(current.toString(), "user: the new session\n");
+}
+
+TEST_F(SessionJournalTest, RefusesFilesThatAreNotJournals) {
+    std::ofstream(path) << "user: a %save transcript\n";
+    ChatHistory history;
+    EXPECT_THROW(replaySessionJournal(path, history), std::runtime_error);
+    EXPECT_THROW(SessionJournal(path, true), std::runtime_error);
+    // Not truncated by the failed open
+    EXPECT_EQ(std::filesystem::file_size(path), 25u);
+}
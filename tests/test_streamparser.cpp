@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include "streamparser.hpp"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Canned chat completion stream as sent by the API, including a role-only first chunk,
+// a keep-alive comment and CRLF line endings on one event.
+const std::string kCannedStream =
+    "data: {\"id\":\"c1\",\"choices\":[{\"index\":0,\"delta\":{\"role\":\"assistant\",\"content\":\"\"}}]}\n\n"
+    "data: {\"id\":\"c1\",\"choices\":[{\"index\":0,\"delta\":{\"content\":\"Hello\"}}]}\n\n"
+    ": keep-alive\n\n"
+    "data: {\"id\":\"c1\",\"choices\":[{\"index\":0,\"delta\":{\"content\":\", w\\u00f6rld\"}}]}\r\n\r\n"
+    "data: {\"id\":\"c1\",\"choices\":[{\"index\":0,\"delta\":{\"content\":\"! Line\\nbreak\"}}]}\n\n"
+    "data: {\"id\":\"c1\",\"choices\":[{\"index\":0,\"delta\":{},\"finish_reason\":\"stop\"}]}\n\n"
+    "data: [DONE]\n\n";
+
+const std::string kCannedContent = "Hello, w\xc3\xb6rld! Line\nbreak";
+
+} // namespace
+
+TEST(SseParserTest, ParsesWholeStream) {
+    std::vector<std::string> deltas;
+    SseParser parser([&](const std::string &delta) { deltas.push_back(delta); });
+    parser.feed(kCannedStream.data(), kCannedStream.size());
+    parser.finish();
+
+    ASSERT_EQ(deltas.size(), 3u);
+    EXPECT_EQ(deltas[0], "Hello");
+    EXPECT_EQ(deltas[1], ", w\xc3\xb6rld");
+    EXPECT_TRUE(parser.isDone());
+    EXPECT_EQ(parser.deltaCount(), 3u);
+    EXPECT_TRUE(parser.rawBody().empty());
+}
+
+TEST(SseParserTest, ParsesStreamSplitAtRandomBoundaries) {
+    std::mt19937 rng(1234);
+    for (int run = 0; run < 500; ++run) {
+        std::string content;
+        SseParser parser([&](const std::string &delta) { content += delta; });
+
+        size_t pos = 0;
+        while (pos < kCannedStream.size()) {
+            std::uniform_int_distribution<size_t> chunkSize(1, 24);
+            size_t length = std::min(chunkSize(rng), kCannedStream.size() - pos);
+            parser.feed(kCannedStream.data() + pos, length);
+            pos += length;
+        }
+        parser.finish();
+
+        ASSERT_EQ(content, kCannedContent) << "run " << run;
+        ASSERT_TRUE(parser.isDone());
+    }
+}
+
+TEST(SseParserTest, ParsesStreamFedOneByteAtATime) {
+    std::string content;
+    SseParser parser([&](const std::string &delta) { content += delta; });
+    for (char c : kCannedStream) {
+        parser.feed(&c, 1);
+    }
+    parser.finish();
+    EXPECT_EQ(content, kCannedContent);
+    EXPECT_TRUE(parser.isDone());
+}
+
+TEST(SseParserTest, CollectsNonStreamErrorBody) {
+    const std::string errorBody = "{\n  \"error\": {\n    \"message\": \"Invalid key\"\n  }\n}";
+    int deltaCalls = 0;
+    SseParser parser([&](const std::string &) { ++deltaCalls; });
+    parser.feed(errorBody.data(), 10);
+    parser.feed(errorBody.data() + 10, errorBody.size() - 10);
+    parser.finish();
+
+    EXPECT_EQ(deltaCalls, 0);
+    EXPECT_FALSE(parser.isDone());
+    EXPECT_EQ(parser.rawBody(), errorBody + "\n");
+}
+
+TEST(SseParserTest, FlushesFinalEventWithoutBlankLine) {
+    const std::string stream = "data: {\"choices\":[{\"delta\":{\"content\":\"tail\"}}]}";
+    std::string content;
+    SseParser parser([&](const std::string &delta) { content += delta; });
+    parser.feed(stream.data(), stream.size());
+    EXPECT_TRUE(content.empty());
+    parser.finish();
+    EXPECT_EQ(content, "tail");
+}
+
+TEST(SseParserTest, KeepsTheUsageOfTheLastChunk) {
+    const std::string stream =
+        "data: {\"choices\":[{\"delta\":{\"content\":\"Hi\"}}],\"usage\":null}\n\n"
+        "data: {\"choices\":[],\"usage\":{\"prompt_tokens\":1200,\"completion_tokens\":7,\"total_tokens\":1207,"
+        "\"prompt_tokens_details\":{\"cached_tokens\":1024}}}\n\n"
+        "data: [DONE]\n\n";
+    std::string content;
+    SseParser parser([&](const std::string &delta) { content += delta; });
+    EXPECT_FALSE(parser.hasUsage());
+    parser.feed(stream.data(), stream.size());
+    parser.finish();
+
+    EXPECT_EQ(content, "Hi");
+    ASSERT_TRUE(parser.hasUsage());
+    EXPECT_EQ(parser.usage().promptTokens, 1200);
+    EXPECT_EQ(parser.usage().completionTokens, 7);
+    EXPECT_EQ(parser.usage().totalTokens, 1207);
+    EXPECT_EQ(parser.usage().cachedTokens, 1024);
+    EXPECT_TRUE(parser.rawBody().empty());
+}
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "tokenizer.hpp"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Every single byte (ranks 0-255) followed by a handful of merges
+std::vector<std::string> testVocabulary() {
+    std::vector<std::string> tokens;
+    for (int byte = 0; byte < 256; ++byte) {
+        tokens.push_back(std::string(1, static_cast<char>(byte)));
+    }
+    for (const char *merge : {"ll", "he", "hell", "hello", " w", "or", " wor", "ld", " world"}) {
+        tokens.push_back(merge);
+    }
+    return tokens;
+}
+
+std::string encodeBase64(const std::string &bytes) {
+    static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    size_t i = 0;
+    for (; i + 2 < bytes.size(); i += 3) {
+        uint32_t n = (uint8_t(bytes[i]) << 16) | (uint8_t(bytes[i + 1]) << 8) | uint8_t(bytes[i + 2]);
+        out += alphabet[(n >> 18) & 63];
+        out += alphabet[(n >> 12) & 63];
+        out += alphabet[(n >> 6) & 63];
+        out += alphabet[n & 63];
+    }
+    if (i + 1 == bytes.size()) {
+        uint32_t n = uint8_t(bytes[i]) << 16;
+        out += alphabet[(n >> 18) & 63];
+        out += alphabet[(n >> 12) & 63];
+        out += "==";
+    } else if (i + 2 == bytes.size()) {
+        uint32_t n = (uint8_t(bytes[i]) << 16) | (uint8_t(bytes[i + 1]) << 8);
+        out += alphabet[(n >> 18) & 63];
+        out += alphabet[(n >> 12) & 63];
+        out += alphabet[(n >> 6) & 63];
+        out += '=';
+    }
+    return out;
+}
+
+} // namespace
+
+TEST(BpeTokenizerTest, EncodesWholeWordsAsSingleTokens) {
+    BpeTokenizer tokenizer(testVocabulary());
+    EXPECT_EQ(tokenizer.encode("hello world"), (std::vector<uint32_t>{259, 264}));
+}
+
+TEST(BpeTokenizerTest, MergesLowestRankPairsFirst) {
+    BpeTokenizer tokenizer(testVocabulary());
+    // h e l l x -> h e [ll] x -> [he] [ll] x -> [hell] x
+    EXPECT_EQ(tokenizer.encode("hellx"), (std::vector<uint32_t>{258, 'x'}));
+    // " word" -> " w" "or" "d" -> " wor" "d"
+    EXPECT_EQ(tokenizer.encode(" word"), (std::vector<uint32_t>{262, 'd'}));
+}
+
+TEST(BpeTokenizerTest, MergesLongPiecesLikeShortOnes) {
+    BpeTokenizer tokenizer(testVocabulary());
+    // One 500-letter piece, merged as "hellx" is above: [ll] first, then [he], [hell], [hello]
+    std::string letters;
+    for (int i = 0; i < 100; ++i) {
+        letters += "hello";
+    }
+    EXPECT_EQ(tokenizer.encode(letters), std::vector<uint32_t>(100, 259));
+    EXPECT_EQ(tokenizer.encode(letters + "hellx").back(), uint32_t('x'));
+}
+
+TEST(BpeTokenizerTest, SplitsContractionsDigitsAndPunctuation) {
+    BpeTokenizer tokenizer(testVocabulary());
+    // "don" "'t" -> 3 + 2 byte tokens; "12345" -> "123" "45" -> 3 + 2; "!!" -> 2
+    EXPECT_EQ(tokenizer.countTokens("don't"), 5u);
+    EXPECT_EQ(tokenizer.countTokens("12345"), 5u);
+    EXPECT_EQ(tokenizer.countTokens("!!"), 2u);
+    EXPECT_EQ(tokenizer.countTokens(""), 0u);
+}
+
+TEST(BpeTokenizerTest, CountMatchesEncode) {
+    BpeTokenizer tokenizer(testVocabulary());
+    const std::string text = "hello world,  hello\n\nworld? It's 2024 - hell\xc3\xb6 w\xc3\xb6rld!";
+    EXPECT_EQ(tokenizer.countTokens(text), tokenizer.encode(text).size());
+}
+
+TEST(BpeTokenizerTest, LoadsTiktokenFile) {
+    std::vector<std::string> tokens = testVocabulary();
+    const std::string path = "test_vocab.tiktoken";
+    {
+        std::ofstream file(path);
+        for (size_t rank = 0; rank < tokens.size(); ++rank) {
+            file << encodeBase64(tokens[rank]) << ' ' << rank << '\n';
+        }
+    }
+    BpeTokenizer tokenizer = BpeTokenizer::fromFile(path);
+    EXPECT_EQ(tokenizer.vocabularySize(), tokens.size());
+    EXPECT_EQ(tokenizer.encode("hello world"), (std::vector<uint32_t>{259, 264}));
+    std::filesystem::remove(path);
+}
+
+TEST(BpeTokenizerTest, MissingFileThrows) {
+    EXPECT_THROW(BpeTokenizer::fromFile("nonexistent.tiktoken"), std::runtime_error);
+}
+
+TEST(ChatHistoryTokenTest, CachesCountsAndTracksEdits) {
+    ChatHistory history;
+    history.addDialog("user", "12345678");     // 2 estimated tokens
+    history.addDialog("assistant", "1234");    // 1
+    EXPECT_EQ(history.tokenCount(0), countTokens("12345678"));
+    EXPECT_EQ(history.totalTokens(), countTokens("12345678") + countTokens("1234") + 2 * ChatHistory::kTokensPerMessage);
+
+    history.appendToLastDialog("5678");
+    EXPECT_EQ(history.tokenCount(1), countTokens("12345678"));
+    history.removeLastDialog();
+    EXPECT_EQ(history.size(), 1u);
+    EXPECT_EQ(history.totalTokens(), countTokens("12345678") + ChatHistory::kTokensPerMessage);
+}
+
+TEST(ChatHistoryTokenTest, PayloadIsWindowedToBudget) {
+    ChatHistory history;
+    history.addDialog("user", "first message");
+    history.addDialog("assistant", "second message");
+    history.addDialog("user", "third message");
+    size_t lastTwo = history.tokenCount(1) + history.tokenCount(2) + 2 * ChatHistory::kTokensPerMessage;
+
+    std::string windowed = history.buildRequestPayload("gpt-4o", false, lastTwo);
+    EXPECT_EQ(windowed.find("first message"), std::string::npos);
+    EXPECT_NE(windowed.find("{\"messages\":[{\"content\":\"second message\""), std::string::npos);
+    EXPECT_NE(windowed.find("third message"), std::string::npos);
+
+    // The newest message is sent even if it alone exceeds the budget
+    std::string newestOnly = history.buildRequestPayload("gpt-4o", false, 1);
+    EXPECT_EQ(newestOnly, "{\"messages\":[{\"content\":\"third message\",\"role\":\"user\"}],\"model\":\"gpt-4o\"}");
+
+    // No budget sends everything
+    EXPECT_NE(history.buildRequestPayload("gpt-4o", false, 0).find("first message"), std::string::npos);
+}
@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+#include "chathistory.hpp"
+#include "mockserver.hpp"
+#include "request.hpp"
+#include "usageledger.hpp"
+#include "testdirectory.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace {
+
+// Requests made by any test would otherwise add to the user's own ledger
+const bool kNoLedgerFile = setenv("CHATGPT_CLI_USAGE_LEDGER", "", 1) == 0;
+
+ChatUsage usage(int64_t prompt, int64_t completion, int64_t cached = 0) {
+    ChatUsage result;
+    result.promptTokens = prompt;
+    result.completionTokens = completion;
+    result.totalTokens = prompt + completion;
+    result.cachedTokens = cached;
+    return result;
+}
+
+// A fresh ledger path per test, removed afterwards
+class UsageLedgerTest : public TempDirectoryTest {
+  protected:
+    std::filesystem::path path;
+
+    void SetUp() override {
+        TempDirectoryTest::SetUp();
+        path = directory / "usage";
+    }
+};
+
+// Points the real request path at a local MockOpenAIServer; restores the shared ledger's limits
+class UsageRequestTest : public ::testing::Test {
+  protected:
+    void use(const MockOpenAIServer &server) {
+        setenv("OPENAI_BASE_URL", server.baseUrl().c_str(), 1);
+        setenv("NO_PROXY", "127.0.0.1", 1);
+        setenv("OPENAI_KEY", "usage-test-key", 1);
+    }
+
+    void TearDown() override {
+        unsetenv("OPENAI_BASE_URL");
+        sharedUsageLedger().setLimits(UsageLimits());
+    }
+};
+
+} // namespace
+
+TEST_F(UsageLedgerTest, KeepsSessionTotalsWithoutAFile) {
+    UsageLedger ledger;
+    ledger.record(usage(100, 20, 64));
+    ledger.record(usage(150, 30));
+
+    UsageTotals session = ledger.session();
+    EXPECT_EQ(session.requests, 2u);
+    EXPECT_EQ(session.promptTokens, 250u);
+    EXPECT_EQ(session.completionTokens, 50u);
+    EXPECT_EQ(session.cachedTokens, 64u);
+    EXPECT_EQ(session.tokens(), 300u);
+    EXPECT_EQ(ledger.today().tokens(), 300u);
+    EXPECT_EQ(ledger.remainingTokens(), UsageLedger::kUnlimited);
+    EXPECT_TRUE(ledger.path().empty());
+}
+
+TEST_F(UsageLedgerTest, AppendsFixedSizeRecordsThatOtherProcessesSee) {
+    UsageLedger first(path);
+    UsageLedger second(path); // Stands in for another CLI process sharing the file
+    first.record(usage(1000, 200, 512));
+    second.record(usage(10, 2));
+    first.record(usage(5, 5));
+
+    EXPECT_EQ(std::filesystem::file_size(path), 8u + 3 * 24u);
+    EXPECT_EQ(first.session().tokens(), 1210u);
+    EXPECT_EQ(second.session().tokens(), 12u);
+    // The day counts every process, including records written since it was last read
+    EXPECT_EQ(first.today().requests, 3u);
+    EXPECT_EQ(second.today().tokens(), 1222u);
+    EXPECT_EQ(second.today().cachedTokens, 512u);
+
+    // A new session picks the day up from the file
+    UsageLedger reopened(path);
+    EXPECT_EQ(reopened.session().requests, 0u);
+    EXPECT_EQ(reopened.today().tokens(), 1222u);
+}
+
+TEST_F(UsageLedgerTest, AddsUpAnyPeriod) {
+    auto now = std::chrono::system_clock::now();
+    auto days = [](int count) { return std::chrono::hours(24 * count); };
+    {
+        UsageLedger ledger(path);
+        ledger.record(usage(1, 0), now - days(45));
+        ledger.record(usage(10, 0), now - days(20));
+        ledger.record(usage(100, 0), now - days(2));
+        ledger.record(usage(1000, 0), now);
+    }
+
+    UsageLedger ledger(path);
+    EXPECT_EQ(ledger.totals(now - days(30), now + days(1)).promptTokens, 1110u);
+    EXPECT_EQ(ledger.totals(now - days(60), now - days(10)).promptTokens, 11u);
+    EXPECT_EQ(ledger.totals(now + days(1), now + days(2)).requests, 0u);
+    EXPECT_EQ(ledger.today().promptTokens, 1000u);
+}
+
+TEST_F(UsageLedgerTest, CutsATornRecordAndRejectsOtherFiles) {
+    {
+        UsageLedger ledger(path);
+        ledger.record(usage(7, 3));
+    }
+    {
+        std::ofstream torn(path, std::ios::binary | std::ios::app);
+        torn << "partial";
+    }
+    UsageLedger ledger(path);
+    EXPECT_EQ(std::filesystem::file_size(path), 8u + 24u);
+    ledger.record(usage(1, 1));
+    EXPECT_EQ(ledger.today().tokens(), 12u);
+
+    std::filesystem::path other = path.string() + ".txt";
+    std::ofstream(other) << "not a ledger";
+    EXPECT_THROW(UsageLedger{other}, std::runtime_error);
+    std::filesystem::remove(other);
+}
+
+TEST_F(UsageLedgerTest, ChecksRequestsAgainstBothLimits) {
+    UsageLedger ledger(path, UsageLimits{1000, 0});
+    ledger.record(usage(800, 100));
+    EXPECT_EQ(ledger.remainingTokens(), 100u);
+    EXPECT_NO_THROW(ledger.checkRoomFor(100));
+    EXPECT_THROW(ledger.checkRoomFor(101), UsageLimitExceeded);
+
+    // The daily limit counts the other sessions of the day as well
+    UsageLedger other(path, UsageLimits{0, 1500});
+    EXPECT_EQ(other.remainingTokens(), 600u);
+    other.record(usage(600, 0));
+    EXPECT_EQ(other.remainingTokens(), 0u);
+    try {
+        other.checkRoomFor(1);
+        FAIL() << "expected UsageLimitExceeded";
+    } catch (const UsageLimitExceeded &e) {
+        EXPECT_NE(std::string(e.what()).find("Daily token limit reached: 1500 of 1500"), std::string::npos);
+    }
+
+    other.setLimits(UsageLimits());
+    EXPECT_EQ(other.remainingTokens(), UsageLedger::kUnlimited);
+}
+
+TEST_F(UsageRequestTest, RecordsStreamedAndPlainResponses) {
+    MockOpenAIServer server;
+    use(server);
+    UsageLedger &ledger = sharedUsageLedger();
+    UsageTotals before = ledger.session();
+
+    ChatHistory history;
+    makeRequest("count me", history);
+    ChatHistory streamed;
+    makeStreamingRequest("and me", streamed, [](const std::string &) {});
+
+    UsageTotals after = ledger.session();
+    EXPECT_EQ(after.requests, before.requests + 2);
+    EXPECT_GT(after.promptTokens, before.promptTokens);
+    EXPECT_GT(after.completionTokens, before.completionTokens);
+}
+
+TEST_F(UsageRequestTest, TrimsThenRefusesRequestsAtTheLimit) {
+    UsageLedger &ledger = sharedUsageLedger();
+    ChatHistory history;
+    for (int i = 0; i < 20; ++i) {
+        history.addDialog(i % 2 == 0 ? "user" : "assistant", std::string(400, 'a' + i % 26));
+    }
+
+    // Room for the newest messages only: the oldest ones are left out of the body
+    ledger.setLimits(UsageLimits{ledger.session().tokens() + 500, 0});
+    EXPECT_LE(requestTokenBudget("question"), 500u);
+    ChatHistory trimmed = history;
+    std::string payload = buildChatRequestPayload("question", trimmed, false);
+    EXPECT_EQ(payload.find(std::string(400, 'a')), std::string::npos);
+    EXPECT_NE(payload.find("question"), std::string::npos);
+    EXPECT_EQ(trimmed.size(), 21u);
+
+    // No room for the message itself: refused before anything is added or sent
+    ledger.setLimits(UsageLimits{ledger.session().tokens() + 5, 0});
+    ChatHistory refused = history;
+    EXPECT_THROW(buildChatRequestPayload(std::string(400, 'q'), refused, false), UsageLimitExceeded);
+    EXPECT_EQ(refused.size(), 20u);
+}
@@ -0,0 +1,32 @@
+//  testdirectory.hpp
+//
+// Fixture giving each test a fresh temporary directory of its own
+
+#ifndef testdirectory_hpp
+#define testdirectory_hpp
+
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+/// @brief Creates an empty directory per test, named after the suite, the process and the test
+/// so parallel runs and forked children do not collide, and removes it afterwards. Suites that
+/// override SetUp or TearDown call these first and last.
+class TempDirectoryTest : public ::testing::Test {
+  protected:
+    std::filesystem::path directory;
+
+    void SetUp() override {
+        const ::testing::TestInfo *test = ::testing::UnitTest::GetInstance()->current_test_info();
+        directory = std::filesystem::temp_directory_path() /
+                    ("chatgpt_cli_" + std::string(test->test_suite_name()) + "_" + std::to_string(getpid()) + "_" +
+                     test->name());
+        std::filesystem::remove_all(directory);
+        std::filesystem::create_directories(directory);
+    }
+
+    void TearDown() override { std::filesystem::remove_all(directory); }
+};
+
+#endif /* testdirectory_hpp */
@@ -0,0 +1,91 @@
+// mock_openai_server.cpp
+//
+// Runs MockOpenAIServer in the foreground so the CLI can be pointed at it with
+// OPENAI_BASE_URL=http://127.0.0.1:<port>/v1
+
+#include "mockserver.hpp"
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+void _printUsage()
+{
+    std::cerr << "Usage: mock_openai_server [--port <n>] [--latency-ms <n>] [--jitter-ms <n>]\n"
+                 "                          [--tokens-per-second <x>] [--reply-words <n>]\n"
+                 "                          [--error-rate <0..1>] [--error-status <code>] [--api-key <key>]\n"
+                 "                          [--rpm <requests per minute per key>] [--tpm <tokens per minute per key>]\n"
+                 "                          [--limit-window <seconds the limits refill over, default 60>]\n";
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    MockServerOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            _printUsage();
+            return EXIT_FAILURE;
+        }
+        std::string value = argv[++i];
+        if (arg == "--port")
+            options.port = static_cast<uint16_t>(std::stoul(value));
+        else if (arg == "--latency-ms")
+            options.latencyMs = static_cast<unsigned>(std::stoul(value));
+        else if (arg == "--jitter-ms")
+            options.latencyJitterMs = static_cast<unsigned>(std::stoul(value));
+        else if (arg == "--tokens-per-second")
+            options.tokensPerSecond = std::stod(value);
+        else if (arg == "--reply-words")
+            options.replyWords = std::stoul(value);
+        else if (arg == "--error-rate")
+            options.errorRate = std::stod(value);
+        else if (arg == "--rpm")
+            options.requestsPerMinute = std::stod(value);
+        else if (arg == "--tpm")
+            options.tokensPerMinute = std::stod(value);
+        else if (arg == "--limit-window")
+            options.limitWindowSeconds = std::stod(value);
+        else if (arg == "--error-status")
+            options.errorStatus = std::stoi(value);
+        else if (arg == "--api-key")
+            options.apiKey = value;
+        else
+        {
+            _printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Block the stop signals before the server threads start so only sigwait() sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try
+    {
+        MockOpenAIServer server(options);
+        std::cout << "Listening on " << server.baseUrl() << " (Ctrl-C to stop)" << std::endl;
+        int signal = 0;
+        sigwait(&signals, &signal);
+
+        MockServerStats stats = server.stats();
+        std::cout << "\nServed " << stats.requests << " requests on " << stats.connections << " connections: "
+                  << stats.completions << " completions (" << stats.streamed << " streamed), " << stats.errors
+                  << " errors, " << stats.cpuSeconds * 1000 << " ms CPU" << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "[ERROR] " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}